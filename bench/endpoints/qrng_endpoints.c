@@ -0,0 +1,460 @@
+/****************************************************************************
+ * qrng-endpoints - cost of each appliance route per delivered random bit   *
+ *                                                                          *
+ * Copyright (C) 2023  Sebastian Mihai Ardelean                             *
+ *                                                                          *
+ * This program is free software: you can redistribute it and/or modify     *
+ * it under the terms of the GNU General Public License as published by     *
+ * the Free Software Foundation, either version 3 of the License, or        *
+ * (at your option) any later version.                                      *
+ *                                                                          *
+ * This program is distributed in the hope that it will be useful,          *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ * GNU General Public License for more details.                             *
+ *                                                                          *
+ * You should have received a copy of the GNU General Public License        *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+
+/**
+ * @file qrng_endpoints.c
+ * @author Sebastian Mihai Ardelean <sebastian.ardelean@cs.upt.ro>
+ * @date 24 May 2023
+ * @brief Fetch the same amount of entropy through every appliance route and compare the cost.
+ *
+ * Each route (hexbytes, short, int, double, float, streambytes) is driven through the public API
+ * with requests carrying the same number of random bits, for every request size given. Wire
+ * bytes come from the library statistics, CPU time from the process clock and cycles from the
+ * hardware counter when the kernel allows it. Values carry log2 of their range in bits: 8 per
+ * byte, 16 per full range short, 32 per full range int, 53 per double and 24 per float.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <qrng.h>
+
+/**
+ * @def PROGRAM_NAME
+ * @brief A macro for the program name.
+ *
+ */
+#define PROGRAM_NAME "qrng-endpoints"
+
+/**
+ * @def VERSION
+ * @brief A macro for the program version.
+ *
+ */
+#define VERSION "1.0.0"
+
+/**
+ * @def DOMAIN_ADDR_LENGTH
+ * @brief Length of the appliance address.
+ *
+ */
+#define DOMAIN_ADDR_LENGTH 256u
+
+/**
+ * @def DEFAULT_ENTROPY
+ * @brief Entropy fetched through each route and request size, in bytes.
+ *
+ */
+#define DEFAULT_ENTROPY (256u * 1024u)
+
+/**
+ * @def DEFAULT_SECONDS
+ * @brief Time limit of each route and request size.
+ *
+ */
+#define DEFAULT_SECONDS 5.0
+
+/**
+ * @def DEFAULT_SIZES
+ * @brief Entropy per request, in bytes.
+ *
+ */
+#define DEFAULT_SIZES "64,1024,16384"
+
+/**
+ * @def MAX_SIZES
+ * @brief Upper bound of the number of request sizes.
+ *
+ */
+#define MAX_SIZES 16u
+
+/**
+ * @def MAX_REQUEST_BYTES
+ * @brief Largest entropy per request, bounded by the streambytes transfer limit.
+ *
+ */
+#define MAX_REQUEST_BYTES (1024u * 1024u)
+
+/**
+ * @brief Output formats.
+ */
+typedef enum {
+    FORMAT_TEXT = 0,
+    FORMAT_CSV,
+    FORMAT_JSON
+}e_format_t;
+
+/**
+ * @brief One way of getting entropy from the appliance.
+ */
+typedef struct {
+    const char *name;
+    qrng_request_type_t type;
+    unsigned bits;              /*!< random bits carried by one value */
+}route_t;
+
+/**
+ * @brief Cost of one route at one request size.
+ */
+typedef struct {
+    uint64_t requests;
+    uint64_t errors;
+    uint64_t bits;
+    uint64_t wire_bytes;
+    uint64_t cpu_ns;
+    uint64_t cycles;
+    uint64_t elapsed_ns;
+    bool have_cycles;
+}result_t;
+
+static const route_t routes[] = {
+    { "hexbytes", QRNG_REQUEST_BYTES, 8u },
+    { "short", QRNG_REQUEST_INT16, 16u },
+    { "int", QRNG_REQUEST_INT32, 32u },
+    { "double", QRNG_REQUEST_DOUBLE, 53u },
+    { "float", QRNG_REQUEST_FLOAT, 24u },
+    { "streambytes", QRNG_REQUEST_STREAM, 8u },
+};
+
+static FILE *sink = NULL;
+static void *values = NULL;
+
+static void print_help(void);
+static uint64_t now_ns(void);
+static uint64_t cpu_ns(void);
+static int open_cycle_counter(void);
+static int parse_sizes(const char *spec, size_t *sizes, size_t *count);
+static int fetch(const route_t *route, size_t samples);
+static int measure(const route_t *route, size_t request_bytes, uint64_t entropy_bytes,
+                   double seconds, int cycle_fd, result_t *result);
+static void report(e_format_t format, const route_t *route, size_t request_bytes,
+                   const result_t *result, bool first);
+
+int main(int argc, char **argv)
+{
+    int opt = -1;
+    char domain_addr[DOMAIN_ADDR_LENGTH] = {0};
+    const char *size_spec = DEFAULT_SIZES;
+    const char *filter = NULL;
+    const char *record_path = NULL;
+    const char *replay_path = NULL;
+    uint64_t entropy_bytes = DEFAULT_ENTROPY;
+    double seconds = DEFAULT_SECONDS;
+    e_format_t format = FORMAT_TEXT;
+    size_t sizes[MAX_SIZES];
+    size_t size_count = 0;
+    size_t r = 0;
+    size_t s = 0;
+    int cycle_fd = -1;
+    bool first = true;
+    result_t result;
+
+    if (argc == 1) {
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+    while ((opt = getopt(argc, argv, "ha:n:d:s:b:f:W:R:")) != -1) {
+        switch (opt) {
+            case 'h':
+                print_help();
+                exit(EXIT_SUCCESS);
+                break;
+            case 'a':
+                strncpy(domain_addr, optarg, DOMAIN_ADDR_LENGTH - 1u);
+                break;
+            case 'n':
+                entropy_bytes = strtoull(optarg, NULL, 10);
+                break;
+            case 'd':
+                seconds = atof(optarg);
+                break;
+            case 's':
+                size_spec = optarg;
+                break;
+            case 'b':
+                filter = optarg;
+                break;
+            case 'f':
+                format = strcmp(optarg, "csv") == 0 ? FORMAT_CSV :
+                    strcmp(optarg, "json") == 0 ? FORMAT_JSON : FORMAT_TEXT;
+                break;
+            case 'W':
+                record_path = optarg;
+                break;
+            case 'R':
+                replay_path = optarg;
+                break;
+            default:
+                print_help();
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (entropy_bytes < 1 || seconds <= 0.0 || parse_sizes(size_spec, sizes, &size_count) != 0) {
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+
+    if (qrng_open(domain_addr) != 0) {
+        exit(EXIT_FAILURE);
+    }
+    if ((record_path && qrng_set_transport(QRNG_TRANSPORT_RECORD, record_path, 0.0) != 0) ||
+        (replay_path && qrng_set_transport(QRNG_TRANSPORT_REPLAY, replay_path, 1.0) != 0)) {
+        qrng_close();
+        exit(EXIT_FAILURE);
+    }
+    sink = fopen("/dev/null", "wb");
+    /* Room for the largest request: no route stores more than two bytes per random byte. */
+    values = malloc(2u * MAX_REQUEST_BYTES + sizeof(double));
+    if (sink == NULL || values == NULL) {
+        fprintf(stderr, "Not enough memory\n");
+        qrng_close();
+        exit(EXIT_FAILURE);
+    }
+    cycle_fd = open_cycle_counter();
+
+    if (format == FORMAT_CSV) {
+        printf("route,request_bytes,requests,errors,entropy_bytes,wire_bytes_per_bit,cpu_ns_per_bit,"
+               "cycles_per_bit,mbit_per_s\n");
+    }
+    else if (format == FORMAT_JSON) {
+        printf("[");
+    }
+    else {
+        printf("%s: %llu entropy bytes or %.1f s per route and request size%s\n", PROGRAM_NAME,
+               (unsigned long long)entropy_bytes, seconds,
+               cycle_fd < 0 ? " (no cycle counter, see cpu ns)" : "");
+    }
+    for (s = 0; s < size_count; s++) {
+        for (r = 0; r < sizeof(routes) / sizeof(routes[0]); r++) {
+            if (filter != NULL && strstr(routes[r].name, filter) == NULL) {
+                continue;
+            }
+            if (measure(&routes[r], sizes[s], entropy_bytes, seconds, cycle_fd, &result) != 0) {
+                continue;
+            }
+            report(format, &routes[r], sizes[s], &result, first);
+            first = false;
+        }
+    }
+    if (format == FORMAT_JSON) {
+        printf("\n]\n");
+    }
+
+    if (cycle_fd >= 0) {
+        close(cycle_fd);
+    }
+    free(values);
+    fclose(sink);
+    qrng_close();
+    exit(EXIT_SUCCESS);
+}
+
+
+uint64_t now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+
+uint64_t cpu_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+
+int open_cycle_counter(void)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 0;
+    attr.exclude_hv = 1;
+    /* Transfers run on the calling thread, so counting this thread covers the client path. */
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+
+int parse_sizes(const char *spec, size_t *sizes, size_t *count)
+{
+    char copy[256];
+    char *save = NULL;
+    char *token = NULL;
+    unsigned long value = 0;
+
+    strncpy(copy, spec, sizeof(copy) - 1u);
+    copy[sizeof(copy) - 1u] = '\0';
+    *count = 0;
+    for (token = strtok_r(copy, ",", &save); token != NULL; token = strtok_r(NULL, ",", &save)) {
+        value = strtoul(token, NULL, 10);
+        if (value < 1 || value > MAX_REQUEST_BYTES || *count == MAX_SIZES) {
+            return -1;
+        }
+        sizes[(*count)++] = (size_t)value;
+    }
+    return *count > 0 ? 0 : -1;
+}
+
+
+int fetch(const route_t *route, size_t samples)
+{
+    switch (route->type) {
+        case QRNG_REQUEST_BYTES:
+            return qrng_random_bytes(samples, (uint8_t *)values);
+        case QRNG_REQUEST_INT16:
+            return qrng_random_int16(INT16_MIN, INT16_MAX, samples, (int16_t *)values);
+        case QRNG_REQUEST_INT32:
+            return qrng_random_int32(INT32_MIN, INT32_MAX, samples, (int32_t *)values);
+        case QRNG_REQUEST_DOUBLE:
+            return qrng_random_double(0.0, 1.0, samples, (double *)values);
+        case QRNG_REQUEST_FLOAT:
+            return qrng_random_float(0.0f, 1.0f, samples, (float *)values);
+        default:
+            return qrng_random_stream(sink, samples);
+    }
+}
+
+
+int measure(const route_t *route, size_t request_bytes, uint64_t entropy_bytes,
+            double seconds, int cycle_fd, result_t *result)
+{
+    struct qrng_stats before;
+    struct qrng_stats after;
+    /* Whole values only: round up so that every route delivers at least the requested bits. */
+    size_t samples = (request_bytes * 8u + route->bits - 1u) / route->bits;
+    uint64_t end_ns = 0;
+    uint64_t start_ns = 0;
+    uint64_t start_cpu = 0;
+    long long cycles = 0;
+
+    memset(result, 0, sizeof(*result));
+    if (route->type == QRNG_REQUEST_STREAM) {
+        /* One appliance request per call, of exactly the requested size. */
+        (void)qrng_set_chunk_limits(request_bytes, request_bytes);
+    }
+    /* The first request pays for the connection; keep it out of the figures. */
+    if (fetch(route, samples) != 0) {
+        fprintf(stderr, "%s: %zu byte requests fail, skipped\n", route->name, request_bytes);
+        return -1;
+    }
+
+    (void)qrng_get_stats(&before);
+    if (cycle_fd >= 0) {
+        (void)ioctl(cycle_fd, PERF_EVENT_IOC_RESET, 0);
+        (void)ioctl(cycle_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    start_cpu = cpu_ns();
+    start_ns = now_ns();
+    end_ns = start_ns + (uint64_t)(seconds * 1e9);
+    do {
+        if (fetch(route, samples) != 0) {
+            result->errors++;
+        }
+        else {
+            result->bits += (uint64_t)samples * route->bits;
+        }
+        result->requests++;
+    } while (result->bits < entropy_bytes * 8u && now_ns() < end_ns);
+    result->elapsed_ns = now_ns() - start_ns;
+    result->cpu_ns = cpu_ns() - start_cpu;
+    if (cycle_fd >= 0) {
+        (void)ioctl(cycle_fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(cycle_fd, &cycles, sizeof(cycles)) == (ssize_t)sizeof(cycles)) {
+            result->cycles = (uint64_t)cycles;
+            result->have_cycles = true;
+        }
+    }
+    (void)qrng_get_stats(&after);
+    result->wire_bytes = after.types[route->type].wire_bytes - before.types[route->type].wire_bytes;
+    return 0;
+}
+
+
+void report(e_format_t format, const route_t *route, size_t request_bytes,
+            const result_t *result, bool first)
+{
+    double bits = result->bits > 0 ? (double)result->bits : 1.0;
+    double wire_per_bit = (double)result->wire_bytes / bits;
+    double cpu_per_bit = (double)result->cpu_ns / bits;
+    double cycles_per_bit = (double)result->cycles / bits;
+    double mbps = result->elapsed_ns > 0 ? (double)result->bits * 1e3 / (double)result->elapsed_ns : 0.0;
+
+    if (format == FORMAT_CSV) {
+        printf("%s,%zu,%llu,%llu,%llu,%.4f,%.3f,", route->name, request_bytes,
+               (unsigned long long)result->requests, (unsigned long long)result->errors,
+               (unsigned long long)(result->bits / 8u), wire_per_bit, cpu_per_bit);
+        if (result->have_cycles) {
+            printf("%.2f", cycles_per_bit);
+        }
+        printf(",%.3f\n", mbps);
+    }
+    else if (format == FORMAT_JSON) {
+        printf("%s\n  {\"route\": \"%s\", \"request_bytes\": %zu, \"requests\": %llu, \"errors\": %llu, "
+               "\"entropy_bytes\": %llu, \"wire_bytes_per_bit\": %.4f, \"cpu_ns_per_bit\": %.3f, "
+               "\"cycles_per_bit\": ", first ? "" : ",", route->name, request_bytes,
+               (unsigned long long)result->requests, (unsigned long long)result->errors,
+               (unsigned long long)(result->bits / 8u), wire_per_bit, cpu_per_bit);
+        if (result->have_cycles) {
+            printf("%.2f", cycles_per_bit);
+        }
+        else {
+            printf("null");
+        }
+        printf(", \"mbit_per_s\": %.3f}", mbps);
+    }
+    else {
+        printf("%-12s %7zu B/req %8.4f wire B/bit %9.3f cpu ns/bit ", route->name, request_bytes,
+               wire_per_bit, cpu_per_bit);
+        if (result->have_cycles) {
+            printf("%9.2f cycles/bit ", cycles_per_bit);
+        }
+        printf("%9.3f Mbit/s  [%llu requests, %llu errors]\n", mbps,
+               (unsigned long long)result->requests, (unsigned long long)result->errors);
+    }
+}
+
+
+void print_help(void)
+{
+    fprintf(stderr, "%s version %s\n", PROGRAM_NAME, VERSION);
+    fprintf(stderr, "%s -a domain [-h] [-n bytes] [-d seconds] [-s sizes] [-b route] [-W capture | -R capture] [-f text|csv|json]\n", PROGRAM_NAME);
+    fprintf(stderr, "-a \t IDQ's Quantis Appliance address, http:// for a local mock.\n");
+    fprintf(stderr, "-n \t entropy fetched per route and request size, in bytes. [Default %u]\n", DEFAULT_ENTROPY);
+    fprintf(stderr, "-d \t time limit per route and request size, in seconds. [Default %.0f]\n", DEFAULT_SECONDS);
+    fprintf(stderr, "-s \t comma separated entropy per request, in bytes. [Default %s]\n", DEFAULT_SIZES);
+    fprintf(stderr, "-b \t only run routes whose name contains this string.\n");
+    fprintf(stderr, "-W \t record every appliance response to a capture file.\n");
+    fprintf(stderr, "-R \t replay a capture file instead of using the network.\n");
+    fprintf(stderr, "-f \t output format. [Default text]\n");
+    fprintf(stderr, "-h \t print this help.\n");
+}
@@ -0,0 +1,459 @@
+/****************************************************************************
+ * qrng-micro - microbenchmarks of the libqrng response handling paths      *
+ *                                                                          *
+ * Copyright (C) 2023  Sebastian Mihai Ardelean                             *
+ *                                                                          *
+ * This program is free software: you can redistribute it and/or modify     *
+ * it under the terms of the GNU General Public License as published by     *
+ * the Free Software Foundation, either version 3 of the License, or        *
+ * (at your option) any later version.                                      *
+ *                                                                          *
+ * This program is distributed in the hope that it will be useful,          *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ * GNU General Public License for more details.                             *
+ *                                                                          *
+ * You should have received a copy of the GNU General Public License        *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+
+/**
+ * @file qrng_micro.c
+ * @author Sebastian Mihai Ardelean <sebastian.ardelean@cs.upt.ro>
+ * @date 24 May 2023
+ * @brief In-process benchmarks of the parsers, write callbacks and conversion kernels.
+ *
+ * Responses are generated in the appliance format (or loaded from recorded bodies) and fed
+ * through the library internals, so no network is involved. Each benchmark runs the warmup
+ * iterations, then the measured repetitions; the median and the best repetition are reported.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <qrng.h>
+#include <qrng_internal.h>
+
+/**
+ * @def PROGRAM_NAME
+ * @brief A macro for the program name.
+ *
+ */
+#define PROGRAM_NAME "qrng-micro"
+
+/**
+ * @def VERSION
+ * @brief A macro for the program version.
+ *
+ */
+#define VERSION "1.0.0"
+
+/**
+ * @def DEFAULT_VALUES
+ * @brief Values per synthetic response.
+ *
+ */
+#define DEFAULT_VALUES 4096u
+
+/**
+ * @def DEFAULT_WARMUP
+ * @brief Unmeasured iterations run before the repetitions.
+ *
+ */
+#define DEFAULT_WARMUP 20u
+
+/**
+ * @def DEFAULT_REPETITIONS
+ * @brief Measured repetitions.
+ *
+ */
+#define DEFAULT_REPETITIONS 200u
+
+/**
+ * @def CALLBACK_PIECE
+ * @brief Size of the pieces libcurl hands to a write callback (CURL_MAX_WRITE_SIZE).
+ *
+ */
+#define CALLBACK_PIECE 16384u
+
+/**
+ * @brief Output formats.
+ */
+typedef enum {
+    FORMAT_TEXT = 0,
+    FORMAT_CSV,
+    FORMAT_JSON
+}e_format_t;
+
+/**
+ * @brief One benchmark: a kernel run over a prepared input.
+ */
+typedef struct {
+    const char *name;
+    e_req_type_t type;          /*!< response kind, NUMBER_OF_REQUESTS for binary inputs */
+    void (*run)(size_t values);
+}bench_t;
+
+static char *response = NULL;   /* pristine response body */
+static size_t response_len = 0;
+static char *work = NULL;       /* copy consumed by the parser */
+static uint8_t *raw = NULL;     /* streambytes body */
+static size_t raw_len = 0;
+static void *values_out = NULL;
+static uint64_t rng_state = 0x9e3779b97f4a7c15u;
+static e_req_type_t parse_type = NUMBER_OF_REQUESTS;
+
+static void print_help(void);
+static uint64_t now_ns(void);
+static uint64_t next_random(void);
+static int make_response(e_req_type_t type, size_t values, const char *recorded_dir);
+static void run_parse(size_t values);
+static void run_memory_cbk(size_t values);
+static void run_raw_cbk(size_t values);
+static void run_int32(size_t values);
+static void run_double(size_t values);
+static int compare_u64(const void *a, const void *b);
+
+static const bench_t benches[] = {
+    { "parse_hexbytes", BYTES_RANDOM_NUMBER, &run_parse },
+    { "parse_short", INT16_RANDOM_NUMBER, &run_parse },
+    { "parse_int", INT32_RANDOM_NUMBER, &run_parse },
+    { "parse_double", DOUBLE_RANDOM_NUMBER, &run_parse },
+    { "parse_float", FLOAT_RANDOM_NUMBER, &run_parse },
+    { "write_cbk_json", DOUBLE_RANDOM_NUMBER, &run_memory_cbk },
+    { "write_cbk_stream", NUMBER_OF_REQUESTS, &run_raw_cbk },
+    { "convert_int32", NUMBER_OF_REQUESTS, &run_int32 },
+    { "convert_double", NUMBER_OF_REQUESTS, &run_double },
+};
+
+int main(int argc, char **argv)
+{
+    int opt = -1;
+    size_t values = DEFAULT_VALUES;
+    unsigned warmup = DEFAULT_WARMUP;
+    unsigned repetitions = DEFAULT_REPETITIONS;
+    int cpu = -1;
+    e_format_t format = FORMAT_TEXT;
+    const char *filter = NULL;
+    const char *recorded_dir = NULL;
+    cpu_set_t set;
+    uint64_t *samples = NULL;
+    uint64_t start = 0;
+    double ns_median = 0.0;
+    double ns_best = 0.0;
+    double gbps = 0.0;
+    size_t input_bytes = 0;
+    size_t b = 0;
+    unsigned r = 0;
+    bool first = true;
+
+    while ((opt = getopt(argc, argv, "hn:w:r:c:f:b:d:")) != -1) {
+        switch (opt) {
+            case 'h':
+                print_help();
+                exit(EXIT_SUCCESS);
+                break;
+            case 'n':
+                values = atol(optarg);
+                break;
+            case 'w':
+                warmup = atoi(optarg);
+                break;
+            case 'r':
+                repetitions = atoi(optarg);
+                break;
+            case 'c':
+                cpu = atoi(optarg);
+                break;
+            case 'f':
+                format = strcmp(optarg, "csv") == 0 ? FORMAT_CSV :
+                    strcmp(optarg, "json") == 0 ? FORMAT_JSON : FORMAT_TEXT;
+                break;
+            case 'b':
+                filter = optarg;
+                break;
+            case 'd':
+                recorded_dir = optarg;
+                break;
+            default:
+                print_help();
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (values < 1 || repetitions < 1) {
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+
+    if (cpu >= 0) {
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+            perror("sched_setaffinity");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    samples = malloc(repetitions * sizeof(*samples));
+    values_out = malloc(values * sizeof(double));
+    raw_len = values * sizeof(uint64_t);
+    raw = malloc(raw_len);
+    if (samples == NULL || values_out == NULL || raw == NULL) {
+        fprintf(stderr, "Not enough memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (b = 0; b + sizeof(uint64_t) <= raw_len; b += sizeof(uint64_t)) {
+        uint64_t v = next_random();
+        memcpy(raw + b, &v, sizeof(v));
+    }
+
+    if (format == FORMAT_CSV) {
+        printf("benchmark,values,input_bytes,repetitions,ns_per_value_median,ns_per_value_best,gb_per_s_median\n");
+    }
+    else if (format == FORMAT_JSON) {
+        printf("[");
+    }
+    for (b = 0; b < sizeof(benches) / sizeof(benches[0]); b++) {
+        if (filter != NULL && strstr(benches[b].name, filter) == NULL) {
+            continue;
+        }
+        if (benches[b].type != NUMBER_OF_REQUESTS) {
+            if (make_response(benches[b].type, values, recorded_dir) != 0) {
+                exit(EXIT_FAILURE);
+            }
+            input_bytes = response_len;
+        }
+        else {
+            input_bytes = raw_len;
+        }
+        parse_type = benches[b].type;
+
+        for (r = 0; r < warmup; r++) {
+            benches[b].run(values);
+        }
+        for (r = 0; r < repetitions; r++) {
+            start = now_ns();
+            benches[b].run(values);
+            samples[r] = now_ns() - start;
+        }
+        qsort(samples, repetitions, sizeof(*samples), &compare_u64);
+        ns_median = (double)samples[repetitions / 2u] / (double)values;
+        ns_best = (double)samples[0] / (double)values;
+        gbps = (double)input_bytes / (double)samples[repetitions / 2u];
+
+        if (format == FORMAT_CSV) {
+            printf("%s,%zu,%zu,%u,%.3f,%.3f,%.4f\n", benches[b].name, values, input_bytes,
+                   repetitions, ns_median, ns_best, gbps);
+        }
+        else if (format == FORMAT_JSON) {
+            printf("%s\n  {\"benchmark\": \"%s\", \"values\": %zu, \"input_bytes\": %zu, \"repetitions\": %u, "
+                   "\"ns_per_value_median\": %.3f, \"ns_per_value_best\": %.3f, \"gb_per_s_median\": %.4f}",
+                   first ? "" : ",", benches[b].name, values, input_bytes, repetitions,
+                   ns_median, ns_best, gbps);
+        }
+        else {
+            printf("%-18s %10.3f ns/value (best %8.3f) %8.4f GB/s  [%zu values, %zu bytes]\n",
+                   benches[b].name, ns_median, ns_best, gbps, values, input_bytes);
+        }
+        first = false;
+    }
+    if (format == FORMAT_JSON) {
+        printf("\n]\n");
+    }
+
+    free(samples);
+    free(values_out);
+    free(raw);
+    free(response);
+    free(work);
+    exit(EXIT_SUCCESS);
+}
+
+
+uint64_t now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+
+uint64_t next_random(void)
+{
+    /* xorshift64*: reproducible inputs across builds. */
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1du;
+}
+
+
+int make_response(e_req_type_t type, size_t values, const char *recorded_dir)
+{
+    static const char *recorded_names[] = { "hexbytes.json", "short.json", "int.json", "double.json", "float.json" };
+    char path[1024];
+    FILE *file = NULL;
+    size_t cap = values * 32u + 16u;
+    size_t i = 0;
+    int len = 0;
+
+    free(response);
+    free(work);
+    response = NULL;
+    work = NULL;
+
+    if (recorded_dir != NULL && (unsigned)type < sizeof(recorded_names) / sizeof(recorded_names[0])) {
+        snprintf(path, sizeof(path), "%s/%s", recorded_dir, recorded_names[type]);
+        file = fopen(path, "rb");
+    }
+    if (file != NULL) {
+        /* A recorded body must hold at least the requested number of values. */
+        fseek(file, 0, SEEK_END);
+        cap = (size_t)ftell(file) + 1u;
+        fseek(file, 0, SEEK_SET);
+        response = malloc(cap);
+        work = malloc(cap);
+        if (response == NULL || work == NULL) {
+            fprintf(stderr, "Not enough memory\n");
+            fclose(file);
+            return -1;
+        }
+        response_len = fread(response, 1, cap - 1u, file);
+        response[response_len] = '\0';
+        fclose(file);
+        return 0;
+    }
+
+    response = malloc(cap);
+    work = malloc(cap);
+    if (response == NULL || work == NULL) {
+        fprintf(stderr, "Not enough memory\n");
+        return -1;
+    }
+    response_len = 0;
+    response[response_len++] = '[';
+    for (i = 0; i < values; i++) {
+        uint64_t v = next_random();
+        switch (type) {
+            case BYTES_RANDOM_NUMBER:
+                len = snprintf(response + response_len, cap - response_len, "\"%02x\"", (unsigned)(v & 0xffu));
+                break;
+            case INT16_RANDOM_NUMBER:
+                len = snprintf(response + response_len, cap - response_len, "%d", (int16_t)v);
+                break;
+            case INT32_RANDOM_NUMBER:
+                len = snprintf(response + response_len, cap - response_len, "%d", (int32_t)v);
+                break;
+            case DOUBLE_RANDOM_NUMBER:
+                len = snprintf(response + response_len, cap - response_len, "%.17g",
+                               (double)(v >> 11) / 9007199254740992.0);
+                break;
+            default:
+                len = snprintf(response + response_len, cap - response_len, "%.9g",
+                               (float)(v >> 40) / 16777216.0f);
+                break;
+        }
+        response_len += (size_t)len;
+        if (i + 1u < values) {
+            response[response_len++] = ',';
+        }
+    }
+    response[response_len++] = ']';
+    response[response_len] = '\0';
+    return 0;
+}
+
+
+void run_parse(size_t values)
+{
+    /* The parser tokenizes in place; the copy is part of the cost it imposes. */
+    memcpy(work, response, response_len + 1u);
+    qrng_parse_response(work, values_out, values, parse_type);
+}
+
+
+void run_memory_cbk(size_t values)
+{
+    memory_t mem;
+    size_t offset = 0;
+    size_t piece = 0;
+
+    (void)values;
+    memset(&mem, 0, sizeof(mem));
+    for (offset = 0; offset < response_len; offset += piece) {
+        piece = response_len - offset < CALLBACK_PIECE ? response_len - offset : CALLBACK_PIECE;
+        if (qrng_memory_write_cbk(response + offset, 1, piece, &mem) != piece) {
+            break;
+        }
+    }
+#ifndef NO_DYNAMIC_MEMORY_ALLOCATION
+    free(mem.memory);
+#endif
+}
+
+
+void run_raw_cbk(size_t values)
+{
+    raw_sink_t sink = { .dst = (uint8_t *)values_out, .cap = values * sizeof(double), .len = 0 };
+    size_t offset = 0;
+    size_t piece = 0;
+
+    for (offset = 0; offset < raw_len; offset += piece) {
+        piece = raw_len - offset < CALLBACK_PIECE ? raw_len - offset : CALLBACK_PIECE;
+        (void)qrng_raw_write_cbk(raw + offset, 1, piece, &sink);
+    }
+}
+
+
+void run_int32(size_t values)
+{
+    int32_t *out = (int32_t *)values_out;
+    size_t i = 0;
+    int32_t v = 0;
+
+    for (i = 0; i < values; i++) {
+        if (qrng_bytes_to_int32(-1000, 1000, raw + i * sizeof(uint64_t), &v) == 0) {
+            out[i] = v;
+        }
+    }
+}
+
+
+void run_double(size_t values)
+{
+    double *out = (double *)values_out;
+    size_t i = 0;
+
+    for (i = 0; i < values; i++) {
+        out[i] = qrng_bytes_to_double(0.0, 1.0, raw + i * sizeof(uint64_t));
+    }
+}
+
+
+int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+
+void print_help(void)
+{
+    fprintf(stderr, "\n\n\t\t%s version %s\n\n", PROGRAM_NAME, VERSION);
+    fprintf(stderr, "%s [-h] [-n values] [-w warmup] [-r repetitions] [-c cpu] [-f text|csv|json] [-b filter] [-d recorded dir]\n", PROGRAM_NAME);
+    fprintf(stderr, "-h \t help\n");
+    fprintf(stderr, "-n \t values per response. [Default 4096]\n");
+    fprintf(stderr, "-w \t warmup iterations. [Default 20]\n");
+    fprintf(stderr, "-r \t measured repetitions. [Default 200]\n");
+    fprintf(stderr, "-c \t pin to this CPU. [Default: not pinned]\n");
+    fprintf(stderr, "-f \t output format. [Default text]\n");
+    fprintf(stderr, "-b \t run only benchmarks whose name contains this string.\n");
+    fprintf(stderr, "-d \t directory with recorded bodies (hexbytes.json, short.json, int.json, double.json, float.json).\n");
+}
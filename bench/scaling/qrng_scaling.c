@@ -0,0 +1,506 @@
+/****************************************************************************
+ * qrng-scaling - throughput and latency of libqrng against thread count    *
+ *                                                                          *
+ * Copyright (C) 2023  Sebastian Mihai Ardelean                             *
+ *                                                                          *
+ * This program is free software: you can redistribute it and/or modify     *
+ * it under the terms of the GNU General Public License as published by     *
+ * the Free Software Foundation, either version 3 of the License, or        *
+ * (at your option) any later version.                                      *
+ *                                                                          *
+ * This program is distributed in the hope that it will be useful,          *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ * GNU General Public License for more details.                             *
+ *                                                                          *
+ * You should have received a copy of the GNU General Public License        *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+
+/**
+ * @file qrng_scaling.c
+ * @author Sebastian Mihai Ardelean <sebastian.ardelean@cs.upt.ro>
+ * @date 24 May 2023
+ * @brief Sweep thread count, request size, connection count and request path.
+ *
+ * Every combination runs closed loop for a fixed time: all threads start together and call
+ * @qrng_random_bytes@ back to back. The paths differ in what the library does underneath:
+ * "direct" sends every call to the appliance, "coalesce" merges concurrent calls and "pool"
+ * serves from the entropy pool. Latencies are kept per thread (reservoir sampled beyond
+ * SAMPLES_PER_THREAD) so both the overall percentiles and the spread between threads show.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <qrng.h>
+
+/**
+ * @def PROGRAM_NAME
+ * @brief A macro for the program name.
+ *
+ */
+#define PROGRAM_NAME "qrng-scaling"
+
+/**
+ * @def VERSION
+ * @brief A macro for the program version.
+ *
+ */
+#define VERSION "1.0.0"
+
+/**
+ * @def DOMAIN_ADDR_LENGTH
+ * @brief Length of the appliance address.
+ *
+ */
+#define DOMAIN_ADDR_LENGTH 256u
+
+/**
+ * @def MAX_THREADS
+ * @brief Upper bound of the number of threads.
+ *
+ */
+#define MAX_THREADS 256u
+
+/**
+ * @def MAX_LIST
+ * @brief Upper bound of the entries of a sweep list.
+ *
+ */
+#define MAX_LIST 16u
+
+/**
+ * @def SAMPLES_PER_THREAD
+ * @brief Latencies kept per thread and configuration.
+ *
+ */
+#define SAMPLES_PER_THREAD 16384u
+
+/**
+ * @def MAX_REQUEST_BYTES
+ * @brief Largest request size.
+ *
+ */
+#define MAX_REQUEST_BYTES (1024u * 1024u)
+
+#define DEFAULT_THREADS "1,2,4,8,16,32,64"
+#define DEFAULT_SIZES "16,4096"
+#define DEFAULT_CONNECTIONS "1,4"
+#define DEFAULT_PATHS "direct,coalesce,pool"
+#define DEFAULT_SECONDS 2.0
+#define COALESCE_WINDOW_US 200u
+#define COALESCE_MAX_SAMPLES 65536u
+#define POOL_CAPACITY (4u * 1024u * 1024u)
+
+/**
+ * @brief Request paths through the library.
+ */
+typedef enum {
+    PATH_DIRECT = 0,
+    PATH_COALESCE,
+    PATH_POOL,
+    NUMBER_OF_PATHS
+}e_path_t;
+
+/**
+ * @brief State of one load thread.
+ */
+typedef struct {
+    pthread_t tid;
+    uint64_t *latencies;
+    uint64_t seen;
+    uint64_t kept;
+    uint64_t requests;
+    uint64_t errors;
+    uint64_t rng;
+    uint8_t *buffer;
+}worker_t;
+
+/**
+ * @brief Figures of one configuration.
+ */
+typedef struct {
+    uint64_t requests;
+    uint64_t errors;
+    double seconds;
+    double cpu_cores;
+    uint64_t p50_ns;
+    uint64_t p90_ns;
+    uint64_t p99_ns;
+    uint64_t max_ns;
+    uint64_t thread_p99_min_ns;
+    uint64_t thread_p99_max_ns;
+}result_t;
+
+static const char *path_names[NUMBER_OF_PATHS] = { "direct", "coalesce", "pool" };
+
+static worker_t workers[MAX_THREADS];
+static pthread_barrier_t start_barrier;
+static atomic_bool stop = false;
+static size_t request_bytes = 0;
+static uint64_t *merged = NULL;
+
+static void print_help(void);
+static uint64_t now_ns(void);
+static uint64_t cpu_ns(void);
+static int parse_list(const char *spec, unsigned long *list, size_t *count, unsigned long max);
+static int parse_paths(const char *spec, e_path_t *list, size_t *count);
+static void *worker_thread(void *arg);
+static int setup_path(e_path_t path);
+static void teardown_path(e_path_t path);
+static int run(unsigned threads, double seconds, result_t *result);
+static uint64_t percentile(uint64_t *sorted, uint64_t count, double p);
+static int compare_u64(const void *a, const void *b);
+
+int main(int argc, char **argv)
+{
+    int opt = -1;
+    char domain_addr[DOMAIN_ADDR_LENGTH] = {0};
+    const char *thread_spec = DEFAULT_THREADS;
+    const char *size_spec = DEFAULT_SIZES;
+    const char *connection_spec = DEFAULT_CONNECTIONS;
+    const char *path_spec = DEFAULT_PATHS;
+    double seconds = DEFAULT_SECONDS;
+    bool csv = false;
+    unsigned long threads[MAX_LIST];
+    unsigned long sizes[MAX_LIST];
+    unsigned long connections[MAX_LIST];
+    e_path_t paths[MAX_LIST];
+    size_t thread_count = 0;
+    size_t size_count = 0;
+    size_t connection_count = 0;
+    size_t path_count = 0;
+    size_t p = 0;
+    size_t c = 0;
+    size_t s = 0;
+    size_t t = 0;
+    unsigned i = 0;
+    result_t result;
+
+    if (argc == 1) {
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+    while ((opt = getopt(argc, argv, "ha:t:s:l:m:d:f:")) != -1) {
+        switch (opt) {
+            case 'h':
+                print_help();
+                exit(EXIT_SUCCESS);
+                break;
+            case 'a':
+                strncpy(domain_addr, optarg, DOMAIN_ADDR_LENGTH - 1u);
+                break;
+            case 't':
+                thread_spec = optarg;
+                break;
+            case 's':
+                size_spec = optarg;
+                break;
+            case 'l':
+                connection_spec = optarg;
+                break;
+            case 'm':
+                path_spec = optarg;
+                break;
+            case 'd':
+                seconds = atof(optarg);
+                break;
+            case 'f':
+                csv = strcmp(optarg, "csv") == 0;
+                break;
+            default:
+                print_help();
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (seconds <= 0.0 ||
+        parse_list(thread_spec, threads, &thread_count, MAX_THREADS) != 0 ||
+        parse_list(size_spec, sizes, &size_count, MAX_REQUEST_BYTES) != 0 ||
+        parse_list(connection_spec, connections, &connection_count, 8u) != 0 ||
+        parse_paths(path_spec, paths, &path_count) != 0) {
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+
+    merged = malloc(MAX_THREADS * SAMPLES_PER_THREAD * sizeof(*merged));
+    for (i = 0; i < MAX_THREADS; i++) {
+        workers[i].latencies = malloc(SAMPLES_PER_THREAD * sizeof(uint64_t));
+        workers[i].buffer = malloc(MAX_REQUEST_BYTES);
+        if (workers[i].latencies == NULL || workers[i].buffer == NULL) {
+            merged = NULL;
+            break;
+        }
+    }
+    if (merged == NULL) {
+        fprintf(stderr, "Not enough memory\n");
+        exit(EXIT_FAILURE);
+    }
+    if (qrng_open(domain_addr) != 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    if (csv) {
+        printf("path,connections,request_bytes,threads,requests,errors,req_per_s,mb_per_s,"
+               "p50_ms,p90_ms,p99_ms,max_ms,thread_p99_min_ms,thread_p99_max_ms,cpu_cores\n");
+    }
+    else {
+        printf("%-8s %4s %8s %7s %10s %6s %10s %9s %9s %9s %9s %9s %19s %6s\n", "path", "conn",
+               "bytes", "threads", "requests", "errors", "req/s", "MB/s", "p50 ms", "p90 ms",
+               "p99 ms", "max ms", "thread p99 min-max", "cores");
+    }
+    for (p = 0; p < path_count; p++) {
+        for (c = 0; c < connection_count; c++) {
+            for (s = 0; s < size_count; s++) {
+                if (qrng_set_lanes(connections[c], connections[c]) != 0 || setup_path(paths[p]) != 0) {
+                    fprintf(stderr, "Cannot configure %s with %lu connections\n",
+                            path_names[paths[p]], connections[c]);
+                    qrng_close();
+                    exit(EXIT_FAILURE);
+                }
+                request_bytes = sizes[s];
+                for (t = 0; t < thread_count; t++) {
+                    if (run((unsigned)threads[t], seconds, &result) != 0) {
+                        qrng_close();
+                        exit(EXIT_FAILURE);
+                    }
+                    printf(csv ? "%s,%lu,%lu,%lu,%llu,%llu,%.1f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.2f\n" :
+                           "%-8s %4lu %8lu %7lu %10llu %6llu %10.1f %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f-%-9.3f %6.2f\n",
+                           path_names[paths[p]], connections[c], sizes[s], threads[t],
+                           (unsigned long long)result.requests, (unsigned long long)result.errors,
+                           (double)result.requests / result.seconds,
+                           (double)result.requests * (double)sizes[s] / result.seconds / 1e6,
+                           (double)result.p50_ns / 1e6, (double)result.p90_ns / 1e6,
+                           (double)result.p99_ns / 1e6, (double)result.max_ns / 1e6,
+                           (double)result.thread_p99_min_ns / 1e6, (double)result.thread_p99_max_ns / 1e6,
+                           result.cpu_cores);
+                    fflush(stdout);
+                }
+                teardown_path(paths[p]);
+            }
+        }
+    }
+
+    qrng_close();
+    for (i = 0; i < MAX_THREADS; i++) {
+        free(workers[i].latencies);
+        free(workers[i].buffer);
+    }
+    free(merged);
+    exit(EXIT_SUCCESS);
+}
+
+
+uint64_t now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+
+uint64_t cpu_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+
+int parse_list(const char *spec, unsigned long *list, size_t *count, unsigned long max)
+{
+    char copy[256];
+    char *save = NULL;
+    char *token = NULL;
+    unsigned long value = 0;
+
+    strncpy(copy, spec, sizeof(copy) - 1u);
+    copy[sizeof(copy) - 1u] = '\0';
+    *count = 0;
+    for (token = strtok_r(copy, ",", &save); token != NULL; token = strtok_r(NULL, ",", &save)) {
+        value = strtoul(token, NULL, 10);
+        if (value < 1 || value > max || *count == MAX_LIST) {
+            return -1;
+        }
+        list[(*count)++] = value;
+    }
+    return *count > 0 ? 0 : -1;
+}
+
+
+int parse_paths(const char *spec, e_path_t *list, size_t *count)
+{
+    char copy[256];
+    char *save = NULL;
+    char *token = NULL;
+    unsigned p = 0;
+
+    strncpy(copy, spec, sizeof(copy) - 1u);
+    copy[sizeof(copy) - 1u] = '\0';
+    *count = 0;
+    for (token = strtok_r(copy, ",", &save); token != NULL; token = strtok_r(NULL, ",", &save)) {
+        for (p = 0; p < NUMBER_OF_PATHS && strcmp(token, path_names[p]) != 0; p++) {
+        }
+        if (p == NUMBER_OF_PATHS || *count == MAX_LIST) {
+            return -1;
+        }
+        list[(*count)++] = (e_path_t)p;
+    }
+    return *count > 0 ? 0 : -1;
+}
+
+
+int setup_path(e_path_t path)
+{
+    if (path == PATH_COALESCE) {
+        qrng_set_coalescing(COALESCE_WINDOW_US, COALESCE_MAX_SAMPLES);
+    }
+    else if (path == PATH_POOL) {
+        return qrng_pool_enable(POOL_CAPACITY, POOL_CAPACITY / 2u);
+    }
+    return 0;
+}
+
+
+void teardown_path(e_path_t path)
+{
+    if (path == PATH_COALESCE) {
+        qrng_set_coalescing(0, 0);
+    }
+    else if (path == PATH_POOL) {
+        qrng_pool_disable();
+    }
+}
+
+
+void *worker_thread(void *arg)
+{
+    worker_t *w = (worker_t *)arg;
+    uint64_t start = 0;
+    uint64_t latency = 0;
+    uint64_t slot = 0;
+
+    pthread_barrier_wait(&start_barrier);
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        start = now_ns();
+        if (qrng_random_bytes(request_bytes, w->buffer) != 0) {
+            w->errors++;
+        }
+        latency = now_ns() - start;
+        w->requests++;
+        /* Reservoir sampling keeps an unbiased subset once the buffer is full. */
+        if (w->kept < SAMPLES_PER_THREAD) {
+            w->latencies[w->kept++] = latency;
+        }
+        else {
+            w->rng ^= w->rng << 13;
+            w->rng ^= w->rng >> 7;
+            w->rng ^= w->rng << 17;
+            slot = w->rng % (w->seen + 1u);
+            if (slot < SAMPLES_PER_THREAD) {
+                w->latencies[slot] = latency;
+            }
+        }
+        w->seen++;
+    }
+    return NULL;
+}
+
+
+int run(unsigned threads, double seconds, result_t *result)
+{
+    uint64_t start = 0;
+    uint64_t start_cpu = 0;
+    uint64_t total = 0;
+    uint64_t p99 = 0;
+    unsigned i = 0;
+
+    memset(result, 0, sizeof(*result));
+    atomic_store(&stop, false);
+    pthread_barrier_init(&start_barrier, NULL, threads + 1u);
+    for (i = 0; i < threads; i++) {
+        workers[i].seen = 0;
+        workers[i].kept = 0;
+        workers[i].requests = 0;
+        workers[i].errors = 0;
+        workers[i].rng = 0x9e3779b97f4a7c15u + i;
+        if (pthread_create(&workers[i].tid, NULL, &worker_thread, &workers[i]) != 0) {
+            fprintf(stderr, "Cannot create thread %u\n", i);
+            return -1;
+        }
+    }
+    pthread_barrier_wait(&start_barrier);
+    start_cpu = cpu_ns();
+    start = now_ns();
+    usleep((useconds_t)(seconds * 1e6));
+    atomic_store(&stop, true);
+    for (i = 0; i < threads; i++) {
+        pthread_join(workers[i].tid, NULL);
+    }
+    result->seconds = (double)(now_ns() - start) / 1e9;
+    result->cpu_cores = (double)(cpu_ns() - start_cpu) / 1e9 / result->seconds;
+    pthread_barrier_destroy(&start_barrier);
+
+    result->thread_p99_min_ns = UINT64_MAX;
+    for (i = 0; i < threads; i++) {
+        result->requests += workers[i].requests;
+        result->errors += workers[i].errors;
+        if (workers[i].kept == 0) {
+            continue;
+        }
+        qsort(workers[i].latencies, workers[i].kept, sizeof(uint64_t), &compare_u64);
+        p99 = percentile(workers[i].latencies, workers[i].kept, 99.0);
+        result->thread_p99_min_ns = p99 < result->thread_p99_min_ns ? p99 : result->thread_p99_min_ns;
+        result->thread_p99_max_ns = p99 > result->thread_p99_max_ns ? p99 : result->thread_p99_max_ns;
+        memcpy(merged + total, workers[i].latencies, workers[i].kept * sizeof(uint64_t));
+        total += workers[i].kept;
+    }
+    if (total == 0) {
+        result->thread_p99_min_ns = 0;
+        return 0;
+    }
+    qsort(merged, total, sizeof(uint64_t), &compare_u64);
+    result->p50_ns = percentile(merged, total, 50.0);
+    result->p90_ns = percentile(merged, total, 90.0);
+    result->p99_ns = percentile(merged, total, 99.0);
+    result->max_ns = merged[total - 1u];
+    return 0;
+}
+
+
+uint64_t percentile(uint64_t *sorted, uint64_t count, double p)
+{
+    uint64_t index = (uint64_t)((double)count * p / 100.0);
+
+    return sorted[index < count ? index : count - 1u];
+}
+
+
+int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+
+void print_help(void)
+{
+    fprintf(stderr, "%s version %s\n", PROGRAM_NAME, VERSION);
+    fprintf(stderr, "%s -a domain [-h] [-t threads] [-s bytes] [-l connections] [-m paths] [-d seconds] [-f text|csv]\n", PROGRAM_NAME);
+    fprintf(stderr, "-a \t IDQ's Quantis Appliance address, http:// for a local mock.\n");
+    fprintf(stderr, "-t \t comma separated thread counts. [Default %s]\n", DEFAULT_THREADS);
+    fprintf(stderr, "-s \t comma separated request sizes in bytes. [Default %s]\n", DEFAULT_SIZES);
+    fprintf(stderr, "-l \t comma separated connections per lane, 1 to 8. [Default %s]\n", DEFAULT_CONNECTIONS);
+    fprintf(stderr, "-m \t comma separated request paths: direct, coalesce, pool. [Default %s]\n", DEFAULT_PATHS);
+    fprintf(stderr, "-d \t duration of each configuration in seconds. [Default %.0f]\n", DEFAULT_SECONDS);
+    fprintf(stderr, "-f \t output format. [Default text]\n");
+    fprintf(stderr, "-h \t print this help.\n");
+}
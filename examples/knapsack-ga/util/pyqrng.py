@@ -23,10 +23,14 @@
 # @date 24 May 2023                                                         #
 # @brief API for interacting with IDQ's Quantis Appliance                   #
 #############################################################################
+import os
 import qrng
 from collections import deque
 import numpy as np
 
+# Set QRNG_ADDRESS=unix:/tmp/qrngd.sock to share one qrngd daemon between runs.
+ADDRESS = os.environ.get("QRNG_ADDRESS", "random.cs.upt.ro")
+
 
 def randint(l,h,n,pool_size=1000):
     if not hasattr(randint, "ivalues"):
@@ -38,14 +42,14 @@ def randint(l,h,n,pool_size=1000):
         #found the key, let's check the values
         values = randint.ivalues[key]
         if len(values) == 0 or len(values)<n:       
-            qrng.qrand_init("random.cs.upt.ro")
+            qrng.qrand_init(ADDRESS)
             values = qrng.qrand_rand_int(l,h,(n+pool_size))
             qrng.qrand_close()
             randint.ivalues[key]+=values
         else:
             pass
     else:
-        qrng.qrand_init("random.cs.upt.ro")
+        qrng.qrand_init(ADDRESS)
         randint.ivalues[key]=qrng.qrand_rand_int(l,h,(n+pool_size))
         qrng.qrand_close()
 
@@ -61,14 +65,14 @@ def uniform(l,h,n,pool_size = 1000):
         #found the key
         values = uniform.fvalues[key]
         if len(values) == 0 or len(values)<n:
-            qrng.qrand_init("random.cs.upt.ro")
+            qrng.qrand_init(ADDRESS)
             values = qrng.qrand_rand_float(l,h,(n+pool_size))
             qrng.qrand_close()
             uniform.fvalues[key]+=values
         else:
             pass
     else:
-        qrng.qrand_init("random.cs.upt.ro")
+        qrng.qrand_init(ADDRESS)
         uniform.fvalues[key]=qrng.qrand_rand_float(l,h,(n+pool_size))
         qrng.qrand_close()
 
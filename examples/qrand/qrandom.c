@@ -152,6 +152,7 @@ int main(int argc, char **argv)
     double *datad = NULL;
     size_t i = 0;
     FILE *stream = NULL;
+    struct qrng_perf_report perf;
 
     /* Initialize the with the default values. */
     strncpy(domain_addr, default_domain_addr, DOMAIN_ADDR_LENGTH);
@@ -286,6 +287,17 @@ int main(int argc, char **argv)
 	    (void)qrng_random_stream(stream, number_of_samples);
             break;
         case PERFORMANCE_REQUEST:
+            if (qrng_measure_performance(NULL, &perf) == 0) {
+                printf("connection setup:  dns %.3f ms, connect %.3f ms, tls %.3f ms\n",
+                       perf.dns_ns / 1e6, perf.connect_ns / 1e6, perf.tls_ns / 1e6);
+                printf("small requests:    p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+                       perf.latency_p50_ns / 1e6, perf.latency_p90_ns / 1e6,
+                       perf.latency_p99_ns / 1e6, perf.latency_max_ns / 1e6);
+                printf("streambytes:       %.0f bytes/s\n", perf.stream_bytes_per_s);
+                printf("json (double):     %.0f values/s (%.0f bytes/s)\n",
+                       perf.json_values_per_s, perf.json_bytes_per_s);
+                printf("errors:            %u\n", perf.errors);
+            }
             break;
         case FIRMWARE_INFO_REQUEST:
 	    (void)qrng_firmware_info(stdout);
@@ -29,12 +29,14 @@
 #include <stdbool.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
 #include <curl/curl.h>
 #include "qrng.h"
+#include "qrng_internal.h"
+#include "qrng_probes.h"
+#include "qrngd_protocol.h"
 
 
-#define DOMAIN_ADDRESS_LENGTH 254u
-#define URL_MAX_LENGTH 512u
 #define DEFAULT_NUMBER_OF_SAMPLES 1u
 #define MIN_VALUE_INT 0u
 #define MAX_VALUE_INT 1u
@@ -42,50 +44,19 @@
 #define MIN_VALUE_FLOAT 0.0f
 #define MAX_VALUE_FLOAT 1.0f
 
+#define DEADLINE_CHUNK_BYTES 512u
 
-typedef enum {
-  BYTES_RANDOM_NUMBER = 0,
-  INT16_RANDOM_NUMBER,
-  INT32_RANDOM_NUMBER,
-  DOUBLE_RANDOM_NUMBER,
-  FLOAT_RANDOM_NUMBER,
-  STREAM_BINARY,
-  PERFORMANCE_REQUEST,
-  FIRMWARE_INFO_REQUEST,
-  SYSTEM_INFO_REQUEST,
-  NUMBER_OF_REQUESTS
-}e_req_type_t;
+#define DEFAULT_INTERACTIVE_CONNECTIONS 1u
+#define DEFAULT_BULK_CONNECTIONS 1u
+
+#define DAEMON_SCHEME "unix:"
 
 
-typedef struct
-{
-  e_req_type_t type;
-  const char *api_url;
-  char domain_address[DOMAIN_ADDRESS_LENGTH];
-  size_t samples;
-  int32_t min_range_i;
-  int32_t max_range_i;
-  double min_range_f;
-  double max_range_f;
-}s_api_t;
-
-#ifdef NO_DYNAMIC_MEMORY_ALLOCATION
-#define TOTAL_MAX_SIZE_RESPONSE CURL_MAX_HTTP_HEADER
-typedef struct {
-  char memory[TOTAL_MAX_SIZE_RESPONSE];
-  size_t size;
-}memory_t;
-#else
-typedef struct {
-    char *memory;
-    size_t size;
-}memory_t;
-#endif
 
 static s_api_t api_types[] = {
   {
     .type = BYTES_RANDOM_NUMBER,
-    .api_url = "https://%s/api/2.0/hexbytes?quantity=%lu&dataLength=1",
+    .api_url = "%s/api/2.0/hexbytes?quantity=%lu&dataLength=1",
     .domain_address = "",
     .samples = DEFAULT_NUMBER_OF_SAMPLES,
     .min_range_i = MIN_VALUE_INT,
@@ -95,7 +66,7 @@ static s_api_t api_types[] = {
   },
   {
     .type = INT16_RANDOM_NUMBER,
-    .api_url = "https://%s/api/2.0/short?min=%d&max=%d&quantity=%lu",
+    .api_url = "%s/api/2.0/short?min=%d&max=%d&quantity=%lu",
     .domain_address = "",
     .samples = DEFAULT_NUMBER_OF_SAMPLES,
     .min_range_i = MIN_VALUE_INT,
@@ -105,7 +76,7 @@ static s_api_t api_types[] = {
   },
   {
     .type = INT32_RANDOM_NUMBER,
-    .api_url = "https://%s/api/2.0/int?min=%d&max=%d&quantity=%lu",
+    .api_url = "%s/api/2.0/int?min=%d&max=%d&quantity=%lu",
     .domain_address = "",
     .samples = DEFAULT_NUMBER_OF_SAMPLES,
     .min_range_i = MIN_VALUE_INT,
@@ -115,7 +86,7 @@ static s_api_t api_types[] = {
   },
   {
     .type = DOUBLE_RANDOM_NUMBER,
-    .api_url = "https://%s/api/2.0/double?min=%lf&max=%lf&quantity=%lu",
+    .api_url = "%s/api/2.0/double?min=%lf&max=%lf&quantity=%lu",
     .domain_address = "",
     .samples = DEFAULT_NUMBER_OF_SAMPLES,
     .min_range_i = MIN_VALUE_INT,
@@ -125,7 +96,7 @@ static s_api_t api_types[] = {
   },
   {
     .type = FLOAT_RANDOM_NUMBER,
-    .api_url = "https://%s/api/2.0/double?min=%lf&max=%lf&quantity=%lu",
+    .api_url = "%s/api/2.0/double?min=%lf&max=%lf&quantity=%lu",
     .domain_address = "",
     .samples = DEFAULT_NUMBER_OF_SAMPLES,
     .min_range_i = MIN_VALUE_INT,
@@ -135,7 +106,7 @@ static s_api_t api_types[] = {
   },
   {
     .type = STREAM_BINARY,
-    .api_url = "https://%s/api/2.0/streambytes?size=%lu",
+    .api_url = "%s/api/2.0/streambytes?size=%lu",
     .domain_address = "",
     .samples = DEFAULT_NUMBER_OF_SAMPLES,
     .min_range_i = MIN_VALUE_INT,
@@ -155,7 +126,7 @@ static s_api_t api_types[] = {
   },
   {
     .type = FIRMWARE_INFO_REQUEST,
-    .api_url = "https://%s/api/2.0/firmwareinfo",
+    .api_url = "%s/api/2.0/firmwareinfo",
     .domain_address = "",
     .samples = DEFAULT_NUMBER_OF_SAMPLES,
     .min_range_i = MIN_VALUE_INT,
@@ -165,7 +136,7 @@ static s_api_t api_types[] = {
   },
   {
     .type = SYSTEM_INFO_REQUEST,
-    .api_url = "https://%s/api/2.0/systeminfo",
+    .api_url = "%s/api/2.0/systeminfo",
     .domain_address = "",
     .samples = DEFAULT_NUMBER_OF_SAMPLES,
     .min_range_i = MIN_VALUE_INT,
@@ -178,50 +149,63 @@ static s_api_t api_types[] = {
 
 
 
-static CURL *p_curl_handle = NULL;
+static bool is_open = false;
 
-static size_t curl_write_cbk(void *content, 
-		      size_t size, 
-		      size_t nmemb, 
-		      void *userp);
-static void create_req_url(e_req_type_t req_type, char *api_url);
-static int execute_request(char *url, void *buffer);
-static int execute_stream_request(char *url, void *buffer);
+static void create_req_url(const s_api_t *req, char *api_url);
+static int execute_request(char *url, void *buffer, long timeout_ms, e_lane_t lane, xfer_info_t *info);
+static int execute_stream_request(char *url, void *buffer, e_lane_t lane, xfer_info_t *info);
+static size_t take_buffered(uint8_t *dst, size_t len);
+static int rest_open(qrng_source_t *src, const char *address);
+static int rest_fill_bytes(qrng_source_t *src, CURL *handle, size_t size, qrng_write_cbk_t cbk, void *data,
+                           long timeout_ms, xfer_info_t *info);
+static int rest_fill_typed(qrng_source_t *src, const s_api_t *req, void *buffer, size_t value_size,
+                           long timeout_ms, xfer_info_t *info);
+static void rest_stats(const qrng_source_t *src, struct qrng_backend_stats *stats);
+static void rest_close(qrng_source_t *src);
 
-static void parse_response_string(char *random_values_string, void *buffer, size_t samples, e_req_type_t request_type);
+const qrng_backend_t qrng_rest_backend = {
+    .name = "rest",
+    .open = &rest_open,
+    .fill_bytes = &rest_fill_bytes,
+    .fill_typed = &rest_fill_typed,
+    .stats = &rest_stats,
+    .close = &rest_close
+};
 
 int qrng_open(const char *device_domain_address){
 
     int retval = 0;
-    size_t i = 0;
-    if (device_domain_address[0] != '\0') {
-      for (i = 0 ; i < NUMBER_OF_REQUESTS; i++) {
-        strncpy(api_types[i].domain_address, device_domain_address, DOMAIN_ADDRESS_LENGTH);
+    const char *socket_path = NULL;
+
+    qrng_fork_init();
+    if (strncmp(device_domain_address, DAEMON_SCHEME, strlen(DAEMON_SCHEME)) == 0) {
+      /* "unix:/run/qrngd.sock" or "unix:///run/qrngd.sock": every call goes through qrngd. */
+      socket_path = device_domain_address + strlen(DAEMON_SCHEME);
+      if (strncmp(socket_path, "//", 2) == 0) {
+        socket_path += 2;
       }
-
-      
+      retval = qrng_client_open(socket_path);
+      is_open = retval == 0;
+    }
+    else if (device_domain_address[0] != '\0') {
+      /* Lanes are opened for local sources too: they bound the concurrent fills of any backend. */
       if(curl_global_init(CURL_GLOBAL_ALL)!=0) {
 	fprintf(stderr, "Error in curl_global_init");
 	retval = -1;
 	
       }
       else {
-	p_curl_handle = curl_easy_init();
-	if (!p_curl_handle) {
-          fprintf(stderr, "Error in curl_easy_init");
+	if (qrng_lanes_open(DEFAULT_INTERACTIVE_CONNECTIONS, DEFAULT_BULK_CONNECTIONS) != 0) {
           curl_global_cleanup();
           retval = -2;
 	}
+        else if (qrng_backend_open(device_domain_address) != 0) {
+          qrng_lanes_close();
+          curl_global_cleanup();
+          retval = -1;
+        }
         else {
-
-#ifdef DEBUG
-          (void)curl_easy_setopt(p_curl_handle, CURLOPT_VERBOSE, 1L);
-#endif
-          (void)curl_easy_setopt(p_curl_handle, CURLOPT_SSL_VERIFYHOST, 0L);
-
-          (void)curl_easy_setopt(p_curl_handle, CURLOPT_SSL_VERIFYPEER, 0L);
-	    	    
-          (void)curl_easy_setopt(p_curl_handle, CURLOPT_FAILONERROR, 1L);
+          is_open = true;
 	}
       }
     }
@@ -233,256 +217,591 @@ int qrng_open(const char *device_domain_address){
 }
 
 
+bool qrng_is_open(void)
+{
+  return is_open;
+}
+
+
+void qrng_request_init(s_api_t *req, e_req_type_t type)
+{
+  *req = api_types[type];
+}
+
+
+void qrng_setup_handle(CURL *handle)
+{
+#ifdef DEBUG
+  (void)curl_easy_setopt(handle, CURLOPT_VERBOSE, 1L);
+#endif
+  (void)curl_easy_setopt(handle, CURLOPT_SSL_VERIFYHOST, 0L);
+
+  (void)curl_easy_setopt(handle, CURLOPT_SSL_VERIFYPEER, 0L);
+
+  (void)curl_easy_setopt(handle, CURLOPT_FAILONERROR, 1L);
+
+  /* Timeouts are used from several threads; signals are process wide. */
+  (void)curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+}
+
+
+void qrng_abandon_handle(CURL *handle)
+{
+  curl_socket_t sock = CURL_SOCKET_BAD;
+
+  if (handle == NULL) {
+    return;
+  }
+  /* curl_easy_cleanup would send a TLS close_notify on the session the parent keeps using. */
+  if (curl_easy_getinfo(handle, CURLINFO_ACTIVESOCKET, &sock) == CURLE_OK && sock != CURL_SOCKET_BAD) {
+    close(sock);
+  }
+}
+
+
 void qrng_close(void)
 {
-    if (p_curl_handle) {
-	curl_easy_cleanup(p_curl_handle);
+    qrng_info_close();
+    qrng_ring_detach();
+    qrng_pool_shutdown();
+    qrng_reserve_close();
+    qrng_transport_close();
+    if (qrng_client_enabled()) {
+        qrng_client_close();
+        is_open = false;
+    }
+    if (is_open) {
+        qrng_backend_close();
+	qrng_lanes_close();
+        is_open = false;
         curl_global_cleanup();
     }
 
 }
 
 
+int qrng_warmup(size_t connections, long timeout_ms, struct qrng_warmup_stats *stats)
+{
+  struct qrng_warmup_stats local;
+  char final_url[URL_MAX_LENGTH] = {0};
+  uint64_t start_ns = qrng_now_ns();
+  int retval = 0;
+
+  if (stats == NULL) {
+    stats = &local;
+  }
+  memset(stats, 0, sizeof(*stats));
+  if (!is_open) {
+    return -1;
+  }
+  if (qrng_client_enabled()) {
+    /* A local socket connects in microseconds; only the accept and thread start are saved. */
+    stats->connections = qrng_client_warmup(connections == 0 ? 1u : connections);
+    stats->duration_ns = qrng_now_ns() - start_ns;
+    return stats->connections > 0 ? 0 : -1;
+  }
+  if (!qrng_backend_has_rest()) {
+    return 0;
+  }
+  create_req_url(&api_types[FIRMWARE_INFO_REQUEST], final_url);
+  retval = qrng_lanes_warmup(connections, final_url, timeout_ms, stats);
+  if (retval != 0) {
+    fprintf(stderr, "Could not warm up %llu of the appliance connections\n", (unsigned long long)stats->failed);
+  }
+  return retval;
+}
+
+
 int qrng_random_stream(FILE *stream, size_t size)
 {
   int retval = 0;
-  char final_url[URL_MAX_LENGTH] = {0};
-  api_types[STREAM_BINARY].samples = size;
-  create_req_url(STREAM_BINARY, final_url);
-  retval = execute_stream_request(final_url, (void *)stream);
+  s_api_t req = api_types[STREAM_BINARY];
+  xfer_info_t info;
+  uint64_t start_ns = 0;
+  conn_t *conn = NULL;
+
+  if (qrng_client_enabled()) {
+    return qrng_client_stream(STREAM_BINARY, QRNGD_OP_STREAM, stream, size);
+  }
+  /* Split into controller sized chunks: each one is a feedback sample and a point
+     where interactive requests can get ahead. */
+  while (size > 0 && !retval) {
+    req.samples = qrng_chunk_size();
+    if (req.samples > size) {
+      req.samples = size;
+    }
+    start_ns = qrng_stats_start(STREAM_BINARY, req.samples);
+    retval = qrng_lane_acquire(LANE_BULK, 0, &conn);
+    if (retval) {
+      if (retval == QRNG_DEADLINE_EXCEEDED) {
+        fprintf(stderr, "The scheduler did not admit the stream transfer in time\n");
+      }
+      else {
+        fprintf(stderr, "No appliance connection: libqrng is not initialized or the lane is empty\n");
+      }
+      qrng_stats_record(STREAM_BINARY, req.samples, NULL, qrng_now_ns() - start_ns, retval);
+      return retval;
+    }
+    retval = qrng_backend_fill_bytes(conn->handle, req.samples, &qrng_stream_write_cbk, (void *)stream, 0L, &info);
+    qrng_lane_release(conn);
+    qrng_stats_record(STREAM_BINARY, req.samples, &info, qrng_now_ns() - start_ns, retval);
+    qrng_chunk_feedback(&info, retval);
+    size -= req.samples;
+  }
   return retval;
 }
 
 
 int qrng_random_double(double min, double max, size_t samples, double *buffer)
 {
-    int retval = 0;
+    s_api_t req = api_types[DOUBLE_RANDOM_NUMBER];
 
-    char final_url[URL_MAX_LENGTH]={0};
+    req.samples = samples;
+    req.min_range_f = min;
+    req.max_range_f = max;
 
-    
-    memory_t mem_buffer;
-    
-    api_types[DOUBLE_RANDOM_NUMBER].samples = samples;
-    api_types[DOUBLE_RANDOM_NUMBER].min_range_f = min;
-    api_types[DOUBLE_RANDOM_NUMBER].max_range_f = max;
-    
-    memset(&mem_buffer, 0, sizeof(mem_buffer));
+    if (qrng_client_enabled()) {
+        return qrng_client_values(DOUBLE_RANDOM_NUMBER, QRNGD_OP_DOUBLE, &req, (void *)buffer, sizeof(*buffer), NULL, NULL);
+    }
+    return qrng_coalesce_request(&req, (void *)buffer, sizeof(*buffer));
+}
 
-    create_req_url(DOUBLE_RANDOM_NUMBER, final_url);
+int qrng_random_float(float min, float max, size_t samples, float *buffer)
+{
+    s_api_t req = api_types[FLOAT_RANDOM_NUMBER];
 
+    req.samples = samples;
+    req.min_range_f = min;
+    req.max_range_f = max;
 
-    retval = execute_request(final_url, (void *)&mem_buffer);
-      
-    if (!retval) {
-      /* parse values array */
-      char *random_values_string = mem_buffer.memory;
-      parse_response_string(random_values_string, buffer, samples, DOUBLE_RANDOM_NUMBER);
+    if (qrng_client_enabled()) {
+        return qrng_client_values(FLOAT_RANDOM_NUMBER, QRNGD_OP_FLOAT, &req, (void *)buffer, sizeof(*buffer), NULL, NULL);
     }
-    else {
-      fprintf(stderr, "could not execute curl request");
+    return qrng_coalesce_request(&req, (void *)buffer, sizeof(*buffer));
+}
+
+
+int qrng_random_bytes(size_t samples, uint8_t *buffer)
+{
+    s_api_t req = api_types[BYTES_RANDOM_NUMBER];
+    size_t pooled = 0;
+
+    /* Serve what is already buffered, request only the remainder. */
+    (void)qrng_sched_admit(0);
+    pooled = qrng_ring_take(buffer, samples, NULL);
+    qrng_sched_consume(pooled);
+    pooled += take_buffered(buffer + pooled, samples - pooled);
+    if (pooled == samples) {
+      return 0;
     }
-#ifndef NO_DYNAMIC_MEMORY_ALLOCATION    
-    if (mem_buffer.memory) {
-      free(mem_buffer.memory);
+    req.samples = samples - pooled;
+
+    if (qrng_client_enabled()) {
+        return qrng_client_values(BYTES_RANDOM_NUMBER, QRNGD_OP_BYTES, &req, (void *)(buffer + pooled),
+                                  sizeof(*buffer), NULL, NULL);
     }
-#endif
-    return retval;
+    return qrng_coalesce_request(&req, (void *)(buffer + pooled), sizeof(*buffer));
 }
 
-int qrng_random_float(float min, float max, size_t samples, float *buffer)
+
+int qrng_random_int16(int16_t min, int16_t max, size_t samples, int16_t *buffer)
 {
-    int retval = 0;
+    s_api_t req = api_types[INT16_RANDOM_NUMBER];
 
-    char final_url[URL_MAX_LENGTH]={0};
+    req.samples = samples;
+    req.min_range_i = min;
+    req.max_range_i = max;
 
-    
-    memory_t mem_buffer;
+    if (qrng_client_enabled()) {
+        return qrng_client_values(INT16_RANDOM_NUMBER, QRNGD_OP_INT16, &req, (void *)buffer, sizeof(*buffer), NULL, NULL);
+    }
+    return qrng_coalesce_request(&req, (void *)buffer, sizeof(*buffer));
+}
 
-    api_types[FLOAT_RANDOM_NUMBER].samples = samples;
-    api_types[FLOAT_RANDOM_NUMBER].min_range_f = min;
-    api_types[FLOAT_RANDOM_NUMBER].max_range_f = max;
-    
-    memset(&mem_buffer, 0, sizeof(mem_buffer));
+int qrng_random_int32(int32_t min, int32_t max, size_t samples, int32_t *buffer)
+{
+    s_api_t req = api_types[INT32_RANDOM_NUMBER];
 
-    create_req_url(FLOAT_RANDOM_NUMBER, final_url);
+    req.samples = samples;
+    req.min_range_i = min;
+    req.max_range_i = max;
 
+    if (qrng_client_enabled()) {
+        return qrng_client_values(INT32_RANDOM_NUMBER, QRNGD_OP_INT32, &req, (void *)buffer, sizeof(*buffer), NULL, NULL);
+    }
+    return qrng_coalesce_request(&req, (void *)buffer, sizeof(*buffer));
+}
 
-    retval = execute_request(final_url, (void *)&mem_buffer);
-      
-    if (!retval) {
-      /* parse values array */
-      char *random_values_string = mem_buffer.memory;
-      parse_response_string(random_values_string, buffer, samples, FLOAT_RANDOM_NUMBER);
 
+int qrng_firmware_info(void *buffer) {
+  int retval = 0;
+  char final_url[URL_MAX_LENGTH] = {0};
+  xfer_info_t info;
+  uint64_t start_ns = 0;
+
+  if (qrng_client_enabled()) {
+    return qrng_client_stream(FIRMWARE_INFO_REQUEST, QRNGD_OP_FIRMWARE_INFO, (FILE *)buffer, 0);
+  }
+  if (!qrng_backend_has_rest()) {
+    fprintf(stderr, "No appliance among the entropy sources, firmware info is not available\n");
+    return -1;
+  }
+  start_ns = qrng_stats_start(FIRMWARE_INFO_REQUEST, 0);
+  create_req_url(&api_types[FIRMWARE_INFO_REQUEST], final_url);
+  retval = execute_stream_request(final_url, (void *)buffer, LANE_INTERACTIVE, &info);
+  qrng_stats_record(FIRMWARE_INFO_REQUEST, 0, &info, qrng_now_ns() - start_ns, retval);
+  return retval;
+}
+
+int qrng_system_info(void *buffer) {
+  int retval = 0;
+  char final_url[URL_MAX_LENGTH] = {0};
+  xfer_info_t info;
+  uint64_t start_ns = 0;
+
+  if (qrng_client_enabled()) {
+    return qrng_client_stream(SYSTEM_INFO_REQUEST, QRNGD_OP_SYSTEM_INFO, (FILE *)buffer, 0);
+  }
+  if (!qrng_backend_has_rest()) {
+    fprintf(stderr, "No appliance among the entropy sources, system info is not available\n");
+    return -1;
+  }
+  start_ns = qrng_stats_start(SYSTEM_INFO_REQUEST, 0);
+  create_req_url(&api_types[SYSTEM_INFO_REQUEST], final_url);
+  retval = execute_stream_request(final_url, (void *)buffer, LANE_INTERACTIVE, &info);
+  qrng_stats_record(SYSTEM_INFO_REQUEST, 0, &info, qrng_now_ns() - start_ns, retval);
+  return retval;
+}
+
+
+size_t take_buffered(uint8_t *dst, size_t len)
+{
+    size_t got = qrng_pool_take(dst, len);
+
+    /* The on-disk reserve absorbs what the pool cannot serve. */
+    if (got < len) {
+        got += qrng_reserve_take(dst + got, len - got);
     }
-    else {
-      fprintf(stderr, "could not execute curl request");
-    }
-#ifndef NO_DYNAMIC_MEMORY_ALLOCATION    
-    if (mem_buffer.memory) {
-      free(mem_buffer.memory);
-    }
-#endif
-    return retval;
+    /* Buffered bytes count against the caller's rate, like the transfers that would replace them. */
+    qrng_sched_consume(got);
+    return got;
 }
 
 
-int qrng_random_bytes(size_t samples, uint8_t *buffer)
+int qrng_random_bytes_deadline(size_t samples, uint8_t *buffer,
+                               const struct timespec *deadline, size_t *filled)
 {
     int retval = 0;
-    char final_url[URL_MAX_LENGTH] = {0};
-    
-    memory_t mem_buffer;
-    api_types[BYTES_RANDOM_NUMBER].samples = samples;
-    
-    memset(&mem_buffer, 0, sizeof(mem_buffer));
-    create_req_url(BYTES_RANDOM_NUMBER, final_url);
-    
-    retval = execute_request(final_url, (void *)&mem_buffer);
-
-    if (!retval) {
-      /* parse values array */
-      char *random_values_string = mem_buffer.memory;
-      parse_response_string(random_values_string, buffer, samples, BYTES_RANDOM_NUMBER);
+    size_t got = 0;
+    size_t received = 0;
+    long remaining_ms = 0;
+    conn_t *conn = NULL;
+    s_api_t req;
+
+    retval = qrng_sched_admit(qrng_deadline_ns(deadline));
+    if (retval) {
+        if (filled) {
+            *filled = 0;
+        }
+        return retval;
     }
-    else {
-      fprintf(stderr, "could not execute curl request");
+    got = qrng_ring_take(buffer, samples, deadline);
+    qrng_sched_consume(got);
+    if (qrng_client_enabled() && got < samples) {
+        qrng_request_init(&req, BYTES_RANDOM_NUMBER);
+        req.samples = samples - got;
+        retval = qrng_client_values(BYTES_RANDOM_NUMBER, QRNGD_OP_BYTES_DEADLINE, &req, (void *)(buffer + got),
+                                    sizeof(*buffer), deadline, &received);
+        if (filled) {
+            *filled = got + received;
+        }
+        return retval;
     }
-    
-#ifndef NO_DYNAMIC_MEMORY_ALLOCATION        
-    if (mem_buffer.memory) {
-      free(mem_buffer.memory);
+    got += take_buffered(buffer + got, samples - got);
+    while (got < samples) {
+        remaining_ms = qrng_ms_until(deadline);
+        if (remaining_ms == 0) {
+            retval = QRNG_DEADLINE_EXCEEDED;
+            break;
+        }
+        retval = qrng_lane_acquire(qrng_lane_classify(samples - got), qrng_deadline_ns(deadline), &conn);
+        if (retval) {
+            break;
+        }
+        /* Waiting for the connection used part of the time left. */
+        remaining_ms = qrng_ms_until(deadline);
+        if (remaining_ms == 0) {
+            qrng_lane_release(conn);
+            retval = QRNG_DEADLINE_EXCEEDED;
+            break;
+        }
+        received = 0;
+        /* streambytes delivers raw bytes, so a timed out transfer still yields a valid prefix. */
+        retval = qrng_fetch_raw(conn->handle, samples - got, buffer + got, &received,
+                                remaining_ms < 0 ? 0 : remaining_ms);
+        qrng_lane_release(conn);
+        got += received;
+        if (retval) {
+            break;
+        }
+    }
+    if (filled) {
+        *filled = got;
     }
-#endif
     return retval;
 }
 
 
-int qrng_random_int16(int16_t min, int16_t max, size_t samples, int16_t *buffer)
+int qrng_random_int32_deadline(int32_t min, int32_t max, size_t samples, int32_t *buffer,
+                               const struct timespec *deadline, size_t *filled)
 {
     int retval = 0;
+    size_t got = 0;
+    size_t want = 0;
+    size_t avail = 0;
+    size_t offset = 0;
+    int32_t value = 0;
+    long remaining_ms = 0;
+    uint8_t raw[DEADLINE_CHUNK_BYTES];
+    s_api_t req;
+
+    if (max < min) {
+        if (filled) {
+            *filled = 0;
+        }
+        return -1;
+    }
+    if (qrng_client_enabled()) {
+        req = api_types[INT32_RANDOM_NUMBER];
+        req.samples = samples;
+        req.min_range_i = min;
+        req.max_range_i = max;
+        return qrng_client_values(INT32_RANDOM_NUMBER, QRNGD_OP_INT32_DEADLINE, &req, (void *)buffer,
+                                  sizeof(*buffer), deadline, filled);
+    }
+    retval = qrng_sched_admit(qrng_deadline_ns(deadline));
+    if (retval) {
+        if (filled) {
+            *filled = 0;
+        }
+        return retval;
+    }
+    /* Convert buffered bytes locally first; rejected draws are simply dropped. */
+    while (got < samples) {
+        want = (samples - got) * sizeof(int32_t);
+        avail = take_buffered(raw, want < sizeof(raw) ? want : sizeof(raw));
+        if (avail < sizeof(int32_t)) {
+            break;
+        }
+        for (offset = 0; offset + sizeof(int32_t) <= avail && got < samples; offset += sizeof(int32_t)) {
+            if (qrng_bytes_to_int32(min, max, raw + offset, &value) == 0) {
+                buffer[got++] = value;
+            }
+        }
+    }
+    memset(raw, 0, sizeof(raw));
 
-    char final_url[URL_MAX_LENGTH]={0};
+    if (got < samples) {
+        remaining_ms = qrng_ms_until(deadline);
+        if (remaining_ms == 0) {
+            retval = QRNG_DEADLINE_EXCEEDED;
+        }
+        else {
+            req = api_types[INT32_RANDOM_NUMBER];
+            req.samples = samples - got;
+            req.min_range_i = min;
+            req.max_range_i = max;
+            retval = qrng_fetch_typed(&req, (void *)(buffer + got), sizeof(*buffer),
+                                      remaining_ms < 0 ? 0 : remaining_ms);
+            if (!retval) {
+                got = samples;
+            }
+        }
+    }
+    if (filled) {
+        *filled = got;
+    }
+    return retval;
+}
 
-    
-    memory_t mem_buffer;
 
-    api_types[INT16_RANDOM_NUMBER].samples = samples;
-    api_types[INT16_RANDOM_NUMBER].min_range_i = min;
-    api_types[INT16_RANDOM_NUMBER].max_range_i = max;
+int qrng_random_double_deadline(double min, double max, size_t samples, double *buffer,
+                                const struct timespec *deadline, size_t *filled)
+{
+    int retval = 0;
+    size_t got = 0;
+    size_t want = 0;
+    size_t avail = 0;
+    size_t offset = 0;
+    long remaining_ms = 0;
+    uint8_t raw[DEADLINE_CHUNK_BYTES];
+    s_api_t req;
+
+    if (qrng_client_enabled()) {
+        req = api_types[DOUBLE_RANDOM_NUMBER];
+        req.samples = samples;
+        req.min_range_f = min;
+        req.max_range_f = max;
+        return qrng_client_values(DOUBLE_RANDOM_NUMBER, QRNGD_OP_DOUBLE_DEADLINE, &req, (void *)buffer,
+                                  sizeof(*buffer), deadline, filled);
+    }
+    retval = qrng_sched_admit(qrng_deadline_ns(deadline));
+    if (retval) {
+        if (filled) {
+            *filled = 0;
+        }
+        return retval;
+    }
+    while (got < samples) {
+        want = (samples - got) * sizeof(uint64_t);
+        avail = take_buffered(raw, want < sizeof(raw) ? want : sizeof(raw));
+        if (avail < sizeof(uint64_t)) {
+            break;
+        }
+        for (offset = 0; offset + sizeof(uint64_t) <= avail && got < samples; offset += sizeof(uint64_t)) {
+            buffer[got++] = qrng_bytes_to_double(min, max, raw + offset);
+        }
+    }
+    memset(raw, 0, sizeof(raw));
 
-    memset(&mem_buffer, 0, sizeof(mem_buffer));
+    if (got < samples) {
+        remaining_ms = qrng_ms_until(deadline);
+        if (remaining_ms == 0) {
+            retval = QRNG_DEADLINE_EXCEEDED;
+        }
+        else {
+            req = api_types[DOUBLE_RANDOM_NUMBER];
+            req.samples = samples - got;
+            req.min_range_f = min;
+            req.max_range_f = max;
+            retval = qrng_fetch_typed(&req, (void *)(buffer + got), sizeof(*buffer),
+                                      remaining_ms < 0 ? 0 : remaining_ms);
+            if (!retval) {
+                got = samples;
+            }
+        }
+    }
+    if (filled) {
+        *filled = got;
+    }
+    return retval;
+}
 
-    create_req_url(INT16_RANDOM_NUMBER, final_url);
 
+int qrng_fetch_typed(const s_api_t *req, void *buffer, size_t value_size, long timeout_ms)
+{
+    int retval = 0;
+    xfer_info_t info;
+    uint64_t start_ns = qrng_stats_start(req->type, req->samples);
 
-    retval = execute_request(final_url, (void *)&mem_buffer);
-      
-    if (!retval) {
-      /* parse values array */
-      char *random_values_string = mem_buffer.memory;
-      parse_response_string(random_values_string, buffer, samples, INT16_RANDOM_NUMBER);
-    }
-    else {
-      fprintf(stderr, "could not execute curl request");
-    }
-    
-#ifndef NO_DYNAMIC_MEMORY_ALLOCATION        
-    if (mem_buffer.memory) {
-free(mem_buffer.memory);
-    }
-#endif
+    retval = qrng_backend_fill_typed(req, buffer, value_size, timeout_ms, &info);
+    qrng_stats_record(req->type, req->samples, &info, qrng_now_ns() - start_ns, retval);
     return retval;
 }
 
-int qrng_random_int32(int32_t min, int32_t max, size_t samples, int32_t *buffer)
+
+int rest_fill_typed(qrng_source_t *src, const s_api_t *req, void *buffer, size_t value_size,
+                    long timeout_ms, xfer_info_t *info)
 {
     int retval = 0;
 
     char final_url[URL_MAX_LENGTH]={0};
 
-    
     memory_t mem_buffer;
+    uint64_t parse_ns = 0;
 
-
-    api_types[INT32_RANDOM_NUMBER].samples = samples;
-    api_types[INT32_RANDOM_NUMBER].min_range_i = min;
-    api_types[INT32_RANDOM_NUMBER].max_range_i = max;
-
+    (void)src;
     memset(&mem_buffer, 0, sizeof(mem_buffer));
 
-    create_req_url(INT32_RANDOM_NUMBER, final_url);
+    create_req_url(req, final_url);
+
 
+    retval = execute_request(final_url, (void *)&mem_buffer, timeout_ms,
+                             qrng_lane_classify(req->samples * value_size), info);
 
-    retval = execute_request(final_url, (void *)&mem_buffer);
-      
     if (!retval) {
       /* parse values array */
       char *random_values_string = mem_buffer.memory;
-      parse_response_string(random_values_string, buffer, samples, INT32_RANDOM_NUMBER);
+      QRNG_PROBE2(parse__start, (int)req->type, req->samples);
+      parse_ns = qrng_now_ns();
+      qrng_parse_response(random_values_string, buffer, req->samples, req->type);
+      parse_ns = qrng_now_ns() - parse_ns;
+      QRNG_PROBE3(parse__end, (int)req->type, req->samples, parse_ns);
+      qrng_stats_record_parse(req->type, parse_ns);
     }
-    else {
+    else if (retval != QRNG_DEADLINE_EXCEEDED) {
       fprintf(stderr, "could not execute curl request");
     }
-#ifndef NO_DYNAMIC_MEMORY_ALLOCATION        
+#ifndef NO_DYNAMIC_MEMORY_ALLOCATION
     if (mem_buffer.memory) {
       free(mem_buffer.memory);
     }
-#endif   
+#endif
     return retval;
 }
 
 
-int qrng_firmware_info(void *buffer) {
-  int retval = 0;
-  char final_url[URL_MAX_LENGTH] = {0};
-  create_req_url(FIRMWARE_INFO_REQUEST, final_url);
-  retval = execute_stream_request(final_url, (void *)buffer);
-  return retval;
-}
+int execute_request(char *url, void *buffer, long timeout_ms, e_lane_t lane, xfer_info_t *info) {
+  CURLcode error = CURLE_OK;
 
-int qrng_system_info(void *buffer) {
   int retval = 0;
-  char final_url[URL_MAX_LENGTH] = {0};
-  create_req_url(SYSTEM_INFO_REQUEST, final_url);
-  retval = execute_stream_request(final_url, (void *)buffer);
-  return retval;
-}
 
+  conn_t *conn = NULL;
 
-int execute_request(char *url, void *buffer) {
-  CURLcode error = CURLE_OK;
+  uint64_t until_ns = timeout_ms > 0 ? qrng_now_ns() + (uint64_t)timeout_ms * 1000000u : 0;
 
-  int retval = 0;
+  uint64_t now_ns = 0;
 
+  memset(info, 0, sizeof(*info));
+  retval = qrng_lane_acquire(lane, until_ns, &conn);
+  if (retval == QRNG_DEADLINE_EXCEEDED) {
+    return retval;
+  }
+  if (retval) {
+    fprintf(stderr, "libqrng is not initialized\n");
+    return -1;
+  }
+  /* The transfer only gets the time left after waiting for the connection. */
+  if (until_ns) {
+    now_ns = qrng_now_ns();
+    if (now_ns >= until_ns) {
+      qrng_lane_release(conn);
+      return QRNG_DEADLINE_EXCEEDED;
+    }
+    timeout_ms = (long)((until_ns - now_ns + 999999u) / 1000000u);
+  }
 
+  error = qrng_transport_perform(conn->handle, url, &qrng_memory_write_cbk, buffer, timeout_ms, info);
+  qrng_lane_release(conn);
 
-  (void)curl_easy_setopt(p_curl_handle, CURLOPT_URL, url);
-  (void)curl_easy_setopt(p_curl_handle, CURLOPT_WRITEFUNCTION, &curl_write_cbk); \
-  (void)curl_easy_setopt(p_curl_handle, CURLOPT_WRITEDATA, buffer);
-  error = curl_easy_perform(p_curl_handle);
-  
-  if(error != CURLE_OK) {
+  if (error == CURLE_OPERATION_TIMEDOUT && timeout_ms > 0) {
+    retval = QRNG_DEADLINE_EXCEEDED;
+  }
+  else if(error != CURLE_OK) {
     fprintf(stderr, "curl_easy_perform() failed: %s\n", curl_easy_strerror(error));
     retval = -1;
   }
   else {
     //do nothing
   }
-  
+
   return retval;
 }
 
 
-int execute_stream_request(char *url, void *buffer) {
+int execute_stream_request(char *url, void *buffer, e_lane_t lane, xfer_info_t *info) {
     CURLcode error = CURLE_OK;
     int retval = 0;
+    conn_t *conn = NULL;
 
-    (void)curl_easy_setopt(p_curl_handle, CURLOPT_URL, url);
-    (void)curl_easy_setopt(p_curl_handle, CURLOPT_WRITEDATA, buffer);
+    memset(info, 0, sizeof(*info));
+    if (qrng_lane_acquire(lane, 0, &conn) != 0) {
+      fprintf(stderr, "libqrng is not initialized\n");
+      return -1;
+    }
 
-    error = curl_easy_perform(p_curl_handle);
+    error = qrng_transport_perform(conn->handle, url, &qrng_stream_write_cbk, buffer, 0L, info);
+    qrng_lane_release(conn);
     if(error != CURLE_OK) {
 	fprintf(stderr, "curl_easy_perform() failed: %s\n", curl_easy_strerror(error));
         retval = -1;
@@ -490,135 +809,216 @@ int execute_stream_request(char *url, void *buffer) {
     else {
 	//do nothing
     }
-  
+
     return retval;
 }
 
 
-void create_req_url(e_req_type_t req_type, char *api_url)
+int qrng_fetch_raw(CURL *handle, size_t size, uint8_t *out, size_t *received, long timeout_ms)
 {
+    int retval = 0;
+    raw_sink_t sink = { .dst = out, .cap = size, .len = 0 };
+    xfer_info_t info;
+    uint64_t start_ns = qrng_stats_start(STREAM_BINARY, size);
+
+    retval = qrng_backend_fill_bytes(handle, size, &qrng_raw_write_cbk, (void *)&sink, timeout_ms, &info);
+    /* A deadline says nothing about the link, only about the caller. */
+    if (retval != QRNG_DEADLINE_EXCEEDED) {
+        qrng_chunk_feedback(&info, retval);
+    }
+    qrng_stats_record(STREAM_BINARY, size, &info, qrng_now_ns() - start_ns, retval);
+    *received = sink.len;
+    return retval;
+}
+
 
-  switch(req_type) {
+int qrng_probe_raw(CURL *handle, size_t size, uint8_t *out, size_t *received)
+{
+    int retval = 0;
+    raw_sink_t sink = { .dst = out, .cap = size, .len = 0 };
+    xfer_info_t info;
+    uint64_t start_ns = 0;
+
+    *received = 0;
+    /* Admitted like any other appliance transfer, so a probe cannot starve the tenants. */
+    retval = qrng_backend_sched_wait(0);
+    if (retval) {
+        return retval;
+    }
+    start_ns = qrng_stats_start(STREAM_BINARY, size);
+    /* The sizes are the probe's, not the link's: no chunk controller feedback. */
+    retval = qrng_backend_fill_bytes(handle, size, &qrng_raw_write_cbk, (void *)&sink, 0L, &info);
+    qrng_stats_record(STREAM_BINARY, size, &info, qrng_now_ns() - start_ns, retval);
+    *received = sink.len;
+    return retval;
+}
+
+
+int rest_open(qrng_source_t *src, const char *address)
+{
+    size_t i = 0;
+
+    (void)src;
+    for (i = 0 ; i < NUMBER_OF_REQUESTS; i++) {
+        /* The scheme defaults to HTTPS; "http://host:port" reaches a local stand-in. */
+        snprintf(api_types[i].domain_address, DOMAIN_ADDRESS_LENGTH, "%s%s",
+                 strstr(address, "://") == NULL ? "https://" : "", address);
+    }
+    return 0;
+}
+
+
+int rest_fill_bytes(qrng_source_t *src, CURL *handle, size_t size, qrng_write_cbk_t cbk, void *data,
+                    long timeout_ms, xfer_info_t *info)
+{
+    CURLcode error = CURLE_OK;
+    char url[URL_MAX_LENGTH] = {0};
+
+    (void)src;
+    /* Formatted locally: api_types[STREAM_BINARY].samples belongs to the caller thread. */
+    snprintf(url, URL_MAX_LENGTH, api_types[STREAM_BINARY].api_url,
+             api_types[STREAM_BINARY].domain_address, size);
+
+    error = qrng_transport_perform(handle, url, cbk, data, timeout_ms, info);
+    if (error == CURLE_OPERATION_TIMEDOUT && timeout_ms > 0) {
+        return QRNG_DEADLINE_EXCEEDED;
+    }
+    if (error != CURLE_OK) {
+        fprintf(stderr, "curl_easy_perform() failed: %s\n", curl_easy_strerror(error));
+        return -1;
+    }
+    return 0;
+}
+
+
+void rest_stats(const qrng_source_t *src, struct qrng_backend_stats *stats)
+{
+    (void)src;
+    snprintf(stats->source, sizeof(stats->source), "%.63s", api_types[STREAM_BINARY].domain_address);
+}
+
+
+void rest_close(qrng_source_t *src)
+{
+    /* The connections belong to the lanes, closed by qrng_close. */
+    (void)src;
+}
+
+
+void qrng_read_xfer_info(CURL *handle, xfer_info_t *info)
+{
+    curl_off_t namelookup_us = 0;
+    curl_off_t connect_us = 0;
+    curl_off_t appconnect_us = 0;
+    curl_off_t pretransfer_us = 0;
+    curl_off_t ttfb_us = 0;
+    curl_off_t total_us = 0;
+    curl_off_t bytes = 0;
+    curl_off_t speed = 0;
+    long header_bytes = 0;
+    long connects = 0;
+
+    /* All times are measured from the start of the transfer. */
+    (void)curl_easy_getinfo(handle, CURLINFO_NAMELOOKUP_TIME_T, &namelookup_us);
+    (void)curl_easy_getinfo(handle, CURLINFO_CONNECT_TIME_T, &connect_us);
+    (void)curl_easy_getinfo(handle, CURLINFO_APPCONNECT_TIME_T, &appconnect_us);
+    (void)curl_easy_getinfo(handle, CURLINFO_PRETRANSFER_TIME_T, &pretransfer_us);
+    (void)curl_easy_getinfo(handle, CURLINFO_STARTTRANSFER_TIME_T, &ttfb_us);
+    (void)curl_easy_getinfo(handle, CURLINFO_TOTAL_TIME_T, &total_us);
+    (void)curl_easy_getinfo(handle, CURLINFO_SIZE_DOWNLOAD_T, &bytes);
+    (void)curl_easy_getinfo(handle, CURLINFO_HEADER_SIZE, &header_bytes);
+    (void)curl_easy_getinfo(handle, CURLINFO_SPEED_DOWNLOAD_T, &speed);
+    (void)curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &connects);
+    info->namelookup_ns = (uint64_t)namelookup_us * 1000u;
+    info->connect_ns = (uint64_t)connect_us * 1000u;
+    info->appconnect_ns = (uint64_t)appconnect_us * 1000u;
+    info->pretransfer_ns = (uint64_t)pretransfer_us * 1000u;
+    info->ttfb_ns = (uint64_t)ttfb_us * 1000u;
+    info->total_ns = (uint64_t)total_us * 1000u;
+    info->bytes = (uint64_t)bytes;
+    info->header_bytes = (uint64_t)header_bytes;
+    info->speed_bps = (uint64_t)speed;
+    info->new_connections = (uint64_t)connects;
+}
+
+
+uint64_t qrng_now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+
+long qrng_ms_until(const struct timespec *deadline)
+{
+    uint64_t now = 0;
+    uint64_t end = 0;
+
+    if (deadline == NULL) {
+        return -1;
+    }
+    now = qrng_now_ns();
+    end = (uint64_t)deadline->tv_sec * 1000000000u + (uint64_t)deadline->tv_nsec;
+    if (end <= now) {
+        return 0;
+    }
+    /* Round up so that a sub-millisecond remainder is not reported as expired. */
+    return (long)((end - now + 999999u) / 1000000u);
+}
+
+
+uint64_t qrng_deadline_ns(const struct timespec *deadline)
+{
+    if (deadline == NULL) {
+        return 0;
+    }
+    return (uint64_t)deadline->tv_sec * 1000000000u + (uint64_t)deadline->tv_nsec;
+}
+
+
+void create_req_url(const s_api_t *req, char *api_url)
+{
+
+  switch(req->type) {
   case BYTES_RANDOM_NUMBER:
-    snprintf(api_url, URL_MAX_LENGTH, api_types[req_type].api_url,
-             api_types[req_type].domain_address,
-             api_types[req_type].samples);
+    snprintf(api_url, URL_MAX_LENGTH, req->api_url,
+             req->domain_address,
+             req->samples);
     break;
   case INT16_RANDOM_NUMBER:
   case INT32_RANDOM_NUMBER:
-    snprintf(api_url, URL_MAX_LENGTH, api_types[req_type].api_url,
-             api_types[req_type].domain_address,
-             api_types[req_type].min_range_i,
-             api_types[req_type].max_range_i,
-             api_types[req_type].samples);
+    snprintf(api_url, URL_MAX_LENGTH, req->api_url,
+             req->domain_address,
+             req->min_range_i,
+             req->max_range_i,
+             req->samples);
     break;
   case DOUBLE_RANDOM_NUMBER:
   case FLOAT_RANDOM_NUMBER:
-    snprintf(api_url, URL_MAX_LENGTH, api_types[req_type].api_url,
-             api_types[req_type].domain_address,
-             api_types[req_type].min_range_f,
-             api_types[req_type].max_range_f,
-             api_types[req_type].samples);
+    snprintf(api_url, URL_MAX_LENGTH, req->api_url,
+             req->domain_address,
+             req->min_range_f,
+             req->max_range_f,
+             req->samples);
     break;
   case STREAM_BINARY:
-    snprintf(api_url, URL_MAX_LENGTH, api_types[req_type].api_url,
-             api_types[req_type].domain_address,
-             api_types[req_type].samples);
+    snprintf(api_url, URL_MAX_LENGTH, req->api_url,
+             req->domain_address,
+             req->samples);
     break;
   case PERFORMANCE_REQUEST:
     break;
   case FIRMWARE_INFO_REQUEST:
-    snprintf(api_url, URL_MAX_LENGTH, api_types[req_type].api_url,
-	    api_types[req_type].domain_address);
+    snprintf(api_url, URL_MAX_LENGTH, req->api_url,
+	    req->domain_address);
     break;
   case SYSTEM_INFO_REQUEST:
-    snprintf(api_url, URL_MAX_LENGTH, api_types[req_type].api_url,
-	    api_types[req_type].domain_address);
+    snprintf(api_url, URL_MAX_LENGTH, req->api_url,
+	    req->domain_address);
     break;
   default:
     break;
   }
 
 }
-
-
-size_t curl_write_cbk(void *content, size_t size, size_t nmemb, void *userp)
-{
-#ifdef NO_DYNAMIC_MEMORY_ALLOCATION
-  size_t real_size = size *nmemb;
-  memory_t *mem = (memory_t *)userp;
-  size_t available_space = TOTAL_MAX_SIZE_RESPONSE - (mem->size + real_size + 1);
-  if (available_space > (real_size + 1)) {
-    memcpy(&(mem->memory[mem->size]), content, real_size);
-    mem->size += real_size;
-    mem->memory[mem->size] = 0;
-    return real_size;
-  }
-  fprintf(stderr, "Static buffer full!\n");
-  return 0;
-#else
-    size_t real_size = size * nmemb;
-    memory_t *mem = (memory_t *)userp;
-    char *ptr = realloc(mem->memory, mem->size + real_size + 1);
-    if (!ptr) {
-	fprintf(stderr, "Not enough memory (realloc returned NULL)\n");
-	return 0;
-    }
-
-    mem->memory = ptr;
-    memcpy(&(mem->memory[mem->size]), content, real_size);
-    mem->size += real_size;
-    mem->memory[mem->size] = 0;
-    return real_size;
-#endif
-}
-
-
-void parse_response_string(char *random_values_string, void *buffer, size_t samples, e_req_type_t request_type)
-{
-    /* Skip first character because it's [ */
-    random_values_string ++;
-    /* Skip last character because is ] */
-    random_values_string[strlen(random_values_string)-1]=0;
-    char *token = strtok(random_values_string,",");
-    size_t i = 0;
-
-    switch(request_type) {
-        case BYTES_RANDOM_NUMBER:  
-            for (i = 0; i < samples && token != NULL; i++) {
-                /* Remove quotes */
-                token++;
-                token[strlen(token) - 1] = '\0';
-                uint8_t value = (uint8_t)strtol(token, NULL, 16);
-                ((uint8_t *)buffer)[i] = value;
-                token = strtok(NULL, ",");
-            }
-            break;
-        case INT16_RANDOM_NUMBER:
-            for (i = 0; i < samples; i++) {
-                ((int16_t *)buffer)[i] = (int16_t)strtol(token, NULL, 10);
-                token = strtok(NULL, ",");
-            }
-            break;
-        case INT32_RANDOM_NUMBER:
-            for (i = 0; i < samples; i++) {
-                ((int32_t *)buffer)[i] = strtol(token, NULL, 10);
-                token = strtok(NULL, ",");
-            }
-            break;
-        case DOUBLE_RANDOM_NUMBER:
-            for (i = 0; i < samples; i++) {
-                ((double *)buffer)[i] = strtod(token, NULL);
-                token = strtok(NULL, ",");
-            }
-            break;
-        case FLOAT_RANDOM_NUMBER:
-            for (i = 0; i < samples; i++) {
-                ((float *)buffer)[i] = strtof(token, NULL);
-                token = strtok(NULL, ",");
-            }
-            break;
-        default:
-            break;
-    }
-}
@@ -27,17 +27,280 @@
 #ifndef QRNG_H
 #define QRNG_H
 
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+/**
+ * @def QRNG_DEADLINE_EXCEEDED
+ * @brief Returned by the @*_deadline@ functions when the deadline passed before all samples were produced.
+ */
+#define QRNG_DEADLINE_EXCEEDED (-4)
 
 #ifdef __cplusplus
 extern "C"
 {
 #endif
+/**
+ * @brief Request classes used to pick the connections a request is sent on.
+ */
+typedef enum {
+    QRNG_CLASS_AUTO = 0,    /*!< small requests are interactive, large ones bulk */
+    QRNG_CLASS_INTERACTIVE, /*!< latency-critical requests */
+    QRNG_CLASS_BULK         /*!< throughput-oriented transfers */
+}qrng_class_t;
+
+/**
+ * @brief Where appliance responses come from, see @qrng_set_transport@.
+ */
+typedef enum {
+    QRNG_TRANSPORT_NETWORK = 0, /*!< talk to the appliance (default) */
+    QRNG_TRANSPORT_RECORD,      /*!< talk to the appliance and append every response to a capture file */
+    QRNG_TRANSPORT_REPLAY       /*!< serve responses from a capture file, without network */
+}qrng_transport_t;
+
+/**
+ * @brief State of the transfer size controller, see @qrng_get_chunk_stats@.
+ */
+struct qrng_chunk_stats {
+    uint64_t chunk_bytes;   /*!< size currently used for background and split transfers */
+    uint64_t bandwidth_bps; /*!< smoothed transfer rate, bytes per second */
+    uint64_t rtt_us;        /*!< smoothed time to first byte, microseconds */
+    uint64_t bdp_bytes;     /*!< bandwidth-delay product, bytes */
+    uint64_t increases;     /*!< number of additive increases */
+    uint64_t decreases;     /*!< number of multiplicative decreases */
+};
+
+/**
+ * @brief State of the entropy pool, see @qrng_pool_get_stats@.
+ */
+struct qrng_pool_stats {
+    uint64_t level;            /*!< bytes currently buffered */
+    uint64_t capacity;         /*!< bytes of buffer currently allocated */
+    uint64_t refill_threshold; /*!< level under which a refill starts */
+    uint64_t rate_bps;         /*!< forecast consumption, bytes per second (predictive mode) */
+    uint64_t underflows;       /*!< takes that found fewer bytes than requested */
+};
+
+/**
+ * @brief State of the on-disk entropy reserve, see @qrng_reserve_get_stats@.
+ */
+struct qrng_reserve_stats {
+    uint64_t level;            /*!< bytes stored and not consumed yet */
+    uint64_t capacity;         /*!< size of the reserve in bytes */
+    uint64_t served;           /*!< bytes handed out by this process */
+    uint64_t journal_writes;   /*!< synchronous journal updates by this process */
+};
+
+/**
+ * @def QRNG_MAX_TENANTS
+ * @brief Number of scheduler tenants, the default tenant 0 included.
+ */
+#define QRNG_MAX_TENANTS 32
+
+/**
+ * @brief Traffic of one tenant, see @qrng_get_tenant_stats@.
+ */
+struct qrng_tenant_stats {
+    uint64_t requests;           /*!< transfers sent to the appliance */
+    uint64_t bytes;              /*!< bytes received for them */
+    uint64_t throughput_bps;     /*!< bytes per second over the last second or so */
+    uint64_t queue_delay_avg_ns; /*!< mean time a transfer waited for the scheduler */
+    uint64_t queue_delay_max_ns; /*!< longest such wait */
+    uint64_t queued;             /*!< transfers waiting right now */
+};
+
+/**
+ * @def QRNG_MAX_BACKENDS
+ * @brief Number of entropy sources that may be chained in the address given to @qrng_open@.
+ */
+#define QRNG_MAX_BACKENDS 4
+
+/**
+ * @brief Traffic of one entropy source, see @qrng_get_backend_stats@.
+ */
+struct qrng_backend_stats {
+    char source[64];      /*!< backend and address, e.g. "file:/dev/urandom" */
+    uint64_t requests;    /*!< fills asked of this source */
+    uint64_t bytes;       /*!< bytes it delivered */
+    uint64_t errors;      /*!< fills it could not complete */
+    uint64_t failovers;   /*!< of those, fills handed to the next source of the chain */
+    uint64_t busy_ns;     /*!< time spent in its fills */
+};
+
+/**
+ * @brief Outcome of @qrng_warmup@.
+ */
+struct qrng_warmup_stats {
+    uint64_t connections;  /*!< connections ready for the first request */
+    uint64_t failed;       /*!< connections that could not be set up in time */
+    uint64_t duration_ns;  /*!< wall time of the warm-up */
+    uint64_t dns_ns;       /*!< name resolution of the slowest connection */
+    uint64_t connect_ns;   /*!< TCP connect of the slowest connection */
+    uint64_t tls_ns;       /*!< TLS handshake of the slowest connection */
+};
+
+/**
+ * @def QRNG_INFO_MAX_FIELDS
+ * @brief Number of top-level fields kept by a @qrng_info@; further ones are only in @raw@.
+ */
+#define QRNG_INFO_MAX_FIELDS 32
+#define QRNG_INFO_KEY_LENGTH 64
+#define QRNG_INFO_VALUE_LENGTH 256
+#define QRNG_INFO_MAX_RAW 4096
+
+/**
+ * @brief One top-level field of an info response.
+ */
+struct qrng_info_field {
+    char key[QRNG_INFO_KEY_LENGTH];     /*!< field name */
+    char value[QRNG_INFO_VALUE_LENGTH]; /*!< string value unquoted; numbers, booleans, objects and arrays as JSON text */
+};
+
+/**
+ * @brief Parsed firmware or system information, see @qrng_get_firmware_info@.
+ */
+struct qrng_info {
+    struct qrng_info_field fields[QRNG_INFO_MAX_FIELDS];
+    size_t count;                /*!< fields in use */
+    char raw[QRNG_INFO_MAX_RAW]; /*!< the response as received, NUL terminated */
+    uint64_t age_ns;             /*!< time since the appliance sent it */
+};
+
+/**
+ * @def QRNG_HISTOGRAM_BUCKETS
+ * @brief Number of buckets of a @qrng_histogram@. Each power of two from 1 us up is split in four.
+ */
+#define QRNG_HISTOGRAM_BUCKETS 128
+
+/**
+ * @brief Kinds of appliance request, used to index @qrng_stats.types@.
+ */
+typedef enum {
+    QRNG_REQUEST_BYTES = 0,
+    QRNG_REQUEST_INT16,
+    QRNG_REQUEST_INT32,
+    QRNG_REQUEST_DOUBLE,
+    QRNG_REQUEST_FLOAT,
+    QRNG_REQUEST_STREAM,        /*!< streambytes transfers, including pool refills */
+    QRNG_REQUEST_PERFORMANCE,
+    QRNG_REQUEST_FIRMWARE_INFO,
+    QRNG_REQUEST_SYSTEM_INFO,
+    QRNG_REQUEST_TYPES
+}qrng_request_type_t;
+
+/**
+ * @brief Log-linear latency histogram, see @qrng_histogram_percentile@.
+ */
+struct qrng_histogram {
+    uint64_t count;                           /*!< recorded values */
+    uint64_t sum_ns;                          /*!< sum of the recorded values */
+    uint64_t max_ns;                          /*!< largest recorded value */
+    uint64_t buckets[QRNG_HISTOGRAM_BUCKETS]; /*!< bucket i counts values up to @qrng_histogram_bucket_limit(i)@ */
+};
+
+/**
+ * @brief Network phases of a request, in nanoseconds. Connect and TLS are 0 on a reused connection.
+ */
+struct qrng_phase_times {
+    uint64_t dns_ns;      /*!< name resolution */
+    uint64_t connect_ns;  /*!< TCP connect */
+    uint64_t tls_ns;      /*!< TLS handshake */
+    uint64_t wait_ns;     /*!< request sent to first response byte: appliance generation time */
+    uint64_t transfer_ns; /*!< first to last response byte */
+};
+
+/**
+ * @brief Counters of one request kind. Coalesced calls count as a single request.
+ */
+struct qrng_request_stats {
+    uint64_t requests;             /*!< requests sent to the appliance */
+    uint64_t samples;              /*!< values (bytes for streams) requested */
+    uint64_t wire_bytes;           /*!< response bytes received, headers included */
+    uint64_t errors;               /*!< failed requests, timeouts included */
+    uint64_t retries;              /*!< requests repeated after a failure */
+    uint64_t connections;          /*!< new connections opened by these requests */
+    struct qrng_phase_times phases; /*!< sum of the network phases, divide by @requests@ for the mean */
+    struct qrng_histogram latency; /*!< connection wait, transfer and parsing */
+    struct qrng_histogram wait;    /*!< time to first byte after the request was sent */
+    struct qrng_histogram parse;   /*!< response parsing only */
+};
+
+/**
+ * @brief Breakdown of one request, passed to the @qrng_set_timing_callback@ callback.
+ */
+struct qrng_request_timing {
+    qrng_request_type_t type;
+    int result;                    /*!< return code of the request */
+    uint64_t samples;              /*!< values (bytes for streams) requested */
+    uint64_t wire_bytes;           /*!< response bytes received, headers included */
+    uint64_t speed_bps;            /*!< average download speed, bytes per second */
+    int new_connection;            /*!< non-zero if a connection was opened for this request */
+    struct qrng_phase_times phases;
+    uint64_t total_ns;             /*!< end-to-end latency, including connection wait and parsing */
+};
+
+/**
+ * @brief Per request timing callback, see @qrng_set_timing_callback@.
+ */
+typedef void (*qrng_timing_cbk_t)(const struct qrng_request_timing *timing, void *user_data);
+
+/**
+ * @brief Snapshot returned by @qrng_get_stats@.
+ */
+struct qrng_stats {
+    struct qrng_request_stats types[QRNG_REQUEST_TYPES];
+    struct qrng_chunk_stats chunk;
+    struct qrng_pool_stats pool;
+};
+
+/**
+ * @brief Parameters of @qrng_measure_performance@. Zero fields take the default value.
+ */
+struct qrng_perf_config {
+    unsigned duration_ms;         /*!< length of each throughput phase [Default 2000] */
+    size_t stream_chunk_bytes;    /*!< bytes per streambytes request, at most 1 MiB [Default 65536] */
+    size_t json_samples;          /*!< doubles per JSON request [Default 1024] */
+    unsigned latency_requests;    /*!< sequential one-value requests, at most 1000 [Default 100] */
+    unsigned connection_samples;  /*!< connections opened to measure the setup cost [Default 5] */
+};
+
+/**
+ * @brief Result of @qrng_measure_performance@.
+ */
+struct qrng_perf_report {
+    double stream_bytes_per_s;    /*!< sustained streambytes throughput */
+    double json_values_per_s;     /*!< sustained JSON (double) throughput */
+    double json_bytes_per_s;      /*!< same, as bytes of random data delivered */
+    uint64_t latency_p50_ns;      /*!< one-value request latency percentiles */
+    uint64_t latency_p90_ns;
+    uint64_t latency_p99_ns;
+    uint64_t latency_max_ns;
+    uint64_t dns_ns;              /*!< mean connection setup cost, per phase */
+    uint64_t connect_ns;
+    uint64_t tls_ns;
+    unsigned errors;              /*!< failed requests; a failing phase stops early */
+};
+
 /**
  * @brief Initialization function
  * This function must be called to initialize libcurl and to configure the URL addresses.
- * @param device_domain_address domain address of the IDQ Quantis Appliance device.
- * @return Function returns 0 on SUCCESS, -1 if @curl_global_init@ fails, -2 if the libcurl handle cannot be initialized, and -3 if the @device_domain_address@ is NULL.
+ * @param device_domain_address domain address of the IDQ Quantis Appliance device. HTTPS is used unless a scheme is given, e.g. "http://localhost:8080" for a local stand-in.
+ * A "unix:" address, e.g. "unix:/tmp/qrngd.sock", selects client mode: every call is forwarded to the qrngd daemon
+ * listening on that socket, which owns the appliance connections and the pool. In client mode the pool and lane
+ * settings are left to the daemon and @qrng_measure_performance@ is not available.
+ * Local entropy sources are selected by scheme: "file:/path" (a file or FIFO, never rewound), "hwrng:" or
+ * "hwrng:/dev/hwrng" (a hardware RNG device) and "mock:" or "mock:seed" (a fast deterministic generator for
+ * tests and benchmarks). Up to @QRNG_MAX_BACKENDS@ sources separated by '|', e.g. "random.cs.upt.ro|hwrng:",
+ * are tried in order: a failed request is completed by the next source and the failed one is skipped for a
+ * second. Pool, lanes and the other settings apply to every source; typed values from local sources are
+ * mapped from raw bytes, and firmware and system info need the appliance in the list.
+ * @return Function returns 0 on SUCCESS, -1 if @curl_global_init@ fails, the daemon cannot be reached or a source cannot be opened, -2 if the libcurl handle cannot be initialized, and -3 if the @device_domain_address@ is NULL.
  * @note On failure, the function performs clean-up.
+ * @note The library may be opened once before forking workers. A child never serves bytes buffered
+ * by its parent (pool, ring spare, reserve) and opens its own appliance or daemon connections on first
+ * use; an enabled pool restarts empty in the child. The on-disk reserve stays with the parent.
  */
 int qrng_open(const char *device_domain_address);
 
@@ -118,6 +381,359 @@ int qrng_firmware_info(void *buffer);
  */  
 int qrng_system_info(void *buffer);
 
+/**
+ * @brief Parsed firmware information, served from a cache.
+ * The appliance is asked only when the cached copy is older than the TTL (5 s unless changed with
+ * @qrng_set_info_cache@). Callers arriving while that request is in flight wait for it instead of
+ * sending their own.
+ * @param info receives the fields of the response, the response itself and its age.
+ * @return Function returns 0 on SUCCESS and -1 if @info@ is NULL, the request fails or the response is larger than @QRNG_INFO_MAX_RAW@.
+ */
+int qrng_get_firmware_info(struct qrng_info *info);
+
+/**
+ * @brief Parsed system information, served from a cache; see @qrng_get_firmware_info@.
+ */
+int qrng_get_system_info(struct qrng_info *info);
+
+/**
+ * @brief Look up a field of a @qrng_info@.
+ * @return the value, or NULL if the response has no such top-level field.
+ */
+const char *qrng_info_value(const struct qrng_info *info, const char *key);
+
+/**
+ * @brief Configure the firmware and system info cache.
+ * @param ttl_ms age after which a cached response is fetched again, 0 to fetch on every call.
+ * @param refresh_ms if not 0, a background thread fetches both responses this often, so that readers
+ * never wait for the appliance. Must be shorter than @ttl_ms@.
+ * @return Function returns 0 on SUCCESS and -1 on invalid intervals or if the thread cannot be started.
+ * @note @qrng_close@ stops the thread and drops the cached responses.
+ */
+int qrng_set_info_cache(uint64_t ttl_ms, uint64_t refresh_ms);
+
+/**
+ * @brief Configure the connections reserved to each request class.
+ * Interactive requests are always dispatched first; bulk transfers are throttled while interactive
+ * requests are queued or in flight. @qrng_open@ reserves one connection per class.
+ * @param interactive_connections connections reserved to interactive requests (1 to 8).
+ * @param bulk_connections connections reserved to bulk requests (1 to 8).
+ * @return Function returns 0 on SUCCESS, -1 on invalid sizes and -2 if a libcurl handle cannot be initialized.
+ * @note Must not be called while requests are in flight.
+ */
+int qrng_set_lanes(size_t interactive_connections, size_t bulk_connections);
+
+/**
+ * @brief Set up appliance connections before the first request needs them.
+ * Without it, name resolution, TCP connect and the TLS handshake all happen inside the first
+ * requests after @qrng_open@, which are then several times slower than the following ones. The
+ * connections are warmed in parallel with a firmware info request, which consumes no entropy and
+ * leaves a connection that later requests reuse. Interactive connections are warmed first.
+ * Call it after @qrng_set_lanes@, which replaces the connections.
+ * @param connections number of lane connections to warm, 0 for all of them.
+ * @param timeout_ms bound on the whole warm-up, 0 for none.
+ * @param stats receives the number of connections warmed and the time spent, may be NULL.
+ * @return Function returns 0 on SUCCESS, QRNG_DEADLINE_EXCEEDED if some connections were not ready in time and -1 on other failures.
+ * @note Does nothing for local entropy sources. In client mode it opens daemon sockets ahead of use.
+ */
+int qrng_warmup(size_t connections, long timeout_ms, struct qrng_warmup_stats *stats);
+
+/**
+ * @brief Set the class of the requests issued by the calling thread.
+ * With @QRNG_CLASS_AUTO@ (the default) requests up to 4096 bytes are interactive and larger ones,
+ * including every @qrng_random_stream@ transfer, are bulk.
+ * @param request_class class used by subsequent requests of this thread.
+ */
+void qrng_set_request_class(qrng_class_t request_class);
+
+/**
+ * @brief Merge concurrent small requests into one appliance request.
+ * The first small request of a given type and range waits up to @window_microseconds@ for other
+ * threads asking for the same type and range, or until @max_batch_samples@ samples are gathered,
+ * then a single request is sent and each caller receives its own share of the values.
+ * @param window_microseconds how long the first request waits for others. 0 disables coalescing (default).
+ * @param max_batch_samples largest merged request; bigger requests are never coalesced.
+ * @note Has no effect when the library is built with NO_DYNAMIC_MEMORY_ALLOCATION.
+ */
+void qrng_set_coalescing(unsigned long window_microseconds, size_t max_batch_samples);
+
+/**
+ * @brief Define a tenant of the appliance scheduler.
+ * Every transfer to the appliance is charged to the tenant of the calling thread (tenant 0 unless
+ * @qrng_set_tenant@ says otherwise). Waiting transfers are dispatched in weighted fair queuing
+ * order, so backlogged tenants share the appliance in proportion to their weights, and a tenant
+ * with a rate never goes above it on average. Refill threads (pool, reserve, ring) are charged to
+ * the tenant of the thread that started them; the buffered bytes are charged again, against the
+ * rate only, to the tenant they are served to.
+ * @param weight share of the appliance relative to the other tenants, at least 1. Tenant 0 has weight 1.
+ * @param rate_bytes_per_s cap on the bytes the tenant receives, fetched or buffered, 0 for none.
+ * @param burst_bytes bytes the tenant may send at once after idling, ignored without a rate.
+ * @return the new tenant, or -1 on invalid arguments or when @QRNG_MAX_TENANTS@ are defined.
+ * @note Has no effect in client mode; the daemon schedules its own clients.
+ */
+int qrng_tenant_create(unsigned weight, uint64_t rate_bytes_per_s, uint64_t burst_bytes);
+
+/**
+ * @brief Charge the appliance transfers of the calling thread to @tenant@.
+ * @return Function returns 0 on SUCCESS and -1 if the tenant does not exist.
+ */
+int qrng_set_tenant(int tenant);
+
+/**
+ * @brief Cap the traffic from this process to the appliance, all tenants together.
+ * @param bytes_per_s ceiling in bytes per second, 0 to remove it (default).
+ * @param burst_bytes bytes that may be sent at once after idling.
+ */
+void qrng_set_bandwidth_limit(uint64_t bytes_per_s, uint64_t burst_bytes);
+
+/**
+ * @brief Read the traffic counters of a tenant.
+ * @return Function returns 0 on SUCCESS and -1 if @stats@ is NULL or the tenant does not exist.
+ */
+int qrng_get_tenant_stats(int tenant, struct qrng_tenant_stats *stats);
+
+/**
+ * @brief Read the counters of an entropy source, see @qrng_open@ for chaining sources.
+ * @param index position of the source in the address, 0 for the first.
+ * @return Function returns 0 on SUCCESS and -1 if @stats@ is NULL or there is no such source.
+ * @note Not available in client mode; the daemon's sources are its own.
+ */
+int qrng_get_backend_stats(size_t index, struct qrng_backend_stats *stats);
+
+/**
+ * @brief Bound the size of background (pool refill) and split (@qrng_random_stream@) transfers.
+ * The size adapts between the bounds: it grows by a fixed step while throughput improves and is
+ * halved on transfer errors or latency spikes.
+ * @param min_bytes smallest transfer size.
+ * @param max_bytes largest transfer size, at most 1 MiB.
+ * @return Function returns 0 on SUCCESS and -1 on invalid bounds.
+ */
+int qrng_set_chunk_limits(size_t min_bytes, size_t max_bytes);
+
+/**
+ * @brief Read the state of the transfer size controller.
+ * @param stats structure to fill.
+ * @return Function returns 0 on SUCCESS and -1 if @stats@ is NULL.
+ */
+int qrng_get_chunk_stats(struct qrng_chunk_stats *stats);
+
+/**
+ * @brief Enable the buffered entropy pool.
+ * A background thread keeps up to @capacity@ bytes buffered, using its own connection, and starts
+ * refilling as soon as the level drops under @low_watermark@. @qrng_random_bytes@ and the
+ * @*_deadline@ functions serve from the pool first. Each buffered byte is handed out only once.
+ * @param capacity maximum number of buffered bytes.
+ * @param low_watermark refill threshold, must be lower than @capacity@. 0 is taken as 1: refill once
+ * the pool is empty.
+ * @return Function returns 0 on SUCCESS, -1 on invalid parameters or if memory/thread allocation fails, and -2 if the libcurl handle cannot be initialized.
+ * @note @qrng_open@ must be called first. Calling it again replaces the current pool.
+ */
+int qrng_pool_enable(size_t capacity, size_t low_watermark);
+
+/**
+ * @brief Enable the entropy pool in predictive mode.
+ * Instead of a fixed watermark, the refill thread forecasts the consumption rate (fast and slow
+ * EWMAs, the larger one wins) and keeps enough bytes buffered to cover the demand during one
+ * transfer plus one round trip. The buffer grows with demand up to @max_capacity@ and shrinks
+ * back towards @min_capacity@ when consumption drops.
+ * @param min_capacity buffer size kept at idle.
+ * @param max_capacity upper bound of the buffer size.
+ * @return Function returns 0 on SUCCESS, -1 on invalid parameters or if memory/thread allocation fails, and -2 if the libcurl handle cannot be initialized.
+ * @note With NO_DYNAMIC_MEMORY_ALLOCATION the buffer is static; only the refill threshold adapts.
+ */
+int qrng_pool_enable_predictive(size_t min_capacity, size_t max_capacity);
+
+/**
+ * @brief Read the state of the entropy pool.
+ * @param stats structure to fill.
+ * @return Function returns 0 on SUCCESS and -1 if @stats@ is NULL.
+ * @note In a forked child the pool reads as empty until the first take restarts it.
+ */
+int qrng_pool_get_stats(struct qrng_pool_stats *stats);
+
+/**
+ * @brief Disable the pool, stop the refill thread and wipe the buffered bytes.
+ */
+void qrng_pool_disable(void);
+
+/**
+ * @brief Number of bytes currently buffered in the pool.
+ */
+size_t qrng_pool_level(void);
+
+/**
+ * @brief Open (or create) a persistent on-disk reserve of random bytes.
+ * The file is memory mapped and refilled in the background with its own connection. Bytes
+ * survive restarts and appliance outages; @qrng_random_bytes@ and the @*_deadline@ functions use
+ * them after the pool and before the network. A journal in the file records the consumption
+ * before bytes are handed out, so no byte is used twice, even after a crash; a crash drops at
+ * most one journal step (1/64 of the capacity, between 64 KiB and 64 MiB).
+ * @param path reserve file; it is locked, so only one process uses it at a time.
+ * @param capacity size of a new reserve in bytes, at least 1 MiB. An existing file keeps its size.
+ * @return Function returns 0 on SUCCESS, -1 on invalid parameters or if the file cannot be used, and -2 if the libcurl handle cannot be initialized.
+ * @note @qrng_open@ must be called first. In client mode the call does nothing.
+ */
+int qrng_reserve_open(const char *path, size_t capacity);
+
+/**
+ * @brief Read the state of the on-disk reserve.
+ * @param stats structure to fill.
+ * @return Function returns 0 on SUCCESS and -1 if @stats@ is NULL.
+ */
+int qrng_reserve_get_stats(struct qrng_reserve_stats *stats);
+
+/**
+ * @brief Stop the fill thread, record the exact consumption and close the reserve file.
+ */
+void qrng_reserve_close(void);
+
+/**
+ * @brief Create a shared-memory ring and keep it filled with random bytes for other processes.
+ * A background thread fetches bytes through this library (pool, lanes, coalescing) directly into
+ * a POSIX shared memory object that consumer processes map with @qrng_ring_attach@. Each byte is
+ * handed to exactly one consumer; blocks held by a consumer that crashed are recycled.
+ * @param name shared memory object name, starting with '/', e.g. "/qrngd".
+ * @param bytes size of the ring; rounded down to whole 4 KiB blocks, at least 16 of them.
+ * @return Function returns 0 on SUCCESS and -1 on invalid parameters or if the object or the thread cannot be created.
+ * @note @qrng_open@ must be called first. The object is removed by @qrng_ring_detach@ or @qrng_close@.
+ */
+int qrng_ring_create(const char *name, size_t bytes);
+
+/**
+ * @brief Map a ring created by another process and serve @qrng_random_bytes@ from it.
+ * @qrng_random_bytes@ and @qrng_random_bytes_deadline@ copy from the ring first and fetch the rest
+ * as usual. Only a call with a deadline waits for an empty ring, up to 100 ms or the deadline.
+ * @param name name given to @qrng_ring_create@.
+ * @return Function returns 0 on SUCCESS and -1 if the ring does not exist or is not a libqrng ring.
+ */
+int qrng_ring_attach(const char *name);
+
+/**
+ * @brief Unmap the ring; a producer also stops its thread and removes the object.
+ */
+void qrng_ring_detach(void);
+
+/**
+ * @brief Generate random bytes before an absolute deadline.
+ * Buffered bytes are used first; the remainder is requested from the appliance with a transfer
+ * timeout equal to the time left.
+ * @param samples number of bytes to generate.
+ * @param buffer array in which the bytes will be stored.
+ * @param deadline absolute @CLOCK_MONOTONIC@ time. NULL means no limit.
+ * @param filled if not NULL, receives the number of bytes written to @buffer@, also on failure.
+ * @return Function returns 0 on SUCCESS, QRNG_DEADLINE_EXCEEDED if the deadline passed first, and -1 if libcurl cannot perform the request.
+ */
+int qrng_random_bytes_deadline(size_t samples, uint8_t *buffer,
+                               const struct timespec *deadline, size_t *filled);
+
+/**
+ * @brief Generate random @int32@ values in [min, max] before an absolute deadline.
+ * Both bounds are included, as in @qrng_random_int32@. Buffered bytes are converted locally first;
+ * the remaining values are requested from the appliance.
+ * @param min interval minimum value.
+ * @param max interval maximum value, at least @min@.
+ * @param samples number of values to generate.
+ * @param buffer array of type @int32@ in which the values will be stored.
+ * @param deadline absolute @CLOCK_MONOTONIC@ time. NULL means no limit.
+ * @param filled if not NULL, receives the number of values written to @buffer@, also on failure.
+ * @return Function returns 0 on SUCCESS, QRNG_DEADLINE_EXCEEDED if the deadline passed first, and -1 if @max@ is lower than @min@ or libcurl cannot perform the request.
+ */
+int qrng_random_int32_deadline(int32_t min, int32_t max, size_t samples, int32_t *buffer,
+                               const struct timespec *deadline, size_t *filled);
+
+/**
+ * @brief Generate random @double@ values in [min, max) before an absolute deadline.
+ * Buffered bytes are converted locally first; the remaining values are requested from the appliance.
+ * @param min interval minimum value.
+ * @param max interval maximum value.
+ * @param samples number of values to generate.
+ * @param buffer array of type @double@ in which the values will be stored.
+ * @param deadline absolute @CLOCK_MONOTONIC@ time. NULL means no limit.
+ * @param filled if not NULL, receives the number of values written to @buffer@, also on failure.
+ * @return Function returns 0 on SUCCESS, QRNG_DEADLINE_EXCEEDED if the deadline passed first, and -1 if libcurl cannot perform the request.
+ */
+int qrng_random_double_deadline(double min, double max, size_t samples, double *buffer,
+                                const struct timespec *deadline, size_t *filled);
+
+/**
+ * @brief Map 4 random bytes to an @int32@ in [min, max], both bounds included as by the appliance.
+ * This is the conversion used for buffered and local bytes. It rejects some draws so that every
+ * value is equally likely; a rejected draw is replaced with 4 new bytes.
+ * @param min interval minimum value.
+ * @param max interval maximum value, at least @min@.
+ * @param bytes 4 random bytes.
+ * @param value receives the value when the draw is accepted.
+ * @return Function returns 0 when the draw is accepted, 1 when it is rejected and -1 if @max@ is lower than @min@.
+ */
+int qrng_bytes_to_int32(int32_t min, int32_t max, const uint8_t *bytes, int32_t *value);
+
+/**
+ * @brief Measure the appliance: connection setup cost, small request latency, then sustained
+ * streambytes and JSON throughput, each phase running back to back on this thread.
+ * @param config probe parameters, NULL for the defaults.
+ * @param report structure to fill.
+ * @return Function returns 0 on SUCCESS (see @report->errors@), -1 if the library is not opened, is in client mode or @report@ is NULL and -2 if a libcurl handle cannot be initialized.
+ */
+int qrng_measure_performance(const struct qrng_perf_config *config, struct qrng_perf_report *report);
+
+/**
+ * @brief Take a snapshot of the request counters and histograms.
+ * Collection is always on and does not lock; the snapshot sums per-thread shards, so counters
+ * updated concurrently may be off by the requests in flight.
+ * @param stats structure to fill, including the chunk controller and pool state.
+ * @return Function returns 0 on SUCCESS and -1 if @stats@ is NULL.
+ */
+int qrng_get_stats(struct qrng_stats *stats);
+
+/**
+ * @brief Zero the request counters and histograms.
+ */
+void qrng_reset_stats(void);
+
+/**
+ * @brief Register a function called after every appliance request with its timing breakdown.
+ * The callback runs on the thread that issued the request, after the values are delivered; it
+ * must be fast and must not call back into libqrng.
+ * @param cbk function to call, NULL to disable (default).
+ * @param user_data pointer passed back to @cbk@.
+ * @note Must not be called while requests are in flight.
+ */
+void qrng_set_timing_callback(qrng_timing_cbk_t cbk, void *user_data);
+
+/**
+ * @brief Name of a request kind, for reports.
+ */
+const char *qrng_request_type_name(qrng_request_type_t type);
+
+/**
+ * @brief Upper bound, in nanoseconds, of a histogram bucket.
+ */
+uint64_t qrng_histogram_bucket_limit(unsigned bucket);
+
+/**
+ * @brief Estimate a percentile of a histogram.
+ * @param histogram histogram taken from a @qrng_stats@ snapshot.
+ * @param percentile between 0 and 100.
+ * @return upper bound of the bucket holding the percentile, in nanoseconds (at most 25% above the exact value), 0 if empty.
+ */
+uint64_t qrng_histogram_percentile(const struct qrng_histogram *histogram, double percentile);
+
+/**
+ * @brief Select where appliance responses come from.
+ * In record mode every transfer (URL, status, body and timers) is appended to @capture_path@.
+ * In replay mode each request is answered by the next recorded transfer for the same URL path
+ * and query, with the original body delivered in the same sized pieces through the regular
+ * callbacks, parser and conversions. The capture is read from the start again when exhausted.
+ * @param mode transport to use.
+ * @param capture_path capture file, ignored for @QRNG_TRANSPORT_NETWORK@.
+ * @param speed replay pacing: 1.0 reproduces the recorded timing, 10.0 runs ten times faster and
+ * 0 serves every response immediately. Ignored unless replaying.
+ * @return Function returns 0 on SUCCESS, -1 on invalid parameters or if the capture cannot be opened or is not a valid capture.
+ * @note Must not be called while requests are in flight. Recording is not available with NO_DYNAMIC_MEMORY_ALLOCATION.
+ * Captures use the byte order of the machine that recorded them.
+ */
+int qrng_set_transport(qrng_transport_t mode, const char *capture_path, double speed);
+
 /**
  * @brief Close function
  * This function must be called for clean-up. It performs libcurl clean-up.
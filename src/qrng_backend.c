@@ -0,0 +1,640 @@
+/****************************************************************************
+ * libqrng - library for interacting with IDQ's Quantis Appliance           *
+ *                                                                          *
+ * Copyright (C) 2023  Sebastian Mihai Ardelean                             *
+ *                                                                          *
+ * This program is free software: you can redistribute it and/or modify     *
+ * it under the terms of the GNU General Public License as published by     *
+ * the Free Software Foundation, either version 3 of the License, or        *
+ * (at your option) any later version.                                      *
+ *                                                                          *
+ * This program is distributed in the hope that it will be useful,          *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ * GNU General Public License for more details.                             *
+ *                                                                          *
+ * You should have received a copy of the GNU General Public License        *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+
+/**
+ * @file qrng_backend.c
+ * @author Sebastian Mihai Ardelean <sebastian.ardelean@cs.upt.ro>
+ * @date 24 May 2023
+ * @brief Entropy backends: the appliance, a file or FIFO, the local hwrng and a deterministic mock.
+ *
+ * The address given to @qrng_open@ is a chain of sources separated by '|', tried in order; a
+ * source that fails is skipped for a while and the request moves on to the next one with what
+ * is still missing. Every module above (lanes, coalescing, pool, reserve, ring, scheduler,
+ * statistics) goes through @qrng_backend_fill_bytes@ or @qrng_backend_fill_typed@ and does not
+ * know which source answered. Local sources produce raw bytes; typed values are converted here
+ * with the same mapping the deadline functions use for buffered bytes.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "qrng.h"
+#include "qrng_internal.h"
+
+#define SOURCE_ADDRESS_LENGTH DOMAIN_ADDRESS_LENGTH
+#define SOURCE_PIECE_BYTES CURL_MAX_WRITE_SIZE
+#define TYPED_PIECE_BYTES 4096u
+#define SOURCE_RETRY_NS 1000000000u
+#define DEFAULT_HWRNG_PATH "/dev/hwrng"
+#define MOCK_INCREMENT UINT64_C(0x9e3779b97f4a7c15)
+
+struct qrng_source {
+    const qrng_backend_t *backend;
+    char address[SOURCE_ADDRESS_LENGTH];
+    int fd;
+    bool fifo;
+    atomic_bool exhausted;
+    uint64_t seed;
+    atomic_uint_fast64_t counter;
+    atomic_uint_fast64_t down_until_ns;
+    atomic_uint_fast64_t requests;
+    atomic_uint_fast64_t bytes;
+    atomic_uint_fast64_t errors;
+    atomic_uint_fast64_t failovers;
+    atomic_uint_fast64_t busy_ns;
+};
+
+/**
+ * @brief Write callback wrapper counting what a source delivered, so the next one is asked
+ * only for the rest.
+ */
+typedef struct {
+    qrng_write_cbk_t cbk;
+    void *data;
+    size_t count;
+}counting_sink_t;
+
+static int fd_open(qrng_source_t *src, const char *address);
+static int hwrng_open(qrng_source_t *src, const char *address);
+static int fd_fill_bytes(qrng_source_t *src, CURL *handle, size_t size, qrng_write_cbk_t cbk, void *data,
+                         long timeout_ms, xfer_info_t *info);
+static void fd_stats(const qrng_source_t *src, struct qrng_backend_stats *stats);
+static void fd_close(qrng_source_t *src);
+static int mock_open(qrng_source_t *src, const char *address);
+static int mock_fill_bytes(qrng_source_t *src, CURL *handle, size_t size, qrng_write_cbk_t cbk, void *data,
+                           long timeout_ms, xfer_info_t *info);
+static void mock_stats(const qrng_source_t *src, struct qrng_backend_stats *stats);
+static void mock_close(qrng_source_t *src);
+static int local_fill_typed(qrng_source_t *src, const s_api_t *req, void *buffer, size_t value_size,
+                            long timeout_ms, xfer_info_t *info);
+static const qrng_backend_t *backend_for(const char *entry, const char **address);
+static size_t counting_write_cbk(void *content, size_t size, size_t nmemb, void *userp);
+static void source_account(qrng_source_t *src, size_t bytes, uint64_t busy_ns, int error);
+static bool source_skipped(const qrng_source_t *src, size_t index);
+static void source_failed(qrng_source_t *src, size_t index);
+static int wait_readable(int fd, uint64_t until_ns);
+static uint64_t mix64(uint64_t x);
+
+static const qrng_backend_t file_backend = {
+    .name = "file",
+    .open = &fd_open,
+    .fill_bytes = &fd_fill_bytes,
+    .fill_typed = &local_fill_typed,
+    .stats = &fd_stats,
+    .close = &fd_close
+};
+
+static const qrng_backend_t hwrng_backend = {
+    .name = "hwrng",
+    .open = &hwrng_open,
+    .fill_bytes = &fd_fill_bytes,
+    .fill_typed = &local_fill_typed,
+    .stats = &fd_stats,
+    .close = &fd_close
+};
+
+static const qrng_backend_t mock_backend = {
+    .name = "mock",
+    .open = &mock_open,
+    .fill_bytes = &mock_fill_bytes,
+    .fill_typed = &local_fill_typed,
+    .stats = &mock_stats,
+    .close = &mock_close
+};
+
+/* Selected by "<name>:" at the start of a chain entry; anything else is an appliance address. */
+static const qrng_backend_t *const local_backends[] = {
+    &file_backend,
+    &hwrng_backend,
+    &mock_backend
+};
+
+#define NUMBER_OF_LOCAL_BACKENDS (sizeof(local_backends) / sizeof(local_backends[0]))
+
+static qrng_source_t chain[QRNG_MAX_BACKENDS];
+static size_t chain_length = 0;
+
+
+int qrng_backend_open(const char *address)
+{
+    char entry[SOURCE_ADDRESS_LENGTH];
+    const char *next = NULL;
+    const char *location = NULL;
+    const qrng_backend_t *backend = NULL;
+    qrng_source_t *src = NULL;
+    size_t length = 0;
+    bool rest = false;
+
+    qrng_backend_close();
+    while (address != NULL && *address != '\0') {
+        next = strchr(address, '|');
+        length = next ? (size_t)(next - address) : strlen(address);
+        if (length == 0 || length >= sizeof(entry) || chain_length == QRNG_MAX_BACKENDS) {
+            fprintf(stderr, "Invalid entropy source list: %s\n", address);
+            qrng_backend_close();
+            return -1;
+        }
+        memcpy(entry, address, length);
+        entry[length] = '\0';
+        backend = backend_for(entry, &location);
+        /* The appliance settings (URLs, lanes, transport) are process wide. */
+        if (backend == &qrng_rest_backend && rest) {
+            fprintf(stderr, "Only one appliance may be listed: %s\n", entry);
+            qrng_backend_close();
+            return -1;
+        }
+        rest = rest || backend == &qrng_rest_backend;
+
+        src = &chain[chain_length];
+        memset(src, 0, sizeof(*src));
+        src->backend = backend;
+        src->fd = -1;
+        strcpy(src->address, location);
+        if (backend->open(src, src->address) != 0) {
+            qrng_backend_close();
+            return -1;
+        }
+        chain_length++;
+        address = next ? next + 1 : NULL;
+    }
+    return chain_length > 0 ? 0 : -1;
+}
+
+
+void qrng_backend_close(void)
+{
+    while (chain_length > 0) {
+        chain_length--;
+        chain[chain_length].backend->close(&chain[chain_length]);
+    }
+}
+
+
+bool qrng_backend_has_rest(void)
+{
+    size_t i = 0;
+
+    for (i = 0; i < chain_length; i++) {
+        if (chain[i].backend == &qrng_rest_backend) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+int qrng_backend_sched_wait(uint64_t until_ns)
+{
+    size_t i = 0;
+
+    /* Only the appliance is shared between tenants; the first source not skipped serves the fill. */
+    for (i = 0; i < chain_length; i++) {
+        if (!source_skipped(&chain[i], i)) {
+            return chain[i].backend == &qrng_rest_backend ? qrng_sched_wait(until_ns) : 0;
+        }
+    }
+    return 0;
+}
+
+
+void qrng_backend_atfork(e_fork_phase_t phase)
+{
+    size_t i = 0;
+
+    if (phase != FORK_CHILD) {
+        return;
+    }
+    /* The child would replay its parent's mock sequence; it gets one of its own instead. */
+    for (i = 0; i < chain_length; i++) {
+        if (chain[i].backend == &mock_backend) {
+            chain[i].seed = mix64(chain[i].seed ^ qrng_fork_generation());
+        }
+    }
+}
+
+
+int qrng_backend_fill_bytes(CURL *handle, size_t size, qrng_write_cbk_t cbk, void *data,
+                            long timeout_ms, xfer_info_t *info)
+{
+    counting_sink_t sink = { .cbk = cbk, .data = data, .count = 0 };
+    qrng_source_t *src = NULL;
+    uint64_t start_ns = 0;
+    size_t before = 0;
+    size_t i = 0;
+    int retval = -1;
+
+    memset(info, 0, sizeof(*info));
+    if (chain_length == 0) {
+        fprintf(stderr, "libqrng is not initialized\n");
+        return -1;
+    }
+    for (i = 0; i < chain_length; i++) {
+        src = &chain[i];
+        if (source_skipped(src, i)) {
+            continue;
+        }
+        before = sink.count;
+        start_ns = qrng_now_ns();
+        retval = src->backend->fill_bytes(src, handle, size - sink.count, &counting_write_cbk,
+                                          (void *)&sink, timeout_ms, info);
+        if (!retval && sink.count < size) {
+            retval = -1;
+        }
+        source_account(src, sink.count - before, qrng_now_ns() - start_ns, retval);
+        /* A deadline says nothing about the source, only about the caller. */
+        if (retval != -1) {
+            break;
+        }
+        source_failed(src, i);
+    }
+    return retval;
+}
+
+
+int qrng_backend_fill_typed(const s_api_t *req, void *buffer, size_t value_size, long timeout_ms,
+                            xfer_info_t *info)
+{
+    qrng_source_t *src = NULL;
+    uint64_t start_ns = 0;
+    size_t i = 0;
+    int retval = -1;
+
+    memset(info, 0, sizeof(*info));
+    if (chain_length == 0) {
+        fprintf(stderr, "libqrng is not initialized\n");
+        return -1;
+    }
+    for (i = 0; i < chain_length; i++) {
+        src = &chain[i];
+        if (source_skipped(src, i)) {
+            continue;
+        }
+        start_ns = qrng_now_ns();
+        /* Values are not split across sources: the next one refills the whole buffer. */
+        retval = src->backend->fill_typed(src, req, buffer, value_size, timeout_ms, info);
+        source_account(src, retval ? 0 : req->samples * value_size, qrng_now_ns() - start_ns, retval);
+        if (retval != -1) {
+            break;
+        }
+        source_failed(src, i);
+    }
+    return retval;
+}
+
+
+int qrng_get_backend_stats(size_t index, struct qrng_backend_stats *stats)
+{
+    const qrng_source_t *src = NULL;
+
+    if (stats == NULL || index >= chain_length) {
+        return -1;
+    }
+    src = &chain[index];
+    memset(stats, 0, sizeof(*stats));
+    src->backend->stats(src, stats);
+    stats->requests = atomic_load(&src->requests);
+    stats->bytes = atomic_load(&src->bytes);
+    stats->errors = atomic_load(&src->errors);
+    stats->failovers = atomic_load(&src->failovers);
+    stats->busy_ns = atomic_load(&src->busy_ns);
+    return 0;
+}
+
+
+const qrng_backend_t *backend_for(const char *entry, const char **address)
+{
+    size_t i = 0;
+    size_t length = 0;
+
+    for (i = 0; i < NUMBER_OF_LOCAL_BACKENDS; i++) {
+        length = strlen(local_backends[i]->name);
+        if (strncmp(entry, local_backends[i]->name, length) == 0 && entry[length] == ':') {
+            *address = entry + length + 1;
+            return local_backends[i];
+        }
+    }
+    *address = entry;
+    return &qrng_rest_backend;
+}
+
+
+size_t counting_write_cbk(void *content, size_t size, size_t nmemb, void *userp)
+{
+    counting_sink_t *sink = (counting_sink_t *)userp;
+    size_t written = sink->cbk(content, size, nmemb, sink->data);
+
+    sink->count += written * size;
+    return written;
+}
+
+
+void source_account(qrng_source_t *src, size_t bytes, uint64_t busy_ns, int error)
+{
+    atomic_fetch_add_explicit(&src->requests, 1u, memory_order_relaxed);
+    atomic_fetch_add_explicit(&src->bytes, bytes, memory_order_relaxed);
+    atomic_fetch_add_explicit(&src->busy_ns, busy_ns, memory_order_relaxed);
+    if (error) {
+        atomic_fetch_add_explicit(&src->errors, 1u, memory_order_relaxed);
+    }
+}
+
+
+bool source_skipped(const qrng_source_t *src, size_t index)
+{
+    /* The last source is always tried: there is nothing left to fall back on. */
+    return index + 1u < chain_length && atomic_load(&src->down_until_ns) > qrng_now_ns();
+}
+
+
+void source_failed(qrng_source_t *src, size_t index)
+{
+    if (index + 1u < chain_length) {
+        atomic_store(&src->down_until_ns, qrng_now_ns() + SOURCE_RETRY_NS);
+        atomic_fetch_add_explicit(&src->failovers, 1u, memory_order_relaxed);
+    }
+}
+
+
+int fd_open(qrng_source_t *src, const char *address)
+{
+    struct stat st;
+
+    /* Non-blocking, so that an idle FIFO writer reads as "no data yet" and a missing one as EOF. */
+    src->fd = open(address, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+    if (src->fd < 0) {
+        fprintf(stderr, "Cannot open the entropy source %s: %s\n", address, strerror(errno));
+        return -1;
+    }
+    if (fstat(src->fd, &st) == 0) {
+        src->fifo = S_ISFIFO(st.st_mode);
+    }
+    return 0;
+}
+
+
+int hwrng_open(qrng_source_t *src, const char *address)
+{
+    if (address[0] == '\0') {
+        strcpy(src->address, DEFAULT_HWRNG_PATH);
+    }
+    return fd_open(src, src->address);
+}
+
+
+int fd_fill_bytes(qrng_source_t *src, CURL *handle, size_t size, qrng_write_cbk_t cbk, void *data,
+                  long timeout_ms, xfer_info_t *info)
+{
+    uint8_t piece[SOURCE_PIECE_BYTES];
+    uint64_t start_ns = qrng_now_ns();
+    uint64_t until_ns = timeout_ms > 0 ? start_ns + (uint64_t)timeout_ms * 1000000u : 0;
+    size_t done = 0;
+    ssize_t got = 0;
+    int retval = 0;
+
+    (void)handle;
+    while (done < size) {
+        got = read(src->fd, piece, size - done < sizeof(piece) ? size - done : sizeof(piece));
+        if (got > 0) {
+            if (done == 0) {
+                info->ttfb_ns = qrng_now_ns() - start_ns;
+            }
+            if (cbk((void *)piece, 1, (size_t)got, data) != (size_t)got) {
+                retval = -1;
+                break;
+            }
+            done += (size_t)got;
+        }
+        else if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        else if (got < 0 && errno == EAGAIN) {
+            retval = wait_readable(src->fd, until_ns);
+            if (retval) {
+                break;
+            }
+        }
+        else {
+            /* A regular file is never rewound: its bytes were already handed out. */
+            if (got == 0 && !src->fifo && !atomic_exchange(&src->exhausted, true)) {
+                fprintf(stderr, "The entropy source %s is exhausted\n", src->address);
+            }
+            else if (got == 0 && src->fifo) {
+                fprintf(stderr, "The entropy source %s has no writer\n", src->address);
+            }
+            else if (got < 0) {
+                fprintf(stderr, "Cannot read the entropy source %s: %s\n", src->address, strerror(errno));
+            }
+            retval = -1;
+            break;
+        }
+    }
+    memset(piece, 0, sizeof(piece));
+    info->total_ns = qrng_now_ns() - start_ns;
+    info->bytes = done;
+    info->speed_bps = info->total_ns > 0 ? (uint64_t)((double)done * 1e9 / (double)info->total_ns) : 0;
+    return retval;
+}
+
+
+void fd_stats(const qrng_source_t *src, struct qrng_backend_stats *stats)
+{
+    snprintf(stats->source, sizeof(stats->source), "%s:%.57s", src->backend->name, src->address);
+}
+
+
+void fd_close(qrng_source_t *src)
+{
+    if (src->fd >= 0) {
+        close(src->fd);
+        src->fd = -1;
+    }
+}
+
+
+int mock_open(qrng_source_t *src, const char *address)
+{
+    char *end = NULL;
+
+    src->seed = address[0] == '\0' ? 0 : strtoull(address, &end, 0);
+    if (end != NULL && *end != '\0') {
+        fprintf(stderr, "Invalid mock seed: %s\n", address);
+        return -1;
+    }
+    atomic_store(&src->counter, 0);
+    return 0;
+}
+
+
+int mock_fill_bytes(qrng_source_t *src, CURL *handle, size_t size, qrng_write_cbk_t cbk, void *data,
+                    long timeout_ms, xfer_info_t *info)
+{
+    uint8_t piece[SOURCE_PIECE_BYTES];
+    uint64_t start_ns = qrng_now_ns();
+    uint64_t block = 0;
+    uint64_t index = 0;
+    size_t done = 0;
+    size_t length = 0;
+    size_t i = 0;
+    int retval = 0;
+
+    (void)handle;
+    (void)timeout_ms;
+    /* Counter based: a request owns a range of the sequence, whichever thread makes it. */
+    index = atomic_fetch_add(&src->counter, (size + sizeof(block) - 1u) / sizeof(block));
+    while (done < size) {
+        length = size - done < sizeof(piece) ? size - done : sizeof(piece);
+        for (i = 0; i < length; i += sizeof(block)) {
+            block = mix64(src->seed + (index++) * MOCK_INCREMENT);
+            memcpy(piece + i, &block, length - i < sizeof(block) ? length - i : sizeof(block));
+        }
+        if (cbk((void *)piece, 1, length, data) != length) {
+            retval = -1;
+            break;
+        }
+        done += length;
+    }
+    info->total_ns = qrng_now_ns() - start_ns;
+    info->bytes = done;
+    info->speed_bps = info->total_ns > 0 ? (uint64_t)((double)done * 1e9 / (double)info->total_ns) : 0;
+    return retval;
+}
+
+
+void mock_stats(const qrng_source_t *src, struct qrng_backend_stats *stats)
+{
+    snprintf(stats->source, sizeof(stats->source), "mock:%llu", (unsigned long long)src->seed);
+}
+
+
+void mock_close(qrng_source_t *src)
+{
+    (void)src;
+}
+
+
+int local_fill_typed(qrng_source_t *src, const s_api_t *req, void *buffer, size_t value_size,
+                     long timeout_ms, xfer_info_t *info)
+{
+    uint8_t raw[TYPED_PIECE_BYTES];
+    raw_sink_t sink;
+    xfer_info_t piece_info;
+    uint64_t start_ns = qrng_now_ns();
+    uint64_t until_ns = timeout_ms > 0 ? start_ns + (uint64_t)timeout_ms * 1000000u : 0;
+    uint64_t now = 0;
+    size_t draw = req->type == DOUBLE_RANDOM_NUMBER || req->type == FLOAT_RANDOM_NUMBER ? sizeof(uint64_t)
+                                                                                        : sizeof(uint32_t);
+    size_t got = 0;
+    size_t offset = 0;
+    long remaining_ms = 0;
+    int32_t value = 0;
+    int retval = 0;
+
+    (void)value_size;
+    if ((req->type == INT16_RANDOM_NUMBER || req->type == INT32_RANDOM_NUMBER) &&
+        req->max_range_i < req->min_range_i) {
+        fprintf(stderr, "Invalid interval [%d, %d]\n", (int)req->min_range_i, (int)req->max_range_i);
+        return -1;
+    }
+    if (req->type == BYTES_RANDOM_NUMBER) {
+        sink.dst = (uint8_t *)buffer;
+        sink.cap = req->samples;
+        sink.len = 0;
+        return src->backend->fill_bytes(src, NULL, req->samples, &qrng_raw_write_cbk, (void *)&sink,
+                                        timeout_ms, info);
+    }
+    while (got < req->samples && !retval) {
+        now = qrng_now_ns();
+        if (until_ns && now >= until_ns) {
+            retval = QRNG_DEADLINE_EXCEEDED;
+            break;
+        }
+        remaining_ms = until_ns ? (long)((until_ns - now + 999999u) / 1000000u) : 0;
+        sink.dst = raw;
+        sink.cap = (req->samples - got) * draw < sizeof(raw) ? (req->samples - got) * draw : sizeof(raw);
+        sink.len = 0;
+        memset(&piece_info, 0, sizeof(piece_info));
+        retval = src->backend->fill_bytes(src, NULL, sink.cap, &qrng_raw_write_cbk, (void *)&sink,
+                                          remaining_ms, &piece_info);
+        info->bytes += piece_info.bytes;
+        for (offset = 0; offset + draw <= sink.len && got < req->samples; offset += draw) {
+            switch (req->type) {
+                case INT16_RANDOM_NUMBER:
+                    if (qrng_bytes_to_int32(req->min_range_i, req->max_range_i, raw + offset, &value) == 0) {
+                        ((int16_t *)buffer)[got++] = (int16_t)value;
+                    }
+                    break;
+                case INT32_RANDOM_NUMBER:
+                    if (qrng_bytes_to_int32(req->min_range_i, req->max_range_i, raw + offset, &value) == 0) {
+                        ((int32_t *)buffer)[got++] = value;
+                    }
+                    break;
+                case DOUBLE_RANDOM_NUMBER:
+                    ((double *)buffer)[got++] = qrng_bytes_to_double(req->min_range_f, req->max_range_f, raw + offset);
+                    break;
+                case FLOAT_RANDOM_NUMBER:
+                    ((float *)buffer)[got++] = (float)qrng_bytes_to_double(req->min_range_f, req->max_range_f,
+                                                                           raw + offset);
+                    break;
+                default:
+                    retval = -1;
+                    break;
+            }
+        }
+    }
+    memset(raw, 0, sizeof(raw));
+    info->total_ns = qrng_now_ns() - start_ns;
+    return retval;
+}
+
+
+int wait_readable(int fd, uint64_t until_ns)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN, .revents = 0 };
+    uint64_t now = 0;
+    int timeout = -1;
+
+    if (until_ns) {
+        now = qrng_now_ns();
+        if (now >= until_ns) {
+            return QRNG_DEADLINE_EXCEEDED;
+        }
+        timeout = (int)((until_ns - now + 999999u) / 1000000u);
+    }
+    if (poll(&pfd, 1, timeout) == 0) {
+        return QRNG_DEADLINE_EXCEEDED;
+    }
+    /* POLLHUP and errors are reported by the read that follows. */
+    return 0;
+}
+
+
+uint64_t mix64(uint64_t x)
+{
+    /* SplitMix64 finalizer. */
+    x = (x ^ (x >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+    x = (x ^ (x >> 27)) * UINT64_C(0x94d049bb133111eb);
+    return x ^ (x >> 31);
+}
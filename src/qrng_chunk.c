@@ -0,0 +1,216 @@
+/****************************************************************************
+ * libqrng - library for interacting with IDQ's Quantis Appliance           *
+ *                                                                          *
+ * Copyright (C) 2023  Sebastian Mihai Ardelean                             *
+ *                                                                          *
+ * This program is free software: you can redistribute it and/or modify     *
+ * it under the terms of the GNU General Public License as published by     *
+ * the Free Software Foundation, either version 3 of the License, or        *
+ * (at your option) any later version.                                      *
+ *                                                                          *
+ * This program is distributed in the hope that it will be useful,          *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ * GNU General Public License for more details.                             *
+ *                                                                          *
+ * You should have received a copy of the GNU General Public License        *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+
+/**
+ * @file qrng_chunk.c
+ * @author Sebastian Mihai Ardelean <sebastian.ardelean@cs.upt.ro>
+ * @date 24 May 2023
+ * @brief AIMD controller for the size of background and split transfers.
+ *
+ * Every raw transfer reports its size, time to first byte and total time. While throughput
+ * keeps improving the chunk grows by a fixed step; a transfer error or a time to first byte far
+ * above the recent minimum halves it. Bandwidth and RTT are smoothed with an EWMA (1/8 weight)
+ * and their product is the bandwidth-delay product reported through the stats.
+ *
+ * The RTT sample starts when the request is sent, so DNS, TCP and TLS setup of a new connection
+ * are not counted. The minimum only holds for RTT_MIN_WINDOW_NS, after which the next sample
+ * replaces it, so a path change is picked up. Transfers under the minimum chunk size give an RTT
+ * sample but say too little about throughput to move the chunk.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include "qrng.h"
+#include "qrng_internal.h"
+
+#define CHUNK_DEFAULT_MIN (4u * 1024u)
+#define CHUNK_START (64u * 1024u)
+#define CHUNK_STEP (16u * 1024u)
+#define LATENCY_SPIKE_FACTOR 2u
+#define LATENCY_SPIKE_FLOOR_NS 1000000u
+#define THROUGHPUT_TOLERANCE_PCT 95u
+#define EWMA_SHIFT 3u
+#define RTT_MIN_WINDOW_NS (10u * 1000000000ull)
+
+typedef struct {
+    size_t chunk;
+    size_t min;
+    size_t max;
+    double bandwidth_bps;
+    double last_bandwidth_bps;
+    uint64_t rtt_ns;
+    uint64_t rtt_min_ns;
+    uint64_t rtt_min_stamp_ns;
+    uint64_t increases;
+    uint64_t decreases;
+}chunk_ctl_t;
+
+static chunk_ctl_t ctl = {
+    .chunk = CHUNK_START,
+    .min = CHUNK_DEFAULT_MIN,
+    .max = QRNG_CHUNK_MAX_BYTES
+};
+static pthread_mutex_t chunk_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void decrease_locked(void);
+static uint64_t rtt_sample(const xfer_info_t *info);
+
+
+int qrng_set_chunk_limits(size_t min_bytes, size_t max_bytes)
+{
+    if (min_bytes == 0 || min_bytes > max_bytes || max_bytes > QRNG_CHUNK_MAX_BYTES) {
+        return -1;
+    }
+    pthread_mutex_lock(&chunk_lock);
+    ctl.min = min_bytes;
+    ctl.max = max_bytes;
+    if (ctl.chunk < min_bytes) {
+        ctl.chunk = min_bytes;
+    }
+    if (ctl.chunk > max_bytes) {
+        ctl.chunk = max_bytes;
+    }
+    pthread_mutex_unlock(&chunk_lock);
+    return 0;
+}
+
+
+int qrng_get_chunk_stats(struct qrng_chunk_stats *stats)
+{
+    if (stats == NULL) {
+        return -1;
+    }
+    pthread_mutex_lock(&chunk_lock);
+    stats->chunk_bytes = ctl.chunk;
+    stats->bandwidth_bps = (uint64_t)ctl.bandwidth_bps;
+    stats->rtt_us = ctl.rtt_ns / 1000u;
+    stats->bdp_bytes = (uint64_t)(ctl.bandwidth_bps * (double)ctl.rtt_ns / 1e9);
+    stats->increases = ctl.increases;
+    stats->decreases = ctl.decreases;
+    pthread_mutex_unlock(&chunk_lock);
+    return 0;
+}
+
+
+size_t qrng_chunk_size(void)
+{
+    size_t chunk = 0;
+    pthread_mutex_lock(&chunk_lock);
+    chunk = ctl.chunk;
+    pthread_mutex_unlock(&chunk_lock);
+    return chunk;
+}
+
+
+void qrng_chunk_feedback(const xfer_info_t *info, int error)
+{
+    double bandwidth = 0.0;
+    uint64_t body_ns = 0;
+    uint64_t rtt = 0;
+    uint64_t now_ns = 0;
+
+    pthread_mutex_lock(&chunk_lock);
+    if (error || info == NULL || info->total_ns == 0) {
+        decrease_locked();
+        pthread_mutex_unlock(&chunk_lock);
+        return;
+    }
+
+    rtt = rtt_sample(info);
+    if (rtt > 0) {
+        now_ns = qrng_now_ns();
+        ctl.rtt_ns = ctl.rtt_ns == 0 ? rtt : ctl.rtt_ns - (ctl.rtt_ns >> EWMA_SHIFT) + (rtt >> EWMA_SHIFT);
+        if (ctl.rtt_min_ns == 0 || rtt <= ctl.rtt_min_ns || now_ns - ctl.rtt_min_stamp_ns > RTT_MIN_WINDOW_NS) {
+            ctl.rtt_min_ns = rtt;
+            ctl.rtt_min_stamp_ns = now_ns;
+        }
+    }
+    if (info->bytes < ctl.min) {
+        pthread_mutex_unlock(&chunk_lock);
+        return;
+    }
+    /* Bandwidth over the body only, the first byte latency is accounted as RTT. */
+    body_ns = info->total_ns > info->ttfb_ns ? info->total_ns - info->ttfb_ns : info->total_ns;
+    bandwidth = (double)info->bytes * 1e9 / (double)body_ns;
+    ctl.bandwidth_bps = ctl.bandwidth_bps == 0.0 ? bandwidth :
+        ctl.bandwidth_bps + (bandwidth - ctl.bandwidth_bps) / (double)(1u << EWMA_SHIFT);
+
+    /* Sub-millisecond jitter on a fast link is scheduling noise, not queueing. */
+    if (ctl.rtt_min_ns > 0 && rtt > LATENCY_SPIKE_FACTOR * ctl.rtt_min_ns &&
+        rtt > ctl.rtt_min_ns + LATENCY_SPIKE_FLOOR_NS && rtt > ctl.rtt_ns) {
+        decrease_locked();
+    }
+    else if (ctl.last_bandwidth_bps == 0.0 ||
+             bandwidth * 100.0 >= ctl.last_bandwidth_bps * THROUGHPUT_TOLERANCE_PCT) {
+        /* Additive increase while a larger chunk is not slower. */
+        if (ctl.chunk + CHUNK_STEP <= ctl.max) {
+            ctl.chunk += CHUNK_STEP;
+            ctl.increases++;
+        }
+        else if (ctl.chunk < ctl.max) {
+            ctl.chunk = ctl.max;
+            ctl.increases++;
+        }
+    }
+    ctl.last_bandwidth_bps = bandwidth;
+    pthread_mutex_unlock(&chunk_lock);
+}
+
+
+uint64_t rtt_sample(const xfer_info_t *info)
+{
+    uint64_t sent = info->connect_ns;
+
+    /* The request goes out after the last setup step that took place. */
+    if (info->appconnect_ns > sent) {
+        sent = info->appconnect_ns;
+    }
+    if (info->pretransfer_ns > sent) {
+        sent = info->pretransfer_ns;
+    }
+    return info->ttfb_ns > sent ? info->ttfb_ns - sent : 0;
+}
+
+
+void decrease_locked(void)
+{
+    /* Multiplicative decrease. */
+    ctl.chunk /= 2u;
+    if (ctl.chunk < ctl.min) {
+        ctl.chunk = ctl.min;
+    }
+    ctl.decreases++;
+    ctl.last_bandwidth_bps = 0.0;
+}
+
+
+void qrng_chunk_atfork(e_fork_phase_t phase)
+{
+    /* The learned chunk size describes the same link in the child; it is kept. */
+    if (phase == FORK_PREPARE) {
+        pthread_mutex_lock(&chunk_lock);
+    }
+    else if (phase == FORK_PARENT) {
+        pthread_mutex_unlock(&chunk_lock);
+    }
+    else {
+        pthread_mutex_init(&chunk_lock, NULL);
+    }
+}
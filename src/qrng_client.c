@@ -0,0 +1,377 @@
+/****************************************************************************
+ * libqrng - library for interacting with IDQ's Quantis Appliance           *
+ *                                                                          *
+ * Copyright (C) 2023  Sebastian Mihai Ardelean                             *
+ *                                                                          *
+ * This program is free software: you can redistribute it and/or modify     *
+ * it under the terms of the GNU General Public License as published by     *
+ * the Free Software Foundation, either version 3 of the License, or        *
+ * (at your option) any later version.                                      *
+ *                                                                          *
+ * This program is distributed in the hope that it will be useful,          *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ * GNU General Public License for more details.                             *
+ *                                                                          *
+ * You should have received a copy of the GNU General Public License        *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+
+/**
+ * @file qrng_client.c
+ * @author Sebastian Mihai Ardelean <sebastian.ardelean@cs.upt.ro>
+ * @date 24 May 2023
+ * @brief Client mode: the public calls are forwarded to a qrngd daemon over a Unix socket.
+ *
+ * Each call borrows a socket from a small stack of idle connections (or opens one), sends the
+ * request and reads the payload straight into the caller's buffer. A call that fails on a
+ * reused socket is retried once on a fresh one, so a restarted daemon goes unnoticed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "qrng.h"
+#include "qrng_internal.h"
+#include "qrngd_protocol.h"
+
+#define CLIENT_MAX_IDLE 64u
+#define CLIENT_PIECE 16384u
+
+static bool client_enabled = false;
+static char socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static int idle_fds[CLIENT_MAX_IDLE];
+static size_t idle_count = 0;
+static pthread_mutex_t client_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int connect_daemon(void);
+static int acquire(bool *reused);
+static void release(int fd, bool reusable);
+static int write_all(int fd, const void *data, size_t len);
+static int read_all(int fd, void *data, size_t len);
+static int transact(const qrngd_request_t *request, qrngd_response_t *response);
+static void init_request(qrngd_request_t *request, unsigned op, const s_api_t *req,
+                         const struct timespec *deadline);
+
+
+bool qrng_client_enabled(void)
+{
+    return client_enabled;
+}
+
+
+int qrng_client_open(const char *path)
+{
+    int fd = -1;
+
+    if (path[0] == '\0' || strlen(path) >= sizeof(socket_path)) {
+        fprintf(stderr, "Invalid qrngd socket path\n");
+        return -1;
+    }
+    strcpy(socket_path, path);
+    /* Fail early, like qrng_open does when libcurl cannot be initialized. */
+    fd = connect_daemon();
+    if (fd < 0) {
+        fprintf(stderr, "Cannot connect to qrngd at %s\n", socket_path);
+        return -1;
+    }
+    client_enabled = true;
+    release(fd, true);
+    return 0;
+}
+
+
+void qrng_client_close(void)
+{
+    pthread_mutex_lock(&client_lock);
+    while (idle_count > 0) {
+        close(idle_fds[--idle_count]);
+    }
+    client_enabled = false;
+    pthread_mutex_unlock(&client_lock);
+}
+
+
+void qrng_client_atfork(e_fork_phase_t phase)
+{
+    if (phase == FORK_PREPARE) {
+        pthread_mutex_lock(&client_lock);
+    }
+    else if (phase == FORK_PARENT) {
+        pthread_mutex_unlock(&client_lock);
+    }
+    else {
+        /* Two processes on one daemon connection would read each other's responses; the child
+           opens its own on the next call. */
+        while (idle_count > 0) {
+            close(idle_fds[--idle_count]);
+        }
+        pthread_mutex_init(&client_lock, NULL);
+    }
+}
+
+
+int qrng_client_values(e_req_type_t type, unsigned op, const s_api_t *req, void *buffer,
+                       size_t value_size, const struct timespec *deadline, size_t *filled)
+{
+    qrngd_request_t request;
+    qrngd_response_t response;
+    s_api_t piece = *req;
+    uint8_t *dst = (uint8_t *)buffer;
+    size_t left = req->samples;
+    size_t got = 0;
+    uint64_t start_ns = 0;
+    int retval = 0;
+    int fd = -1;
+
+    /* Split like the stream, so that the daemon's payload limit is invisible to the caller. */
+    do {
+        piece.samples = left < QRNGD_MAX_PAYLOAD / value_size ? left : QRNGD_MAX_PAYLOAD / value_size;
+        start_ns = qrng_stats_start(type, piece.samples);
+        init_request(&request, op, &piece, deadline);
+        fd = transact(&request, &response);
+        if (fd < 0) {
+            retval = -1;
+        }
+        else if (response.length > piece.samples * value_size || response.length % value_size != 0) {
+            fprintf(stderr, "Invalid response from qrngd\n");
+            release(fd, false);
+            retval = -1;
+        }
+        else if (read_all(fd, dst, response.length) != 0) {
+            release(fd, false);
+            retval = -1;
+        }
+        else {
+            release(fd, true);
+            retval = response.status;
+            got += response.length / value_size;
+            dst += response.length;
+            /* A short piece without an error cannot be resumed without skipping values. */
+            if (!retval && response.length != piece.samples * value_size) {
+                retval = -1;
+            }
+        }
+        qrng_stats_record(type, piece.samples, NULL, qrng_now_ns() - start_ns, retval);
+        left -= piece.samples;
+    } while (left > 0 && !retval);
+    if (filled) {
+        *filled = got;
+    }
+    return retval;
+}
+
+
+int qrng_client_stream(e_req_type_t type, unsigned op, FILE *stream, size_t size)
+{
+    qrngd_request_t request;
+    qrngd_response_t response;
+    uint8_t piece[CLIENT_PIECE];
+    s_api_t req;
+    uint64_t start_ns = 0;
+    uint64_t left = 0;
+    size_t len = 0;
+    int retval = 0;
+    int fd = -1;
+
+    memset(&req, 0, sizeof(req));
+    /* Info requests carry no size and are sent once. */
+    do {
+        req.samples = size < QRNGD_MAX_PAYLOAD ? size : QRNGD_MAX_PAYLOAD;
+        start_ns = qrng_stats_start(type, req.samples);
+        init_request(&request, op, &req, NULL);
+        fd = transact(&request, &response);
+        if (fd < 0) {
+            retval = -1;
+        }
+        else if (op == QRNGD_OP_STREAM && response.length > req.samples) {
+            fprintf(stderr, "Invalid response from qrngd\n");
+            release(fd, false);
+            retval = -1;
+        }
+        else {
+            /* A full stream still consumes the payload, to keep the connection in sync. */
+            for (left = response.length; left > 0; left -= len) {
+                len = left < sizeof(piece) ? (size_t)left : sizeof(piece);
+                if (read_all(fd, piece, len) != 0) {
+                    break;
+                }
+                if (!retval && fwrite(piece, 1, len, stream) != len) {
+                    retval = -1;
+                }
+            }
+            memset(piece, 0, sizeof(piece));
+            release(fd, left == 0);
+            if (left > 0) {
+                retval = -1;
+            }
+            else if (!retval) {
+                retval = response.status;
+            }
+        }
+        qrng_stats_record(type, req.samples, NULL, qrng_now_ns() - start_ns, retval);
+        size -= req.samples;
+    } while (size > 0 && !retval);
+    return retval;
+}
+
+
+size_t qrng_client_warmup(size_t connections)
+{
+    size_t opened = 0;
+    int fd = -1;
+
+    while (opened < connections && opened < CLIENT_MAX_IDLE) {
+        fd = connect_daemon();
+        if (fd < 0) {
+            break;
+        }
+        release(fd, true);
+        opened++;
+    }
+    return opened;
+}
+
+
+int connect_daemon(void)
+{
+    struct sockaddr_un addr;
+    int fd = -1;
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+int acquire(bool *reused)
+{
+    int fd = -1;
+
+    pthread_mutex_lock(&client_lock);
+    if (idle_count > 0) {
+        fd = idle_fds[--idle_count];
+    }
+    pthread_mutex_unlock(&client_lock);
+    *reused = fd >= 0;
+    return fd >= 0 ? fd : connect_daemon();
+}
+
+
+void release(int fd, bool reusable)
+{
+    pthread_mutex_lock(&client_lock);
+    if (reusable && client_enabled && idle_count < CLIENT_MAX_IDLE) {
+        idle_fds[idle_count++] = fd;
+        fd = -1;
+    }
+    pthread_mutex_unlock(&client_lock);
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+
+int write_all(int fd, const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    ssize_t n = 0;
+
+    while (len > 0) {
+        /* A daemon gone away must be an error code, not a SIGPIPE. */
+        n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+
+int read_all(int fd, void *data, size_t len)
+{
+    uint8_t *p = (uint8_t *)data;
+    ssize_t n = 0;
+
+    while (len > 0) {
+        n = recv(fd, p, len, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+
+int transact(const qrngd_request_t *request, qrngd_response_t *response)
+{
+    bool reused = false;
+    int attempt = 0;
+    int fd = -1;
+
+    for (attempt = 0; attempt < 2; attempt++) {
+        fd = acquire(&reused);
+        if (fd < 0) {
+            fprintf(stderr, "Cannot connect to qrngd at %s\n", socket_path);
+            return -1;
+        }
+        if (write_all(fd, request, sizeof(*request)) == 0 &&
+            read_all(fd, response, sizeof(*response)) == 0) {
+            return fd;
+        }
+        release(fd, false);
+        if (!reused) {
+            break;
+        }
+    }
+    fprintf(stderr, "Lost the connection to qrngd\n");
+    return -1;
+}
+
+
+void init_request(qrngd_request_t *request, unsigned op, const s_api_t *req,
+                  const struct timespec *deadline)
+{
+    memset(request, 0, sizeof(*request));
+    request->magic = QRNGD_MAGIC;
+    request->version = QRNGD_VERSION;
+    request->op = (uint16_t)op;
+    request->samples = req->samples;
+    request->min_i = req->min_range_i;
+    request->max_i = req->max_range_i;
+    request->min_f = req->min_range_f;
+    request->max_f = req->max_range_f;
+    /* Same host, same monotonic clock: the deadline travels as is. */
+    if (deadline) {
+        request->deadline_ns = (uint64_t)deadline->tv_sec * 1000000000u + (uint64_t)deadline->tv_nsec;
+        if (request->deadline_ns == 0) {
+            request->deadline_ns = 1;
+        }
+    }
+}
@@ -0,0 +1,262 @@
+/****************************************************************************
+ * libqrng - library for interacting with IDQ's Quantis Appliance           *
+ *                                                                          *
+ * Copyright (C) 2023  Sebastian Mihai Ardelean                             *
+ *                                                                          *
+ * This program is free software: you can redistribute it and/or modify     *
+ * it under the terms of the GNU General Public License as published by     *
+ * the Free Software Foundation, either version 3 of the License, or        *
+ * (at your option) any later version.                                      *
+ *                                                                          *
+ * This program is distributed in the hope that it will be useful,          *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ * GNU General Public License for more details.                             *
+ *                                                                          *
+ * You should have received a copy of the GNU General Public License        *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+
+/**
+ * @file qrng_coalesce.c
+ * @author Sebastian Mihai Ardelean <sebastian.ardelean@cs.upt.ro>
+ * @date 24 May 2023
+ * @brief Merging of concurrent small requests into a single appliance request.
+ *
+ * The first thread asking for a given type and range becomes the leader of a batch. It waits
+ * for the coalescing window, or until the batch reaches the size threshold, while other threads
+ * asking for the same type and range append themselves to the batch. The leader then issues one
+ * request for the sum of the samples and copies each waiter's share into its buffer.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "qrng.h"
+#include "qrng_internal.h"
+
+#define COALESCE_SLOTS 16u
+
+typedef struct waiter_s {
+    void *buffer;
+    size_t samples;
+    struct waiter_s *next;
+}waiter_t;
+
+typedef struct {
+    s_api_t req;
+    waiter_t *first;
+    waiter_t *last;
+    size_t users;
+    bool open;
+    bool done;
+    int result;
+    pthread_cond_t full;
+    pthread_cond_t finished;
+}batch_t;
+
+static batch_t batches[COALESCE_SLOTS];
+static bool batches_ready = false;
+static pthread_mutex_t coalesce_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Window in microseconds and size threshold in samples; a zero window disables coalescing. */
+static unsigned long window_us = 0;
+static size_t max_samples = 0;
+
+#ifndef NO_DYNAMIC_MEMORY_ALLOCATION
+static bool same_key(const s_api_t *a, const s_api_t *b);
+static batch_t *find_open_batch(const s_api_t *req, size_t samples);
+static batch_t *claim_free_batch(void);
+static int lead_batch(batch_t *batch, size_t value_size);
+#endif
+
+
+void qrng_set_coalescing(unsigned long window_microseconds, size_t max_batch_samples)
+{
+    size_t i = 0;
+
+    pthread_mutex_lock(&coalesce_lock);
+    if (!batches_ready) {
+        for (i = 0; i < COALESCE_SLOTS; i++) {
+            pthread_cond_init(&batches[i].full, NULL);
+            pthread_cond_init(&batches[i].finished, NULL);
+        }
+        batches_ready = true;
+    }
+    window_us = window_microseconds;
+    max_samples = max_batch_samples;
+    pthread_mutex_unlock(&coalesce_lock);
+}
+
+
+void qrng_coalesce_atfork(e_fork_phase_t phase)
+{
+    size_t i = 0;
+
+    if (phase == FORK_PREPARE) {
+        pthread_mutex_lock(&coalesce_lock);
+        return;
+    }
+    if (phase == FORK_PARENT) {
+        pthread_mutex_unlock(&coalesce_lock);
+        return;
+    }
+    /* Leaders and joiners of open batches stayed in the parent; their slots are free here. */
+    for (i = 0; i < COALESCE_SLOTS; i++) {
+        batches[i].first = NULL;
+        batches[i].last = NULL;
+        batches[i].users = 0;
+        batches[i].open = false;
+        batches[i].done = true;
+        if (batches_ready) {
+            pthread_cond_init(&batches[i].full, NULL);
+            pthread_cond_init(&batches[i].finished, NULL);
+        }
+    }
+    pthread_mutex_init(&coalesce_lock, NULL);
+}
+
+
+int qrng_coalesce_request(const s_api_t *req, void *buffer, size_t value_size)
+{
+#ifdef NO_DYNAMIC_MEMORY_ALLOCATION
+    /* Merged responses need a scratch buffer sized at run time. */
+    return qrng_fetch_typed(req, buffer, value_size, 0);
+#else
+    int retval = 0;
+    batch_t *batch = NULL;
+    waiter_t self = { .buffer = buffer, .samples = req->samples, .next = NULL };
+
+    pthread_mutex_lock(&coalesce_lock);
+    if (window_us == 0 || req->samples == 0 || req->samples > max_samples) {
+        pthread_mutex_unlock(&coalesce_lock);
+        return qrng_fetch_typed(req, buffer, value_size, 0);
+    }
+
+    batch = find_open_batch(req, req->samples);
+    if (batch != NULL) {
+        /* Join the batch and let the leader fetch for us. */
+        batch->last->next = &self;
+        batch->last = &self;
+        batch->req.samples += req->samples;
+        batch->users++;
+        if (batch->req.samples >= max_samples) {
+            pthread_cond_signal(&batch->full);
+        }
+        while (!batch->done) {
+            pthread_cond_wait(&batch->finished, &coalesce_lock);
+        }
+        retval = batch->result;
+        batch->users--;
+        pthread_mutex_unlock(&coalesce_lock);
+        return retval;
+    }
+
+    batch = claim_free_batch();
+    if (batch == NULL) {
+        pthread_mutex_unlock(&coalesce_lock);
+        return qrng_fetch_typed(req, buffer, value_size, 0);
+    }
+    batch->req = *req;
+    batch->first = &self;
+    batch->last = &self;
+    batch->users = 1;
+    batch->open = true;
+    batch->done = false;
+    retval = lead_batch(batch, value_size);
+    batch->users--;
+    pthread_mutex_unlock(&coalesce_lock);
+    return retval;
+#endif
+}
+
+
+#ifndef NO_DYNAMIC_MEMORY_ALLOCATION
+int lead_batch(batch_t *batch, size_t value_size)
+{
+    struct timespec until;
+    uint8_t *merged = NULL;
+    size_t offset = 0;
+    waiter_t *w = NULL;
+    int retval = 0;
+
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_nsec += (long)(window_us % 1000000u) * 1000L;
+    until.tv_sec += (time_t)(window_us / 1000000u) + until.tv_nsec / 1000000000L;
+    until.tv_nsec %= 1000000000L;
+    while (batch->req.samples < max_samples &&
+           pthread_cond_timedwait(&batch->full, &coalesce_lock, &until) == 0) {
+        /* woken up by a joiner; re-check the threshold */
+    }
+    /* From here on nobody can join; the waiter list is stable. */
+    batch->open = false;
+    pthread_mutex_unlock(&coalesce_lock);
+
+    if (batch->first == batch->last) {
+        retval = qrng_fetch_typed(&batch->req, batch->first->buffer, value_size, 0);
+    }
+    else {
+        merged = malloc(batch->req.samples * value_size);
+        if (merged == NULL) {
+            fprintf(stderr, "Not enough memory to coalesce requests\n");
+            retval = -1;
+        }
+        else {
+            retval = qrng_fetch_typed(&batch->req, (void *)merged, value_size, 0);
+            if (!retval) {
+                for (w = batch->first; w != NULL; w = w->next) {
+                    memcpy(w->buffer, merged + offset, w->samples * value_size);
+                    offset += w->samples * value_size;
+                }
+            }
+            memset(merged, 0, batch->req.samples * value_size);
+            free(merged);
+        }
+    }
+
+    pthread_mutex_lock(&coalesce_lock);
+    batch->result = retval;
+    batch->done = true;
+    pthread_cond_broadcast(&batch->finished);
+    return retval;
+}
+
+
+bool same_key(const s_api_t *a, const s_api_t *b)
+{
+    return a->type == b->type &&
+        a->min_range_i == b->min_range_i && a->max_range_i == b->max_range_i &&
+        a->min_range_f == b->min_range_f && a->max_range_f == b->max_range_f;
+}
+
+
+batch_t *find_open_batch(const s_api_t *req, size_t samples)
+{
+    size_t i = 0;
+
+    for (i = 0; i < COALESCE_SLOTS; i++) {
+        if (batches[i].open && same_key(&batches[i].req, req) &&
+            batches[i].req.samples + samples <= max_samples) {
+            return &batches[i];
+        }
+    }
+    return NULL;
+}
+
+
+batch_t *claim_free_batch(void)
+{
+    size_t i = 0;
+
+    for (i = 0; i < COALESCE_SLOTS; i++) {
+        /* A finished batch is reusable once every waiter has read its result. */
+        if (!batches[i].open && batches[i].users == 0) {
+            return &batches[i];
+        }
+    }
+    return NULL;
+}
+#endif /* NO_DYNAMIC_MEMORY_ALLOCATION */
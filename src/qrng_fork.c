@@ -0,0 +1,115 @@
+/****************************************************************************
+ * libqrng - library for interacting with IDQ's Quantis Appliance           *
+ *                                                                          *
+ * Copyright (C) 2023  Sebastian Mihai Ardelean                             *
+ *                                                                          *
+ * This program is free software: you can redistribute it and/or modify     *
+ * it under the terms of the GNU General Public License as published by     *
+ * the Free Software Foundation, either version 3 of the License, or        *
+ * (at your option) any later version.                                      *
+ *                                                                          *
+ * This program is distributed in the hope that it will be useful,          *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ * GNU General Public License for more details.                             *
+ *                                                                          *
+ * You should have received a copy of the GNU General Public License        *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+
+/**
+ * @file qrng_fork.c
+ * @author Sebastian Mihai Ardelean <sebastian.ardelean@cs.upt.ro>
+ * @date 24 May 2023
+ * @brief Fork safety: buffered bytes and appliance connections never cross a fork.
+ *
+ * Before a fork every module lock is taken, so the child starts from consistent state. In
+ * the child the handlers only do what is safe in a forked multi-threaded process: close
+ * inherited sockets, wipe small buffers and reinitialize locks. They also bump a generation
+ * counter. Work that needs libcurl, malloc or threads (new connections, restarting the pool)
+ * happens lazily, the first time a module finds its saved generation out of date. The parent
+ * keeps all of its state.
+ */
+#include <stdio.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "qrng.h"
+#include "qrng_internal.h"
+
+typedef void (*fork_hook_t)(e_fork_phase_t phase);
+
+/* Outermost lock first: the pool and the reserve call the chunk controller with theirs held. */
+static const fork_hook_t hooks[] = {
+    &qrng_info_atfork,
+    &qrng_coalesce_atfork,
+    &qrng_sched_atfork,
+    &qrng_client_atfork,
+    &qrng_pool_atfork,
+    &qrng_reserve_atfork,
+    &qrng_ring_atfork,
+    &qrng_lanes_atfork,
+    &qrng_transport_atfork,
+    &qrng_backend_atfork,
+    &qrng_chunk_atfork
+};
+
+#define NUMBER_OF_HOOKS (sizeof(hooks) / sizeof(hooks[0]))
+
+static atomic_uint generation = 0;
+static pthread_once_t install_once = PTHREAD_ONCE_INIT;
+
+static void fork_install(void);
+static void fork_prepare(void);
+static void fork_parent(void);
+static void fork_child(void);
+
+
+void qrng_fork_init(void)
+{
+    pthread_once(&install_once, &fork_install);
+}
+
+
+unsigned qrng_fork_generation(void)
+{
+    return atomic_load(&generation);
+}
+
+
+void fork_install(void)
+{
+    if (pthread_atfork(&fork_prepare, &fork_parent, &fork_child) != 0) {
+        fprintf(stderr, "Cannot install the fork handlers\n");
+    }
+}
+
+
+void fork_prepare(void)
+{
+    size_t i = 0;
+
+    for (i = 0; i < NUMBER_OF_HOOKS; i++) {
+        hooks[i](FORK_PREPARE);
+    }
+}
+
+
+void fork_parent(void)
+{
+    size_t i = NUMBER_OF_HOOKS;
+
+    while (i > 0) {
+        hooks[--i](FORK_PARENT);
+    }
+}
+
+
+void fork_child(void)
+{
+    size_t i = NUMBER_OF_HOOKS;
+
+    atomic_fetch_add(&generation, 1u);
+    while (i > 0) {
+        hooks[--i](FORK_CHILD);
+    }
+}
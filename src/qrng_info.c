@@ -0,0 +1,423 @@
+/****************************************************************************
+ * libqrng - library for interacting with IDQ's Quantis Appliance           *
+ *                                                                          *
+ * Copyright (C) 2023  Sebastian Mihai Ardelean                             *
+ *                                                                          *
+ * This program is free software: you can redistribute it and/or modify     *
+ * it under the terms of the GNU General Public License as published by     *
+ * the Free Software Foundation, either version 3 of the License, or        *
+ * (at your option) any later version.                                      *
+ *                                                                          *
+ * This program is distributed in the hope that it will be useful,          *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ * GNU General Public License for more details.                             *
+ *                                                                          *
+ * You should have received a copy of the GNU General Public License        *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+
+/**
+ * @file qrng_info.c
+ * @author Sebastian Mihai Ardelean <sebastian.ardelean@cs.upt.ro>
+ * @date 24 May 2023
+ * @brief Cached, parsed firmware and system information.
+ *
+ * Each kind of information has one cache entry. A caller that finds it older than the TTL
+ * becomes the fetcher; callers arriving while the fetch is in flight wait for its result
+ * instead of sending their own (single flight). The fetch goes through @qrng_firmware_info@ or
+ * @qrng_system_info@ into a memory stream, so it works the same in client mode. An optional
+ * thread refreshes the entries ahead of expiry, so that readers never wait for the appliance.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "qrng.h"
+#include "qrng_internal.h"
+
+#define DEFAULT_INFO_TTL_MS 5000u
+
+typedef enum {
+    INFO_FIRMWARE = 0,
+    INFO_SYSTEM,
+    NUMBER_OF_INFO_KINDS
+}e_info_kind_t;
+
+/**
+ * @brief Cache entry of one kind of information.
+ */
+typedef struct {
+    struct qrng_info info;
+    uint64_t fetched_ns;
+    bool valid;
+    bool fetching;
+    int error;
+    /* Completed fetches; waiters compare it to know theirs is done. */
+    uint64_t fetches;
+}info_entry_t;
+
+static info_entry_t entries[NUMBER_OF_INFO_KINDS];
+static uint64_t ttl_ns = (uint64_t)DEFAULT_INFO_TTL_MS * 1000000u;
+static uint64_t refresh_ns = 0;
+static bool refresher_running = false;
+static unsigned refresher_generation = 0;
+static pthread_t refresher;
+static pthread_mutex_t info_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t info_fetched = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t refresher_wake = PTHREAD_COND_INITIALIZER;
+
+static int get_info(e_info_kind_t kind, struct qrng_info *info);
+static int fetch_locked(e_info_kind_t kind);
+static void *refresher_thread(void *arg);
+static void stop_refresher(void);
+static void parse_object(const char *text, struct qrng_info *info);
+static const char *skip_space(const char *p);
+static const char *parse_string(const char *p, char *out, size_t length);
+static const char *parse_value(const char *p, char *out, size_t length);
+
+
+int qrng_get_firmware_info(struct qrng_info *info)
+{
+    return get_info(INFO_FIRMWARE, info);
+}
+
+
+int qrng_get_system_info(struct qrng_info *info)
+{
+    return get_info(INFO_SYSTEM, info);
+}
+
+
+const char *qrng_info_value(const struct qrng_info *info, const char *key)
+{
+    size_t i = 0;
+
+    if (info == NULL || key == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < info->count; i++) {
+        if (strcmp(info->fields[i].key, key) == 0) {
+            return info->fields[i].value;
+        }
+    }
+    return NULL;
+}
+
+
+int qrng_set_info_cache(uint64_t ttl_ms, uint64_t refresh_ms)
+{
+    int retval = 0;
+
+    if (refresh_ms > 0 && ttl_ms > 0 && refresh_ms >= ttl_ms) {
+        return -1;
+    }
+    stop_refresher();
+    pthread_mutex_lock(&info_lock);
+    ttl_ns = ttl_ms * 1000000u;
+    refresh_ns = refresh_ms * 1000000u;
+    if (refresh_ns > 0) {
+        refresher_running = true;
+        refresher_generation = qrng_fork_generation();
+        if (pthread_create(&refresher, NULL, &refresher_thread, NULL) != 0) {
+            fprintf(stderr, "Cannot start the info refresher\n");
+            refresher_running = false;
+            refresh_ns = 0;
+            retval = -1;
+        }
+    }
+    pthread_mutex_unlock(&info_lock);
+    return retval;
+}
+
+
+void qrng_info_close(void)
+{
+    size_t kind = 0;
+
+    stop_refresher();
+    pthread_mutex_lock(&info_lock);
+    /* The next qrng_open may point at another appliance. */
+    for (kind = 0; kind < NUMBER_OF_INFO_KINDS; kind++) {
+        entries[kind].valid = false;
+    }
+    pthread_mutex_unlock(&info_lock);
+}
+
+
+void qrng_info_atfork(e_fork_phase_t phase)
+{
+    size_t kind = 0;
+
+    if (phase == FORK_PREPARE) {
+        pthread_mutex_lock(&info_lock);
+        return;
+    }
+    if (phase == FORK_PARENT) {
+        pthread_mutex_unlock(&info_lock);
+        return;
+    }
+    /* Cached values stay valid; fetches in flight and the refresher stayed in the parent. */
+    for (kind = 0; kind < NUMBER_OF_INFO_KINDS; kind++) {
+        entries[kind].fetching = false;
+    }
+    pthread_cond_init(&info_fetched, NULL);
+    pthread_cond_init(&refresher_wake, NULL);
+    pthread_mutex_init(&info_lock, NULL);
+}
+
+
+int get_info(e_info_kind_t kind, struct qrng_info *info)
+{
+    info_entry_t *entry = &entries[kind];
+    uint64_t now = 0;
+    int retval = 0;
+
+    if (info == NULL) {
+        return -1;
+    }
+    pthread_mutex_lock(&info_lock);
+    /* A forked child restarts the refresher it inherited the settings of. */
+    if (refresh_ns > 0 && refresher_generation != qrng_fork_generation()) {
+        refresher_generation = qrng_fork_generation();
+        refresher_running = pthread_create(&refresher, NULL, &refresher_thread, NULL) == 0;
+    }
+    now = qrng_now_ns();
+    if (!entry->valid || now - entry->fetched_ns >= ttl_ns) {
+        retval = fetch_locked(kind);
+    }
+    if (!retval) {
+        *info = entry->info;
+        info->age_ns = qrng_now_ns() - entry->fetched_ns;
+    }
+    pthread_mutex_unlock(&info_lock);
+    return retval;
+}
+
+
+int fetch_locked(e_info_kind_t kind)
+{
+    info_entry_t *entry = &entries[kind];
+    char body[QRNG_INFO_MAX_RAW];
+    uint64_t fetches = entry->fetches;
+    FILE *stream = NULL;
+    long length = 0;
+    int retval = 0;
+
+    if (entry->fetching) {
+        /* Single flight: share the result of the fetch already on its way. */
+        while (entry->fetches == fetches) {
+            pthread_cond_wait(&info_fetched, &info_lock);
+        }
+        return entry->error;
+    }
+    entry->fetching = true;
+    pthread_mutex_unlock(&info_lock);
+
+    memset(body, 0, sizeof(body));
+    /* One byte short, so the body is always NUL terminated; a larger body fails the write. */
+    stream = fmemopen(body, sizeof(body) - 1u, "w");
+    if (stream == NULL) {
+        fprintf(stderr, "Cannot open a memory stream: %s\n", strerror(errno));
+        retval = -1;
+    }
+    else {
+        setvbuf(stream, NULL, _IONBF, 0);
+        retval = kind == INFO_FIRMWARE ? qrng_firmware_info((void *)stream) : qrng_system_info((void *)stream);
+        length = ftell(stream);
+        fclose(stream);
+    }
+
+    pthread_mutex_lock(&info_lock);
+    if (!retval && length >= 0) {
+        memset(&entry->info, 0, sizeof(entry->info));
+        memcpy(entry->info.raw, body, (size_t)length);
+        parse_object(entry->info.raw, &entry->info);
+        entry->fetched_ns = qrng_now_ns();
+        entry->valid = true;
+    }
+    entry->error = retval;
+    entry->fetching = false;
+    entry->fetches++;
+    pthread_cond_broadcast(&info_fetched);
+    return retval;
+}
+
+
+void *refresher_thread(void *arg)
+{
+    struct timespec wake;
+    uint64_t when = 0;
+    size_t kind = 0;
+
+    (void)arg;
+    pthread_mutex_lock(&info_lock);
+    while (refresher_running) {
+        for (kind = 0; kind < NUMBER_OF_INFO_KINDS; kind++) {
+            /* Early enough that a reader never finds the entry expired. */
+            if (!entries[kind].fetching &&
+                (!entries[kind].valid || qrng_now_ns() - entries[kind].fetched_ns >= refresh_ns)) {
+                (void)fetch_locked((e_info_kind_t)kind);
+            }
+        }
+        when = qrng_now_ns() + refresh_ns;
+        clock_gettime(CLOCK_REALTIME, &wake);
+        /* The condition uses the realtime clock; only the interval is taken from the monotonic one. */
+        wake.tv_sec += (time_t)(refresh_ns / 1000000000u);
+        wake.tv_nsec += (long)(refresh_ns % 1000000000u);
+        if (wake.tv_nsec >= 1000000000L) {
+            wake.tv_sec++;
+            wake.tv_nsec -= 1000000000L;
+        }
+        while (refresher_running && qrng_now_ns() < when &&
+               pthread_cond_timedwait(&refresher_wake, &info_lock, &wake) != ETIMEDOUT) {
+            ;
+        }
+    }
+    pthread_mutex_unlock(&info_lock);
+    return NULL;
+}
+
+
+void stop_refresher(void)
+{
+    bool joinable = false;
+
+    pthread_mutex_lock(&info_lock);
+    joinable = refresher_running && refresher_generation == qrng_fork_generation();
+    refresher_running = false;
+    refresh_ns = 0;
+    pthread_cond_broadcast(&refresher_wake);
+    pthread_mutex_unlock(&info_lock);
+    if (joinable) {
+        pthread_join(refresher, NULL);
+    }
+}
+
+
+void parse_object(const char *text, struct qrng_info *info)
+{
+    struct qrng_info_field *field = NULL;
+    char ignored[QRNG_INFO_VALUE_LENGTH];
+    const char *p = skip_space(text);
+
+    /* Flat view of a JSON object: nested objects and arrays are kept as their JSON text. */
+    if (*p != '{') {
+        return;
+    }
+    p = skip_space(p + 1);
+    while (p != NULL && *p == '"') {
+        field = info->count < QRNG_INFO_MAX_FIELDS ? &info->fields[info->count] : NULL;
+        p = parse_string(p, field ? field->key : ignored, field ? sizeof(field->key) : sizeof(ignored));
+        p = p ? skip_space(p) : NULL;
+        if (p == NULL || *p != ':') {
+            break;
+        }
+        p = parse_value(skip_space(p + 1), field ? field->value : ignored,
+                        field ? sizeof(field->value) : sizeof(ignored));
+        if (p == NULL) {
+            break;
+        }
+        if (field) {
+            info->count++;
+        }
+        p = skip_space(p);
+        if (*p != ',') {
+            break;
+        }
+        p = skip_space(p + 1);
+    }
+}
+
+
+const char *skip_space(const char *p)
+{
+    while (isspace((unsigned char)*p)) {
+        p++;
+    }
+    return p;
+}
+
+
+const char *parse_string(const char *p, char *out, size_t length)
+{
+    size_t n = 0;
+    char c = 0;
+
+    for (p++; *p != '\0' && *p != '"'; p++) {
+        c = *p;
+        if (c == '\\') {
+            p++;
+            switch (*p) {
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case 'r': c = '\r'; break;
+                case 'b': c = '\b'; break;
+                case 'f': c = '\f'; break;
+                case 'u':
+                    /* Kept escaped: the values of interest are ASCII. */
+                    c = '\\';
+                    p--;
+                    break;
+                case '\0':
+                    return NULL;
+                default:
+                    c = *p;
+                    break;
+            }
+        }
+        if (n + 1u < length) {
+            out[n++] = c;
+        }
+    }
+    out[n] = '\0';
+    return *p == '"' ? p + 1 : NULL;
+}
+
+
+const char *parse_value(const char *p, char *out, size_t length)
+{
+    const char *start = p;
+    size_t depth = 0;
+    size_t n = 0;
+    bool quoted = false;
+
+    if (*p == '"') {
+        return parse_string(p, out, length);
+    }
+    for (; *p != '\0'; p++) {
+        if (quoted) {
+            if (*p == '\\' && p[1] != '\0') {
+                p++;
+            }
+            else if (*p == '"') {
+                quoted = false;
+            }
+            continue;
+        }
+        if (*p == '"') {
+            quoted = true;
+        }
+        else if (*p == '{' || *p == '[') {
+            depth++;
+        }
+        else if ((*p == '}' || *p == ']') && depth > 0) {
+            depth--;
+        }
+        else if (depth == 0 && (*p == ',' || *p == '}' || isspace((unsigned char)*p))) {
+            break;
+        }
+    }
+    if (p == start) {
+        return NULL;
+    }
+    n = (size_t)(p - start) < length ? (size_t)(p - start) : length - 1u;
+    memcpy(out, start, n);
+    out[n] = '\0';
+    return p;
+}
@@ -0,0 +1,544 @@
+/****************************************************************************
+ * libqrng - library for interacting with IDQ's Quantis Appliance           *
+ *                                                                          *
+ * Copyright (C) 2023  Sebastian Mihai Ardelean                             *
+ *                                                                          *
+ * This program is free software: you can redistribute it and/or modify     *
+ * it under the terms of the GNU General Public License as published by     *
+ * the Free Software Foundation, either version 3 of the License, or        *
+ * (at your option) any later version.                                      *
+ *                                                                          *
+ * This program is distributed in the hope that it will be useful,          *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ * GNU General Public License for more details.                             *
+ *                                                                          *
+ * You should have received a copy of the GNU General Public License        *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+
+/**
+ * @file qrng_internal.h
+ * @author Sebastian Mihai Ardelean <sebastian.ardelean@cs.upt.ro>
+ * @date 24 May 2023
+ * @brief Declarations shared between the libqrng translation units. Not installed.
+ */
+
+#ifndef QRNG_INTERNAL_H
+#define QRNG_INTERNAL_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <time.h>
+#include <curl/curl.h>
+
+/* Scheme and domain address, e.g. "https://" followed by up to 253 characters. */
+#define DOMAIN_ADDRESS_LENGTH 262u
+#define URL_MAX_LENGTH 512u
+#define QRNG_MAX_LANE_CONNECTIONS 8u
+#define QRNG_CHUNK_MAX_BYTES (1024u * 1024u)
+
+/**
+ * @brief Kinds of request sent to the appliance.
+ */
+typedef enum {
+  BYTES_RANDOM_NUMBER = 0,
+  INT16_RANDOM_NUMBER,
+  INT32_RANDOM_NUMBER,
+  DOUBLE_RANDOM_NUMBER,
+  FLOAT_RANDOM_NUMBER,
+  STREAM_BINARY,
+  PERFORMANCE_REQUEST,
+  FIRMWARE_INFO_REQUEST,
+  SYSTEM_INFO_REQUEST,
+  NUMBER_OF_REQUESTS
+}e_req_type_t;
+
+/**
+ * @brief Parameters of one request; api_types holds a template per request kind.
+ */
+typedef struct
+{
+  e_req_type_t type;
+  const char *api_url;
+  char domain_address[DOMAIN_ADDRESS_LENGTH];
+  size_t samples;
+  int32_t min_range_i;
+  int32_t max_range_i;
+  double min_range_f;
+  double max_range_f;
+}s_api_t;
+
+/**
+ * @brief Body of a JSON response, NUL terminated.
+ */
+#ifdef NO_DYNAMIC_MEMORY_ALLOCATION
+#define TOTAL_MAX_SIZE_RESPONSE CURL_MAX_HTTP_HEADER
+typedef struct {
+  char memory[TOTAL_MAX_SIZE_RESPONSE];
+  size_t size;
+}memory_t;
+#else
+typedef struct {
+    char *memory;
+    size_t size;
+}memory_t;
+#endif
+
+/**
+ * @brief Signature of the libcurl write callbacks below.
+ */
+typedef size_t (*qrng_write_cbk_t)(void *content, size_t size, size_t nmemb, void *userp);
+
+/**
+ * @brief Destination of a raw (streambytes) transfer.
+ * The write callback copies at most @cap@ bytes into @dst@ and never allocates.
+ */
+typedef struct {
+    uint8_t *dst;
+    size_t cap;
+    size_t len;
+}raw_sink_t;
+
+/**
+ * @brief Timing of one completed transfer, read back from the easy handle.
+ */
+typedef struct {
+    uint64_t namelookup_ns;
+    uint64_t connect_ns;
+    uint64_t appconnect_ns;
+    uint64_t pretransfer_ns;
+    uint64_t ttfb_ns;
+    uint64_t total_ns;
+    uint64_t bytes;
+    uint64_t header_bytes;
+    uint64_t speed_bps;
+    uint64_t new_connections;
+}xfer_info_t;
+
+/**
+ * @brief Request classes; each one owns its own connections.
+ */
+typedef enum {
+    LANE_INTERACTIVE = 0,
+    LANE_BULK,
+    NUMBER_OF_LANES
+}e_lane_t;
+
+/**
+ * @brief A libcurl easy handle reserved to a lane.
+ */
+typedef struct {
+    CURL *handle;
+    e_lane_t lane;
+    bool busy;
+}conn_t;
+
+/**
+ * @brief One configured entropy source of the chain, see qrng_backend.c.
+ */
+typedef struct qrng_source qrng_source_t;
+
+/**
+ * @brief Operations of an entropy backend, see qrng_backend.c.
+ * A source is one configured instance of a backend. Fill functions return 0, -1 on failure
+ * (the next source of the chain takes over) or QRNG_DEADLINE_EXCEEDED.
+ */
+typedef struct {
+    const char *name;   /*!< scheme selecting the backend, "name:" in the address */
+    int (*open)(qrng_source_t *src, const char *address);
+    /* @handle@ is the caller's appliance connection; local backends ignore it. */
+    int (*fill_bytes)(qrng_source_t *src, CURL *handle, size_t size, qrng_write_cbk_t cbk, void *data,
+                      long timeout_ms, xfer_info_t *info);
+    int (*fill_typed)(qrng_source_t *src, const s_api_t *req, void *buffer, size_t value_size,
+                      long timeout_ms, xfer_info_t *info);
+    void (*stats)(const qrng_source_t *src, struct qrng_backend_stats *stats);
+    void (*close)(qrng_source_t *src);
+}qrng_backend_t;
+
+/**
+ * @brief Phases of a @fork@, as seen by the @pthread_atfork@ handlers of each module.
+ */
+typedef enum {
+    FORK_PREPARE = 0,
+    FORK_PARENT,
+    FORK_CHILD
+}e_fork_phase_t;
+
+/**
+ * @brief True between a successful @qrng_open@ and @qrng_close@.
+ */
+bool qrng_is_open(void);
+
+/**
+ * @brief Initialize @req@ from the template of the given request kind.
+ */
+void qrng_request_init(s_api_t *req, e_req_type_t type);
+
+/**
+ * @brief Monotonic clock in nanoseconds.
+ */
+uint64_t qrng_now_ns(void);
+
+/**
+ * @brief Milliseconds left until an absolute @CLOCK_MONOTONIC@ deadline.
+ * @return 0 if the deadline already passed, -1 if @deadline@ is NULL (no limit).
+ */
+long qrng_ms_until(const struct timespec *deadline);
+
+/**
+ * @brief An absolute @CLOCK_MONOTONIC@ deadline in @qrng_now_ns@ units, 0 if @deadline@ is NULL (no limit).
+ */
+uint64_t qrng_deadline_ns(const struct timespec *deadline);
+
+/**
+ * @brief libcurl write callback appending the response to a @memory_t@.
+ */
+size_t qrng_memory_write_cbk(void *content, size_t size, size_t nmemb, void *userp);
+
+/**
+ * @brief libcurl write callback copying the response into a @raw_sink_t@.
+ */
+size_t qrng_raw_write_cbk(void *content, size_t size, size_t nmemb, void *userp);
+
+/**
+ * @brief libcurl write callback writing the response to a @FILE@.
+ */
+size_t qrng_stream_write_cbk(void *content, size_t size, size_t nmemb, void *userp);
+
+/**
+ * @brief Parse a JSON array response into @samples@ values of the given kind.
+ * @param random_values_string response body; it is modified while tokenizing.
+ */
+void qrng_parse_response(char *random_values_string, void *buffer, size_t samples, e_req_type_t request_type);
+
+/**
+ * @brief Map 8 raw bytes (top 53 bits) to a double in [min, max).
+ */
+double qrng_bytes_to_double(double min, double max, const uint8_t *bytes);
+
+/**
+ * @brief Fetch raw bytes from the streambytes endpoint on the given handle.
+ * @param handle easy handle to use. It is not shared with other threads while the call runs.
+ * @param size number of bytes to request.
+ * @param out destination, at least @size@ bytes.
+ * @param received number of bytes written to @out@, also on failure.
+ * @param timeout_ms transfer timeout, 0 for none.
+ * @return 0 on SUCCESS, QRNG_DEADLINE_EXCEEDED on timeout and -1 on any other error.
+ */
+int qrng_fetch_raw(CURL *handle, size_t size, uint8_t *out, size_t *received, long timeout_ms);
+
+/**
+ * @brief qrng_fetch_raw for the performance probe: waits for the scheduler, no timeout, and
+ * does not feed the transfer size controller.
+ * @return 0 on SUCCESS, -1 on error.
+ */
+int qrng_probe_raw(CURL *handle, size_t size, uint8_t *out, size_t *received);
+
+/**
+ * @brief Request typed values (JSON endpoints) and parse them into @buffer@.
+ * @param req request parameters, including the number of samples.
+ * @param buffer destination with room for @req->samples@ values.
+ * @param value_size size of one value in @buffer@, used to classify the request.
+ * @param timeout_ms transfer timeout, 0 for none.
+ * @return 0 on SUCCESS, QRNG_DEADLINE_EXCEEDED on timeout and -1 on any other error.
+ */
+int qrng_fetch_typed(const s_api_t *req, void *buffer, size_t value_size, long timeout_ms);
+
+/**
+ * @brief Same as @qrng_fetch_typed@, merging the request with concurrent ones of the same type and range when coalescing is enabled.
+ */
+int qrng_coalesce_request(const s_api_t *req, void *buffer, size_t value_size);
+
+/**
+ * @brief The Quantis REST API backend, the default for addresses without a known scheme.
+ */
+extern const qrng_backend_t qrng_rest_backend;
+
+/**
+ * @brief Open the chain of sources described by @address@ ("src|src|...").
+ * @return 0 on success, -1 if the list is invalid or a source cannot be opened.
+ */
+int qrng_backend_open(const char *address);
+
+/**
+ * @brief Close every source of the chain.
+ */
+void qrng_backend_close(void);
+
+/**
+ * @brief Whether the appliance is one of the sources, i.e. firmware and system info are available.
+ */
+bool qrng_backend_has_rest(void);
+
+/**
+ * @brief @qrng_sched_wait@ when the next fill goes to the appliance; local sources are not metered.
+ */
+int qrng_backend_sched_wait(uint64_t until_ns);
+
+/**
+ * @brief Deliver @size@ raw bytes to @cbk@, from the first source of the chain able to.
+ */
+int qrng_backend_fill_bytes(CURL *handle, size_t size, qrng_write_cbk_t cbk, void *data,
+                            long timeout_ms, xfer_info_t *info);
+
+/**
+ * @brief Fill @buffer@ with the values described by @req@, from the first source of the chain able to.
+ */
+int qrng_backend_fill_typed(const s_api_t *req, void *buffer, size_t value_size, long timeout_ms,
+                            xfer_info_t *info);
+
+/**
+ * @brief Perform one transfer through the selected transport (network, record or replay).
+ * @param handle easy handle to use; not touched when replaying.
+ * @param url request URL.
+ * @param cbk write callback receiving the body.
+ * @param data user pointer passed to @cbk@.
+ * @param timeout_ms transfer timeout, 0 for none.
+ * @param info filled with the timing of the transfer (the recorded one when replaying).
+ * @return the libcurl result of the transfer.
+ */
+CURLcode qrng_transport_perform(CURL *handle, const char *url, qrng_write_cbk_t cbk, void *data,
+                                long timeout_ms, xfer_info_t *info);
+
+/**
+ * @brief Close the capture file and go back to the network transport.
+ */
+void qrng_transport_close(void);
+
+/**
+ * @brief Stop the info refresher and drop the cached responses.
+ */
+void qrng_info_close(void);
+
+/**
+ * @brief True when @qrng_open@ was given a qrngd socket ("unix:" address).
+ */
+bool qrng_client_enabled(void);
+
+/**
+ * @brief Enter client mode and check that the daemon answers on @path@.
+ * @return 0 on SUCCESS and -1 if the path is invalid or nothing listens on it.
+ */
+int qrng_client_open(const char *path);
+
+/**
+ * @brief Close the idle daemon connections and leave client mode.
+ */
+void qrng_client_close(void);
+
+/**
+ * @brief Forward a typed request to the daemon.
+ * @param type kind of request, for the statistics.
+ * @param op daemon operation (@e_qrngd_op_t@).
+ * @param req samples and range.
+ * @param buffer destination with room for @req->samples@ values.
+ * @param value_size size of one value in @buffer@.
+ * @param deadline absolute deadline for the deadline operations, NULL otherwise.
+ * @param filled if not NULL, receives the number of values written to @buffer@.
+ * @return the result of the call made by the daemon, -1 if the daemon cannot be reached.
+ */
+int qrng_client_values(e_req_type_t type, unsigned op, const s_api_t *req, void *buffer,
+                       size_t value_size, const struct timespec *deadline, size_t *filled);
+
+/**
+ * @brief Forward a stream or info request to the daemon and write the payload to @stream@.
+ * @param size bytes to transfer, 0 for the info requests.
+ * @return the result of the call made by the daemon, -1 if the daemon cannot be reached or @stream@ cannot be written.
+ */
+int qrng_client_stream(e_req_type_t type, unsigned op, FILE *stream, size_t size);
+
+/**
+ * @brief Open up to @connections@ daemon sockets ahead of use and park them with the idle ones.
+ * @return number of sockets opened.
+ */
+size_t qrng_client_warmup(size_t connections);
+
+/**
+ * @brief True while this process consumes from a shared-memory ring.
+ */
+bool qrng_ring_attached(void);
+
+/**
+ * @brief Copy up to @len@ bytes out of the attached ring.
+ * @param deadline bounds the wait for an empty ring, NULL to take only the bytes published already.
+ * @return number of bytes copied, 0 if no ring is attached.
+ */
+size_t qrng_ring_take(uint8_t *dst, size_t len, const struct timespec *deadline);
+
+/**
+ * @brief Fill @info@ from the timers of the last transfer performed on @handle@.
+ */
+void qrng_read_xfer_info(CURL *handle, xfer_info_t *info);
+
+/**
+ * @brief Mark the start of an appliance request.
+ * @return the start time to pass, as a difference, to @qrng_stats_record@.
+ */
+uint64_t qrng_stats_start(e_req_type_t type, size_t samples);
+
+/**
+ * @brief Count one appliance request in the statistics.
+ * @param type kind of request.
+ * @param samples values (bytes for streams) requested.
+ * @param info transfer read back from the handle, NULL if nothing was sent.
+ * @param latency_ns time from the call to the returned values.
+ * @param error non-zero if the request failed.
+ */
+void qrng_stats_record(e_req_type_t type, size_t samples, const xfer_info_t *info,
+                       uint64_t latency_ns, int error);
+
+/**
+ * @brief Record the time spent parsing one response.
+ */
+void qrng_stats_record_parse(e_req_type_t type, uint64_t parse_ns);
+
+/**
+ * @brief Count a request repeated after a failure.
+ */
+void qrng_stats_record_retry(e_req_type_t type);
+
+/**
+ * @brief Current size of background and split transfers, in bytes.
+ */
+size_t qrng_chunk_size(void);
+
+/**
+ * @brief Report a finished raw transfer to the chunk size controller.
+ * @param info timing of the transfer, ignored when @error@ is set.
+ * @param error non-zero if the transfer failed.
+ */
+void qrng_chunk_feedback(const xfer_info_t *info, int error);
+
+/**
+ * @brief Set the common options on a freshly created easy handle.
+ */
+void qrng_setup_handle(CURL *handle);
+
+/**
+ * @brief Drop an easy handle inherited from the parent: its socket is closed in this process only.
+ * The handle is deliberately leaked; cleaning it up could write to the connection the parent still uses.
+ */
+void qrng_abandon_handle(CURL *handle);
+
+/**
+ * @brief Create the easy handles of both lanes, replacing the previous ones.
+ * @return 0 on SUCCESS, -1 on invalid sizes and -2 if a libcurl handle cannot be initialized.
+ */
+int qrng_lanes_open(size_t interactive, size_t bulk);
+
+/**
+ * @brief Release the easy handles of both lanes.
+ */
+void qrng_lanes_close(void);
+
+/**
+ * @brief Lane of a request delivering @bytes@ bytes, honouring the calling thread's class.
+ */
+e_lane_t qrng_lane_classify(size_t bytes);
+
+/**
+ * @brief Wait until a connection of @lane@ is free and claim it.
+ * Bulk requests are not dispatched while interactive requests are queued.
+ * @param until_ns absolute @qrng_now_ns@ time after which the wait is given up, 0 for no limit.
+ * @param conn receives the connection, NULL on failure.
+ * @return 0 on SUCCESS, QRNG_DEADLINE_EXCEEDED if the scheduler or the lane did not let the request go in time, and -1 if the lane has no connections (library not opened).
+ */
+int qrng_lane_acquire(e_lane_t lane, uint64_t until_ns, conn_t **conn);
+
+/**
+ * @brief Return a connection obtained from @qrng_lane_acquire@.
+ */
+void qrng_lane_release(conn_t *conn);
+
+/**
+ * @brief Install the throttling progress callback used by bulk transfers.
+ */
+void qrng_lane_setup_bulk(CURL *handle);
+
+/**
+ * @brief Send @url@ on up to @connections@ idle lane connections (0 for all) in parallel, so that
+ * resolution, connection and TLS are done before the first real request.
+ * @return 0 if every one succeeded, QRNG_DEADLINE_EXCEEDED if some ran out of time, -1 otherwise.
+ */
+int qrng_lanes_warmup(size_t connections, const char *url, long timeout_ms, struct qrng_warmup_stats *stats);
+
+/**
+ * @brief Wait until the scheduler lets the calling thread's tenant send a transfer.
+ * Called before a connection is taken, so that a tenant over its rate never holds one.
+ * @param until_ns give up at this @qrng_now_ns@ time, 0 to wait as long as needed.
+ * @return 0 when the transfer may go, QRNG_DEADLINE_EXCEEDED if @until_ns@ passed first.
+ */
+int qrng_sched_wait(uint64_t until_ns);
+
+/**
+ * @brief Charge the bytes received by the transfer the calling thread just finished.
+ */
+void qrng_sched_charge(uint64_t bytes);
+
+/**
+ * @brief Wait until the calling thread's tenant is back within its rate, before it is served
+ * buffered bytes (ring, pool or reserve).
+ * @param until_ns give up at this @qrng_now_ns@ time, 0 to wait as long as needed.
+ * @return 0 when the tenant may be served, QRNG_DEADLINE_EXCEEDED if @until_ns@ passed first.
+ */
+int qrng_sched_admit(uint64_t until_ns);
+
+/**
+ * @brief Charge @bytes@ served from a buffer to the calling thread's tenant.
+ */
+void qrng_sched_consume(uint64_t bytes);
+
+/**
+ * @brief Tenant of the calling thread; refill threads adopt the one of the thread that started them.
+ */
+int qrng_sched_tenant(void);
+
+/**
+ * @brief Copy up to @len@ buffered bytes out of the pool.
+ * @return number of bytes copied, 0 if the pool is disabled or empty.
+ */
+size_t qrng_pool_take(uint8_t *dst, size_t len);
+
+/**
+ * @brief Stop the refill thread and release the pool storage.
+ */
+void qrng_pool_shutdown(void);
+
+/**
+ * @brief Copy up to @len@ bytes out of the on-disk reserve.
+ * @return number of bytes copied, 0 if no reserve is open or it is empty.
+ */
+size_t qrng_reserve_take(uint8_t *dst, size_t len);
+
+/**
+ * @brief Install the fork handlers; safe to call more than once.
+ */
+void qrng_fork_init(void);
+
+/**
+ * @brief Number of forks between the process that opened the library and this one.
+ * Modules remember it with their state and rebuild that state lazily when it changes.
+ */
+unsigned qrng_fork_generation(void);
+
+/**
+ * @brief Fork handlers of the modules. @FORK_PREPARE@ takes the module lock, @FORK_PARENT@ releases it,
+ * and @FORK_CHILD@ drops what belongs to the parent (threads, connections, unconsumed bytes) and
+ * reinitializes the lock.
+ */
+void qrng_coalesce_atfork(e_fork_phase_t phase);
+void qrng_sched_atfork(e_fork_phase_t phase);
+void qrng_client_atfork(e_fork_phase_t phase);
+void qrng_pool_atfork(e_fork_phase_t phase);
+void qrng_reserve_atfork(e_fork_phase_t phase);
+void qrng_ring_atfork(e_fork_phase_t phase);
+void qrng_lanes_atfork(e_fork_phase_t phase);
+void qrng_transport_atfork(e_fork_phase_t phase);
+void qrng_backend_atfork(e_fork_phase_t phase);
+void qrng_info_atfork(e_fork_phase_t phase);
+void qrng_chunk_atfork(e_fork_phase_t phase);
+
+#endif /* QRNG_INTERNAL_H */
@@ -0,0 +1,466 @@
+/****************************************************************************
+ * libqrng - library for interacting with IDQ's Quantis Appliance           *
+ *                                                                          *
+ * Copyright (C) 2023  Sebastian Mihai Ardelean                             *
+ *                                                                          *
+ * This program is free software: you can redistribute it and/or modify     *
+ * it under the terms of the GNU General Public License as published by     *
+ * the Free Software Foundation, either version 3 of the License, or        *
+ * (at your option) any later version.                                      *
+ *                                                                          *
+ * This program is distributed in the hope that it will be useful,          *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ * GNU General Public License for more details.                             *
+ *                                                                          *
+ * You should have received a copy of the GNU General Public License        *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+
+/**
+ * @file qrng_lanes.c
+ * @author Sebastian Mihai Ardelean <sebastian.ardelean@cs.upt.ro>
+ * @date 24 May 2023
+ * @brief Connections reserved per request class and the dispatch order between classes.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <curl/curl.h>
+#include "qrng.h"
+#include "qrng_internal.h"
+
+#define INTERACTIVE_MAX_BYTES 4096u
+#define BULK_THROTTLE_NS 2000000L
+
+/**
+ * @brief One connection being warmed up by its own thread.
+ */
+typedef struct {
+    conn_t *conn;
+    const char *url;
+    uint64_t until_ns;
+    CURLcode error;
+    xfer_info_t info;
+    pthread_t thread;
+    bool threaded;
+}warmup_t;
+
+typedef struct {
+    conn_t connections[QRNG_MAX_LANE_CONNECTIONS];
+    size_t count;
+    size_t waiting;
+    pthread_cond_t available;
+}lane_t;
+
+static lane_t lanes[NUMBER_OF_LANES] = {
+    [LANE_INTERACTIVE] = { .available = PTHREAD_COND_INITIALIZER },
+    [LANE_BULK] = { .available = PTHREAD_COND_INITIALIZER }
+};
+
+static pthread_mutex_t lanes_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Interactive requests queued or in flight; bulk transfers yield while it is not zero. */
+static atomic_size_t interactive_pending = 0;
+
+/* Fork generation the handles were created in; a child reconnects on its first request. */
+static unsigned lanes_generation = 0;
+
+static __thread qrng_class_t thread_class = QRNG_CLASS_AUTO;
+
+static int bulk_xferinfo_cbk(void *clientp,
+                             curl_off_t dltotal,
+                             curl_off_t dlnow,
+                             curl_off_t ultotal,
+                             curl_off_t ulnow);
+static void lanes_cleanup_locked(void);
+static void lanes_reconnect_locked(void);
+static CURL *lane_handle(e_lane_t lane);
+static void *warmup_thread(void *arg);
+static size_t discard_write_cbk(void *content, size_t size, size_t nmemb, void *userp);
+static int lane_wait_locked(lane_t *l, uint64_t until_ns);
+
+
+int qrng_lanes_open(size_t interactive, size_t bulk)
+{
+    size_t sizes[NUMBER_OF_LANES] = { interactive, bulk };
+    size_t lane = 0;
+    size_t i = 0;
+    CURL *handle = NULL;
+
+    if (interactive == 0 || bulk == 0 ||
+        interactive > QRNG_MAX_LANE_CONNECTIONS || bulk > QRNG_MAX_LANE_CONNECTIONS) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&lanes_lock);
+    lanes_cleanup_locked();
+    lanes_generation = qrng_fork_generation();
+    for (lane = 0; lane < NUMBER_OF_LANES; lane++) {
+        for (i = 0; i < sizes[lane]; i++) {
+            handle = lane_handle((e_lane_t)lane);
+            if (!handle) {
+                lanes_cleanup_locked();
+                pthread_mutex_unlock(&lanes_lock);
+                return -2;
+            }
+            lanes[lane].connections[i].handle = handle;
+            lanes[lane].connections[i].lane = (e_lane_t)lane;
+            lanes[lane].connections[i].busy = false;
+            lanes[lane].count++;
+        }
+    }
+    pthread_mutex_unlock(&lanes_lock);
+    return 0;
+}
+
+
+void qrng_lanes_close(void)
+{
+    pthread_mutex_lock(&lanes_lock);
+    lanes_cleanup_locked();
+    pthread_mutex_unlock(&lanes_lock);
+}
+
+
+int qrng_set_lanes(size_t interactive_connections, size_t bulk_connections)
+{
+    if (qrng_client_enabled()) {
+        return 0;
+    }
+    return qrng_lanes_open(interactive_connections, bulk_connections);
+}
+
+
+void qrng_set_request_class(qrng_class_t request_class)
+{
+    thread_class = request_class;
+}
+
+
+e_lane_t qrng_lane_classify(size_t bytes)
+{
+    if (thread_class == QRNG_CLASS_INTERACTIVE) {
+        return LANE_INTERACTIVE;
+    }
+    if (thread_class == QRNG_CLASS_BULK) {
+        return LANE_BULK;
+    }
+    return bytes <= INTERACTIVE_MAX_BYTES ? LANE_INTERACTIVE : LANE_BULK;
+}
+
+
+int qrng_lane_acquire(e_lane_t lane, uint64_t until_ns, conn_t **conn)
+{
+    lane_t *l = &lanes[lane];
+    size_t i = 0;
+    int retval = 0;
+
+    *conn = NULL;
+    /* Tenants take turns before taking a connection, never while holding one. */
+    retval = qrng_backend_sched_wait(until_ns);
+    if (retval) {
+        return retval;
+    }
+    if (lane == LANE_INTERACTIVE) {
+        atomic_fetch_add(&interactive_pending, 1);
+    }
+
+    pthread_mutex_lock(&lanes_lock);
+    if (lanes_generation != qrng_fork_generation()) {
+        lanes_reconnect_locked();
+    }
+    l->waiting++;
+    while (*conn == NULL && l->count > 0 && !retval) {
+        /* Interactive work is always dispatched first; new bulk transfers wait for it. */
+        if (lane == LANE_BULK && lanes[LANE_INTERACTIVE].waiting > 0) {
+            retval = lane_wait_locked(l, until_ns);
+            continue;
+        }
+        for (i = 0; i < l->count; i++) {
+            if (!l->connections[i].busy) {
+                *conn = &l->connections[i];
+                (*conn)->busy = true;
+                break;
+            }
+        }
+        if (*conn == NULL) {
+            retval = lane_wait_locked(l, until_ns);
+        }
+    }
+    l->waiting--;
+    if (lane == LANE_INTERACTIVE && l->waiting == 0) {
+        pthread_cond_broadcast(&lanes[LANE_BULK].available);
+    }
+    pthread_mutex_unlock(&lanes_lock);
+
+    if (*conn == NULL && lane == LANE_INTERACTIVE) {
+        atomic_fetch_sub(&interactive_pending, 1);
+    }
+    if (*conn == NULL && !retval) {
+        retval = -1;
+    }
+    return retval;
+}
+
+
+void qrng_lane_release(conn_t *conn)
+{
+    if (conn == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&lanes_lock);
+    conn->busy = false;
+    pthread_cond_signal(&lanes[conn->lane].available);
+    pthread_mutex_unlock(&lanes_lock);
+
+    if (conn->lane == LANE_INTERACTIVE) {
+        atomic_fetch_sub(&interactive_pending, 1);
+    }
+}
+
+
+int qrng_lanes_warmup(size_t connections, const char *url, long timeout_ms, struct qrng_warmup_stats *stats)
+{
+    warmup_t warm[NUMBER_OF_LANES * QRNG_MAX_LANE_CONNECTIONS];
+    size_t count = 0;
+    size_t lane = 0;
+    size_t i = 0;
+    uint64_t start_ns = qrng_now_ns();
+    /* One deadline for the whole warm-up, also when connections end up warmed one after another. */
+    uint64_t until_ns = timeout_ms > 0 ? start_ns + (uint64_t)timeout_ms * 1000000u : 0;
+    int retval = 0;
+
+    memset(stats, 0, sizeof(*stats));
+    /* Claim idle connections, interactive ones first: they carry the latency-critical requests.
+       Busy ones are skipped, they are connected already or about to be. */
+    pthread_mutex_lock(&lanes_lock);
+    if (lanes_generation != qrng_fork_generation()) {
+        lanes_reconnect_locked();
+    }
+    for (lane = 0; lane < NUMBER_OF_LANES; lane++) {
+        for (i = 0; i < lanes[lane].count && (connections == 0 || count < connections); i++) {
+            if (!lanes[lane].connections[i].busy) {
+                lanes[lane].connections[i].busy = true;
+                memset(&warm[count], 0, sizeof(warm[count]));
+                warm[count].conn = &lanes[lane].connections[i];
+                warm[count].url = url;
+                warm[count].until_ns = until_ns;
+                count++;
+            }
+        }
+    }
+    pthread_mutex_unlock(&lanes_lock);
+
+    /* In parallel, so that warming N connections costs one handshake, not N. */
+    for (i = 0; i < count; i++) {
+        warm[i].threaded = pthread_create(&warm[i].thread, NULL, &warmup_thread, (void *)&warm[i]) == 0;
+        if (!warm[i].threaded) {
+            (void)warmup_thread((void *)&warm[i]);
+        }
+    }
+    for (i = 0; i < count; i++) {
+        if (warm[i].threaded) {
+            pthread_join(warm[i].thread, NULL);
+        }
+        if (warm[i].error == CURLE_OK) {
+            stats->connections++;
+        }
+        else {
+            stats->failed++;
+            /* A refused or broken connection says more than one that merely ran out of time. */
+            if (warm[i].error != CURLE_OPERATION_TIMEDOUT) {
+                retval = -1;
+            }
+            else if (retval == 0) {
+                retval = QRNG_DEADLINE_EXCEEDED;
+            }
+        }
+        /* Phases of the slowest connection; libcurl reports them cumulatively. */
+        if (warm[i].info.namelookup_ns > stats->dns_ns) {
+            stats->dns_ns = warm[i].info.namelookup_ns;
+        }
+        if (warm[i].info.connect_ns > warm[i].info.namelookup_ns &&
+            warm[i].info.connect_ns - warm[i].info.namelookup_ns > stats->connect_ns) {
+            stats->connect_ns = warm[i].info.connect_ns - warm[i].info.namelookup_ns;
+        }
+        if (warm[i].info.appconnect_ns > warm[i].info.connect_ns &&
+            warm[i].info.appconnect_ns - warm[i].info.connect_ns > stats->tls_ns) {
+            stats->tls_ns = warm[i].info.appconnect_ns - warm[i].info.connect_ns;
+        }
+        /* Not qrng_lane_release: a warm-up never counted as pending interactive work. */
+        pthread_mutex_lock(&lanes_lock);
+        warm[i].conn->busy = false;
+        pthread_cond_signal(&lanes[warm[i].conn->lane].available);
+        pthread_mutex_unlock(&lanes_lock);
+    }
+    stats->duration_ns = qrng_now_ns() - start_ns;
+    return retval;
+}
+
+
+void qrng_lanes_atfork(e_fork_phase_t phase)
+{
+    size_t lane = 0;
+    size_t i = 0;
+
+    if (phase == FORK_PREPARE) {
+        pthread_mutex_lock(&lanes_lock);
+        return;
+    }
+    if (phase == FORK_PARENT) {
+        pthread_mutex_unlock(&lanes_lock);
+        return;
+    }
+    /* The threads that held or waited for connections stayed in the parent. */
+    for (lane = 0; lane < NUMBER_OF_LANES; lane++) {
+        for (i = 0; i < lanes[lane].count; i++) {
+            qrng_abandon_handle(lanes[lane].connections[i].handle);
+            lanes[lane].connections[i].handle = NULL;
+            lanes[lane].connections[i].busy = false;
+        }
+        lanes[lane].waiting = 0;
+        pthread_cond_init(&lanes[lane].available, NULL);
+    }
+    atomic_store(&interactive_pending, 0);
+    pthread_mutex_init(&lanes_lock, NULL);
+}
+
+
+void qrng_lane_setup_bulk(CURL *handle)
+{
+    (void)curl_easy_setopt(handle, CURLOPT_XFERINFOFUNCTION, &bulk_xferinfo_cbk);
+    (void)curl_easy_setopt(handle, CURLOPT_NOPROGRESS, 0L);
+}
+
+
+void *warmup_thread(void *arg)
+{
+    warmup_t *warm = (warmup_t *)arg;
+    uint64_t now_ns = qrng_now_ns();
+    long timeout_ms = 0;
+
+    if (warm->until_ns != 0) {
+        if (now_ns >= warm->until_ns) {
+            warm->error = CURLE_OPERATION_TIMEDOUT;
+            return NULL;
+        }
+        /* Rounded up, so that less than a millisecond left is not read as no timeout. */
+        timeout_ms = (long)((warm->until_ns - now_ns + 999999u) / 1000000u);
+    }
+    warm->error = qrng_transport_perform(warm->conn->handle, warm->url, &discard_write_cbk, NULL,
+                                         timeout_ms, &warm->info);
+    return NULL;
+}
+
+
+size_t discard_write_cbk(void *content, size_t size, size_t nmemb, void *userp)
+{
+    (void)content;
+    (void)userp;
+    return size * nmemb;
+}
+
+
+int bulk_xferinfo_cbk(void *clientp,
+                      curl_off_t dltotal,
+                      curl_off_t dlnow,
+                      curl_off_t ultotal,
+                      curl_off_t ulnow)
+{
+    struct timespec pause = { .tv_sec = 0, .tv_nsec = BULK_THROTTLE_NS };
+
+    (void)clientp;
+    (void)dltotal;
+    (void)dlnow;
+    (void)ultotal;
+    (void)ulnow;
+    /* Stalling the callback stops reading the socket, leaving the link to interactive work. */
+    if (atomic_load(&interactive_pending) > 0) {
+        nanosleep(&pause, NULL);
+    }
+    return 0;
+}
+
+
+void lanes_cleanup_locked(void)
+{
+    size_t lane = 0;
+    size_t i = 0;
+
+    for (lane = 0; lane < NUMBER_OF_LANES; lane++) {
+        for (i = 0; i < lanes[lane].count; i++) {
+            curl_easy_cleanup(lanes[lane].connections[i].handle);
+            lanes[lane].connections[i].handle = NULL;
+        }
+        lanes[lane].count = 0;
+    }
+}
+
+
+void lanes_reconnect_locked(void)
+{
+    size_t lane = 0;
+    size_t i = 0;
+
+    lanes_generation = qrng_fork_generation();
+    for (lane = 0; lane < NUMBER_OF_LANES; lane++) {
+        for (i = 0; i < lanes[lane].count; i++) {
+            lanes[lane].connections[i].handle = lane_handle((e_lane_t)lane);
+            if (!lanes[lane].connections[i].handle) {
+                /* Keep the connections made so far; an empty lane fails its requests. */
+                lanes[lane].count = i;
+                break;
+            }
+        }
+    }
+}
+
+
+CURL *lane_handle(e_lane_t lane)
+{
+    CURL *handle = curl_easy_init();
+
+    if (!handle) {
+        fprintf(stderr, "Error in curl_easy_init");
+        return NULL;
+    }
+    qrng_setup_handle(handle);
+    if (lane == LANE_BULK) {
+        qrng_lane_setup_bulk(handle);
+    }
+    return handle;
+}
+
+
+int lane_wait_locked(lane_t *l, uint64_t until_ns)
+{
+    struct timespec until;
+    uint64_t now_ns = 0;
+    uint64_t wait_ns = 0;
+
+    if (until_ns == 0) {
+        pthread_cond_wait(&l->available, &lanes_lock);
+        return 0;
+    }
+    now_ns = qrng_now_ns();
+    if (now_ns >= until_ns) {
+        return QRNG_DEADLINE_EXCEEDED;
+    }
+    /* The deadline is monotonic, the condition waits on the real-time clock: wait the time left. */
+    wait_ns = until_ns - now_ns;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += (time_t)(wait_ns / 1000000000u);
+    until.tv_nsec += (long)(wait_ns % 1000000000u);
+    if (until.tv_nsec >= 1000000000L) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&l->available, &lanes_lock, &until);
+    return 0;
+}
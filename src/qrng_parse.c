@@ -0,0 +1,178 @@
+/****************************************************************************
+ * libqrng - library for interacting with IDQ's Quantis Appliance           *
+ *                                                                          *
+ * Copyright (C) 2023  Sebastian Mihai Ardelean                             *
+ *                                                                          *
+ * This program is free software: you can redistribute it and/or modify     *
+ * it under the terms of the GNU General Public License as published by     *
+ * the Free Software Foundation, either version 3 of the License, or        *
+ * (at your option) any later version.                                      *
+ *                                                                          *
+ * This program is distributed in the hope that it will be useful,          *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ * GNU General Public License for more details.                             *
+ *                                                                          *
+ * You should have received a copy of the GNU General Public License        *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+
+/**
+ * @file qrng_parse.c
+ * @author Sebastian Mihai Ardelean <sebastian.ardelean@cs.upt.ro>
+ * @date 24 May 2023
+ * @brief Response handling: libcurl write callbacks, JSON parsing and local conversion of raw bytes.
+ *
+ * Kept apart from the transport so the benchmarks can drive it without a network.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "qrng.h"
+#include "qrng_internal.h"
+#include "qrng_probes.h"
+
+
+size_t qrng_memory_write_cbk(void *content, size_t size, size_t nmemb, void *userp)
+{
+#ifdef NO_DYNAMIC_MEMORY_ALLOCATION
+  size_t real_size = size *nmemb;
+  memory_t *mem = (memory_t *)userp;
+  size_t available_space = TOTAL_MAX_SIZE_RESPONSE - (mem->size + real_size + 1);
+  if (available_space > (real_size + 1)) {
+    memcpy(&(mem->memory[mem->size]), content, real_size);
+    mem->size += real_size;
+    mem->memory[mem->size] = 0;
+    QRNG_PROBE2(chunk__received, real_size, mem->size);
+    return real_size;
+  }
+  fprintf(stderr, "Static buffer full!\n");
+  return 0;
+#else
+    size_t real_size = size * nmemb;
+    memory_t *mem = (memory_t *)userp;
+    char *ptr = realloc(mem->memory, mem->size + real_size + 1);
+    if (!ptr) {
+	fprintf(stderr, "Not enough memory (realloc returned NULL)\n");
+	return 0;
+    }
+
+    mem->memory = ptr;
+    memcpy(&(mem->memory[mem->size]), content, real_size);
+    mem->size += real_size;
+    mem->memory[mem->size] = 0;
+    QRNG_PROBE2(chunk__received, real_size, mem->size);
+    return real_size;
+#endif
+}
+
+
+size_t qrng_raw_write_cbk(void *content, size_t size, size_t nmemb, void *userp)
+{
+    size_t real_size = size * nmemb;
+    raw_sink_t *sink = (raw_sink_t *)userp;
+
+    if (real_size > sink->cap - sink->len) {
+        fprintf(stderr, "Response larger than requested!\n");
+        return 0;
+    }
+    memcpy(sink->dst + sink->len, content, real_size);
+    sink->len += real_size;
+    QRNG_PROBE2(chunk__received, real_size, sink->len);
+    return real_size;
+}
+
+
+size_t qrng_stream_write_cbk(void *content, size_t size, size_t nmemb, void *userp)
+{
+    size_t written = fwrite(content, size, nmemb, (FILE *)userp);
+
+    QRNG_PROBE2(chunk__received, written * size, (size_t)0);
+    return written;
+}
+
+
+int qrng_bytes_to_int32(int32_t min, int32_t max, const uint8_t *bytes, int32_t *value)
+{
+    uint32_t raw = 0;
+    uint64_t span = 0;
+    uint64_t limit = 0;
+
+    if (max < min) {
+        return -1;
+    }
+    memcpy(&raw, bytes, sizeof(raw));
+    /* Both bounds are included, as in the appliance's int endpoint. Rejection sampling keeps every
+     * value equally likely; over the full range (span 2^32) no draw is rejected. */
+    span = (uint64_t)((int64_t)max - (int64_t)min) + 1u;
+    limit = (UINT64_C(1) << 32) - ((UINT64_C(1) << 32) % span);
+    if ((uint64_t)raw >= limit) {
+        return 1;
+    }
+    *value = (int32_t)((int64_t)min + (int64_t)((uint64_t)raw % span));
+    return 0;
+}
+
+
+double qrng_bytes_to_double(double min, double max, const uint8_t *bytes)
+{
+    uint64_t raw = 0;
+
+    memcpy(&raw, bytes, sizeof(raw));
+    /* The top 53 bits fill the mantissa of a value in [0, 1). */
+    return min + (double)(raw >> 11) * (1.0 / 9007199254740992.0) * (max - min);
+}
+
+
+void qrng_parse_response(char *random_values_string, void *buffer, size_t samples, e_req_type_t request_type)
+{
+    /* Skip first character because it's [ */
+    random_values_string ++;
+    /* Skip last character because is ] */
+    random_values_string[strlen(random_values_string)-1]=0;
+    /* Reentrant: responses are parsed concurrently by the request threads. */
+    char *save = NULL;
+    char *token = strtok_r(random_values_string, ",", &save);
+    size_t i = 0;
+
+    switch(request_type) {
+        case BYTES_RANDOM_NUMBER:  
+            for (i = 0; i < samples && token != NULL; i++) {
+                /* Remove quotes */
+                token++;
+                token[strlen(token) - 1] = '\0';
+                uint8_t value = (uint8_t)strtol(token, NULL, 16);
+                ((uint8_t *)buffer)[i] = value;
+                token = strtok_r(NULL, ",", &save);
+            }
+            break;
+        case INT16_RANDOM_NUMBER:
+            for (i = 0; i < samples; i++) {
+                ((int16_t *)buffer)[i] = (int16_t)strtol(token, NULL, 10);
+                token = strtok_r(NULL, ",", &save);
+            }
+            break;
+        case INT32_RANDOM_NUMBER:
+            for (i = 0; i < samples; i++) {
+                ((int32_t *)buffer)[i] = strtol(token, NULL, 10);
+                token = strtok_r(NULL, ",", &save);
+            }
+            break;
+        case DOUBLE_RANDOM_NUMBER:
+            for (i = 0; i < samples; i++) {
+                ((double *)buffer)[i] = strtod(token, NULL);
+                token = strtok_r(NULL, ",", &save);
+            }
+            break;
+        case FLOAT_RANDOM_NUMBER:
+            for (i = 0; i < samples; i++) {
+                ((float *)buffer)[i] = strtof(token, NULL);
+                token = strtok_r(NULL, ",", &save);
+            }
+            break;
+        default:
+            break;
+    }
+}
@@ -0,0 +1,277 @@
+/****************************************************************************
+ * libqrng - library for interacting with IDQ's Quantis Appliance           *
+ *                                                                          *
+ * Copyright (C) 2023  Sebastian Mihai Ardelean                             *
+ *                                                                          *
+ * This program is free software: you can redistribute it and/or modify     *
+ * it under the terms of the GNU General Public License as published by     *
+ * the Free Software Foundation, either version 3 of the License, or        *
+ * (at your option) any later version.                                      *
+ *                                                                          *
+ * This program is distributed in the hope that it will be useful,          *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ * GNU General Public License for more details.                             *
+ *                                                                          *
+ * You should have received a copy of the GNU General Public License        *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+
+/**
+ * @file qrng_perf.c
+ * @author Sebastian Mihai Ardelean <sebastian.ardelean@cs.upt.ro>
+ * @date 24 May 2023
+ * @brief Implementation of the PERFORMANCE_REQUEST mode: a timed probe of the appliance.
+ *
+ * The connection setup cost is measured on throw-away handles, so a new connection is opened
+ * every time. The latency and JSON phases go through the regular request path; the streambytes
+ * phase uses its own handle, like the pool, so it is not throttled behind the bulk lane. Both
+ * raw phases are admitted by the scheduler and keep their odd sizes out of the chunk controller.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <curl/curl.h>
+#include "qrng.h"
+#include "qrng_internal.h"
+
+#define PERF_DEFAULT_DURATION_MS 2000u
+#define PERF_DEFAULT_CHUNK (64u * 1024u)
+#define PERF_DEFAULT_JSON_SAMPLES 1024u
+#define PERF_DEFAULT_LATENCY_REQUESTS 100u
+#define PERF_DEFAULT_CONNECTIONS 5u
+#define PERF_MAX_LATENCY_REQUESTS 1000u
+
+#ifdef NO_DYNAMIC_MEMORY_ALLOCATION
+#define PERF_STATIC_CHUNK (64u * 1024u)
+static uint8_t perf_bytes[PERF_STATIC_CHUNK];
+static double perf_values[PERF_DEFAULT_JSON_SAMPLES];
+#endif
+
+static int measure_connections(unsigned samples, struct qrng_perf_report *report);
+static void measure_latency(unsigned requests, struct qrng_perf_report *report);
+static int measure_stream(uint64_t duration_ns, size_t chunk, struct qrng_perf_report *report);
+static void measure_json(uint64_t duration_ns, size_t samples, struct qrng_perf_report *report);
+static int compare_u64(const void *a, const void *b);
+
+
+int qrng_measure_performance(const struct qrng_perf_config *config, struct qrng_perf_report *report)
+{
+    struct qrng_perf_config cfg;
+    uint64_t start_ns = 0;
+    int retval = 0;
+
+    if (report == NULL || !qrng_is_open() || qrng_client_enabled()) {
+        return -1;
+    }
+    memset(&cfg, 0, sizeof(cfg));
+    if (config) {
+        cfg = *config;
+    }
+    cfg.duration_ms = cfg.duration_ms ? cfg.duration_ms : PERF_DEFAULT_DURATION_MS;
+    cfg.stream_chunk_bytes = cfg.stream_chunk_bytes ? cfg.stream_chunk_bytes : PERF_DEFAULT_CHUNK;
+    cfg.json_samples = cfg.json_samples ? cfg.json_samples : PERF_DEFAULT_JSON_SAMPLES;
+    cfg.latency_requests = cfg.latency_requests ? cfg.latency_requests : PERF_DEFAULT_LATENCY_REQUESTS;
+    cfg.connection_samples = cfg.connection_samples ? cfg.connection_samples : PERF_DEFAULT_CONNECTIONS;
+    if (cfg.stream_chunk_bytes > QRNG_CHUNK_MAX_BYTES) {
+        cfg.stream_chunk_bytes = QRNG_CHUNK_MAX_BYTES;
+    }
+    if (cfg.latency_requests > PERF_MAX_LATENCY_REQUESTS) {
+        cfg.latency_requests = PERF_MAX_LATENCY_REQUESTS;
+    }
+#ifdef NO_DYNAMIC_MEMORY_ALLOCATION
+    if (cfg.stream_chunk_bytes > PERF_STATIC_CHUNK) {
+        cfg.stream_chunk_bytes = PERF_STATIC_CHUNK;
+    }
+    if (cfg.json_samples > PERF_DEFAULT_JSON_SAMPLES) {
+        cfg.json_samples = PERF_DEFAULT_JSON_SAMPLES;
+    }
+#endif
+
+    memset(report, 0, sizeof(*report));
+    start_ns = qrng_stats_start(PERFORMANCE_REQUEST, 0);
+    retval = measure_connections(cfg.connection_samples, report);
+    if (!retval) {
+        measure_latency(cfg.latency_requests, report);
+        retval = measure_stream((uint64_t)cfg.duration_ms * 1000000u, cfg.stream_chunk_bytes, report);
+    }
+    if (!retval) {
+        measure_json((uint64_t)cfg.duration_ms * 1000000u, cfg.json_samples, report);
+    }
+    qrng_stats_record(PERFORMANCE_REQUEST, 0, NULL, qrng_now_ns() - start_ns, retval);
+    return retval;
+}
+
+
+int measure_connections(unsigned samples, struct qrng_perf_report *report)
+{
+    CURL *handle = NULL;
+    xfer_info_t info;
+    uint8_t byte = 0;
+    size_t received = 0;
+    unsigned ok = 0;
+    unsigned i = 0;
+
+    for (i = 0; i < samples; i++) {
+        handle = curl_easy_init();
+        if (handle == NULL) {
+            fprintf(stderr, "Error in curl_easy_init");
+            return -2;
+        }
+        qrng_setup_handle(handle);
+        if (qrng_probe_raw(handle, 1u, &byte, &received) == 0) {
+            qrng_read_xfer_info(handle, &info);
+            report->dns_ns += info.namelookup_ns;
+            report->connect_ns += info.connect_ns > info.namelookup_ns ? info.connect_ns - info.namelookup_ns : 0;
+            report->tls_ns += info.appconnect_ns > info.connect_ns ? info.appconnect_ns - info.connect_ns : 0;
+            ok++;
+        }
+        else {
+            report->errors++;
+        }
+        curl_easy_cleanup(handle);
+    }
+    if (ok > 0) {
+        report->dns_ns /= ok;
+        report->connect_ns /= ok;
+        report->tls_ns /= ok;
+    }
+    return 0;
+}
+
+
+void measure_latency(unsigned requests, struct qrng_perf_report *report)
+{
+    uint64_t latencies[PERF_MAX_LATENCY_REQUESTS];
+    s_api_t req;
+    int32_t value = 0;
+    uint64_t start_ns = 0;
+    unsigned done = 0;
+    unsigned i = 0;
+
+    qrng_request_init(&req, INT32_RANDOM_NUMBER);
+    req.samples = 1;
+    req.min_range_i = 0;
+    req.max_range_i = 1;
+    for (i = 0; i < requests; i++) {
+        start_ns = qrng_now_ns();
+        if (qrng_fetch_typed(&req, (void *)&value, sizeof(value), 0) != 0) {
+            report->errors++;
+            break;
+        }
+        latencies[done++] = qrng_now_ns() - start_ns;
+    }
+    if (done == 0) {
+        return;
+    }
+    qsort(latencies, done, sizeof(latencies[0]), &compare_u64);
+    report->latency_p50_ns = latencies[done * 50u / 100u];
+    report->latency_p90_ns = latencies[done * 90u / 100u];
+    report->latency_p99_ns = latencies[done * 99u / 100u];
+    report->latency_max_ns = latencies[done - 1u];
+}
+
+
+int measure_stream(uint64_t duration_ns, size_t chunk, struct qrng_perf_report *report)
+{
+    CURL *handle = NULL;
+    uint8_t *buffer = NULL;
+    size_t received = 0;
+    uint64_t bytes = 0;
+    uint64_t start_ns = 0;
+    uint64_t elapsed_ns = 0;
+
+    handle = curl_easy_init();
+    if (handle == NULL) {
+        fprintf(stderr, "Error in curl_easy_init");
+        return -2;
+    }
+    qrng_setup_handle(handle);
+#ifdef NO_DYNAMIC_MEMORY_ALLOCATION
+    buffer = perf_bytes;
+#else
+    buffer = malloc(chunk);
+    if (buffer == NULL) {
+        fprintf(stderr, "Not enough memory for the performance probe\n");
+        curl_easy_cleanup(handle);
+        return -1;
+    }
+#endif
+    /* Warm the connection so the setup cost, measured separately, does not skew the rate. */
+    if (qrng_probe_raw(handle, 1u, buffer, &received) != 0) {
+        report->errors++;
+    }
+    else {
+        start_ns = qrng_now_ns();
+        do {
+            received = 0;
+            if (qrng_probe_raw(handle, chunk, buffer, &received) != 0) {
+                report->errors++;
+                break;
+            }
+            bytes += received;
+            elapsed_ns = qrng_now_ns() - start_ns;
+        } while (elapsed_ns < duration_ns);
+        if (elapsed_ns > 0) {
+            report->stream_bytes_per_s = (double)bytes * 1e9 / (double)elapsed_ns;
+        }
+    }
+    memset(buffer, 0, chunk);
+#ifndef NO_DYNAMIC_MEMORY_ALLOCATION
+    free(buffer);
+#endif
+    curl_easy_cleanup(handle);
+    return 0;
+}
+
+
+void measure_json(uint64_t duration_ns, size_t samples, struct qrng_perf_report *report)
+{
+    s_api_t req;
+    double *values = NULL;
+    uint64_t count = 0;
+    uint64_t start_ns = 0;
+    uint64_t elapsed_ns = 0;
+
+#ifdef NO_DYNAMIC_MEMORY_ALLOCATION
+    values = perf_values;
+#else
+    values = malloc(samples * sizeof(*values));
+    if (values == NULL) {
+        fprintf(stderr, "Not enough memory for the performance probe\n");
+        report->errors++;
+        return;
+    }
+#endif
+    qrng_request_init(&req, DOUBLE_RANDOM_NUMBER);
+    req.samples = samples;
+    req.min_range_f = 0.0;
+    req.max_range_f = 1.0;
+    start_ns = qrng_now_ns();
+    do {
+        if (qrng_fetch_typed(&req, (void *)values, sizeof(*values), 0) != 0) {
+            report->errors++;
+            break;
+        }
+        count += samples;
+        elapsed_ns = qrng_now_ns() - start_ns;
+    } while (elapsed_ns < duration_ns);
+    if (elapsed_ns > 0) {
+        report->json_values_per_s = (double)count * 1e9 / (double)elapsed_ns;
+        report->json_bytes_per_s = report->json_values_per_s * (double)sizeof(*values);
+    }
+#ifndef NO_DYNAMIC_MEMORY_ALLOCATION
+    free(values);
+#endif
+}
+
+
+int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
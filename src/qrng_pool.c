@@ -0,0 +1,542 @@
+/****************************************************************************
+ * libqrng - library for interacting with IDQ's Quantis Appliance           *
+ *                                                                          *
+ * Copyright (C) 2023  Sebastian Mihai Ardelean                             *
+ *                                                                          *
+ * This program is free software: you can redistribute it and/or modify     *
+ * it under the terms of the GNU General Public License as published by     *
+ * the Free Software Foundation, either version 3 of the License, or        *
+ * (at your option) any later version.                                      *
+ *                                                                          *
+ * This program is distributed in the hope that it will be useful,          *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ * GNU General Public License for more details.                             *
+ *                                                                          *
+ * You should have received a copy of the GNU General Public License        *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+
+/**
+ * @file qrng_pool.c
+ * @author Sebastian Mihai Ardelean <sebastian.ardelean@cs.upt.ro>
+ * @date 24 May 2023
+ * @brief Buffered pool of random bytes refilled in the background.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <curl/curl.h>
+#include "qrng.h"
+#include "qrng_internal.h"
+#include "qrng_probes.h"
+
+#define POOL_RETRY_DELAY_MS 1000u
+#define POOL_SCHED_SLICE_NS 100000000u
+
+/* Predictive mode: sampling period, EWMA time constants and provisioning margins. */
+#define FORECAST_TICK_NS 20000000u
+#define FORECAST_FAST_TAU_NS 100000000.0
+#define FORECAST_SLOW_TAU_NS 2000000000.0
+#define FORECAST_SAFETY 1.5
+#define FORECAST_CAPACITY_FACTOR 2u
+
+#ifdef NO_DYNAMIC_MEMORY_ALLOCATION
+#define POOL_MAX_CAPACITY (1024u * 1024u)
+static uint8_t pool_storage[POOL_MAX_CAPACITY];
+static uint8_t pool_scratch[QRNG_CHUNK_MAX_BYTES];
+#endif
+
+typedef struct {
+    uint8_t *data;
+    uint8_t *scratch;
+    size_t capacity;
+    size_t low_watermark;
+    size_t head;
+    size_t level;
+    bool predictive;
+    size_t min_capacity;
+    size_t max_capacity;
+    uint64_t consumed;
+    uint64_t last_sample_ns;
+    double rate_fast;
+    double rate_slow;
+    uint64_t underflows;
+    bool enabled;
+    bool running;
+    unsigned generation;
+    int tenant;
+    CURL *handle;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t refill;
+}pool_t;
+
+static pool_t pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .refill = PTHREAD_COND_INITIALIZER
+};
+
+static void *pool_refill_thread(void *arg);
+static int pool_start_locked(size_t capacity, size_t low_watermark);
+static int pool_start_predictive_locked(void);
+static void pool_after_fork_locked(bool restart);
+static void pool_forecast_locked(void);
+static void pool_resize_locked(size_t capacity);
+static void pool_push(const uint8_t *src, size_t len);
+static void pool_release_storage(void);
+static size_t pool_min_watermark(void);
+
+
+int qrng_pool_enable(size_t capacity, size_t low_watermark)
+{
+    int retval = 0;
+
+    if (capacity == 0 || low_watermark >= capacity) {
+        return -1;
+    }
+    /* A zero threshold would never trigger a refill; 1 refills once the pool is empty. */
+    if (low_watermark == 0) {
+        low_watermark = 1u;
+    }
+
+    qrng_pool_disable();
+    pthread_mutex_lock(&pool.lock);
+    pool.predictive = false;
+    pool.tenant = qrng_sched_tenant();
+    retval = pool_start_locked(capacity, low_watermark);
+    pthread_mutex_unlock(&pool.lock);
+    return retval;
+}
+
+
+int qrng_pool_enable_predictive(size_t min_capacity, size_t max_capacity)
+{
+    int retval = 0;
+
+    if (min_capacity == 0 || min_capacity > max_capacity) {
+        return -1;
+    }
+
+    qrng_pool_disable();
+    pthread_mutex_lock(&pool.lock);
+    pool.predictive = true;
+    pool.tenant = qrng_sched_tenant();
+    pool.min_capacity = min_capacity;
+    pool.max_capacity = max_capacity;
+    retval = pool_start_predictive_locked();
+    pthread_mutex_unlock(&pool.lock);
+    return retval;
+}
+
+
+int qrng_pool_get_stats(struct qrng_pool_stats *stats)
+{
+    if (stats == NULL) {
+        return -1;
+    }
+    pthread_mutex_lock(&pool.lock);
+    /* After a fork the inherited pool is not ours; it is restarted by the next take, not here. */
+    if (pool.generation != qrng_fork_generation()) {
+        memset(stats, 0, sizeof(*stats));
+        pthread_mutex_unlock(&pool.lock);
+        return 0;
+    }
+    stats->level = pool.level;
+    stats->capacity = pool.capacity;
+    stats->refill_threshold = pool.low_watermark;
+    stats->rate_bps = (uint64_t)(pool.rate_fast > pool.rate_slow ? pool.rate_fast : pool.rate_slow);
+    stats->underflows = pool.underflows;
+    pthread_mutex_unlock(&pool.lock);
+    return 0;
+}
+
+
+int pool_start_locked(size_t capacity, size_t low_watermark)
+{
+    int retval = 0;
+
+    /* In client mode the daemon owns the pool; a local one would have no appliance to fill it. */
+    if (qrng_client_enabled()) {
+        return 0;
+    }
+    pool.generation = qrng_fork_generation();
+#ifdef NO_DYNAMIC_MEMORY_ALLOCATION
+    if (capacity > POOL_MAX_CAPACITY) {
+        capacity = POOL_MAX_CAPACITY;
+        if (low_watermark >= capacity) {
+            low_watermark = capacity / 2;
+        }
+    }
+    pool.data = pool_storage;
+    pool.scratch = pool_scratch;
+#else
+    pool.data = malloc(capacity);
+    pool.scratch = malloc(QRNG_CHUNK_MAX_BYTES);
+    if (!pool.data || !pool.scratch) {
+        fprintf(stderr, "Not enough memory for the entropy pool\n");
+        pool_release_storage();
+        return -1;
+    }
+#endif
+    pool.capacity = capacity;
+    pool.low_watermark = low_watermark;
+    pool.head = 0;
+    pool.level = 0;
+
+    pool.handle = curl_easy_init();
+    if (!pool.handle) {
+        fprintf(stderr, "Error in curl_easy_init");
+        pool_release_storage();
+        retval = -2;
+    }
+    else {
+        qrng_setup_handle(pool.handle);
+        /* Refills are background work and yield to interactive requests like any bulk transfer. */
+        qrng_lane_setup_bulk(pool.handle);
+        pool.running = true;
+        if (pthread_create(&pool.thread, NULL, &pool_refill_thread, NULL) != 0) {
+            fprintf(stderr, "Cannot start the pool refill thread\n");
+            curl_easy_cleanup(pool.handle);
+            pool.handle = NULL;
+            pool.running = false;
+            pool_release_storage();
+            retval = -1;
+        }
+        else {
+            pool.enabled = true;
+        }
+    }
+    return retval;
+}
+
+
+int pool_start_predictive_locked(void)
+{
+    pool.consumed = 0;
+    pool.rate_fast = 0.0;
+    pool.rate_slow = 0.0;
+    pool.last_sample_ns = qrng_now_ns();
+#ifdef NO_DYNAMIC_MEMORY_ALLOCATION
+    return pool_start_locked(pool.max_capacity, pool_min_watermark());
+#else
+    /* Start small; the forecaster grows the buffer once demand shows up. */
+    return pool_start_locked(pool.min_capacity, pool_min_watermark());
+#endif
+}
+
+
+void qrng_pool_disable(void)
+{
+    pthread_mutex_lock(&pool.lock);
+    if (pool.generation != qrng_fork_generation()) {
+        pool_after_fork_locked(false);
+    }
+    if (!pool.enabled) {
+        pthread_mutex_unlock(&pool.lock);
+        return;
+    }
+    pool.enabled = false;
+    pool.running = false;
+    pthread_cond_broadcast(&pool.refill);
+    pthread_mutex_unlock(&pool.lock);
+
+    /* The refill thread may be inside curl_easy_perform; wait for it to finish. */
+    pthread_join(pool.thread, NULL);
+
+    pthread_mutex_lock(&pool.lock);
+    curl_easy_cleanup(pool.handle);
+    pool.handle = NULL;
+    /* Never leave random bytes behind in freed memory. */
+    memset(pool.data, 0, pool.capacity);
+    pool_release_storage();
+    pthread_mutex_unlock(&pool.lock);
+}
+
+
+size_t qrng_pool_level(void)
+{
+    size_t level = 0;
+    pthread_mutex_lock(&pool.lock);
+    if (pool.generation == qrng_fork_generation()) {
+        level = pool.level;
+    }
+    pthread_mutex_unlock(&pool.lock);
+    return level;
+}
+
+
+size_t qrng_pool_take(uint8_t *dst, size_t len)
+{
+    size_t copied = 0;
+    size_t part = 0;
+
+    pthread_mutex_lock(&pool.lock);
+    if (pool.generation != qrng_fork_generation()) {
+        pool_after_fork_locked(true);
+    }
+    if (pool.enabled) {
+        /* Forecast the demand, not what the pool happened to satisfy. */
+        pool.consumed += len;
+        if (len > pool.level) {
+            /* The consumer has to fall back to the network: a stall. */
+            pool.underflows++;
+            QRNG_PROBE2(pool__underflow, len, pool.level);
+            len = pool.level;
+        }
+        while (copied < len) {
+            part = pool.capacity - pool.head;
+            if (part > len - copied) {
+                part = len - copied;
+            }
+            memcpy(dst + copied, pool.data + pool.head, part);
+            /* Consumed bytes must not be handed out twice. */
+            memset(pool.data + pool.head, 0, part);
+            pool.head = (pool.head + part) % pool.capacity;
+            copied += part;
+        }
+        pool.level -= copied;
+        if (pool.level < pool.low_watermark) {
+            pthread_cond_signal(&pool.refill);
+        }
+    }
+    pthread_mutex_unlock(&pool.lock);
+    return copied;
+}
+
+
+void qrng_pool_shutdown(void)
+{
+    qrng_pool_disable();
+}
+
+
+void qrng_pool_atfork(e_fork_phase_t phase)
+{
+    if (phase == FORK_PREPARE) {
+        pthread_mutex_lock(&pool.lock);
+    }
+    else if (phase == FORK_PARENT) {
+        pthread_mutex_unlock(&pool.lock);
+    }
+    else {
+        /* The refill thread stayed in the parent; its connection is closed here, the rest waits for first use. */
+        if (pool.enabled) {
+            qrng_abandon_handle(pool.handle);
+            pool.handle = NULL;
+            pool.running = false;
+        }
+        pthread_cond_init(&pool.refill, NULL);
+        pthread_mutex_init(&pool.lock, NULL);
+    }
+}
+
+
+void pool_after_fork_locked(bool restart)
+{
+    size_t capacity = pool.capacity;
+    size_t low_watermark = pool.low_watermark;
+
+    pool.generation = qrng_fork_generation();
+    if (!pool.enabled) {
+        return;
+    }
+    /* Inherited bytes are the parent's to hand out; serving them here would duplicate them. */
+    memset(pool.data, 0, pool.capacity);
+    pool_release_storage();
+    pool.enabled = false;
+    if (!restart) {
+        return;
+    }
+    if (pool.predictive) {
+        (void)pool_start_predictive_locked();
+    }
+    else {
+        (void)pool_start_locked(capacity, low_watermark);
+    }
+}
+
+
+void *pool_refill_thread(void *arg)
+{
+    size_t want = 0;
+    size_t chunk = 0;
+    size_t received = 0;
+    int error = 0;
+    struct timespec retry;
+
+    (void)arg;
+    (void)qrng_set_tenant(pool.tenant);
+    pthread_mutex_lock(&pool.lock);
+    while (pool.running) {
+        if (pool.predictive) {
+            pool_forecast_locked();
+        }
+        if (pool.level >= pool.low_watermark) {
+            if (pool.predictive) {
+                /* Keep sampling the consumption rate even when nothing is taken. */
+                clock_gettime(CLOCK_REALTIME, &retry);
+                retry.tv_nsec += FORECAST_TICK_NS;
+                retry.tv_sec += retry.tv_nsec / 1000000000L;
+                retry.tv_nsec %= 1000000000L;
+                pthread_cond_timedwait(&pool.refill, &pool.lock, &retry);
+            }
+            else {
+                pthread_cond_wait(&pool.refill, &pool.lock);
+            }
+            continue;
+        }
+        want = pool.capacity - pool.level;
+        chunk = qrng_chunk_size();
+        if (want > chunk) {
+            want = chunk;
+        }
+        pthread_mutex_unlock(&pool.lock);
+
+        /* Waits are sliced, so that disabling the pool is not held up by a tenant over its rate. */
+        if (qrng_backend_sched_wait(qrng_now_ns() + POOL_SCHED_SLICE_NS) != 0) {
+            pthread_mutex_lock(&pool.lock);
+            continue;
+        }
+        received = 0;
+        error = qrng_fetch_raw(pool.handle, want, pool.scratch, &received, 0);
+
+        pthread_mutex_lock(&pool.lock);
+        pool_push(pool.scratch, received);
+        memset(pool.scratch, 0, received);
+        QRNG_PROBE3(pool__refill, want, received, pool.level);
+        if (error && pool.running) {
+            /* Do not hammer an appliance that is failing; retry later. */
+            clock_gettime(CLOCK_REALTIME, &retry);
+            retry.tv_sec += POOL_RETRY_DELAY_MS / 1000u;
+            pthread_cond_timedwait(&pool.refill, &pool.lock, &retry);
+            qrng_stats_record_retry(STREAM_BINARY);
+        }
+    }
+    pthread_mutex_unlock(&pool.lock);
+    return NULL;
+}
+
+
+void pool_forecast_locked(void)
+{
+    uint64_t now = qrng_now_ns();
+    uint64_t dt = now - pool.last_sample_ns;
+    double rate = 0.0;
+    double lead_s = 0.0;
+    double target = 0.0;
+    size_t capacity = 0;
+    struct qrng_chunk_stats link;
+
+    if (dt < FORECAST_TICK_NS) {
+        return;
+    }
+    rate = (double)pool.consumed * 1e9 / (double)dt;
+    pool.consumed = 0;
+    pool.last_sample_ns = now;
+    /* Two EWMAs: the fast one follows ramp-ups, the slow one keeps memory through short lulls. */
+    pool.rate_fast += (rate - pool.rate_fast) * ((double)dt / (FORECAST_FAST_TAU_NS + (double)dt));
+    pool.rate_slow += (rate - pool.rate_slow) * ((double)dt / (FORECAST_SLOW_TAU_NS + (double)dt));
+    rate = pool.rate_fast > pool.rate_slow ? pool.rate_fast : pool.rate_slow;
+
+    /* Buffered bytes must cover the demand while one chunk is fetched, plus one round trip. */
+    (void)qrng_get_chunk_stats(&link);
+    lead_s = (double)link.rtt_us / 1e6;
+    if (link.bandwidth_bps > 0) {
+        lead_s += (double)link.chunk_bytes / (double)link.bandwidth_bps;
+    }
+    target = rate * lead_s * FORECAST_SAFETY;
+
+    capacity = (size_t)target * FORECAST_CAPACITY_FACTOR;
+    if (capacity < pool.min_capacity) {
+        capacity = pool.min_capacity;
+    }
+    if (capacity > pool.max_capacity) {
+        capacity = pool.max_capacity;
+    }
+    /* Grow at once, shrink only when far too big to avoid reallocating on every tick. */
+    if (capacity > pool.capacity || capacity * 2u < pool.capacity) {
+        pool_resize_locked(capacity);
+    }
+    pool.low_watermark = (size_t)target < pool.capacity ? (size_t)target : pool.capacity - 1u;
+    if (pool.low_watermark < pool_min_watermark()) {
+        pool.low_watermark = pool_min_watermark();
+    }
+}
+
+
+size_t pool_min_watermark(void)
+{
+    /* As in qrng_pool_enable, a zero threshold would never trigger a refill. */
+    return pool.min_capacity / 2u > 0 ? pool.min_capacity / 2u : 1u;
+}
+
+
+void pool_resize_locked(size_t capacity)
+{
+#ifdef NO_DYNAMIC_MEMORY_ALLOCATION
+    /* Static storage: only the refill threshold adapts. */
+    (void)capacity;
+#else
+    uint8_t *data = malloc(capacity);
+    size_t keep = pool.level < capacity ? pool.level : capacity;
+    size_t part = 0;
+
+    if (data == NULL) {
+        return;
+    }
+    /* Linearize the ring into the new buffer; bytes that do not fit are wiped, never reused. */
+    part = pool.capacity - pool.head;
+    if (part > keep) {
+        part = keep;
+    }
+    memcpy(data, pool.data + pool.head, part);
+    memcpy(data + part, pool.data, keep - part);
+    memset(pool.data, 0, pool.capacity);
+    free(pool.data);
+    pool.data = data;
+    pool.capacity = capacity;
+    pool.head = 0;
+    pool.level = keep;
+#endif
+}
+
+
+void pool_push(const uint8_t *src, size_t len)
+{
+    size_t tail = 0;
+    size_t part = 0;
+
+    if (len > pool.capacity - pool.level) {
+        len = pool.capacity - pool.level;
+    }
+    while (len > 0) {
+        tail = (pool.head + pool.level) % pool.capacity;
+        part = pool.capacity - tail;
+        if (part > len) {
+            part = len;
+        }
+        memcpy(pool.data + tail, src, part);
+        pool.level += part;
+        src += part;
+        len -= part;
+    }
+}
+
+
+void pool_release_storage(void)
+{
+#ifndef NO_DYNAMIC_MEMORY_ALLOCATION
+    free(pool.data);
+    free(pool.scratch);
+#endif
+    pool.data = NULL;
+    pool.scratch = NULL;
+    pool.capacity = 0;
+    pool.low_watermark = 0;
+    pool.head = 0;
+    pool.level = 0;
+}
@@ -0,0 +1,64 @@
+/****************************************************************************
+ * libqrng - library for interacting with IDQ's Quantis Appliance           *
+ *                                                                          *
+ * Copyright (C) 2023  Sebastian Mihai Ardelean                             *
+ *                                                                          *
+ * This program is free software: you can redistribute it and/or modify     *
+ * it under the terms of the GNU General Public License as published by     *
+ * the Free Software Foundation, either version 3 of the License, or        *
+ * (at your option) any later version.                                      *
+ *                                                                          *
+ * This program is distributed in the hope that it will be useful,          *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ * GNU General Public License for more details.                             *
+ *                                                                          *
+ * You should have received a copy of the GNU General Public License        *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+
+/**
+ * @file qrng_probes.h
+ * @author Sebastian Mihai Ardelean <sebastian.ardelean@cs.upt.ro>
+ * @date 24 May 2023
+ * @brief USDT probe points of the libqrng provider. Not installed.
+ *
+ * When <sys/sdt.h> (systemtap-sdt-dev) is available at build time every probe compiles to a
+ * single nop plus an ELF note, so probes cost nothing until a tracer attaches, e.g.
+ *
+ *   bpftrace -e 'usdt:/usr/local/lib/libqrng.so.1.0:libqrng:request__end { @[arg0] = hist(arg3); }'
+ *
+ * Without the header, or with -DQRNG_NO_PROBES, the probes expand to nothing.
+ *
+ * Probes and arguments:
+ *   request__start  (type, samples)
+ *   request__end    (type, samples, result, latency_ns, wire_bytes)
+ *   chunk__received (bytes, total_bytes)
+ *   parse__start    (type, samples)
+ *   parse__end      (type, samples, parse_ns)
+ *   pool__refill    (requested, received, level)
+ *   pool__underflow (requested, available)
+ */
+
+#ifndef QRNG_PROBES_H
+#define QRNG_PROBES_H
+
+#if !defined(QRNG_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define QRNG_HAVE_PROBES 1
+#endif
+#endif
+
+#ifdef QRNG_HAVE_PROBES
+#include <sys/sdt.h>
+#define QRNG_PROBE2(name, a, b) DTRACE_PROBE2(libqrng, name, a, b)
+#define QRNG_PROBE3(name, a, b, c) DTRACE_PROBE3(libqrng, name, a, b, c)
+#define QRNG_PROBE5(name, a, b, c, d, e) DTRACE_PROBE5(libqrng, name, a, b, c, d, e)
+#else
+#define QRNG_PROBE2(name, a, b) do { (void)(a); (void)(b); } while (0)
+#define QRNG_PROBE3(name, a, b, c) do { (void)(a); (void)(b); (void)(c); } while (0)
+#define QRNG_PROBE5(name, a, b, c, d, e) \
+    do { (void)(a); (void)(b); (void)(c); (void)(d); (void)(e); } while (0)
+#endif
+
+#endif /* QRNG_PROBES_H */
@@ -0,0 +1,471 @@
+/****************************************************************************
+ * libqrng - library for interacting with IDQ's Quantis Appliance           *
+ *                                                                          *
+ * Copyright (C) 2023  Sebastian Mihai Ardelean                             *
+ *                                                                          *
+ * This program is free software: you can redistribute it and/or modify     *
+ * it under the terms of the GNU General Public License as published by     *
+ * the Free Software Foundation, either version 3 of the License, or        *
+ * (at your option) any later version.                                      *
+ *                                                                          *
+ * This program is distributed in the hope that it will be useful,          *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ * GNU General Public License for more details.                             *
+ *                                                                          *
+ * You should have received a copy of the GNU General Public License        *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+
+/**
+ * @file qrng_reserve.c
+ * @author Sebastian Mihai Ardelean <sebastian.ardelean@cs.upt.ro>
+ * @date 24 May 2023
+ * @brief Persistent on-disk reserve of random bytes, memory mapped, with a consumption journal.
+ *
+ * The file holds a header page followed by a ring of @capacity@ bytes. Positions are absolute
+ * byte counts: bytes in [consumed, filled) are available. The journal is two entries in separate
+ * sectors of the header page, written alternately with a sequence number and a checksum, so a
+ * torn write leaves the previous entry intact.
+ *
+ * Consumers never wait for the disk per call: the journal records a consumption limit
+ * (@claimed@) ahead of the real position, one step at a time, and bytes are copied straight out
+ * of the mapping up to that limit. After a crash the reserve resumes at the recorded limit, so
+ * the bytes between the real position and the limit are dropped, never handed out again. Fresh
+ * bytes are written to disk before the journal publishes them.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <curl/curl.h>
+#include "qrng.h"
+#include "qrng_internal.h"
+
+#define RESERVE_MAGIC UINT64_C(0x31565253474e5251)      /* "QRNGSRV1" */
+#define RESERVE_VERSION 1u
+#define RESERVE_HEADER_BYTES 4096u
+#define RESERVE_SECTOR 512u
+#define RESERVE_MIN_CAPACITY (1024u * 1024u)
+#define RESERVE_MIN_STEP (64u * 1024u)
+#define RESERVE_MAX_STEP (64u * 1024u * 1024u)
+#define RESERVE_MIN_FILL (64u * 1024u)
+#define RESERVE_RETRY_DELAY_MS 1000u
+#define RESERVE_SCHED_SLICE_NS 100000000u
+
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t capacity;
+}reserve_header_t;
+
+typedef struct {
+    uint64_t seq;
+    uint64_t claimed;
+    uint64_t filled;
+    uint64_t checksum;
+}journal_entry_t;
+
+typedef struct {
+    int fd;
+    uint8_t *map;
+    size_t map_size;
+    uint8_t *data;
+    uint64_t capacity;
+    uint64_t consumed;
+    uint64_t claimed;
+    uint64_t filled;
+    uint64_t seq;
+    uint64_t step;
+    uint64_t served;
+    uint64_t journal_writes;
+    bool enabled;
+    bool running;
+    int tenant;
+    CURL *handle;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t refill;
+}reserve_t;
+
+static reserve_t reserve = {
+    .fd = -1,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .refill = PTHREAD_COND_INITIALIZER
+};
+
+static int reserve_load(uint64_t capacity, bool created);
+static journal_entry_t *journal_slot(uint64_t seq);
+static uint64_t journal_checksum(const journal_entry_t *entry);
+static int journal_write_locked(void);
+static void *reserve_fill_thread(void *arg);
+static void reserve_unmap(void);
+
+
+int qrng_reserve_open(const char *path, size_t capacity)
+{
+    struct stat st;
+    bool created = false;
+    int retval = 0;
+
+    /* In client mode the daemon owns the appliance connection that fills the reserve. */
+    if (qrng_client_enabled()) {
+        return 0;
+    }
+    if (path == NULL || capacity < RESERVE_MIN_CAPACITY) {
+        return -1;
+    }
+    qrng_reserve_close();
+    capacity = capacity / RESERVE_HEADER_BYTES * RESERVE_HEADER_BYTES;
+
+    pthread_mutex_lock(&reserve.lock);
+    reserve.tenant = qrng_sched_tenant();
+    reserve.fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    /* Two processes on one file would hand out the same bytes. */
+    if (reserve.fd < 0 || flock(reserve.fd, LOCK_EX | LOCK_NB) != 0 || fstat(reserve.fd, &st) != 0) {
+        fprintf(stderr, "Cannot open the entropy reserve %s: %s\n", path, strerror(errno));
+        reserve_unmap();
+        pthread_mutex_unlock(&reserve.lock);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        created = true;
+        if (ftruncate(reserve.fd, (off_t)(RESERVE_HEADER_BYTES + capacity)) != 0) {
+            fprintf(stderr, "Cannot size the entropy reserve %s: %s\n", path, strerror(errno));
+            reserve_unmap();
+            pthread_mutex_unlock(&reserve.lock);
+            return -1;
+        }
+        st.st_size = (off_t)(RESERVE_HEADER_BYTES + capacity);
+    }
+    reserve.map_size = (size_t)st.st_size;
+    reserve.map = mmap(NULL, reserve.map_size, PROT_READ | PROT_WRITE, MAP_SHARED, reserve.fd, 0);
+    if (reserve.map == MAP_FAILED) {
+        reserve.map = NULL;
+        fprintf(stderr, "Cannot map the entropy reserve %s: %s\n", path, strerror(errno));
+        reserve_unmap();
+        pthread_mutex_unlock(&reserve.lock);
+        return -1;
+    }
+    if (reserve_load(capacity, created) != 0) {
+        fprintf(stderr, "%s is not a libqrng entropy reserve\n", path);
+        reserve_unmap();
+        pthread_mutex_unlock(&reserve.lock);
+        return -1;
+    }
+
+    reserve.handle = curl_easy_init();
+    if (!reserve.handle) {
+        fprintf(stderr, "Error in curl_easy_init");
+        reserve_unmap();
+        retval = -2;
+    }
+    else {
+        qrng_setup_handle(reserve.handle);
+        /* Filling is background work and yields to interactive requests like any bulk transfer. */
+        qrng_lane_setup_bulk(reserve.handle);
+        reserve.running = true;
+        if (pthread_create(&reserve.thread, NULL, &reserve_fill_thread, NULL) != 0) {
+            fprintf(stderr, "Cannot start the reserve fill thread\n");
+            curl_easy_cleanup(reserve.handle);
+            reserve.handle = NULL;
+            reserve.running = false;
+            reserve_unmap();
+            retval = -1;
+        }
+        else {
+            reserve.enabled = true;
+        }
+    }
+    pthread_mutex_unlock(&reserve.lock);
+    return retval;
+}
+
+
+void qrng_reserve_close(void)
+{
+    pthread_mutex_lock(&reserve.lock);
+    if (!reserve.enabled) {
+        pthread_mutex_unlock(&reserve.lock);
+        return;
+    }
+    reserve.enabled = false;
+    reserve.running = false;
+    pthread_cond_broadcast(&reserve.refill);
+    pthread_mutex_unlock(&reserve.lock);
+
+    /* The fill thread may be inside curl_easy_perform; wait for it to finish. */
+    pthread_join(reserve.thread, NULL);
+
+    pthread_mutex_lock(&reserve.lock);
+    curl_easy_cleanup(reserve.handle);
+    reserve.handle = NULL;
+    /* A clean close records the exact position: nothing is dropped. */
+    reserve.claimed = reserve.consumed;
+    (void)journal_write_locked();
+    reserve_unmap();
+    pthread_mutex_unlock(&reserve.lock);
+}
+
+
+int qrng_reserve_get_stats(struct qrng_reserve_stats *stats)
+{
+    if (stats == NULL) {
+        return -1;
+    }
+    pthread_mutex_lock(&reserve.lock);
+    stats->level = reserve.enabled ? reserve.filled - reserve.consumed : 0;
+    stats->capacity = reserve.enabled ? reserve.capacity : 0;
+    stats->served = reserve.served;
+    stats->journal_writes = reserve.journal_writes;
+    pthread_mutex_unlock(&reserve.lock);
+    return 0;
+}
+
+
+void qrng_reserve_atfork(e_fork_phase_t phase)
+{
+    if (phase == FORK_PREPARE) {
+        pthread_mutex_lock(&reserve.lock);
+    }
+    else if (phase == FORK_PARENT) {
+        pthread_mutex_unlock(&reserve.lock);
+    }
+    else {
+        /* The file stays with the parent: its position is the parent's, and the child's copy of
+           the descriptor would otherwise keep the lock after the parent is gone. */
+        if (reserve.enabled) {
+            qrng_abandon_handle(reserve.handle);
+            reserve.handle = NULL;
+            reserve.enabled = false;
+            reserve.running = false;
+        }
+        reserve_unmap();
+        pthread_cond_init(&reserve.refill, NULL);
+        pthread_mutex_init(&reserve.lock, NULL);
+    }
+}
+
+
+size_t qrng_reserve_take(uint8_t *dst, size_t len)
+{
+    size_t copied = 0;
+    size_t part = 0;
+    uint64_t offset = 0;
+    uint64_t claimed = 0;
+
+    pthread_mutex_lock(&reserve.lock);
+    if (reserve.enabled) {
+        if (len > reserve.filled - reserve.consumed) {
+            len = (size_t)(reserve.filled - reserve.consumed);
+        }
+        if (reserve.consumed + len > reserve.claimed) {
+            /* Record the consumption before handing anything out, a whole step ahead. */
+            claimed = reserve.claimed;
+            reserve.claimed = reserve.consumed + len + reserve.step;
+            if (reserve.claimed > reserve.filled) {
+                reserve.claimed = reserve.filled;
+            }
+            if (journal_write_locked() != 0) {
+                reserve.claimed = claimed;
+                len = 0;
+            }
+        }
+        while (copied < len) {
+            offset = (reserve.consumed + copied) % reserve.capacity;
+            part = (size_t)(reserve.capacity - offset);
+            if (part > len - copied) {
+                part = len - copied;
+            }
+            memcpy(dst + copied, reserve.data + offset, part);
+            copied += part;
+        }
+        reserve.consumed += copied;
+        reserve.served += copied;
+        if (copied > 0 && reserve.capacity - (reserve.filled - reserve.consumed) >= RESERVE_MIN_FILL) {
+            pthread_cond_signal(&reserve.refill);
+        }
+    }
+    pthread_mutex_unlock(&reserve.lock);
+    return copied;
+}
+
+
+int reserve_load(uint64_t capacity, bool created)
+{
+    reserve_header_t *header = (reserve_header_t *)reserve.map;
+    journal_entry_t *entry = NULL;
+    journal_entry_t *best = NULL;
+
+    if (created) {
+        memset(reserve.map, 0, RESERVE_HEADER_BYTES);
+        header->magic = RESERVE_MAGIC;
+        header->version = RESERVE_VERSION;
+        header->capacity = capacity;
+    }
+    /* An existing file keeps its own size; @capacity@ only applies to new reserves. */
+    if (header->magic != RESERVE_MAGIC || header->version != RESERVE_VERSION ||
+        header->capacity < RESERVE_MIN_CAPACITY || header->capacity % RESERVE_HEADER_BYTES != 0 ||
+        RESERVE_HEADER_BYTES + header->capacity > reserve.map_size) {
+        return -1;
+    }
+    reserve.capacity = header->capacity;
+    reserve.data = reserve.map + RESERVE_HEADER_BYTES;
+
+    for (uint64_t i = 0; i < 2u; i++) {
+        entry = journal_slot(i);
+        if (entry->checksum == journal_checksum(entry) && entry->claimed <= entry->filled &&
+            entry->filled - entry->claimed <= reserve.capacity && (best == NULL || entry->seq > best->seq)) {
+            best = entry;
+        }
+    }
+    if (best != NULL) {
+        /* Whatever was taken after the last record is unknown: resume at the recorded limit. */
+        reserve.seq = best->seq;
+        reserve.claimed = best->claimed;
+        reserve.filled = best->filled;
+    }
+    else {
+        /* No valid journal: start empty, so that no stored byte can come out twice. */
+        reserve.seq = 0;
+        reserve.claimed = 0;
+        reserve.filled = 0;
+    }
+    reserve.consumed = reserve.claimed;
+    reserve.step = reserve.capacity / 64u;
+    reserve.step = reserve.step < RESERVE_MIN_STEP ? RESERVE_MIN_STEP :
+                   reserve.step > RESERVE_MAX_STEP ? RESERVE_MAX_STEP : reserve.step;
+    madvise(reserve.data, (size_t)reserve.capacity, MADV_SEQUENTIAL);
+    return journal_write_locked();
+}
+
+
+journal_entry_t *journal_slot(uint64_t seq)
+{
+    /* One sector per entry, so that a torn write can only damage the one being written. */
+    return (journal_entry_t *)(reserve.map + RESERVE_SECTOR * (1u + seq % 2u));
+}
+
+
+uint64_t journal_checksum(const journal_entry_t *entry)
+{
+    const uint64_t words[] = { RESERVE_MAGIC, entry->seq, entry->claimed, entry->filled };
+    uint64_t hash = UINT64_C(0xcbf29ce484222325);
+    size_t i = 0;
+
+    /* FNV-1a over the fields; enough to tell a complete entry from a torn one. */
+    for (i = 0; i < sizeof(words); i++) {
+        hash ^= ((const uint8_t *)words)[i];
+        hash *= UINT64_C(0x100000001b3);
+    }
+    return hash;
+}
+
+
+int journal_write_locked(void)
+{
+    journal_entry_t *entry = journal_slot(reserve.seq + 1u);
+
+    entry->seq = reserve.seq + 1u;
+    entry->claimed = reserve.claimed;
+    entry->filled = reserve.filled;
+    entry->checksum = journal_checksum(entry);
+    if (msync(reserve.map, RESERVE_HEADER_BYTES, MS_SYNC) != 0) {
+        fprintf(stderr, "Cannot write the entropy reserve journal: %s\n", strerror(errno));
+        return -1;
+    }
+    reserve.seq++;
+    reserve.journal_writes++;
+    return 0;
+}
+
+
+void *reserve_fill_thread(void *arg)
+{
+    uint64_t space = 0;
+    uint64_t offset = 0;
+    size_t want = 0;
+    size_t received = 0;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    uint8_t *start = NULL;
+    int error = 0;
+    struct timespec retry;
+
+    (void)arg;
+    (void)qrng_set_tenant(reserve.tenant);
+    pthread_mutex_lock(&reserve.lock);
+    while (reserve.running) {
+        space = reserve.capacity - (reserve.filled - reserve.consumed);
+        if (space < RESERVE_MIN_FILL) {
+            pthread_cond_wait(&reserve.refill, &reserve.lock);
+            continue;
+        }
+        /* Fill up to the end of the ring at most, so that one transfer lands in one piece. */
+        offset = reserve.filled % reserve.capacity;
+        want = qrng_chunk_size();
+        want = want < space ? want : (size_t)space;
+        want = want < reserve.capacity - offset ? want : (size_t)(reserve.capacity - offset);
+        pthread_mutex_unlock(&reserve.lock);
+
+        /* Sliced like the pool's, so that closing is not held up by a tenant over its rate. */
+        if (qrng_backend_sched_wait(qrng_now_ns() + RESERVE_SCHED_SLICE_NS) != 0) {
+            pthread_mutex_lock(&reserve.lock);
+            continue;
+        }
+        /* Consumers only read below @filled@, so the appliance can write straight into the file. */
+        received = 0;
+        error = qrng_fetch_raw(reserve.handle, want, reserve.data + offset, &received, 0);
+        if (received > 0) {
+            start = reserve.data + offset / page * page;
+            if (msync(start, (size_t)(reserve.data + offset + received - start), MS_SYNC) != 0) {
+                received = 0;
+                error = -1;
+            }
+        }
+
+        pthread_mutex_lock(&reserve.lock);
+        if (received > 0) {
+            reserve.filled += received;
+            if (journal_write_locked() != 0) {
+                reserve.filled -= received;
+                error = -1;
+            }
+        }
+        if (error && reserve.running) {
+            /* Maintenance window or a failing disk: retry later, consumers keep the reserve. */
+            clock_gettime(CLOCK_REALTIME, &retry);
+            retry.tv_sec += RESERVE_RETRY_DELAY_MS / 1000u;
+            /* Takes signal @refill@ too; only shutdown ends the pause early. */
+            while (reserve.running && pthread_cond_timedwait(&reserve.refill, &reserve.lock, &retry) != ETIMEDOUT)
+                ;
+            qrng_stats_record_retry(STREAM_BINARY);
+        }
+    }
+    pthread_mutex_unlock(&reserve.lock);
+    return NULL;
+}
+
+
+void reserve_unmap(void)
+{
+    if (reserve.map != NULL) {
+        munmap(reserve.map, reserve.map_size);
+        reserve.map = NULL;
+        reserve.data = NULL;
+    }
+    if (reserve.fd >= 0) {
+        close(reserve.fd);
+        reserve.fd = -1;
+    }
+    reserve.map_size = 0;
+}
@@ -0,0 +1,542 @@
+/****************************************************************************
+ * libqrng - library for interacting with IDQ's Quantis Appliance           *
+ *                                                                          *
+ * Copyright (C) 2023  Sebastian Mihai Ardelean                             *
+ *                                                                          *
+ * This program is free software: you can redistribute it and/or modify     *
+ * it under the terms of the GNU General Public License as published by     *
+ * the Free Software Foundation, either version 3 of the License, or        *
+ * (at your option) any later version.                                      *
+ *                                                                          *
+ * This program is distributed in the hope that it will be useful,          *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ * GNU General Public License for more details.                             *
+ *                                                                          *
+ * You should have received a copy of the GNU General Public License        *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+
+/**
+ * @file qrng_ring.c
+ * @author Sebastian Mihai Ardelean <sebastian.ardelean@cs.upt.ro>
+ * @date 24 May 2023
+ * @brief Shared-memory ring of random bytes: one producer process, any number of consumer processes.
+ *
+ * The ring is a POSIX shared memory object holding fixed-size blocks, each with a sequence word
+ * in the style of a bounded MPMC queue: block @pos@ is free when its sequence equals @pos@, and
+ * holds data when it equals @pos + 1@. A consumer claims the block at the shared head by writing
+ * its pid into the block's owner word, copies the bytes out and frees the block by moving the
+ * sequence one lap ahead. The owner word makes every block go to exactly one consumer and lets the
+ * producer recycle blocks claimed by a consumer that died before freeing them. Both sides sleep on
+ * futexes in the mapped region when the ring is empty or full.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "qrng.h"
+#include "qrng_internal.h"
+
+#define RING_MAGIC 0x52494e47u             /* "RING" */
+#define RING_VERSION 1u
+#define RING_BLOCK 4096u
+#define RING_MIN_BLOCKS 16u
+#define RING_FILL_BATCH 64u
+#define RING_NAME_LENGTH 256u
+#define RING_CONSUMER_WAIT_MS 100u
+#define RING_PRODUCER_WAIT_MS 100u
+#define RING_RETRY_DELAY_MS 1000u
+#define RING_SPINS 64u
+
+typedef struct {
+    _Atomic uint64_t seq;
+    _Atomic int32_t owner;                 /* pid of the consumer holding the block, 0 if none */
+    uint32_t reserved;
+}ring_slot_t;
+
+/* Layout of the shared object: this header, the slots, then the blocks at @data_offset@. */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t blocks;
+    uint64_t block_size;
+    uint64_t data_offset;
+    _Atomic int32_t producer;              /* pid of the producer, 0 once it is gone */
+    uint32_t reserved;
+    _Alignas(64) _Atomic uint64_t head;
+    _Alignas(64) _Atomic uint32_t data_seq;
+    _Atomic uint32_t data_waiters;
+    _Alignas(64) _Atomic uint32_t space_seq;
+    _Atomic uint32_t space_waiters;
+    _Alignas(64) ring_slot_t slots[];
+}ring_header_t;
+
+typedef struct {
+    ring_header_t *hdr;
+    uint8_t *data;
+    size_t map_size;
+    char name[RING_NAME_LENGTH];
+    bool producer;
+    bool consumer;
+    pid_t self;
+    uint64_t tail;
+    atomic_bool stop;
+    int tenant;
+    pthread_t thread;
+    /* Rest of a partially consumed block, private to this process. */
+    uint8_t spare[RING_BLOCK];
+    size_t spare_off;
+    size_t spare_len;
+    pthread_mutex_t lock;
+}ring_t;
+
+static ring_t ring = {
+    .lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+static int ring_map(int fd, size_t size);
+static void *ring_fill_thread(void *arg);
+static size_t ring_free_run(uint64_t pos);
+static bool ring_recycle(uint64_t pos);
+static bool ring_claim(uint64_t *claimed);
+static void ring_release(uint64_t pos);
+static size_t ring_take_spare(uint8_t *dst, size_t len);
+static bool pid_alive(int32_t pid);
+static void futex_wait(_Atomic uint32_t *addr, uint32_t seen, long timeout_ms);
+static void futex_wake(_Atomic uint32_t *addr, int count);
+
+
+int qrng_ring_create(const char *name, size_t bytes)
+{
+    size_t blocks = bytes / RING_BLOCK;
+    size_t data_offset = 0;
+    size_t i = 0;
+    int fd = -1;
+
+    if (name == NULL || name[0] != '/' || strlen(name) >= RING_NAME_LENGTH || blocks < RING_MIN_BLOCKS) {
+        return -1;
+    }
+    qrng_fork_init();
+    qrng_ring_detach();
+
+    data_offset = sizeof(ring_header_t) + blocks * sizeof(ring_slot_t);
+    data_offset = (data_offset + RING_BLOCK - 1u) / RING_BLOCK * RING_BLOCK;
+    /* A ring left by a crashed producer is replaced; its consumers keep their old mapping. */
+    shm_unlink(name);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0660);
+    if (fd < 0 || ftruncate(fd, (off_t)(data_offset + blocks * RING_BLOCK)) != 0 ||
+        ring_map(fd, data_offset + blocks * RING_BLOCK) != 0) {
+        fprintf(stderr, "Cannot create the shared memory ring %s: %s\n", name, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+            shm_unlink(name);
+        }
+        return -1;
+    }
+    close(fd);
+
+    ring.hdr->blocks = blocks;
+    ring.hdr->block_size = RING_BLOCK;
+    ring.hdr->data_offset = data_offset;
+    for (i = 0; i < blocks; i++) {
+        atomic_init(&ring.hdr->slots[i].seq, i);
+        atomic_init(&ring.hdr->slots[i].owner, 0);
+    }
+    ring.data = (uint8_t *)ring.hdr + data_offset;
+    ring.tail = 0;
+    ring.self = getpid();
+    strcpy(ring.name, name);
+    atomic_store(&ring.hdr->producer, (int32_t)ring.self);
+    ring.hdr->version = RING_VERSION;
+    /* Consumers check the magic last: once it is there, the ring is usable. */
+    atomic_thread_fence(memory_order_release);
+    ring.hdr->magic = RING_MAGIC;
+
+    atomic_store(&ring.stop, false);
+    ring.tenant = qrng_sched_tenant();
+    ring.producer = true;
+    if (pthread_create(&ring.thread, NULL, &ring_fill_thread, NULL) != 0) {
+        ring.producer = false;
+        qrng_ring_detach();
+        return -1;
+    }
+    return 0;
+}
+
+
+int qrng_ring_attach(const char *name)
+{
+    struct stat st;
+    ring_header_t *hdr = NULL;
+    int fd = -1;
+
+    if (name == NULL || strlen(name) >= RING_NAME_LENGTH) {
+        return -1;
+    }
+    qrng_fork_init();
+    qrng_ring_detach();
+
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ring_header_t) ||
+        ring_map(fd, (size_t)st.st_size) != 0) {
+        fprintf(stderr, "Cannot attach to the shared memory ring %s: %s\n", name, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    close(fd);
+
+    hdr = ring.hdr;
+    atomic_thread_fence(memory_order_acquire);
+    if (hdr->magic != RING_MAGIC || hdr->version != RING_VERSION || hdr->block_size != RING_BLOCK ||
+        hdr->data_offset + hdr->blocks * RING_BLOCK > ring.map_size) {
+        fprintf(stderr, "%s is not a libqrng ring\n", name);
+        qrng_ring_detach();
+        return -1;
+    }
+    ring.data = (uint8_t *)hdr + hdr->data_offset;
+    ring.self = getpid();
+    strcpy(ring.name, name);
+    ring.spare_len = 0;
+    ring.consumer = true;
+    return 0;
+}
+
+
+void qrng_ring_detach(void)
+{
+    if (ring.producer) {
+        atomic_store(&ring.stop, true);
+        futex_wake(&ring.hdr->space_seq, INT_MAX);
+        pthread_join(ring.thread, NULL);
+        /* Tell sleeping consumers not to wait for more data. */
+        atomic_store(&ring.hdr->producer, 0);
+        atomic_fetch_add(&ring.hdr->data_seq, 1u);
+        futex_wake(&ring.hdr->data_seq, INT_MAX);
+        shm_unlink(ring.name);
+        ring.producer = false;
+    }
+    pthread_mutex_lock(&ring.lock);
+    ring.consumer = false;
+    memset(ring.spare, 0, sizeof(ring.spare));
+    ring.spare_len = 0;
+    pthread_mutex_unlock(&ring.lock);
+    if (ring.hdr != NULL) {
+        munmap(ring.hdr, ring.map_size);
+        ring.hdr = NULL;
+        ring.data = NULL;
+        ring.map_size = 0;
+    }
+}
+
+
+size_t qrng_ring_take(uint8_t *dst, size_t len, const struct timespec *deadline)
+{
+    ring_header_t *hdr = ring.hdr;
+    uint64_t end_ns = 0;
+    uint64_t now_ns = 0;
+    uint64_t pos = 0;
+    uint32_t seen = 0;
+    long wait_ms = qrng_ms_until(deadline);
+    const uint8_t *block = NULL;
+    size_t got = 0;
+    size_t n = 0;
+
+    if (!ring.consumer || len == 0) {
+        return 0;
+    }
+    got = ring_take_spare(dst, len);
+    /* Without a deadline the caller has the pool and the appliance to fall back on: take only what
+       is published already. A deadline caller may wait a little for the producer. */
+    if (wait_ms < 0) {
+        wait_ms = 0;
+    }
+    else if (wait_ms > (long)RING_CONSUMER_WAIT_MS) {
+        wait_ms = RING_CONSUMER_WAIT_MS;
+    }
+    end_ns = qrng_now_ns() + (uint64_t)wait_ms * 1000000u;
+
+    while (got < len) {
+        seen = atomic_load(&hdr->data_seq);
+        if (ring_claim(&pos)) {
+            block = ring.data + (pos % hdr->blocks) * RING_BLOCK;
+            n = len - got < RING_BLOCK ? len - got : RING_BLOCK;
+            memcpy(dst + got, block, n);
+            got += n;
+            if (n < RING_BLOCK) {
+                pthread_mutex_lock(&ring.lock);
+                /* Another thread may have refilled the spare meanwhile; the rest is then dropped. */
+                if (ring.spare_len == 0) {
+                    memcpy(ring.spare, block + n, RING_BLOCK - n);
+                    ring.spare_off = 0;
+                    ring.spare_len = RING_BLOCK - n;
+                }
+                pthread_mutex_unlock(&ring.lock);
+            }
+            ring_release(pos);
+            continue;
+        }
+        now_ns = qrng_now_ns();
+        if (now_ns >= end_ns || !pid_alive(atomic_load(&hdr->producer))) {
+            break;
+        }
+        atomic_fetch_add(&hdr->data_waiters, 1u);
+        futex_wait(&hdr->data_seq, seen, (long)((end_ns - now_ns + 999999u) / 1000000u));
+        atomic_fetch_sub(&hdr->data_waiters, 1u);
+    }
+    return got;
+}
+
+
+void qrng_ring_atfork(e_fork_phase_t phase)
+{
+    if (phase == FORK_PREPARE) {
+        pthread_mutex_lock(&ring.lock);
+        return;
+    }
+    if (phase == FORK_PARENT) {
+        pthread_mutex_unlock(&ring.lock);
+        return;
+    }
+    /* The mapping is shared and claims are exactly once, so the child keeps consuming under its own
+       pid. The spare was copied out of a claimed block: it stays the parent's. */
+    memset(ring.spare, 0, sizeof(ring.spare));
+    ring.spare_len = 0;
+    ring.self = getpid();
+    if (ring.producer) {
+        /* The fill thread stayed in the parent, which also removes the ring when it is done. */
+        ring.producer = false;
+        ring.consumer = true;
+    }
+    pthread_mutex_init(&ring.lock, NULL);
+}
+
+
+bool qrng_ring_attached(void)
+{
+    return ring.consumer;
+}
+
+
+int ring_map(int fd, size_t size)
+{
+    void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (addr == MAP_FAILED) {
+        return -1;
+    }
+    ring.hdr = (ring_header_t *)addr;
+    ring.map_size = size;
+    return 0;
+}
+
+
+void *ring_fill_thread(void *arg)
+{
+    ring_header_t *hdr = ring.hdr;
+    uint64_t pos = 0;
+    uint32_t seen = 0;
+    size_t run = 0;
+    size_t i = 0;
+
+    (void)arg;
+    (void)qrng_set_tenant(ring.tenant);
+    while (!atomic_load(&ring.stop)) {
+        pos = ring.tail;
+        seen = atomic_load(&hdr->space_seq);
+        run = ring_free_run(pos);
+        if (run == 0) {
+            if (ring_recycle(pos)) {
+                continue;
+            }
+            atomic_fetch_add(&hdr->space_waiters, 1u);
+            futex_wait(&hdr->space_seq, seen, RING_PRODUCER_WAIT_MS);
+            atomic_fetch_sub(&hdr->space_waiters, 1u);
+            continue;
+        }
+        /* The appliance writes straight into the shared blocks. */
+        if (qrng_random_bytes(run * RING_BLOCK, ring.data + (pos % hdr->blocks) * RING_BLOCK) != 0) {
+            struct timespec delay = { RING_RETRY_DELAY_MS / 1000u, 0 };
+            nanosleep(&delay, NULL);
+            continue;
+        }
+        for (i = 0; i < run; i++) {
+            atomic_store_explicit(&hdr->slots[(pos + i) % hdr->blocks].seq, pos + i + 1u, memory_order_release);
+        }
+        ring.tail = pos + run;
+        atomic_fetch_add(&hdr->data_seq, 1u);
+        if (atomic_load(&hdr->data_waiters) > 0) {
+            futex_wake(&hdr->data_seq, INT_MAX);
+        }
+    }
+    return NULL;
+}
+
+
+size_t ring_free_run(uint64_t pos)
+{
+    ring_header_t *hdr = ring.hdr;
+    ring_slot_t *slot = NULL;
+    int32_t owner = 0;
+    size_t run = 0;
+
+    /* Free blocks from @pos@ up to the end of the mapping, so that one transfer fills them. */
+    while (run < RING_FILL_BATCH && (run == 0 || (pos + run) % hdr->blocks != 0)) {
+        slot = &hdr->slots[(pos + run) % hdr->blocks];
+        if (atomic_load_explicit(&slot->seq, memory_order_acquire) != pos + run) {
+            break;
+        }
+        /* A consumer that died while backing off a stale claim would block the block forever. */
+        owner = atomic_load(&slot->owner);
+        if (owner != 0 && !pid_alive(owner)) {
+            atomic_compare_exchange_strong(&slot->owner, &owner, 0);
+        }
+        run++;
+    }
+    return run;
+}
+
+
+bool ring_recycle(uint64_t pos)
+{
+    ring_header_t *hdr = ring.hdr;
+    ring_slot_t *slot = &hdr->slots[pos % hdr->blocks];
+    uint64_t lap = pos - hdr->blocks;
+    int32_t owner = atomic_load(&slot->owner);
+
+    if (pos < hdr->blocks || owner == 0 || pid_alive(owner) ||
+        atomic_load_explicit(&slot->seq, memory_order_acquire) != lap + 1u) {
+        return false;
+    }
+    if (atomic_load(&hdr->head) > lap) {
+        /* Claimed but never freed: the bytes are dropped, never handed out twice. */
+        atomic_store_explicit(&slot->seq, pos, memory_order_release);
+        atomic_store(&slot->owner, 0);
+    }
+    else {
+        /* Died before the claim completed: the block goes to the next consumer. */
+        atomic_compare_exchange_strong(&slot->owner, &owner, 0);
+    }
+    return true;
+}
+
+
+bool ring_claim(uint64_t *claimed)
+{
+    ring_header_t *hdr = ring.hdr;
+    ring_slot_t *slot = NULL;
+    uint64_t pos = atomic_load(&hdr->head);
+    uint64_t seq = 0;
+    int32_t owner = 0;
+    int32_t none = 0;
+    unsigned spins = 0;
+
+    for (;;) {
+        slot = &hdr->slots[pos % hdr->blocks];
+        seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (seq == pos + 1u) {
+            owner = atomic_load(&slot->owner);
+            if (owner == 0) {
+                none = 0;
+                if (atomic_compare_exchange_strong(&slot->owner, &none, (int32_t)ring.self)) {
+                    /* The sequence may have moved on (another lap) since it was read. */
+                    if (atomic_load_explicit(&slot->seq, memory_order_acquire) == pos + 1u) {
+                        atomic_compare_exchange_strong(&hdr->head, &pos, pos + 1u);
+                        *claimed = pos;
+                        return true;
+                    }
+                    atomic_store(&slot->owner, 0);
+                }
+            }
+            else if (!pid_alive(owner) && atomic_load(&hdr->head) == pos) {
+                /* The owner died before moving the head, so it never copied the block. */
+                atomic_compare_exchange_strong(&slot->owner, &owner, 0);
+                continue;
+            }
+            /* Another consumer is between its claim and moving the head. */
+            if (++spins % RING_SPINS == 0) {
+                sched_yield();
+            }
+            pos = atomic_load(&hdr->head);
+        }
+        else if ((int64_t)(seq - (pos + 1u)) < 0) {
+            return false;
+        }
+        else {
+            pos = atomic_load(&hdr->head);
+        }
+    }
+}
+
+
+void ring_release(uint64_t pos)
+{
+    ring_header_t *hdr = ring.hdr;
+    ring_slot_t *slot = &hdr->slots[pos % hdr->blocks];
+
+    /* Sequence first: a cleared owner on a block still holding this lap could be claimed again. */
+    atomic_store_explicit(&slot->seq, pos + hdr->blocks, memory_order_release);
+    atomic_store_explicit(&slot->owner, 0, memory_order_release);
+    atomic_fetch_add(&hdr->space_seq, 1u);
+    if (atomic_load(&hdr->space_waiters) > 0) {
+        futex_wake(&hdr->space_seq, 1);
+    }
+}
+
+
+size_t ring_take_spare(uint8_t *dst, size_t len)
+{
+    size_t n = 0;
+
+    pthread_mutex_lock(&ring.lock);
+    n = len < ring.spare_len ? len : ring.spare_len;
+    if (n > 0) {
+        memcpy(dst, ring.spare + ring.spare_off, n);
+        memset(ring.spare + ring.spare_off, 0, n);
+        ring.spare_off += n;
+        ring.spare_len -= n;
+    }
+    pthread_mutex_unlock(&ring.lock);
+    return n;
+}
+
+
+bool pid_alive(int32_t pid)
+{
+    /* A recycled pid makes a dead process look alive; the block is then recovered late, not twice. */
+    return pid > 0 && (kill((pid_t)pid, 0) == 0 || errno == EPERM);
+}
+
+
+void futex_wait(_Atomic uint32_t *addr, uint32_t seen, long timeout_ms)
+{
+    struct timespec timeout;
+
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+    /* Shared futex: waiters and wakers live in different processes. */
+    (void)syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAIT, seen, &timeout, NULL, 0);
+}
+
+
+void futex_wake(_Atomic uint32_t *addr, int count)
+{
+    (void)syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAKE, count, NULL, NULL, 0);
+}
@@ -0,0 +1,433 @@
+/****************************************************************************
+ * libqrng - library for interacting with IDQ's Quantis Appliance           *
+ *                                                                          *
+ * Copyright (C) 2023  Sebastian Mihai Ardelean                             *
+ *                                                                          *
+ * This program is free software: you can redistribute it and/or modify     *
+ * it under the terms of the GNU General Public License as published by     *
+ * the Free Software Foundation, either version 3 of the License, or        *
+ * (at your option) any later version.                                      *
+ *                                                                          *
+ * This program is distributed in the hope that it will be useful,          *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ * GNU General Public License for more details.                             *
+ *                                                                          *
+ * You should have received a copy of the GNU General Public License        *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+
+/**
+ * @file qrng_sched.c
+ * @author Sebastian Mihai Ardelean <sebastian.ardelean@cs.upt.ro>
+ * @date 24 May 2023
+ * @brief Fair sharing of the appliance between tenants: token buckets and weighted fair queuing.
+ *
+ * A transfer waits here before it takes a connection. On arrival it gets a virtual finish tag,
+ * max(virtual time, tag of the tenant's previous transfer) + expected bytes / weight
+ * (self-clocked fair queuing). The waiting transfer with the smallest tag goes first, skipping
+ * tenants that are over their rate. Dispatch also needs the process-wide ceiling to have
+ * tokens. The expected size is charged to both buckets at dispatch. Once the transfer is
+ * done, the buckets and the tag are corrected by the difference with the bytes actually
+ * received. Buckets may go into debt, so a transfer bigger than the burst still goes out and
+ * is paid for afterwards. Bytes served from the ring, pool or reserve are paid by the tenant
+ * that receives them, not the refill thread's: a tenant in debt waits before it is served.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "qrng.h"
+#include "qrng_internal.h"
+
+#define SCHED_FIRST_ESTIMATE 4096.0
+#define SCHED_ESTIMATE_WEIGHT 0.25
+#define SCHED_POLL_NS 50000000u
+#define SCHED_WINDOW_NS 1000000000u
+
+typedef struct {
+    double rate;
+    double burst;
+    double tokens;
+    uint64_t last_ns;
+}bucket_t;
+
+typedef struct {
+    bool defined;
+    unsigned weight;
+    bucket_t bucket;
+    double finish;
+    double estimate;
+    uint64_t requests;
+    uint64_t bytes;
+    uint64_t queued;
+    uint64_t delay_sum_ns;
+    uint64_t delay_max_ns;
+    uint64_t window_start_ns;
+    uint64_t window_bytes;
+    uint64_t last_rate_bps;
+}tenant_t;
+
+typedef struct sched_waiter_s {
+    int tenant;
+    double tag;
+    struct sched_waiter_s *next;
+}sched_waiter_t;
+
+static tenant_t tenants[QRNG_MAX_TENANTS] = {
+    [0] = { .defined = true, .weight = 1u, .estimate = SCHED_FIRST_ESTIMATE }
+};
+static bucket_t ceiling;
+static double virtual_time = 0.0;
+static sched_waiter_t *waiters = NULL;
+static pthread_mutex_t sched_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sched_changed = PTHREAD_COND_INITIALIZER;
+
+/* Tenant of the calling thread and the size charged when its current transfer was dispatched. */
+static __thread int thread_tenant = 0;
+static __thread double thread_charged = 0.0;
+
+static void bucket_reset(bucket_t *bucket, double rate, double burst, uint64_t now_ns);
+static void bucket_refill(bucket_t *bucket, uint64_t now_ns);
+static bool bucket_in_debt(const bucket_t *bucket);
+static uint64_t bucket_delay_ns(const bucket_t *bucket);
+static int64_t dispatch_delay_locked(const sched_waiter_t *self, uint64_t now_ns);
+static void unlink_locked(const sched_waiter_t *self);
+static void account_locked(tenant_t *t, uint64_t bytes, uint64_t now_ns);
+static void wait_changed_locked(int64_t wait_ns, uint64_t now_ns, uint64_t until_ns);
+
+
+int qrng_tenant_create(unsigned weight, uint64_t rate_bytes_per_s, uint64_t burst_bytes)
+{
+    int id = 0;
+
+    if (weight == 0) {
+        return -1;
+    }
+    pthread_mutex_lock(&sched_lock);
+    for (id = 1; id < QRNG_MAX_TENANTS && tenants[id].defined; id++) {
+    }
+    if (id == QRNG_MAX_TENANTS) {
+        pthread_mutex_unlock(&sched_lock);
+        return -1;
+    }
+    memset(&tenants[id], 0, sizeof(tenants[id]));
+    tenants[id].defined = true;
+    tenants[id].weight = weight;
+    tenants[id].finish = virtual_time;
+    tenants[id].estimate = SCHED_FIRST_ESTIMATE;
+    bucket_reset(&tenants[id].bucket, (double)rate_bytes_per_s, (double)burst_bytes, qrng_now_ns());
+    pthread_mutex_unlock(&sched_lock);
+    return id;
+}
+
+
+int qrng_set_tenant(int tenant)
+{
+    bool defined = false;
+
+    if (tenant < 0 || tenant >= QRNG_MAX_TENANTS) {
+        return -1;
+    }
+    pthread_mutex_lock(&sched_lock);
+    defined = tenants[tenant].defined;
+    pthread_mutex_unlock(&sched_lock);
+    if (!defined) {
+        return -1;
+    }
+    thread_tenant = tenant;
+    return 0;
+}
+
+
+int qrng_sched_tenant(void)
+{
+    return thread_tenant;
+}
+
+
+void qrng_set_bandwidth_limit(uint64_t bytes_per_s, uint64_t burst_bytes)
+{
+    pthread_mutex_lock(&sched_lock);
+    bucket_reset(&ceiling, (double)bytes_per_s, (double)burst_bytes, qrng_now_ns());
+    pthread_cond_broadcast(&sched_changed);
+    pthread_mutex_unlock(&sched_lock);
+}
+
+
+int qrng_get_tenant_stats(int tenant, struct qrng_tenant_stats *stats)
+{
+    tenant_t *t = NULL;
+    uint64_t elapsed_ns = 0;
+
+    if (stats == NULL || tenant < 0 || tenant >= QRNG_MAX_TENANTS) {
+        return -1;
+    }
+    pthread_mutex_lock(&sched_lock);
+    t = &tenants[tenant];
+    if (!t->defined) {
+        pthread_mutex_unlock(&sched_lock);
+        return -1;
+    }
+    stats->requests = t->requests;
+    stats->bytes = t->bytes;
+    /* A window left open by an idle tenant decays instead of showing its last busy second. */
+    elapsed_ns = qrng_now_ns() - t->window_start_ns;
+    stats->throughput_bps = elapsed_ns >= 2u * SCHED_WINDOW_NS ?
+        (uint64_t)((double)t->window_bytes * 1e9 / (double)elapsed_ns) : t->last_rate_bps;
+    stats->queue_delay_avg_ns = t->requests > 0 ? t->delay_sum_ns / t->requests : 0;
+    stats->queue_delay_max_ns = t->delay_max_ns;
+    stats->queued = t->queued;
+    pthread_mutex_unlock(&sched_lock);
+    return 0;
+}
+
+
+int qrng_sched_wait(uint64_t until_ns)
+{
+    tenant_t *t = NULL;
+    sched_waiter_t self;
+    uint64_t start_ns = qrng_now_ns();
+    uint64_t now_ns = start_ns;
+    uint64_t delay_ns = 0;
+    int64_t wait_ns = 0;
+
+    pthread_mutex_lock(&sched_lock);
+    t = &tenants[thread_tenant];
+    self.tenant = thread_tenant;
+    self.tag = (virtual_time > t->finish ? virtual_time : t->finish) + t->estimate / (double)t->weight;
+    self.next = waiters;
+    waiters = &self;
+    t->finish = self.tag;
+    t->queued++;
+
+    while ((wait_ns = dispatch_delay_locked(&self, now_ns)) != 0) {
+        if (until_ns != 0 && now_ns >= until_ns) {
+            /* Give the place back: the tenant did not send anything. */
+            unlink_locked(&self);
+            t->finish -= t->estimate / (double)t->weight;
+            t->queued--;
+            pthread_mutex_unlock(&sched_lock);
+            return QRNG_DEADLINE_EXCEEDED;
+        }
+        wait_changed_locked(wait_ns, now_ns, until_ns);
+        now_ns = qrng_now_ns();
+    }
+
+    unlink_locked(&self);
+    if (self.tag > virtual_time) {
+        virtual_time = self.tag;
+    }
+    /* Pay the expected size now, so that waiters behind do not all see the same tokens. */
+    thread_charged = t->estimate;
+    t->bucket.tokens -= t->estimate;
+    ceiling.tokens -= t->estimate;
+    t->queued--;
+    delay_ns = now_ns - start_ns;
+    t->delay_sum_ns += delay_ns;
+    if (delay_ns > t->delay_max_ns) {
+        t->delay_max_ns = delay_ns;
+    }
+    if (waiters != NULL) {
+        pthread_cond_broadcast(&sched_changed);
+    }
+    pthread_mutex_unlock(&sched_lock);
+    return 0;
+}
+
+
+void qrng_sched_charge(uint64_t bytes)
+{
+    tenant_t *t = NULL;
+    double error = 0.0;
+    uint64_t now_ns = qrng_now_ns();
+
+    pthread_mutex_lock(&sched_lock);
+    t = &tenants[thread_tenant];
+    error = (double)bytes - thread_charged;
+    thread_charged = 0.0;
+    t->finish += error / (double)t->weight;
+    t->bucket.tokens -= error;
+    ceiling.tokens -= error;
+    t->estimate += ((double)bytes - t->estimate) * SCHED_ESTIMATE_WEIGHT;
+    if (t->estimate < 1.0) {
+        t->estimate = 1.0;
+    }
+
+    t->requests++;
+    account_locked(t, bytes, now_ns);
+    /* A transfer smaller than expected gives tokens back. */
+    if (error < 0.0 && waiters != NULL) {
+        pthread_cond_broadcast(&sched_changed);
+    }
+    pthread_mutex_unlock(&sched_lock);
+}
+
+
+int qrng_sched_admit(uint64_t until_ns)
+{
+    tenant_t *t = NULL;
+    uint64_t now_ns = qrng_now_ns();
+
+    pthread_mutex_lock(&sched_lock);
+    t = &tenants[thread_tenant];
+    bucket_refill(&t->bucket, now_ns);
+    while (bucket_in_debt(&t->bucket)) {
+        if (until_ns != 0 && now_ns >= until_ns) {
+            pthread_mutex_unlock(&sched_lock);
+            return QRNG_DEADLINE_EXCEEDED;
+        }
+        wait_changed_locked((int64_t)bucket_delay_ns(&t->bucket), now_ns, until_ns);
+        now_ns = qrng_now_ns();
+        bucket_refill(&t->bucket, now_ns);
+    }
+    pthread_mutex_unlock(&sched_lock);
+    return 0;
+}
+
+
+void qrng_sched_consume(uint64_t bytes)
+{
+    tenant_t *t = NULL;
+
+    if (bytes == 0) {
+        return;
+    }
+    pthread_mutex_lock(&sched_lock);
+    t = &tenants[thread_tenant];
+    /* The ceiling was paid by the refill that buffered these bytes; the tenant pays on delivery. */
+    t->bucket.tokens -= (double)bytes;
+    account_locked(t, bytes, qrng_now_ns());
+    pthread_mutex_unlock(&sched_lock);
+}
+
+
+void qrng_sched_atfork(e_fork_phase_t phase)
+{
+    size_t i = 0;
+
+    if (phase == FORK_PREPARE) {
+        pthread_mutex_lock(&sched_lock);
+        return;
+    }
+    if (phase == FORK_PARENT) {
+        pthread_mutex_unlock(&sched_lock);
+        return;
+    }
+    /* Waiters are threads of the parent. Tenants, buckets and counters carry on. */
+    waiters = NULL;
+    for (i = 0; i < QRNG_MAX_TENANTS; i++) {
+        tenants[i].queued = 0;
+    }
+    pthread_cond_init(&sched_changed, NULL);
+    pthread_mutex_init(&sched_lock, NULL);
+}
+
+
+int64_t dispatch_delay_locked(const sched_waiter_t *self, uint64_t now_ns)
+{
+    const sched_waiter_t *w = NULL;
+    const sched_waiter_t *best = NULL;
+    tenant_t *t = NULL;
+    int64_t own_ns = -1;
+
+    bucket_refill(&ceiling, now_ns);
+    if (bucket_in_debt(&ceiling)) {
+        return (int64_t)bucket_delay_ns(&ceiling);
+    }
+    for (w = waiters; w != NULL; w = w->next) {
+        t = &tenants[w->tenant];
+        bucket_refill(&t->bucket, now_ns);
+        if (bucket_in_debt(&t->bucket)) {
+            if (w == self) {
+                own_ns = (int64_t)bucket_delay_ns(&t->bucket);
+            }
+            continue;
+        }
+        if (best == NULL || w->tag < best->tag) {
+            best = w;
+        }
+    }
+    if (best == self) {
+        return 0;
+    }
+    /* Over its own rate: sleep until the bucket is back. Otherwise wait for the turn. */
+    return own_ns > 0 ? own_ns : -1;
+}
+
+
+void unlink_locked(const sched_waiter_t *self)
+{
+    sched_waiter_t **link = &waiters;
+
+    while (*link != self) {
+        link = &(*link)->next;
+    }
+    *link = self->next;
+}
+
+
+void account_locked(tenant_t *t, uint64_t bytes, uint64_t now_ns)
+{
+    t->bytes += bytes;
+    if (now_ns - t->window_start_ns >= SCHED_WINDOW_NS) {
+        t->last_rate_bps = (uint64_t)((double)t->window_bytes * 1e9 / (double)(now_ns - t->window_start_ns));
+        t->window_start_ns = now_ns;
+        t->window_bytes = 0;
+    }
+    t->window_bytes += bytes;
+}
+
+
+void wait_changed_locked(int64_t wait_ns, uint64_t now_ns, uint64_t until_ns)
+{
+    struct timespec until;
+
+    /* Poll at least every SCHED_POLL_NS (negative: no known delay) and never past the deadline. */
+    if (wait_ns < 0 || wait_ns > (int64_t)SCHED_POLL_NS) {
+        wait_ns = SCHED_POLL_NS;
+    }
+    if (until_ns != 0 && now_ns + (uint64_t)wait_ns > until_ns) {
+        wait_ns = (int64_t)(until_ns - now_ns);
+    }
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_nsec += (long)wait_ns;
+    until.tv_sec += until.tv_nsec / 1000000000L;
+    until.tv_nsec %= 1000000000L;
+    pthread_cond_timedwait(&sched_changed, &sched_lock, &until);
+}
+
+
+void bucket_reset(bucket_t *bucket, double rate, double burst, uint64_t now_ns)
+{
+    bucket->rate = rate;
+    bucket->burst = burst;
+    bucket->tokens = burst;
+    bucket->last_ns = now_ns;
+}
+
+
+void bucket_refill(bucket_t *bucket, uint64_t now_ns)
+{
+    if (bucket->rate > 0.0 && now_ns > bucket->last_ns) {
+        bucket->tokens += bucket->rate * (double)(now_ns - bucket->last_ns) / 1e9;
+        if (bucket->tokens > bucket->burst) {
+            bucket->tokens = bucket->burst;
+        }
+    }
+    bucket->last_ns = now_ns;
+}
+
+
+bool bucket_in_debt(const bucket_t *bucket)
+{
+    return bucket->rate > 0.0 && bucket->tokens < 0.0;
+}
+
+
+uint64_t bucket_delay_ns(const bucket_t *bucket)
+{
+    return (uint64_t)(-bucket->tokens / bucket->rate * 1e9) + 1u;
+}
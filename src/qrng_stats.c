@@ -0,0 +1,382 @@
+/****************************************************************************
+ * libqrng - library for interacting with IDQ's Quantis Appliance           *
+ *                                                                          *
+ * Copyright (C) 2023  Sebastian Mihai Ardelean                             *
+ *                                                                          *
+ * This program is free software: you can redistribute it and/or modify     *
+ * it under the terms of the GNU General Public License as published by     *
+ * the Free Software Foundation, either version 3 of the License, or        *
+ * (at your option) any later version.                                      *
+ *                                                                          *
+ * This program is distributed in the hope that it will be useful,          *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ * GNU General Public License for more details.                             *
+ *                                                                          *
+ * You should have received a copy of the GNU General Public License        *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+
+/**
+ * @file qrng_stats.c
+ * @author Sebastian Mihai Ardelean <sebastian.ardelean@cs.upt.ro>
+ * @date 24 May 2023
+ * @brief Request counters and latency histograms.
+ *
+ * Counters live in cache line aligned shards. A thread picks a shard the first time it records
+ * something and keeps it, so with up to STATS_SHARDS threads no two threads touch the same line.
+ * Updates are relaxed atomic additions; a snapshot sums the shards and never blocks writers.
+ *
+ * Histograms are log-linear: every power of two between 1 us and 2^42 ns is split into four
+ * sub-buckets, which bounds the relative error of a percentile to 25%.
+ *
+ * The network phases are derived from the cumulative libcurl timers: each phase is the difference
+ * between consecutive timers, so connect and TLS come out as 0 on a reused connection.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "qrng.h"
+#include "qrng_internal.h"
+#include "qrng_probes.h"
+
+#define STATS_SHARDS 8u
+#define CACHE_LINE 64u
+#define HIST_SUB_BITS 2u
+#define HIST_SUB_BUCKETS (1u << HIST_SUB_BITS)
+#define HIST_MIN_POWER 10u
+
+typedef struct {
+    atomic_uint_fast64_t count;
+    atomic_uint_fast64_t sum_ns;
+    atomic_uint_fast64_t max_ns;
+    atomic_uint_fast64_t buckets[QRNG_HISTOGRAM_BUCKETS];
+}hist_shard_t;
+
+typedef struct {
+    atomic_uint_fast64_t requests;
+    atomic_uint_fast64_t samples;
+    atomic_uint_fast64_t wire_bytes;
+    atomic_uint_fast64_t errors;
+    atomic_uint_fast64_t retries;
+    atomic_uint_fast64_t connections;
+    atomic_uint_fast64_t dns_ns;
+    atomic_uint_fast64_t connect_ns;
+    atomic_uint_fast64_t tls_ns;
+    atomic_uint_fast64_t wait_ns;
+    atomic_uint_fast64_t transfer_ns;
+    hist_shard_t latency;
+    hist_shard_t wait;
+    hist_shard_t parse;
+}type_shard_t;
+
+typedef struct {
+    _Alignas(CACHE_LINE) type_shard_t types[QRNG_REQUEST_TYPES];
+}shard_t;
+
+_Static_assert((int)NUMBER_OF_REQUESTS == (int)QRNG_REQUEST_TYPES,
+               "qrng_request_type_t must follow e_req_type_t");
+
+static const char *type_names[QRNG_REQUEST_TYPES] = {
+    "bytes", "int16", "int32", "double", "float", "stream", "performance", "firmware_info", "system_info"
+};
+
+static shard_t shards[STATS_SHARDS];
+static atomic_uint next_shard = 0;
+static __thread shard_t *thread_shard = NULL;
+
+static qrng_timing_cbk_t timing_cbk = NULL;
+static void *timing_data = NULL;
+
+static shard_t *my_shard(void);
+static uint64_t since(uint64_t later, uint64_t earlier);
+static void phases_from_info(const xfer_info_t *info, struct qrng_phase_times *phases);
+static void hist_reset(hist_shard_t *h);
+static unsigned hist_bucket(uint64_t ns);
+static void hist_add(hist_shard_t *h, uint64_t ns);
+static void hist_collect(struct qrng_histogram *out, hist_shard_t *h);
+
+
+uint64_t qrng_stats_start(e_req_type_t type, size_t samples)
+{
+    QRNG_PROBE2(request__start, (int)type, samples);
+    return qrng_now_ns();
+}
+
+
+void qrng_stats_record(e_req_type_t type, size_t samples, const xfer_info_t *info,
+                       uint64_t latency_ns, int error)
+{
+    type_shard_t *t = NULL;
+    struct qrng_request_timing timing;
+
+    if ((unsigned)type >= QRNG_REQUEST_TYPES) {
+        return;
+    }
+    memset(&timing, 0, sizeof(timing));
+    timing.type = (qrng_request_type_t)type;
+    timing.result = error;
+    timing.samples = samples;
+    timing.total_ns = latency_ns;
+    if (info) {
+        timing.wire_bytes = info->bytes + info->header_bytes;
+        timing.speed_bps = info->speed_bps;
+        timing.new_connection = info->new_connections > 0;
+        phases_from_info(info, &timing.phases);
+    }
+
+    t = &my_shard()->types[type];
+    atomic_fetch_add_explicit(&t->requests, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&t->samples, samples, memory_order_relaxed);
+    atomic_fetch_add_explicit(&t->wire_bytes, timing.wire_bytes, memory_order_relaxed);
+    if (error) {
+        atomic_fetch_add_explicit(&t->errors, 1, memory_order_relaxed);
+    }
+    if (timing.new_connection) {
+        atomic_fetch_add_explicit(&t->connections, 1, memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&t->dns_ns, timing.phases.dns_ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&t->connect_ns, timing.phases.connect_ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&t->tls_ns, timing.phases.tls_ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&t->wait_ns, timing.phases.wait_ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&t->transfer_ns, timing.phases.transfer_ns, memory_order_relaxed);
+    hist_add(&t->latency, latency_ns);
+    if (info && info->ttfb_ns > 0) {
+        hist_add(&t->wait, timing.phases.wait_ns);
+    }
+    QRNG_PROBE5(request__end, (int)type, samples, error, latency_ns, timing.wire_bytes);
+
+    if (timing_cbk) {
+        timing_cbk(&timing, timing_data);
+    }
+}
+
+
+void qrng_set_timing_callback(qrng_timing_cbk_t cbk, void *user_data)
+{
+    timing_cbk = cbk;
+    timing_data = user_data;
+}
+
+
+void qrng_stats_record_parse(e_req_type_t type, uint64_t parse_ns)
+{
+    if ((unsigned)type >= QRNG_REQUEST_TYPES) {
+        return;
+    }
+    hist_add(&my_shard()->types[type].parse, parse_ns);
+}
+
+
+void qrng_stats_record_retry(e_req_type_t type)
+{
+    if ((unsigned)type >= QRNG_REQUEST_TYPES) {
+        return;
+    }
+    atomic_fetch_add_explicit(&my_shard()->types[type].retries, 1, memory_order_relaxed);
+}
+
+
+int qrng_get_stats(struct qrng_stats *stats)
+{
+    size_t s = 0;
+    size_t i = 0;
+    type_shard_t *t = NULL;
+    struct qrng_request_stats *out = NULL;
+
+    if (stats == NULL) {
+        return -1;
+    }
+    memset(stats, 0, sizeof(*stats));
+    for (s = 0; s < STATS_SHARDS; s++) {
+        for (i = 0; i < QRNG_REQUEST_TYPES; i++) {
+            t = &shards[s].types[i];
+            out = &stats->types[i];
+            out->requests += atomic_load_explicit(&t->requests, memory_order_relaxed);
+            out->samples += atomic_load_explicit(&t->samples, memory_order_relaxed);
+            out->wire_bytes += atomic_load_explicit(&t->wire_bytes, memory_order_relaxed);
+            out->errors += atomic_load_explicit(&t->errors, memory_order_relaxed);
+            out->retries += atomic_load_explicit(&t->retries, memory_order_relaxed);
+            out->connections += atomic_load_explicit(&t->connections, memory_order_relaxed);
+            out->phases.dns_ns += atomic_load_explicit(&t->dns_ns, memory_order_relaxed);
+            out->phases.connect_ns += atomic_load_explicit(&t->connect_ns, memory_order_relaxed);
+            out->phases.tls_ns += atomic_load_explicit(&t->tls_ns, memory_order_relaxed);
+            out->phases.wait_ns += atomic_load_explicit(&t->wait_ns, memory_order_relaxed);
+            out->phases.transfer_ns += atomic_load_explicit(&t->transfer_ns, memory_order_relaxed);
+            hist_collect(&out->latency, &t->latency);
+            hist_collect(&out->wait, &t->wait);
+            hist_collect(&out->parse, &t->parse);
+        }
+    }
+    (void)qrng_get_chunk_stats(&stats->chunk);
+    (void)qrng_pool_get_stats(&stats->pool);
+    return 0;
+}
+
+
+void qrng_reset_stats(void)
+{
+    size_t s = 0;
+    size_t i = 0;
+    type_shard_t *t = NULL;
+
+    for (s = 0; s < STATS_SHARDS; s++) {
+        for (i = 0; i < QRNG_REQUEST_TYPES; i++) {
+            t = &shards[s].types[i];
+            atomic_store_explicit(&t->requests, 0, memory_order_relaxed);
+            atomic_store_explicit(&t->samples, 0, memory_order_relaxed);
+            atomic_store_explicit(&t->wire_bytes, 0, memory_order_relaxed);
+            atomic_store_explicit(&t->errors, 0, memory_order_relaxed);
+            atomic_store_explicit(&t->retries, 0, memory_order_relaxed);
+            atomic_store_explicit(&t->connections, 0, memory_order_relaxed);
+            atomic_store_explicit(&t->dns_ns, 0, memory_order_relaxed);
+            atomic_store_explicit(&t->connect_ns, 0, memory_order_relaxed);
+            atomic_store_explicit(&t->tls_ns, 0, memory_order_relaxed);
+            atomic_store_explicit(&t->wait_ns, 0, memory_order_relaxed);
+            atomic_store_explicit(&t->transfer_ns, 0, memory_order_relaxed);
+            hist_reset(&t->latency);
+            hist_reset(&t->wait);
+            hist_reset(&t->parse);
+        }
+    }
+}
+
+
+const char *qrng_request_type_name(qrng_request_type_t type)
+{
+    if ((unsigned)type >= QRNG_REQUEST_TYPES) {
+        return "unknown";
+    }
+    return type_names[type];
+}
+
+
+uint64_t qrng_histogram_bucket_limit(unsigned bucket)
+{
+    unsigned power = HIST_MIN_POWER + bucket / HIST_SUB_BUCKETS;
+    unsigned sub = bucket % HIST_SUB_BUCKETS;
+
+    if (bucket >= QRNG_HISTOGRAM_BUCKETS) {
+        return UINT64_MAX;
+    }
+    /* Upper bound of [2^p + sub * 2^p / 4, 2^p + (sub + 1) * 2^p / 4). */
+    return (UINT64_C(1) << power) + ((uint64_t)(sub + 1u) << (power - HIST_SUB_BITS));
+}
+
+
+uint64_t qrng_histogram_percentile(const struct qrng_histogram *histogram, double percentile)
+{
+    uint64_t rank = 0;
+    uint64_t seen = 0;
+    unsigned b = 0;
+
+    if (histogram == NULL || histogram->count == 0) {
+        return 0;
+    }
+    if (percentile >= 100.0) {
+        return histogram->max_ns;
+    }
+    rank = (uint64_t)((double)histogram->count * percentile / 100.0);
+    for (b = 0; b < QRNG_HISTOGRAM_BUCKETS; b++) {
+        seen += histogram->buckets[b];
+        if (seen > rank) {
+            return qrng_histogram_bucket_limit(b) < histogram->max_ns ?
+                qrng_histogram_bucket_limit(b) : histogram->max_ns;
+        }
+    }
+    return histogram->max_ns;
+}
+
+
+shard_t *my_shard(void)
+{
+    if (thread_shard == NULL) {
+        thread_shard = &shards[atomic_fetch_add(&next_shard, 1u) % STATS_SHARDS];
+    }
+    return thread_shard;
+}
+
+
+uint64_t since(uint64_t later, uint64_t earlier)
+{
+    return later > earlier ? later - earlier : 0;
+}
+
+
+void phases_from_info(const xfer_info_t *info, struct qrng_phase_times *phases)
+{
+    uint64_t sent = info->connect_ns;
+
+    /* The request goes out after the last setup step that took place. */
+    if (info->appconnect_ns > sent) {
+        sent = info->appconnect_ns;
+    }
+    if (info->pretransfer_ns > sent) {
+        sent = info->pretransfer_ns;
+    }
+    phases->dns_ns = info->namelookup_ns;
+    phases->connect_ns = since(info->connect_ns, info->namelookup_ns);
+    phases->tls_ns = since(info->appconnect_ns, info->connect_ns);
+    phases->wait_ns = info->ttfb_ns > 0 ? since(info->ttfb_ns, sent) : 0;
+    phases->transfer_ns = info->ttfb_ns > 0 ? since(info->total_ns, info->ttfb_ns) : 0;
+}
+
+
+unsigned hist_bucket(uint64_t ns)
+{
+    unsigned power = 0;
+    unsigned bucket = 0;
+
+    if (ns < (UINT64_C(1) << HIST_MIN_POWER)) {
+        return 0;
+    }
+    power = 63u - (unsigned)__builtin_clzll(ns);
+    bucket = (power - HIST_MIN_POWER) * HIST_SUB_BUCKETS +
+        (unsigned)((ns >> (power - HIST_SUB_BITS)) & (HIST_SUB_BUCKETS - 1u));
+    return bucket < QRNG_HISTOGRAM_BUCKETS ? bucket : QRNG_HISTOGRAM_BUCKETS - 1u;
+}
+
+
+void hist_add(hist_shard_t *h, uint64_t ns)
+{
+    uint_fast64_t max = atomic_load_explicit(&h->max_ns, memory_order_relaxed);
+
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum_ns, ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->buckets[hist_bucket(ns)], 1, memory_order_relaxed);
+    while (ns > max &&
+           !atomic_compare_exchange_weak_explicit(&h->max_ns, &max, ns,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+        /* another thread raised the maximum; retry with its value */
+    }
+}
+
+
+void hist_reset(hist_shard_t *h)
+{
+    unsigned b = 0;
+
+    atomic_store_explicit(&h->count, 0, memory_order_relaxed);
+    atomic_store_explicit(&h->sum_ns, 0, memory_order_relaxed);
+    atomic_store_explicit(&h->max_ns, 0, memory_order_relaxed);
+    for (b = 0; b < QRNG_HISTOGRAM_BUCKETS; b++) {
+        atomic_store_explicit(&h->buckets[b], 0, memory_order_relaxed);
+    }
+}
+
+
+void hist_collect(struct qrng_histogram *out, hist_shard_t *h)
+{
+    unsigned b = 0;
+    uint64_t max = atomic_load_explicit(&h->max_ns, memory_order_relaxed);
+
+    out->count += atomic_load_explicit(&h->count, memory_order_relaxed);
+    out->sum_ns += atomic_load_explicit(&h->sum_ns, memory_order_relaxed);
+    if (max > out->max_ns) {
+        out->max_ns = max;
+    }
+    for (b = 0; b < QRNG_HISTOGRAM_BUCKETS; b++) {
+        out->buckets[b] += atomic_load_explicit(&h->buckets[b], memory_order_relaxed);
+    }
+}
@@ -0,0 +1,490 @@
+/****************************************************************************
+ * libqrng - library for interacting with IDQ's Quantis Appliance           *
+ *                                                                          *
+ * Copyright (C) 2023  Sebastian Mihai Ardelean                             *
+ *                                                                          *
+ * This program is free software: you can redistribute it and/or modify     *
+ * it under the terms of the GNU General Public License as published by     *
+ * the Free Software Foundation, either version 3 of the License, or        *
+ * (at your option) any later version.                                      *
+ *                                                                          *
+ * This program is distributed in the hope that it will be useful,          *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ * GNU General Public License for more details.                             *
+ *                                                                          *
+ * You should have received a copy of the GNU General Public License        *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+
+/**
+ * @file qrng_transport.c
+ * @author Sebastian Mihai Ardelean <sebastian.ardelean@cs.upt.ro>
+ * @date 24 May 2023
+ * @brief Transfers to the appliance, recorded to or replayed from a capture file.
+ *
+ * A capture starts with an 8 byte magic followed by one record per transfer: a fixed header
+ * (@capture_record_t@), the URL path and query, then the response body. Replay maps the file
+ * read-only and hands the body to the same write callbacks libcurl would call, in pieces of at
+ * most CURL_MAX_WRITE_SIZE bytes, so everything above the socket runs unchanged.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <curl/curl.h>
+#include "qrng.h"
+#include "qrng_internal.h"
+
+#define CAPTURE_MAGIC "QRNGCAP1"
+#define CAPTURE_MAGIC_LENGTH 8u
+
+/**
+ * @brief Fixed part of a capture record, followed by the URL path and the body.
+ * Only 64 bit fields, so the layout has no padding.
+ */
+typedef struct {
+    uint64_t path_length;
+    uint64_t body_length;
+    uint64_t result;
+    uint64_t namelookup_ns;
+    uint64_t connect_ns;
+    uint64_t appconnect_ns;
+    uint64_t pretransfer_ns;
+    uint64_t ttfb_ns;
+    uint64_t total_ns;
+    uint64_t header_bytes;
+    uint64_t speed_bps;
+    uint64_t new_connections;
+}capture_record_t;
+
+/**
+ * @brief Write callback wrapper keeping a copy of the body while recording.
+ */
+typedef struct {
+    qrng_write_cbk_t cbk;
+    void *data;
+    char *body;
+    size_t length;
+    size_t capacity;
+    bool truncated;
+}capture_tee_t;
+
+static qrng_transport_t transport_mode = QRNG_TRANSPORT_NETWORK;
+static double replay_speed = 0.0;
+static FILE *capture = NULL;
+static const uint8_t *replay_map = NULL;
+static size_t replay_size = 0;
+static size_t replay_cursor = CAPTURE_MAGIC_LENGTH;
+static pthread_mutex_t transport_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int open_record(const char *capture_path);
+static int open_replay(const char *capture_path);
+static void close_capture(void);
+static const char *url_path(const char *url);
+static CURLcode record_transfer(CURL *handle, const char *url, qrng_write_cbk_t cbk, void *data,
+                                long timeout_ms, xfer_info_t *info);
+static CURLcode replay_transfer(const char *url, qrng_write_cbk_t cbk, void *data,
+                                long timeout_ms, xfer_info_t *info);
+static size_t find_record(const char *path, capture_record_t *record);
+static size_t tee_write_cbk(void *content, size_t size, size_t nmemb, void *userp);
+static void sleep_until_ns(uint64_t when);
+
+
+int qrng_set_transport(qrng_transport_t mode, const char *capture_path, double speed)
+{
+    int retval = 0;
+
+    if (mode > QRNG_TRANSPORT_REPLAY || speed < 0.0 ||
+        (mode != QRNG_TRANSPORT_NETWORK && capture_path == NULL)) {
+        return -1;
+    }
+    pthread_mutex_lock(&transport_lock);
+    close_capture();
+    if (mode == QRNG_TRANSPORT_RECORD) {
+        retval = open_record(capture_path);
+    }
+    else if (mode == QRNG_TRANSPORT_REPLAY) {
+        retval = open_replay(capture_path);
+    }
+    if (!retval) {
+        transport_mode = mode;
+        replay_speed = speed;
+    }
+    pthread_mutex_unlock(&transport_lock);
+    return retval;
+}
+
+
+void qrng_transport_close(void)
+{
+    pthread_mutex_lock(&transport_lock);
+    close_capture();
+    pthread_mutex_unlock(&transport_lock);
+}
+
+
+void qrng_transport_atfork(e_fork_phase_t phase)
+{
+    if (phase == FORK_PREPARE) {
+        pthread_mutex_lock(&transport_lock);
+        /* Buffered records would otherwise be written twice, once by each process. */
+        if (capture) {
+            fflush(capture);
+        }
+    }
+    else if (phase == FORK_PARENT) {
+        pthread_mutex_unlock(&transport_lock);
+    }
+    else {
+        /* A capture has one writer; replay only reads and carries on in the child. */
+        if (capture) {
+            fclose(capture);
+            capture = NULL;
+            transport_mode = QRNG_TRANSPORT_NETWORK;
+        }
+        pthread_mutex_init(&transport_lock, NULL);
+    }
+}
+
+
+CURLcode qrng_transport_perform(CURL *handle, const char *url, qrng_write_cbk_t cbk, void *data,
+                                long timeout_ms, xfer_info_t *info)
+{
+    CURLcode error = CURLE_OK;
+
+    if (transport_mode == QRNG_TRANSPORT_REPLAY) {
+        error = replay_transfer(url, cbk, data, timeout_ms, info);
+    }
+    else if (transport_mode == QRNG_TRANSPORT_RECORD) {
+        error = record_transfer(handle, url, cbk, data, timeout_ms, info);
+    }
+    else {
+        (void)curl_easy_setopt(handle, CURLOPT_URL, url);
+        (void)curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, cbk);
+        (void)curl_easy_setopt(handle, CURLOPT_WRITEDATA, data);
+        (void)curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS, timeout_ms);
+        error = curl_easy_perform(handle);
+        (void)curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS, 0L);
+        qrng_read_xfer_info(handle, info);
+    }
+    qrng_sched_charge(info->bytes);
+    return error;
+}
+
+
+int open_record(const char *capture_path)
+{
+#ifdef NO_DYNAMIC_MEMORY_ALLOCATION
+    (void)capture_path;
+    fprintf(stderr, "Recording needs dynamic memory allocation\n");
+    return -1;
+#else
+    char magic[CAPTURE_MAGIC_LENGTH];
+    long size = 0;
+
+    capture = fopen(capture_path, "a+b");
+    if (capture == NULL) {
+        fprintf(stderr, "Cannot open capture %s\n", capture_path);
+        return -1;
+    }
+    /* Appending to an existing capture is allowed, as long as it is one. */
+    (void)fseek(capture, 0, SEEK_END);
+    size = ftell(capture);
+    if (size == 0) {
+        (void)fwrite(CAPTURE_MAGIC, 1, CAPTURE_MAGIC_LENGTH, capture);
+    }
+    else {
+        rewind(capture);
+        if (fread(magic, 1, CAPTURE_MAGIC_LENGTH, capture) != CAPTURE_MAGIC_LENGTH ||
+            memcmp(magic, CAPTURE_MAGIC, CAPTURE_MAGIC_LENGTH) != 0) {
+            fprintf(stderr, "%s is not a libqrng capture\n", capture_path);
+            fclose(capture);
+            capture = NULL;
+            return -1;
+        }
+    }
+    return 0;
+#endif
+}
+
+
+int open_replay(const char *capture_path)
+{
+    struct stat st;
+    capture_record_t record;
+    size_t offset = CAPTURE_MAGIC_LENGTH;
+    size_t records = 0;
+    void *map = NULL;
+    int fd = -1;
+
+    fd = open(capture_path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot open capture %s\n", capture_path);
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < CAPTURE_MAGIC_LENGTH) {
+        fprintf(stderr, "%s is not a libqrng capture\n", capture_path);
+        close(fd);
+        return -1;
+    }
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Cannot map capture %s\n", capture_path);
+        return -1;
+    }
+    replay_map = (const uint8_t *)map;
+    replay_size = (size_t)st.st_size;
+
+    /* Validate once, so the request path can trust every length. */
+    if (memcmp(replay_map, CAPTURE_MAGIC, CAPTURE_MAGIC_LENGTH) != 0) {
+        offset = 0;
+    }
+    while (offset != 0 && offset < replay_size) {
+        if (replay_size - offset < sizeof(record)) {
+            offset = 0;
+            break;
+        }
+        memcpy(&record, replay_map + offset, sizeof(record));
+        offset += sizeof(record);
+        /* The path length is checked first, so the body check cannot wrap on a truncated record. */
+        if (record.path_length >= URL_MAX_LENGTH || record.path_length > replay_size - offset ||
+            record.body_length > replay_size - offset - record.path_length) {
+            offset = 0;
+            break;
+        }
+        offset += record.path_length + record.body_length;
+        records++;
+    }
+    if (offset == 0 || records == 0) {
+        fprintf(stderr, "%s is not a libqrng capture or holds no transfers\n", capture_path);
+        close_capture();
+        return -1;
+    }
+    replay_cursor = CAPTURE_MAGIC_LENGTH;
+    return 0;
+}
+
+
+void close_capture(void)
+{
+    if (capture) {
+        fclose(capture);
+        capture = NULL;
+    }
+    if (replay_map) {
+        munmap((void *)replay_map, replay_size);
+        replay_map = NULL;
+        replay_size = 0;
+    }
+    transport_mode = QRNG_TRANSPORT_NETWORK;
+}
+
+
+const char *url_path(const char *url)
+{
+    const char *path = strstr(url, "://");
+
+    /* Captures are matched without scheme and host, so they replay against any address. */
+    path = path ? strchr(path + 3, '/') : NULL;
+    return path ? path : url;
+}
+
+
+CURLcode record_transfer(CURL *handle, const char *url, qrng_write_cbk_t cbk, void *data,
+                         long timeout_ms, xfer_info_t *info)
+{
+    capture_tee_t tee = { .cbk = cbk, .data = data, .body = NULL, .length = 0, .capacity = 0,
+                          .truncated = false };
+    capture_record_t record;
+    const char *path = url_path(url);
+    CURLcode error = CURLE_OK;
+
+    (void)curl_easy_setopt(handle, CURLOPT_URL, url);
+    (void)curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, &tee_write_cbk);
+    (void)curl_easy_setopt(handle, CURLOPT_WRITEDATA, (void *)&tee);
+    (void)curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS, timeout_ms);
+    error = curl_easy_perform(handle);
+    (void)curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS, 0L);
+    qrng_read_xfer_info(handle, info);
+
+    if (tee.truncated) {
+        fprintf(stderr, "Not enough memory to record the transfer of %s\n", path);
+    }
+    else {
+        record.path_length = strlen(path);
+        record.body_length = tee.length;
+        record.result = (uint64_t)error;
+        record.namelookup_ns = info->namelookup_ns;
+        record.connect_ns = info->connect_ns;
+        record.appconnect_ns = info->appconnect_ns;
+        record.pretransfer_ns = info->pretransfer_ns;
+        record.ttfb_ns = info->ttfb_ns;
+        record.total_ns = info->total_ns;
+        record.header_bytes = info->header_bytes;
+        record.speed_bps = info->speed_bps;
+        record.new_connections = info->new_connections;
+        pthread_mutex_lock(&transport_lock);
+        if (capture) {
+            (void)fwrite(&record, sizeof(record), 1, capture);
+            (void)fwrite(path, 1, record.path_length, capture);
+            if (tee.length > 0) {
+                (void)fwrite(tee.body, 1, tee.length, capture);
+            }
+        }
+        pthread_mutex_unlock(&transport_lock);
+    }
+#ifndef NO_DYNAMIC_MEMORY_ALLOCATION
+    if (tee.body) {
+        memset(tee.body, 0, tee.length);
+        free(tee.body);
+    }
+#endif
+    return error;
+}
+
+
+CURLcode replay_transfer(const char *url, qrng_write_cbk_t cbk, void *data,
+                         long timeout_ms, xfer_info_t *info)
+{
+    capture_record_t record;
+    const char *path = url_path(url);
+    const uint8_t *body = NULL;
+    uint64_t start_ns = qrng_now_ns();
+    uint64_t ttfb_ns = 0;
+    uint64_t total_ns = 0;
+    size_t offset = 0;
+    size_t piece = 0;
+    CURLcode error = CURLE_OK;
+
+    memset(info, 0, sizeof(*info));
+    pthread_mutex_lock(&transport_lock);
+    offset = find_record(path, &record);
+    pthread_mutex_unlock(&transport_lock);
+    if (offset == 0) {
+        fprintf(stderr, "No recorded transfer for %s\n", path);
+        return CURLE_COULDNT_CONNECT;
+    }
+    body = replay_map + offset + sizeof(record) + record.path_length;
+
+    if (replay_speed > 0.0) {
+        ttfb_ns = (uint64_t)((double)record.ttfb_ns / replay_speed);
+        total_ns = (uint64_t)((double)record.total_ns / replay_speed);
+    }
+    if (timeout_ms > 0 && total_ns > (uint64_t)timeout_ms * 1000000u) {
+        sleep_until_ns(start_ns + (uint64_t)timeout_ms * 1000000u);
+        return CURLE_OPERATION_TIMEDOUT;
+    }
+    sleep_until_ns(start_ns + ttfb_ns);
+    for (offset = 0; offset < record.body_length; offset += piece) {
+        piece = record.body_length - offset;
+        if (piece > CURL_MAX_WRITE_SIZE) {
+            piece = CURL_MAX_WRITE_SIZE;
+        }
+        if (cbk((void *)(body + offset), 1, piece, data) != piece) {
+            error = CURLE_WRITE_ERROR;
+            break;
+        }
+    }
+    sleep_until_ns(start_ns + total_ns);
+
+    info->namelookup_ns = record.namelookup_ns;
+    info->connect_ns = record.connect_ns;
+    info->appconnect_ns = record.appconnect_ns;
+    info->pretransfer_ns = record.pretransfer_ns;
+    info->ttfb_ns = record.ttfb_ns;
+    info->total_ns = record.total_ns;
+    info->bytes = record.body_length;
+    info->header_bytes = record.header_bytes;
+    info->speed_bps = record.speed_bps;
+    info->new_connections = record.new_connections;
+    return error != CURLE_OK ? error : (CURLcode)record.result;
+}
+
+
+size_t find_record(const char *path, capture_record_t *record)
+{
+    size_t path_length = strlen(path);
+    size_t offset = replay_cursor;
+    size_t next = 0;
+    bool wrapped = false;
+
+    if (replay_map == NULL) {
+        return 0;
+    }
+    /* Single threaded runs take the records in order; concurrent ones take the next match. */
+    for (;;) {
+        if (offset >= replay_size) {
+            if (wrapped) {
+                return 0;
+            }
+            wrapped = true;
+            offset = CAPTURE_MAGIC_LENGTH;
+        }
+        if (wrapped && offset >= replay_cursor) {
+            return 0;
+        }
+        memcpy(record, replay_map + offset, sizeof(*record));
+        next = offset + sizeof(*record) + record->path_length + record->body_length;
+        if (record->path_length == path_length &&
+            memcmp(replay_map + offset + sizeof(*record), path, path_length) == 0) {
+            replay_cursor = next;
+            return offset;
+        }
+        offset = next;
+    }
+}
+
+
+size_t tee_write_cbk(void *content, size_t size, size_t nmemb, void *userp)
+{
+    capture_tee_t *tee = (capture_tee_t *)userp;
+    size_t realsize = size * nmemb;
+    size_t capacity = 0;
+    char *body = NULL;
+
+    if (!tee->truncated && tee->length + realsize > tee->capacity) {
+        capacity = tee->capacity ? tee->capacity : CURL_MAX_WRITE_SIZE;
+        while (capacity < tee->length + realsize) {
+            capacity *= 2u;
+        }
+#ifndef NO_DYNAMIC_MEMORY_ALLOCATION
+        body = realloc(tee->body, capacity);
+#endif
+        if (body == NULL) {
+            tee->truncated = true;
+        }
+        else {
+            tee->body = body;
+            tee->capacity = capacity;
+        }
+    }
+    if (!tee->truncated) {
+        memcpy(tee->body + tee->length, content, realsize);
+        tee->length += realsize;
+    }
+    return tee->cbk(content, size, nmemb, tee->data);
+}
+
+
+void sleep_until_ns(uint64_t when)
+{
+    struct timespec ts;
+
+    if (when <= qrng_now_ns()) {
+        return;
+    }
+    ts.tv_sec = (time_t)(when / 1000000000u);
+    ts.tv_nsec = (long)(when % 1000000000u);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
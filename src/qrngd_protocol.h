@@ -0,0 +1,85 @@
+/****************************************************************************
+ * libqrng - library for interacting with IDQ's Quantis Appliance           *
+ *                                                                          *
+ * Copyright (C) 2023  Sebastian Mihai Ardelean                             *
+ *                                                                          *
+ * This program is free software: you can redistribute it and/or modify     *
+ * it under the terms of the GNU General Public License as published by     *
+ * the Free Software Foundation, either version 3 of the License, or        *
+ * (at your option) any later version.                                      *
+ *                                                                          *
+ * This program is distributed in the hope that it will be useful,          *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ * GNU General Public License for more details.                             *
+ *                                                                          *
+ * You should have received a copy of the GNU General Public License        *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+
+/**
+ * @file qrngd_protocol.h
+ * @author Sebastian Mihai Ardelean <sebastian.ardelean@cs.upt.ro>
+ * @date 24 May 2023
+ * @brief Wire format between libqrng in client mode and the qrngd daemon. Not installed.
+ *
+ * Both ends run on the same host, so fields use the native byte order. A client sends a
+ * @qrngd_request_t@ and reads back a @qrngd_response_t@ followed by @length@ payload bytes:
+ * the values in their C representation, the raw bytes, or the info text. A connection carries
+ * any number of requests, one at a time.
+ */
+
+#ifndef QRNGD_PROTOCOL_H
+#define QRNGD_PROTOCOL_H
+
+#include <stdint.h>
+
+#define QRNGD_MAGIC 0x51524e47u            /* "QRNG" */
+#define QRNGD_VERSION 1u
+#define QRNGD_DEFAULT_SOCKET "/tmp/qrngd.sock"
+/* Largest payload of one response; bigger streams are split by the client. */
+#define QRNGD_MAX_PAYLOAD (4u * 1024u * 1024u)
+
+/**
+ * @brief Operations, one per public libqrng call.
+ */
+typedef enum {
+    QRNGD_OP_BYTES = 0,
+    QRNGD_OP_INT16,
+    QRNGD_OP_INT32,
+    QRNGD_OP_DOUBLE,
+    QRNGD_OP_FLOAT,
+    QRNGD_OP_STREAM,
+    QRNGD_OP_FIRMWARE_INFO,
+    QRNGD_OP_SYSTEM_INFO,
+    QRNGD_OP_BYTES_DEADLINE,
+    QRNGD_OP_INT32_DEADLINE,
+    QRNGD_OP_DOUBLE_DEADLINE,
+    QRNGD_OPS
+}e_qrngd_op_t;
+
+/**
+ * @brief Request header, 48 bytes without padding.
+ */
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t op;
+    uint64_t samples;       /*!< values, or bytes for QRNGD_OP_STREAM */
+    uint64_t deadline_ns;   /*!< absolute CLOCK_MONOTONIC time for the deadline ops, 0 for none */
+    int32_t min_i;
+    int32_t max_i;
+    double min_f;
+    double max_f;
+}qrngd_request_t;
+
+/**
+ * @brief Response header, followed by @length@ payload bytes.
+ */
+typedef struct {
+    int32_t status;         /*!< return value of the libqrng call made by the daemon */
+    uint32_t reserved;
+    uint64_t length;
+}qrngd_response_t;
+
+#endif /* QRNGD_PROTOCOL_H */
@@ -0,0 +1,790 @@
+/****************************************************************************
+ * qrng-gateway - caching REST gateway for IDQ's Quantis Appliance          *
+ *                                                                          *
+ * Copyright (C) 2023  Sebastian Mihai Ardelean                             *
+ *                                                                          *
+ * This program is free software: you can redistribute it and/or modify     *
+ * it under the terms of the GNU General Public License as published by     *
+ * the Free Software Foundation, either version 3 of the License, or        *
+ * (at your option) any later version.                                      *
+ *                                                                          *
+ * This program is distributed in the hope that it will be useful,          *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ * GNU General Public License for more details.                             *
+ *                                                                          *
+ * You should have received a copy of the GNU General Public License        *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+
+/**
+ * @file qrng_gateway.c
+ * @author Sebastian Mihai Ardelean <sebastian.ardelean@cs.upt.ro>
+ * @date 24 May 2023
+ * @brief Local HTTP server speaking the appliance's /api/2.0 REST API from a prefetched pool.
+ *
+ * Tools that talk to the appliance directly can be pointed at the gateway unchanged. Every random
+ * endpoint is served from raw bytes kept by libqrng's predictive pool, which refills with large
+ * streambytes transfers over one upstream connection; typed values are converted locally with
+ * rejection sampling. The info endpoints are forwarded to the appliance.
+ *
+ *   qrng-gateway -a random.cs.upt.ro -P 8080
+ *   qrand -a http://localhost:8080 -t 2 -s 10
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <qrng.h>
+
+/**
+ * @def PROGRAM_NAME
+ * @brief A macro for the program name.
+ *
+ */
+#define PROGRAM_NAME "qrng-gateway"
+
+/**
+ * @def VERSION
+ * @brief A macro for the program version.
+ *
+ */
+#define VERSION "1.0.0"
+
+/**
+ * @def DOMAIN_ADDR_LENGTH
+ * @brief Length of the appliance address.
+ *
+ */
+#define DOMAIN_ADDR_LENGTH 256u
+
+#define API_PREFIX "/api/2.0/"
+#define MAX_CLIENTS 1024u
+#define HEADER_MAX 8192u
+#define RAW_BATCH 16384u
+#define STREAM_PIECE 65536u
+#define MAX_VALUES (1024u * 1024u)
+#define MAX_STREAM_BYTES (64u * 1024u * 1024u)
+#define MAX_DATA_LENGTH 256u
+#define DEFAULT_PORT 8080u
+#define DEFAULT_POOL_BYTES (16u * 1024u * 1024u)
+#define SHUTDOWN_WAIT_MS 2000u
+#define WARMUP_TIMEOUT_MS 5000L
+
+/**
+ * @brief Raw bytes drawn for one connection and not converted yet.
+ * Leftovers serve the next request on the same connection, so no byte is handed out twice.
+ */
+typedef struct {
+    uint8_t raw[RAW_BATCH];
+    size_t off;
+    size_t len;
+}entropy_t;
+
+/**
+ * @brief State of one client connection.
+ */
+typedef struct {
+    int fd;
+    char in[HEADER_MAX];
+    size_t in_len;
+    char target[HEADER_MAX];
+    char *out;
+    size_t out_len;
+    size_t out_cap;
+    entropy_t entropy;
+}client_t;
+
+static atomic_bool stopping = false;
+static atomic_uint_fast64_t served_requests = 0;
+static int client_fds[MAX_CLIENTS];
+static unsigned client_count = 0;
+static pthread_mutex_t clients_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool verbose = false;
+
+static void print_help(void);
+static void on_signal(int signo);
+static int listen_on(const char *address, unsigned port);
+static bool register_client(int fd);
+static void unregister_client(int fd);
+static void *client_thread(void *arg);
+static int read_request(client_t *c, bool *keep_alive);
+static int handle(client_t *c, bool keep_alive);
+static int fill_values(client_t *c, const char *endpoint, char *query);
+static const char *query_value(char *query, const char *key);
+static int parse_long(const char *text, long min, long max, long *value);
+static int parse_double(const char *text, double *value);
+static int draw(entropy_t *e, uint8_t *dst, size_t len, size_t hint);
+static int draw_int(entropy_t *e, long min, long max, size_t hint, long *value);
+static int append(client_t *c, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static int send_response(client_t *c, int status, const char *type, const void *body, size_t len, bool keep_alive);
+static int send_error(client_t *c, int status, const char *message, bool keep_alive);
+static int send_stream(client_t *c, size_t size, bool keep_alive);
+static int send_info(client_t *c, bool firmware, bool keep_alive);
+static int write_all(int fd, const void *data, size_t len);
+
+int main(int argc, char **argv)
+{
+    int opt = -1;
+    char domain_addr[DOMAIN_ADDR_LENGTH] = {0};
+    const char *bind_addr = "127.0.0.1";
+    unsigned port = DEFAULT_PORT;
+    size_t pool_bytes = DEFAULT_POOL_BYTES;
+    long connections = 1;
+    struct qrng_warmup_stats warmup;
+    struct sigaction sa;
+    pthread_t tid;
+    int listener = -1;
+    int fd = -1;
+    unsigned pending = 0;
+    unsigned waited_ms = 0;
+    unsigned i = 0;
+
+    if (argc == 1) {
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+    while ((opt = getopt(argc, argv, "ha:b:P:p:l:v")) != -1) {
+        switch (opt) {
+            case 'h':
+                print_help();
+                exit(EXIT_SUCCESS);
+                break;
+            case 'a':
+                strncpy(domain_addr, optarg, DOMAIN_ADDR_LENGTH - 1u);
+                break;
+            case 'b':
+                bind_addr = optarg;
+                break;
+            case 'P':
+                port = (unsigned)atoi(optarg);
+                break;
+            case 'p':
+                pool_bytes = strtoul(optarg, NULL, 10);
+                break;
+            case 'l':
+                connections = atol(optarg);
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            default:
+                print_help();
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (domain_addr[0] == '\0' || port == 0 || port > 65535u || pool_bytes < RAW_BATCH || connections < 1) {
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+
+    if (qrng_open(domain_addr) != 0) {
+        exit(EXIT_FAILURE);
+    }
+    if (qrng_set_lanes((size_t)connections, (size_t)connections) != 0 ||
+        qrng_pool_enable_predictive(pool_bytes / 16u, pool_bytes) != 0) {
+        qrng_close();
+        exit(EXIT_FAILURE);
+    }
+    /* Connect now rather than inside the first client request; a failure is not fatal. */
+    if (qrng_warmup(0, WARMUP_TIMEOUT_MS, &warmup) == 0 && verbose) {
+        fprintf(stderr, "%s: %llu appliance connections ready in %llu ms\n", PROGRAM_NAME,
+                (unsigned long long)warmup.connections, (unsigned long long)(warmup.duration_ns / 1000000u));
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = &on_signal;
+    /* No SA_RESTART: accept() must return on SIGINT/SIGTERM. */
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    listener = listen_on(bind_addr, port);
+    if (listener < 0) {
+        qrng_close();
+        exit(EXIT_FAILURE);
+    }
+    if (verbose) {
+        fprintf(stderr, "%s: serving %s on http://%s:%u\n", PROGRAM_NAME, domain_addr, bind_addr, port);
+    }
+
+    while (!atomic_load(&stopping)) {
+        fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EINTR && errno != ECONNABORTED) {
+                perror("accept");
+            }
+            continue;
+        }
+        if (!register_client(fd)) {
+            close(fd);
+            continue;
+        }
+        if (pthread_create(&tid, NULL, &client_thread, (void *)(intptr_t)fd) != 0) {
+            unregister_client(fd);
+            close(fd);
+            continue;
+        }
+        pthread_detach(tid);
+    }
+
+    close(listener);
+    pthread_mutex_lock(&clients_lock);
+    for (i = 0; i < client_count; i++) {
+        shutdown(client_fds[i], SHUT_RDWR);
+    }
+    pthread_mutex_unlock(&clients_lock);
+    for (waited_ms = 0; waited_ms < SHUTDOWN_WAIT_MS; waited_ms += 10u) {
+        pthread_mutex_lock(&clients_lock);
+        pending = client_count;
+        pthread_mutex_unlock(&clients_lock);
+        if (pending == 0) {
+            break;
+        }
+        usleep(10000);
+    }
+    if (verbose) {
+        fprintf(stderr, "%s: served %llu requests\n", PROGRAM_NAME,
+                (unsigned long long)atomic_load(&served_requests));
+    }
+    qrng_close();
+    exit(EXIT_SUCCESS);
+}
+
+
+void on_signal(int signo)
+{
+    (void)signo;
+    atomic_store(&stopping, true);
+}
+
+
+int listen_on(const char *address, unsigned port)
+{
+    struct sockaddr_in addr;
+    int fd = -1;
+    int one = 1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    if (inet_pton(AF_INET, address, &addr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid bind address: %s\n", address);
+        return -1;
+    }
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    (void)setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        perror("bind");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+bool register_client(int fd)
+{
+    bool ok = false;
+
+    pthread_mutex_lock(&clients_lock);
+    if (client_count < MAX_CLIENTS) {
+        client_fds[client_count++] = fd;
+        ok = true;
+    }
+    pthread_mutex_unlock(&clients_lock);
+    return ok;
+}
+
+
+void unregister_client(int fd)
+{
+    unsigned i = 0;
+
+    pthread_mutex_lock(&clients_lock);
+    for (i = 0; i < client_count; i++) {
+        if (client_fds[i] == fd) {
+            client_fds[i] = client_fds[--client_count];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&clients_lock);
+}
+
+
+void *client_thread(void *arg)
+{
+    client_t *c = NULL;
+    bool keep_alive = true;
+    int fd = (int)(intptr_t)arg;
+    int one = 1;
+
+    c = calloc(1, sizeof(*c));
+    if (c != NULL) {
+        c->fd = fd;
+        /* Small responses must not wait for the client's delayed ACK. */
+        (void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        while (keep_alive && read_request(c, &keep_alive) == 0) {
+            if (handle(c, keep_alive) != 0) {
+                break;
+            }
+            atomic_fetch_add_explicit(&served_requests, 1u, memory_order_relaxed);
+        }
+        memset(&c->entropy, 0, sizeof(c->entropy));
+        free(c->out);
+        free(c);
+    }
+    unregister_client(fd);
+    close(fd);
+    return NULL;
+}
+
+
+int read_request(client_t *c, bool *keep_alive)
+{
+    char *end = NULL;
+    char *line = NULL;
+    char *save = NULL;
+    char *rest = NULL;
+    char *method = NULL;
+    char *target = NULL;
+    char *version = NULL;
+    size_t used = 0;
+    ssize_t n = 0;
+
+    for (;;) {
+        c->in[c->in_len] = '\0';
+        end = strstr(c->in, "\r\n\r\n");
+        if (end != NULL) {
+            break;
+        }
+        if (c->in_len >= sizeof(c->in) - 1u) {
+            send_error(c, 431, "header too large", false);
+            return -1;
+        }
+        n = recv(c->fd, c->in + c->in_len, sizeof(c->in) - 1u - c->in_len, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        c->in_len += (size_t)n;
+    }
+    *end = '\0';
+    used = (size_t)(end - c->in) + 4u;
+
+    line = strtok_r(c->in, "\r\n", &save);
+    method = line ? strtok_r(line, " ", &rest) : NULL;
+    target = method ? strtok_r(NULL, " ", &rest) : NULL;
+    version = target ? strtok_r(NULL, " ", &rest) : NULL;
+    if (version == NULL || strncmp(version, "HTTP/1.", 7) != 0) {
+        send_error(c, 400, "bad request", false);
+        return -1;
+    }
+    /* HTTP/1.1 keeps the connection open unless told otherwise; 1.0 only when asked to. */
+    *keep_alive = strcmp(version, "HTTP/1.1") == 0;
+    while ((line = strtok_r(NULL, "\r\n", &save)) != NULL) {
+        if (strncasecmp(line, "Connection:", 11) == 0) {
+            if (strcasestr(line + 11, "close") != NULL) {
+                *keep_alive = false;
+            }
+            else if (strcasestr(line + 11, "keep-alive") != NULL) {
+                *keep_alive = true;
+            }
+        }
+        else if (strncasecmp(line, "Content-Length:", 15) == 0 && atol(line + 15) != 0) {
+            /* The API is GET only; an unread body would desynchronize the connection. */
+            *keep_alive = false;
+        }
+    }
+    if (strcmp(method, "GET") != 0) {
+        send_error(c, 405, "method not allowed", false);
+        return -1;
+    }
+
+    /* Pipelined requests stay in the buffer, so the target is copied out of their way. */
+    strcpy(c->target, target);
+    c->in_len -= used;
+    memmove(c->in, c->in + used, c->in_len);
+    return 0;
+}
+
+
+int handle(client_t *c, bool keep_alive)
+{
+    char *query = strchr(c->target, '?');
+    const char *endpoint = NULL;
+    long size = 0;
+    int retval = 0;
+
+    if (query != NULL) {
+        *query++ = '\0';
+    }
+    if (strncmp(c->target, API_PREFIX, strlen(API_PREFIX)) != 0) {
+        return send_error(c, 404, "not found", keep_alive);
+    }
+    endpoint = c->target + strlen(API_PREFIX);
+    if (strcmp(endpoint, "firmwareinfo") == 0 || strcmp(endpoint, "systeminfo") == 0) {
+        return send_info(c, endpoint[0] == 'f', keep_alive);
+    }
+    if (strcmp(endpoint, "streambytes") == 0) {
+        if (parse_long(query_value(query, "size"), 0, MAX_STREAM_BYTES, &size) != 0) {
+            return send_error(c, 400, "invalid size", keep_alive);
+        }
+        return send_stream(c, (size_t)size, keep_alive);
+    }
+
+    c->out_len = 0;
+    retval = fill_values(c, endpoint, query);
+    if (retval == -1) {
+        retval = send_error(c, 400, "invalid request", keep_alive);
+    }
+    else if (retval == -2) {
+        retval = send_error(c, 404, "not found", keep_alive);
+    }
+    else if (retval == -3) {
+        retval = send_error(c, 503, "no entropy", false);
+    }
+    else {
+        retval = send_response(c, 200, "application/json", c->out, c->out_len, keep_alive);
+    }
+    memset(c->out, 0, c->out_len);
+    c->out_len = 0;
+    return retval;
+}
+
+
+int fill_values(client_t *c, const char *endpoint, char *query)
+{
+    uint8_t raw[MAX_DATA_LENGTH];
+    uint64_t bits = 0;
+    long quantity = 0;
+    long data_length = 1;
+    long min_i = 0;
+    long max_i = 0;
+    long value = 0;
+    long limit = 0;
+    double min_f = 0.0;
+    double max_f = 0.0;
+    int retval = 0;
+
+    if (strcmp(endpoint, "hexbytes") != 0 && strcmp(endpoint, "int") != 0 && strcmp(endpoint, "short") != 0 &&
+        strcmp(endpoint, "double") != 0) {
+        return -2;
+    }
+    /* Compact arrays, as the appliance sends them. */
+    if (parse_long(query_value(query, "quantity"), 0, MAX_VALUES, &quantity) != 0 || append(c, "[") != 0) {
+        return -1;
+    }
+    if (strcmp(endpoint, "hexbytes") == 0) {
+        if (query_value(query, "dataLength") != NULL &&
+            parse_long(query_value(query, "dataLength"), 1, MAX_DATA_LENGTH, &data_length) != 0) {
+            return -1;
+        }
+        for (long i = 0; !retval && i < quantity; i++) {
+            if (draw(&c->entropy, raw, (size_t)data_length, (size_t)((quantity - i) * data_length)) != 0) {
+                retval = -3;
+                break;
+            }
+            retval = append(c, i ? ",\"" : "\"");
+            for (long j = 0; !retval && j < data_length; j++) {
+                retval = append(c, "%02x", raw[j]);
+            }
+            retval = retval ? retval : append(c, "\"");
+        }
+        memset(raw, 0, sizeof(raw));
+    }
+    else if (strcmp(endpoint, "int") == 0 || strcmp(endpoint, "short") == 0) {
+        limit = endpoint[0] == 'i' ? INT32_MAX : INT16_MAX;
+        if (parse_long(query_value(query, "min"), -limit - 1, limit, &min_i) != 0 ||
+            parse_long(query_value(query, "max"), min_i, limit, &max_i) != 0) {
+            return -1;
+        }
+        for (long i = 0; !retval && i < quantity; i++) {
+            if (draw_int(&c->entropy, min_i, max_i, (size_t)(quantity - i), &value) != 0) {
+                retval = -3;
+                break;
+            }
+            retval = append(c, i ? ",%ld" : "%ld", value);
+        }
+    }
+    else {
+        if (parse_double(query_value(query, "min"), &min_f) != 0 ||
+            parse_double(query_value(query, "max"), &max_f) != 0) {
+            return -1;
+        }
+        for (long i = 0; !retval && i < quantity; i++) {
+            if (draw(&c->entropy, (uint8_t *)&bits, sizeof(bits), (size_t)(quantity - i) * sizeof(bits)) != 0) {
+                retval = -3;
+                break;
+            }
+            /* The top 53 bits fill the mantissa of a value in [0, 1). */
+            retval = append(c, i ? ",%.17g" : "%.17g",
+                            min_f + (double)(bits >> 11) * (1.0 / 9007199254740992.0) * (max_f - min_f));
+        }
+        bits = 0;
+    }
+    if (retval == 0 && append(c, "]") != 0) {
+        retval = -3;
+    }
+    /* An allocation failure while formatting is as fatal as running out of entropy. */
+    return retval == -1 ? -3 : retval;
+}
+
+
+const char *query_value(char *query, const char *key)
+{
+    size_t key_len = strlen(key);
+    char *p = query;
+
+    /* Keys and values are plain ASCII in this API; no percent-decoding is needed. */
+    while (p != NULL && *p != '\0') {
+        if (strncmp(p, key, key_len) == 0 && p[key_len] == '=') {
+            return p + key_len + 1u;
+        }
+        p = strchr(p, '&');
+        if (p != NULL) {
+            p++;
+        }
+    }
+    return NULL;
+}
+
+
+int parse_long(const char *text, long min, long max, long *value)
+{
+    char *end = NULL;
+
+    if (text == NULL) {
+        return -1;
+    }
+    errno = 0;
+    *value = strtol(text, &end, 10);
+    if (errno != 0 || end == text || (*end != '\0' && *end != '&') || *value < min || *value > max) {
+        return -1;
+    }
+    return 0;
+}
+
+
+int parse_double(const char *text, double *value)
+{
+    char *end = NULL;
+
+    if (text == NULL) {
+        return -1;
+    }
+    errno = 0;
+    *value = strtod(text, &end);
+    return errno != 0 || end == text || (*end != '\0' && *end != '&') ? -1 : 0;
+}
+
+
+int draw(entropy_t *e, uint8_t *dst, size_t len, size_t hint)
+{
+    size_t n = 0;
+    size_t want = 0;
+    size_t filled = 0;
+
+    while (len > 0) {
+        if (e->len == 0) {
+            /* Draw what the request still needs, never a whole batch for one value. */
+            want = hint < len ? len : hint;
+            want = want < sizeof(e->raw) ? want : sizeof(e->raw);
+            /* No deadline: pool first, then one streambytes transfer for the rest. */
+            if (qrng_random_bytes_deadline(want, e->raw, NULL, &filled) != 0 || filled != want) {
+                return -1;
+            }
+            e->off = 0;
+            e->len = want;
+        }
+        n = len < e->len ? len : e->len;
+        memcpy(dst, e->raw + e->off, n);
+        memset(e->raw + e->off, 0, n);
+        e->off += n;
+        e->len -= n;
+        dst += n;
+        len -= n;
+    }
+    return 0;
+}
+
+
+int draw_int(entropy_t *e, long min, long max, size_t hint, long *value)
+{
+    /* libqrng's conversion: both bounds included, as by the appliance, and no modulo bias. */
+    uint8_t raw[sizeof(int32_t)];
+    int32_t converted = 0;
+    int retval = 1;
+
+    while (retval == 1) {
+        if (draw(e, raw, sizeof(raw), hint * sizeof(raw)) != 0) {
+            return -1;
+        }
+        retval = qrng_bytes_to_int32((int32_t)min, (int32_t)max, raw, &converted);
+    }
+    memset(raw, 0, sizeof(raw));
+    *value = converted;
+    return retval;
+}
+
+
+int append(client_t *c, const char *fmt, ...)
+{
+    va_list args;
+    char *grown = NULL;
+    size_t cap = 0;
+    int n = 0;
+
+    for (;;) {
+        va_start(args, fmt);
+        n = vsnprintf(c->out + c->out_len, c->out_cap - c->out_len, fmt, args);
+        va_end(args);
+        if (n < 0) {
+            return -1;
+        }
+        if ((size_t)n < c->out_cap - c->out_len) {
+            c->out_len += (size_t)n;
+            return 0;
+        }
+        cap = c->out_cap ? c->out_cap * 2u : 4096u;
+        grown = realloc(c->out, cap);
+        if (grown == NULL) {
+            return -1;
+        }
+        c->out = grown;
+        c->out_cap = cap;
+    }
+}
+
+
+int send_response(client_t *c, int status, const char *type, const void *body, size_t len, bool keep_alive)
+{
+    char header[256];
+    const char *reason = status == 200 ? "OK" : status == 400 ? "Bad Request" : status == 404 ? "Not Found" :
+                         status == 405 ? "Method Not Allowed" : status == 431 ? "Request Header Fields Too Large" :
+                         "Service Unavailable";
+    int n = snprintf(header, sizeof(header),
+                     "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n%s\r\n",
+                     status, reason, type, len, keep_alive ? "" : "Connection: close\r\n");
+
+    if (write_all(c->fd, header, (size_t)n) != 0 || (len > 0 && write_all(c->fd, body, len) != 0)) {
+        return -1;
+    }
+    return keep_alive ? 0 : -1;
+}
+
+
+int send_error(client_t *c, int status, const char *message, bool keep_alive)
+{
+    char body[128];
+    int n = snprintf(body, sizeof(body), "{\"error\":\"%s\"}", message);
+
+    return send_response(c, status, "application/json", body, (size_t)n, keep_alive);
+}
+
+
+int send_stream(client_t *c, size_t size, bool keep_alive)
+{
+    uint8_t piece[STREAM_PIECE];
+    char header[160];
+    size_t len = 0;
+    size_t filled = 0;
+    int n = 0;
+    int retval = 0;
+
+    /* Check that the entropy is there before committing to a 200. */
+    len = size < sizeof(piece) ? size : sizeof(piece);
+    if (len > 0 && (qrng_random_bytes_deadline(len, piece, NULL, &filled) != 0 || filled != len)) {
+        return send_error(c, 503, "no entropy", false);
+    }
+    n = snprintf(header, sizeof(header),
+                 "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: %zu\r\n%s\r\n",
+                 size, keep_alive ? "" : "Connection: close\r\n");
+    retval = write_all(c->fd, header, (size_t)n);
+    while (!retval && size > 0) {
+        retval = write_all(c->fd, piece, len);
+        size -= len;
+        len = size < sizeof(piece) ? size : sizeof(piece);
+        if (!retval && len > 0 && (qrng_random_bytes_deadline(len, piece, NULL, &filled) != 0 || filled != len)) {
+            /* The length is already promised; closing is the only way to signal the failure. */
+            retval = -1;
+        }
+    }
+    memset(piece, 0, sizeof(piece));
+    return retval || !keep_alive ? -1 : 0;
+}
+
+
+int send_info(client_t *c, bool firmware, bool keep_alive)
+{
+    /* Served from the library's info cache, so health checks do not each reach the appliance. */
+    struct qrng_info *info = malloc(sizeof(*info));
+    int retval = -1;
+
+    if (info == NULL) {
+        return -1;
+    }
+    retval = firmware ? qrng_get_firmware_info(info) : qrng_get_system_info(info);
+    if (retval != 0) {
+        retval = send_error(c, 503, "appliance unreachable", keep_alive);
+    }
+    else {
+        retval = send_response(c, 200, "application/json", info->raw, strlen(info->raw), keep_alive);
+    }
+    free(info);
+    return retval;
+}
+
+
+int write_all(int fd, const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    ssize_t n = 0;
+
+    while (len > 0) {
+        n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+
+void print_help(void)
+{
+    fprintf(stderr, "%s version %s\n", PROGRAM_NAME, VERSION);
+    fprintf(stderr, "%s -a domain [-h] [-b address] [-P port] [-p bytes] [-l connections] [-v]\n", PROGRAM_NAME);
+    fprintf(stderr, "-a \t IDQ's Quantis Appliance address, or entropy sources such as \"host|hwrng:\" or \"mock:\".\n");
+    fprintf(stderr, "-b \t IPv4 address to listen on. [Default 127.0.0.1]\n");
+    fprintf(stderr, "-P \t TCP port to listen on. [Default %u]\n", DEFAULT_PORT);
+    fprintf(stderr, "-p \t largest size of the prefetched pool in bytes. [Default %u]\n", DEFAULT_POOL_BYTES);
+    fprintf(stderr, "-l \t upstream connections per lane, 1 to 8. [Default 1]\n");
+    fprintf(stderr, "-v \t log to stderr.\n");
+    fprintf(stderr, "-h \t print this help.\n");
+    fprintf(stderr, "Serves GET %s{hexbytes,short,int,double,streambytes,firmwareinfo,systeminfo}.\n", API_PREFIX);
+}
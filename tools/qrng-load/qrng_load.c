@@ -0,0 +1,592 @@
+/****************************************************************************
+ * qrng-load - load generator for libqrng                                   *
+ *                                                                          *
+ * Copyright (C) 2023  Sebastian Mihai Ardelean                             *
+ *                                                                          *
+ * This program is free software: you can redistribute it and/or modify     *
+ * it under the terms of the GNU General Public License as published by     *
+ * the Free Software Foundation, either version 3 of the License, or        *
+ * (at your option) any later version.                                      *
+ *                                                                          *
+ * This program is distributed in the hope that it will be useful,          *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ * GNU General Public License for more details.                             *
+ *                                                                          *
+ * You should have received a copy of the GNU General Public License        *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+
+/**
+ * @file qrng_load.c
+ * @author Sebastian Mihai Ardelean <sebastian.ardelean@cs.upt.ro>
+ * @date 24 May 2023
+ * @brief Multi-threaded load generator with percentile reporting.
+ *
+ * Closed loop: every thread issues its next request as soon as the previous one returns.
+ * Open loop: every thread follows a fixed arrival schedule and the latency of a request is
+ * measured from its scheduled start, not from the moment it was actually sent, so a stalled
+ * library does not hide its own queueing delay (coordinated omission).
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <qrng.h>
+
+/**
+ * @def PROGRAM_NAME
+ * @brief A macro for the program name.
+ *
+ */
+#define PROGRAM_NAME "qrng-load"
+
+/**
+ * @def VERSION
+ * @brief A macro for the program version.
+ *
+ */
+#define VERSION "1.0.0"
+
+/**
+ * @def DOMAIN_ADDR_LENGTH
+ * @brief A macro for defining the IDQ's Quantis Appliance domain name address.
+ *
+ */
+#define DOMAIN_ADDR_LENGTH 256u
+
+/**
+ * @def MAX_THREADS
+ * @brief Upper bound of the number of load threads.
+ *
+ */
+#define MAX_THREADS 256u
+
+/**
+ * @def MAX_MIX
+ * @brief Upper bound of the number of entries in the request mix.
+ *
+ */
+#define MAX_MIX 16u
+
+/**
+ * @def SUB_BITS
+ * @brief Histogram resolution: each power of two is split in 2^SUB_BITS buckets (about 6% error).
+ *
+ */
+#define SUB_BITS 4u
+#define SUB_BUCKETS (1u << SUB_BITS)
+#define MIN_POWER 10u
+#define BUCKETS (32u * SUB_BUCKETS)
+
+/**
+ * @brief Request kinds the load can be made of.
+ */
+typedef enum {
+    LOAD_BYTES = 0,
+    LOAD_INT16,
+    LOAD_INT32,
+    LOAD_DOUBLE,
+    LOAD_FLOAT,
+    LOAD_STREAM,
+    NUMBER_OF_LOAD_TYPES
+}e_load_type_t;
+
+/**
+ * @brief One entry of the request mix.
+ */
+typedef struct {
+    e_load_type_t type;
+    size_t samples;
+    unsigned weight;
+}mix_t;
+
+/**
+ * @brief Latency histogram updated by every thread.
+ */
+typedef struct {
+    atomic_uint_fast64_t count;
+    atomic_uint_fast64_t errors;
+    atomic_uint_fast64_t max_ns;
+    atomic_uint_fast64_t buckets[BUCKETS];
+}histogram_t;
+
+/**
+ * @brief Plain copy of a histogram, used for reporting.
+ */
+typedef struct {
+    uint64_t count;
+    uint64_t errors;
+    uint64_t max_ns;
+    uint64_t buckets[BUCKETS];
+}snapshot_t;
+
+static const char *type_names[NUMBER_OF_LOAD_TYPES] = {
+    "bytes", "int16", "int32", "double", "float", "stream"
+};
+
+static mix_t mix[MAX_MIX];
+static size_t mix_entries = 0;
+static unsigned mix_total_weight = 0;
+static size_t max_samples = 0;
+static bool open_loop = false;
+static double thread_rate = 0.0;
+static unsigned thread_count = 0;
+static uint64_t start_ns = 0;
+static uint64_t end_ns = 0;
+static FILE *sink = NULL;
+static histogram_t interval_hist;
+static histogram_t total_hist;
+static atomic_uint_fast64_t unsent = 0;
+
+static void print_help(void);
+static uint64_t now_ns(void);
+static void sleep_until(uint64_t deadline_ns);
+static int parse_mix(char *spec);
+static void *load_thread(void *arg);
+static int issue(const mix_t *entry, void *buffer);
+static void record(uint64_t latency_ns, int error);
+static void take(histogram_t *h, snapshot_t *out, bool reset);
+static uint64_t percentile(const snapshot_t *s, double p);
+static void report(const char *label, double seconds, const snapshot_t *s, bool csv);
+
+int main(int argc, char **argv)
+{
+    int opt = -1;
+    char domain_addr[DOMAIN_ADDR_LENGTH] = "\0";
+    char default_mix[] = "int32:4:70,bytes:256:20,double:64:10";
+    char *mix_spec = default_mix;
+    unsigned threads = 4;
+    double duration_s = 10.0;
+    double interval_s = 1.0;
+    double rate = 0.0;
+    unsigned long coalesce_us = 0;
+    long connections = 0;
+    const char *record_path = NULL;
+    const char *replay_path = NULL;
+    double replay_speed = 1.0;
+    size_t pool_bytes = 0;
+    const char *ring_name = NULL;
+    bool csv = false;
+    pthread_t tids[MAX_THREADS];
+    uint64_t ids[MAX_THREADS];
+    snapshot_t snap;
+    uint64_t next_report = 0;
+    uint64_t now = 0;
+    unsigned i = 0;
+    char label[32];
+
+    if (argc == 1) {
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+    while ((opt = getopt(argc, argv, "ha:t:d:i:r:x:l:c:p:g:f:W:R:S:")) != -1) {
+        switch (opt) {
+            case 'h':
+                print_help();
+                exit(EXIT_SUCCESS);
+                break;
+            case 'a':
+                strncpy(domain_addr, optarg, DOMAIN_ADDR_LENGTH - 1u);
+                break;
+            case 't':
+                threads = atoi(optarg);
+                break;
+            case 'd':
+                duration_s = atof(optarg);
+                break;
+            case 'i':
+                interval_s = atof(optarg);
+                break;
+            case 'r':
+                rate = atof(optarg);
+                break;
+            case 'x':
+                mix_spec = optarg;
+                break;
+            case 'l':
+                connections = atol(optarg);
+                break;
+            case 'c':
+                coalesce_us = atol(optarg);
+                break;
+            case 'p':
+                pool_bytes = atol(optarg);
+                break;
+            case 'g':
+                ring_name = optarg;
+                break;
+            case 'W':
+                record_path = optarg;
+                break;
+            case 'R':
+                replay_path = optarg;
+                break;
+            case 'S':
+                replay_speed = atof(optarg);
+                break;
+            case 'f':
+                csv = strcmp(optarg, "csv") == 0;
+                break;
+            default:
+                print_help();
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (threads < 1 || threads > MAX_THREADS || duration_s <= 0.0 || interval_s <= 0.0 ||
+        rate < 0.0 || connections < 0 || parse_mix(mix_spec) != 0 ||
+        /* Each thread needs a period of at least 1 ns between arrivals. */
+        (rate > 0.0 && (uint64_t)(1e9 * threads / rate) == 0)) {
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+    open_loop = rate > 0.0;
+    thread_rate = rate / threads;
+    thread_count = threads;
+
+    if (qrng_open(domain_addr) != 0) {
+        exit(EXIT_FAILURE);
+    }
+    if (record_path && qrng_set_transport(QRNG_TRANSPORT_RECORD, record_path, 0.0) != 0) {
+        qrng_close();
+        exit(EXIT_FAILURE);
+    }
+    if (replay_path && qrng_set_transport(QRNG_TRANSPORT_REPLAY, replay_path, replay_speed) != 0) {
+        qrng_close();
+        exit(EXIT_FAILURE);
+    }
+    if (connections > 0 && qrng_set_lanes((size_t)connections, (size_t)connections) != 0) {
+        qrng_close();
+        exit(EXIT_FAILURE);
+    }
+    if (coalesce_us > 0) {
+        qrng_set_coalescing(coalesce_us, 4096u);
+    }
+    if (pool_bytes > 0 && qrng_pool_enable(pool_bytes, pool_bytes / 2u) != 0) {
+        qrng_close();
+        exit(EXIT_FAILURE);
+    }
+    if (ring_name && qrng_ring_attach(ring_name) != 0) {
+        qrng_close();
+        exit(EXIT_FAILURE);
+    }
+    sink = fopen("/dev/null", "wb");
+    if (sink == NULL) {
+        qrng_close();
+        exit(EXIT_FAILURE);
+    }
+
+    if (csv) {
+        printf("interval,seconds,requests,errors,rps,p50_ms,p90_ms,p99_ms,p999_ms,max_ms\n");
+    }
+    else {
+        printf("%s: %u threads, %s loop%s, %.1f s\n", PROGRAM_NAME, threads,
+               open_loop ? "open" : "closed", open_loop ? "" : " (no rate limit)", duration_s);
+        if (open_loop) {
+            printf("target rate %.1f req/s\n", rate);
+        }
+    }
+
+    start_ns = now_ns();
+    end_ns = start_ns + (uint64_t)(duration_s * 1e9);
+    for (i = 0; i < threads; i++) {
+        ids[i] = i;
+        if (pthread_create(&tids[i], NULL, &load_thread, &ids[i]) != 0) {
+            fprintf(stderr, "Cannot create thread %u\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    next_report = start_ns;
+    do {
+        next_report += (uint64_t)(interval_s * 1e9);
+        sleep_until(next_report < end_ns ? next_report : end_ns);
+        now = now_ns();
+        take(&interval_hist, &snap, true);
+        snprintf(label, sizeof(label), "%.1f", (double)(now - start_ns) / 1e9);
+        report(label, interval_s, &snap, csv);
+    } while (now < end_ns);
+
+    for (i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    take(&total_hist, &snap, false);
+    report("total", (double)(now_ns() - start_ns) / 1e9, &snap, csv);
+    if (open_loop && !csv && atomic_load(&unsent) > 0) {
+        printf("%lu scheduled requests were not sent before the end of the test\n",
+               (unsigned long)atomic_load(&unsent));
+    }
+
+    fclose(sink);
+    qrng_close();
+    exit(EXIT_SUCCESS);
+}
+
+
+void *load_thread(void *arg)
+{
+    uint64_t id = *(uint64_t *)arg;
+    uint64_t rng = 0x9e3779b97f4a7c15u ^ (id + 1u) * 0xbf58476d1ce4e5b9u;
+    uint64_t period_ns = 0;
+    uint64_t scheduled = start_ns;
+    uint64_t begin = 0;
+    unsigned pick = 0;
+    size_t m = 0;
+    void *buffer = malloc(max_samples * sizeof(double));
+    int retval = 0;
+
+    if (buffer == NULL) {
+        fprintf(stderr, "Not enough memory\n");
+        return NULL;
+    }
+    if (open_loop) {
+        period_ns = (uint64_t)(1e9 / thread_rate);
+        /* Spread the threads over one period so arrivals do not come in bursts. */
+        scheduled += period_ns * id / thread_count;
+    }
+
+    while (true) {
+        if (open_loop) {
+            if (scheduled >= end_ns) {
+                break;
+            }
+            if (now_ns() >= end_ns) {
+                /* The library fell behind the schedule; report what it never got to. */
+                atomic_fetch_add(&unsent, (end_ns - scheduled + period_ns - 1u) / period_ns);
+                break;
+            }
+            sleep_until(scheduled);
+            begin = scheduled;
+            scheduled += period_ns;
+        }
+        else {
+            begin = now_ns();
+            if (begin >= end_ns) {
+                break;
+            }
+        }
+
+        rng ^= rng >> 12;
+        rng ^= rng << 25;
+        rng ^= rng >> 27;
+        pick = (unsigned)((rng * 0x2545f4914f6cdd1du) >> 33) % mix_total_weight;
+        for (m = 0; m + 1u < mix_entries && pick >= mix[m].weight; m++) {
+            pick -= mix[m].weight;
+        }
+        retval = issue(&mix[m], buffer);
+        record(now_ns() - begin, retval);
+    }
+    free(buffer);
+    return NULL;
+}
+
+
+int issue(const mix_t *entry, void *buffer)
+{
+    switch (entry->type) {
+        case LOAD_BYTES:
+            return qrng_random_bytes(entry->samples, (uint8_t *)buffer);
+        case LOAD_INT16:
+            return qrng_random_int16(0, 1000, entry->samples, (int16_t *)buffer);
+        case LOAD_INT32:
+            return qrng_random_int32(0, 1000000, entry->samples, (int32_t *)buffer);
+        case LOAD_DOUBLE:
+            return qrng_random_double(0.0, 1.0, entry->samples, (double *)buffer);
+        case LOAD_FLOAT:
+            return qrng_random_float(0.0f, 1.0f, entry->samples, (float *)buffer);
+        case LOAD_STREAM:
+            return qrng_random_stream(sink, entry->samples);
+        default:
+            return -1;
+    }
+}
+
+
+void record(uint64_t latency_ns, int error)
+{
+    histogram_t *targets[2] = { &interval_hist, &total_hist };
+    unsigned bucket = 0;
+    unsigned power = 0;
+    uint_fast64_t max = 0;
+    size_t t = 0;
+
+    if (latency_ns >= (UINT64_C(1) << MIN_POWER)) {
+        power = 63u - (unsigned)__builtin_clzll(latency_ns);
+        bucket = (power - MIN_POWER) * SUB_BUCKETS +
+            (unsigned)((latency_ns >> (power - SUB_BITS)) & (SUB_BUCKETS - 1u));
+        if (bucket >= BUCKETS) {
+            bucket = BUCKETS - 1u;
+        }
+    }
+    for (t = 0; t < 2; t++) {
+        atomic_fetch_add_explicit(&targets[t]->count, 1, memory_order_relaxed);
+        if (error) {
+            atomic_fetch_add_explicit(&targets[t]->errors, 1, memory_order_relaxed);
+        }
+        atomic_fetch_add_explicit(&targets[t]->buckets[bucket], 1, memory_order_relaxed);
+        max = atomic_load_explicit(&targets[t]->max_ns, memory_order_relaxed);
+        while (latency_ns > max &&
+               !atomic_compare_exchange_weak_explicit(&targets[t]->max_ns, &max, latency_ns,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+            /* retry with the value another thread stored */
+        }
+    }
+}
+
+
+void take(histogram_t *h, snapshot_t *out, bool reset)
+{
+    unsigned b = 0;
+
+    if (reset) {
+        out->count = atomic_exchange_explicit(&h->count, 0, memory_order_relaxed);
+        out->errors = atomic_exchange_explicit(&h->errors, 0, memory_order_relaxed);
+        out->max_ns = atomic_exchange_explicit(&h->max_ns, 0, memory_order_relaxed);
+        for (b = 0; b < BUCKETS; b++) {
+            out->buckets[b] = atomic_exchange_explicit(&h->buckets[b], 0, memory_order_relaxed);
+        }
+        return;
+    }
+    out->count = atomic_load_explicit(&h->count, memory_order_relaxed);
+    out->errors = atomic_load_explicit(&h->errors, memory_order_relaxed);
+    out->max_ns = atomic_load_explicit(&h->max_ns, memory_order_relaxed);
+    for (b = 0; b < BUCKETS; b++) {
+        out->buckets[b] = atomic_load_explicit(&h->buckets[b], memory_order_relaxed);
+    }
+}
+
+
+uint64_t percentile(const snapshot_t *s, double p)
+{
+    uint64_t total = 0;
+    uint64_t rank = 0;
+    uint64_t seen = 0;
+    uint64_t limit = 0;
+    unsigned b = 0;
+    unsigned power = 0;
+
+    for (b = 0; b < BUCKETS; b++) {
+        total += s->buckets[b];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    rank = (uint64_t)((double)total * p / 100.0);
+    for (b = 0; b < BUCKETS; b++) {
+        seen += s->buckets[b];
+        if (seen > rank) {
+            power = MIN_POWER + b / SUB_BUCKETS;
+            limit = (UINT64_C(1) << power) + ((uint64_t)(b % SUB_BUCKETS + 1u) << (power - SUB_BITS));
+            return limit < s->max_ns ? limit : s->max_ns;
+        }
+    }
+    return s->max_ns;
+}
+
+
+void report(const char *label, double seconds, const snapshot_t *s, bool csv)
+{
+    double rps = seconds > 0.0 ? (double)s->count / seconds : 0.0;
+
+    if (csv) {
+        printf("%s,%.3f,%lu,%lu,%.1f,%.3f,%.3f,%.3f,%.3f,%.3f\n", label, seconds,
+               (unsigned long)s->count, (unsigned long)s->errors, rps,
+               percentile(s, 50.0) / 1e6, percentile(s, 90.0) / 1e6, percentile(s, 99.0) / 1e6,
+               percentile(s, 99.9) / 1e6, s->max_ns / 1e6);
+    }
+    else {
+        printf("%6s s  %8lu req %6lu err %9.1f req/s  p50 %8.3f  p90 %8.3f  p99 %8.3f  p99.9 %8.3f  max %8.3f ms\n",
+               label, (unsigned long)s->count, (unsigned long)s->errors, rps,
+               percentile(s, 50.0) / 1e6, percentile(s, 90.0) / 1e6, percentile(s, 99.0) / 1e6,
+               percentile(s, 99.9) / 1e6, s->max_ns / 1e6);
+    }
+    fflush(stdout);
+}
+
+
+int parse_mix(char *spec)
+{
+    char *entry = NULL;
+    char *save = NULL;
+    char name[16];
+    unsigned long samples = 0;
+    unsigned weight = 0;
+    size_t t = 0;
+
+    for (entry = strtok_r(spec, ",", &save); entry != NULL; entry = strtok_r(NULL, ",", &save)) {
+        if (mix_entries == MAX_MIX || sscanf(entry, "%15[a-z0-9]:%lu:%u", name, &samples, &weight) != 3 ||
+            samples == 0 || weight == 0) {
+            fprintf(stderr, "Invalid mix entry '%s'\n", entry);
+            return -1;
+        }
+        for (t = 0; t < NUMBER_OF_LOAD_TYPES && strcmp(name, type_names[t]) != 0; t++) {
+            /* look the type up by name */
+        }
+        if (t == NUMBER_OF_LOAD_TYPES) {
+            fprintf(stderr, "Unknown request type '%s'\n", name);
+            return -1;
+        }
+        mix[mix_entries].type = (e_load_type_t)t;
+        mix[mix_entries].samples = samples;
+        mix[mix_entries].weight = weight;
+        mix_total_weight += weight;
+        if (t != LOAD_STREAM && samples > max_samples) {
+            max_samples = samples;
+        }
+        mix_entries++;
+    }
+    if (max_samples == 0) {
+        max_samples = 1;
+    }
+    return mix_entries > 0 ? 0 : -1;
+}
+
+
+uint64_t now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+
+void sleep_until(uint64_t deadline_ns)
+{
+    struct timespec until;
+
+    until.tv_sec = (time_t)(deadline_ns / 1000000000u);
+    until.tv_nsec = (long)(deadline_ns % 1000000000u);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) != 0) {
+        /* interrupted, sleep again */
+    }
+}
+
+
+void print_help(void)
+{
+    fprintf(stderr, "\n\n\t\t%s version %s\n\n", PROGRAM_NAME, VERSION);
+    fprintf(stderr, "%s -a domain [-h] [-t threads] [-d seconds] [-i seconds] [-r rate] [-x mix] [-l connections] [-c microseconds] [-p bytes] [-g ring] [-W capture | -R capture [-S speed]] [-f text|csv]\n", PROGRAM_NAME);
+    fprintf(stderr, "-h \t help\n");
+    fprintf(stderr, "-a \t domain address, e.g. random.cs.upt.ro or http://localhost:8080. Mandatory parameter!\n");
+    fprintf(stderr, "-t \t number of threads. [Default 4]\n");
+    fprintf(stderr, "-d \t test duration in seconds. [Default 10]\n");
+    fprintf(stderr, "-i \t report interval in seconds. [Default 1]\n");
+    fprintf(stderr, "-r \t total arrival rate in requests/s; enables the open loop, at most 1e9 per thread. [Default 0: closed loop]\n");
+    fprintf(stderr, "-x \t request mix, type:samples:weight[,...] with type one of bytes, int16, int32, double, float, stream.\n");
+    fprintf(stderr, "   \t [Default int32:4:70,bytes:256:20,double:64:10]\n");
+    fprintf(stderr, "-l \t connections per lane (interactive and bulk). [Default: library default]\n");
+    fprintf(stderr, "-c \t coalescing window in microseconds. [Default 0: disabled]\n");
+    fprintf(stderr, "-p \t entropy pool capacity in bytes. [Default 0: disabled]\n");
+    fprintf(stderr, "-g \t read bytes from the shared memory ring of a qrngd started with -r, e.g. /qrngd.\n");
+    fprintf(stderr, "-W \t record every appliance response to a capture file.\n");
+    fprintf(stderr, "-R \t replay the responses of a capture file instead of using the network.\n");
+    fprintf(stderr, "-S \t replay speed: 1 keeps the recorded timing, 0 replays without delays. [Default 1]\n");
+    fprintf(stderr, "-f \t output format. [Default text]\n");
+    fprintf(stderr, "\nLatencies are reported in milliseconds. In open loop they are measured from the scheduled\n");
+    fprintf(stderr, "start of each request, so they include the time a request waited behind slower ones.\n");
+}
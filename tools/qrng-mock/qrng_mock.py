@@ -0,0 +1,222 @@
+#!/usr/bin/env python3
+############################################################################
+# qrng-mock - local stand-in for IDQ's Quantis Appliance                   #
+#                                                                          #
+# Copyright (C) 2023  Sebastian Mihai Ardelean                             #
+#                                                                          #
+# This program is free software: you can redistribute it and/or modify     #
+# it under the terms of the GNU General Public License as published by     #
+# the Free Software Foundation, either version 3 of the License, or        #
+# (at your option) any later version.                                      #
+#                                                                          #
+# This program is distributed in the hope that it will be useful,          #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of           #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            #
+# GNU General Public License for more details.                             #
+#                                                                          #
+# You should have received a copy of the GNU General Public License        #
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.   #
+############################################################################
+"""Local Quantis Appliance for offline tests and benchmarks.
+
+Serves the /api/2.0 endpoints used by libqrng (hexbytes, short, int, double,
+streambytes, firmwareinfo, systeminfo) with the appliance response formats,
+over HTTP, or HTTPS when a certificate is given. Latency, a throughput cap,
+errors and tail latency can be injected; with --seed the data and the injected
+faults are reproducible for a given request order.
+
+    ./qrng_mock.py --port 8080 --latency-ms 2 --tail-rate 0.01 --tail-ms 200
+    qrand -a http://localhost:8080 -t 0 -s 10
+
+Only the Python 3 standard library is needed.
+"""
+
+import argparse
+import json
+import random
+import ssl
+import sys
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import parse_qs, urlparse
+
+API_PREFIX = "/api/2.0/"
+WRITE_PIECE = 16384
+MAX_QUANTITY = 1024 * 1024 * 64
+
+
+class Throttle:
+    """Global token bucket shared by every connection."""
+
+    def __init__(self, bytes_per_s):
+        self.rate = bytes_per_s
+        self.lock = threading.Lock()
+        self.next_free = time.monotonic()
+
+    def wait(self, size):
+        if self.rate <= 0:
+            return
+        with self.lock:
+            start = max(time.monotonic(), self.next_free)
+            self.next_free = start + size / self.rate
+            until = self.next_free
+        delay = until - time.monotonic()
+        if delay > 0:
+            time.sleep(delay)
+
+
+class Appliance:
+    """Response generation and fault injection, shared by the handler threads."""
+
+    def __init__(self, args):
+        self.args = args
+        self.lock = threading.Lock()
+        self.rng = random.Random(args.seed)
+        self.throttle = Throttle(args.throughput_bps)
+        self.requests = 0
+        self.errors = 0
+        self.tails = 0
+
+    def draw(self):
+        """Per request decisions: (delay in seconds, inject error, data seed)."""
+        with self.lock:
+            self.requests += 1
+            delay = self.args.latency_ms / 1000.0
+            if self.args.jitter_ms > 0:
+                delay += self.rng.uniform(0, self.args.jitter_ms / 1000.0)
+            if self.rng.random() < self.args.tail_rate:
+                delay += self.args.tail_ms / 1000.0
+                self.tails += 1
+            error = self.rng.random() < self.args.error_rate
+            if error:
+                self.errors += 1
+            return delay, error, self.rng.getrandbits(64)
+
+    @staticmethod
+    def quantity(query):
+        value = int(query.get("quantity", query.get("size", "1")))
+        if value < 0 or value > MAX_QUANTITY:
+            raise ValueError("quantity out of range")
+        return value
+
+    def body(self, endpoint, query, seed):
+        rng = random.Random(seed)
+        # Compact arrays, as the appliance sends them: libqrng splits on "," only.
+        if endpoint == "hexbytes":
+            n = self.quantity(query)
+            return "application/json", json.dumps(["%02x" % b for b in rng.randbytes(n)], separators=(",", ":")).encode()
+        if endpoint in ("short", "int"):
+            n = self.quantity(query)
+            low, high = int(query["min"]), int(query["max"])
+            if low > high:
+                raise ValueError("min greater than max")
+            return "application/json", json.dumps([rng.randint(low, high) for _ in range(n)], separators=(",", ":")).encode()
+        if endpoint == "double":
+            n = self.quantity(query)
+            low, high = float(query["min"]), float(query["max"])
+            return "application/json", json.dumps([rng.uniform(low, high) for _ in range(n)], separators=(",", ":")).encode()
+        if endpoint == "streambytes":
+            return "application/octet-stream", rng.randbytes(self.quantity(query))
+        if endpoint == "firmwareinfo":
+            return "application/json", json.dumps({"firmwareVersion": "mock-1.0.0"}).encode()
+        if endpoint == "systeminfo":
+            return "application/json", json.dumps({
+                "model": "Quantis Appliance (mock)",
+                "uptime": int(time.monotonic()),
+                "requests": self.requests,
+            }).encode()
+        return None, None
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    # Headers and body are separate writes; without TCP_NODELAY every response waits for an ACK.
+    disable_nagle_algorithm = True
+    appliance = None
+
+    def log_message(self, fmt, *args):
+        if self.appliance.args.verbose:
+            sys.stderr.write("%s %s\n" % (self.address_string(), fmt % args))
+
+    def send_body(self, status, content_type, body):
+        self.send_response(status)
+        self.send_header("Content-Type", content_type)
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        for offset in range(0, len(body), WRITE_PIECE):
+            piece = body[offset:offset + WRITE_PIECE]
+            self.appliance.throttle.wait(len(piece))
+            self.wfile.write(piece)
+
+    def do_GET(self):
+        url = urlparse(self.path)
+        query = {k: v[0] for k, v in parse_qs(url.query).items()}
+        delay, error, seed = self.appliance.draw()
+        if delay > 0:
+            time.sleep(delay)
+        if error:
+            if self.appliance.args.error_kind == "reset":
+                self.close_connection = True
+                self.connection.close()
+                return
+            self.send_body(503, "application/json", b'{"error":"injected"}')
+            return
+        if not url.path.startswith(API_PREFIX):
+            self.send_body(404, "application/json", b'{"error":"not found"}')
+            return
+        try:
+            content_type, body = self.appliance.body(url.path[len(API_PREFIX):], query, seed)
+        except (KeyError, ValueError) as exc:
+            self.send_body(400, "application/json", json.dumps({"error": str(exc)}).encode())
+            return
+        if body is None:
+            self.send_body(404, "application/json", b'{"error":"not found"}')
+            return
+        self.send_body(200, content_type, body)
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(description="Local stand-in for IDQ's Quantis Appliance.")
+    parser.add_argument("--bind", default="127.0.0.1", help="address to listen on [127.0.0.1]")
+    parser.add_argument("--port", type=int, default=8080, help="port to listen on [8080]")
+    parser.add_argument("--cert", help="PEM certificate; enables HTTPS")
+    parser.add_argument("--key", help="PEM private key of --cert")
+    parser.add_argument("--latency-ms", type=float, default=0.0, help="fixed delay before every response")
+    parser.add_argument("--jitter-ms", type=float, default=0.0, help="uniform random delay added to --latency-ms")
+    parser.add_argument("--throughput-bps", type=float, default=0.0, help="cap on response bytes per second, all connections together")
+    parser.add_argument("--error-rate", type=float, default=0.0, help="probability of an injected error")
+    parser.add_argument("--error-kind", choices=("status", "reset"), default="status",
+                        help="injected error: HTTP 503 or a closed connection [status]")
+    parser.add_argument("--tail-rate", type=float, default=0.0, help="probability of a tail latency event")
+    parser.add_argument("--tail-ms", type=float, default=0.0, help="delay added by a tail latency event")
+    parser.add_argument("--seed", type=int, default=None, help="seed for data and injected faults")
+    parser.add_argument("--verbose", action="store_true", help="log every request")
+    return parser.parse_args()
+
+
+def main():
+    args = parse_args()
+    Handler.appliance = Appliance(args)
+    server = ThreadingHTTPServer((args.bind, args.port), Handler)
+    server.daemon_threads = True
+    scheme = "http"
+    if args.cert:
+        context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+        context.load_cert_chain(args.cert, args.key)
+        server.socket = context.wrap_socket(server.socket, server_side=True)
+        scheme = "https"
+    sys.stderr.write("qrng-mock listening on %s://%s:%d\n" % (scheme, args.bind, server.server_address[1]))
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        appliance = Handler.appliance
+        sys.stderr.write("requests %d, injected errors %d, tail events %d\n"
+                         % (appliance.requests, appliance.errors, appliance.tails))
+        server.server_close()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,542 @@
+/****************************************************************************
+ * qrngprov - OpenSSL 3 random provider backed by libqrng                   *
+ *                                                                          *
+ * Copyright (C) 2023  Sebastian Mihai Ardelean                             *
+ *                                                                          *
+ * This program is free software: you can redistribute it and/or modify     *
+ * it under the terms of the GNU General Public License as published by     *
+ * the Free Software Foundation, either version 3 of the License, or        *
+ * (at your option) any later version.                                      *
+ *                                                                          *
+ * This program is distributed in the hope that it will be useful,          *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ * GNU General Public License for more details.                             *
+ *                                                                          *
+ * You should have received a copy of the GNU General Public License        *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+
+/**
+ * @file qrng_provider.c
+ * @author Sebastian Mihai Ardelean <sebastian.ardelean@cs.upt.ro>
+ * @date 24 May 2023
+ * @brief OpenSSL 3 provider exposing libqrng as the "QRNG" random generator and seed source.
+ *
+ * The provider opens libqrng once and enables its pool, so @RAND_bytes@ and DRBG reseeds copy
+ * from memory while a background thread refills the pool with large transfers. A handshake only
+ * waits on the appliance when the pool runs dry. As a seed source, QRNG feeds OpenSSL's primary
+ * DRBG; as the random generator, it serves @RAND_bytes@ directly.
+ *
+ *   openssl_conf = init
+ *   [init]
+ *   providers = provider_sect
+ *   random = random_sect
+ *   [provider_sect]
+ *   default = default_sect
+ *   qrngprov = qrngprov_sect
+ *   [default_sect]
+ *   activate = 1
+ *   [qrngprov_sect]
+ *   module = /usr/local/lib/ossl-modules/qrngprov.so
+ *   source = random.cs.upt.ro
+ *   pool_bytes = 1048576
+ *   activate = 1
+ *   [random_sect]
+ *   seed = QRNG
+ *   seed_properties = provider=qrngprov
+ *
+ * Without a config section the source is read from QRNG_SOURCE, so "QRNG_SOURCE=mock:" tries the
+ * provider locally without an appliance. libqrng keeps process-wide state: an application that
+ * also calls @qrng_open@ itself should not load the provider.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <openssl/core.h>
+#include <openssl/core_dispatch.h>
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <qrng.h>
+
+/**
+ * @def PROVIDER_NAME
+ * @brief A macro for the provider name.
+ *
+ */
+#define PROVIDER_NAME "qrngprov"
+
+/**
+ * @def VERSION
+ * @brief A macro for the provider version.
+ *
+ */
+#define VERSION "1.0.0"
+
+#define SOURCE_ENV "QRNG_SOURCE"
+#define DAEMON_SCHEME "unix:"
+#define DEFAULT_POOL_BYTES (1024u * 1024u)
+#define MIN_POOL_BYTES 4096u
+#define DEFAULT_TIMEOUT_MS 5000L
+#define STRENGTH_BITS 256u
+#define MAX_REQUEST (1024u * 1024u)
+
+/**
+ * @brief Settings read from the provider's config section when it is loaded.
+ */
+typedef struct {
+    const OSSL_CORE_HANDLE *handle;
+    size_t pool_bytes;
+    long timeout_ms;
+}provider_t;
+
+/**
+ * @brief One EVP_RAND instance. All instances share the process-wide libqrng pool.
+ */
+typedef struct {
+    provider_t *provider;
+    int state;
+    pthread_mutex_t *lock;
+}rand_ctx_t;
+
+static int read_config(const OSSL_CORE_HANDLE *handle, const OSSL_DISPATCH *in,
+                       provider_t *provider, const char **source);
+static int parse_size(const char *text, size_t min, size_t max, size_t *value);
+static int fill(const provider_t *provider, unsigned char *out, size_t outlen);
+
+static OSSL_FUNC_provider_teardown_fn provider_teardown;
+static OSSL_FUNC_provider_gettable_params_fn provider_gettable_params;
+static OSSL_FUNC_provider_get_params_fn provider_get_params;
+static OSSL_FUNC_provider_query_operation_fn provider_query;
+
+static OSSL_FUNC_rand_newctx_fn rand_newctx;
+static OSSL_FUNC_rand_freectx_fn rand_freectx;
+static OSSL_FUNC_rand_instantiate_fn rand_instantiate;
+static OSSL_FUNC_rand_uninstantiate_fn rand_uninstantiate;
+static OSSL_FUNC_rand_generate_fn rand_generate;
+static OSSL_FUNC_rand_reseed_fn rand_reseed;
+static OSSL_FUNC_rand_get_seed_fn rand_get_seed;
+static OSSL_FUNC_rand_clear_seed_fn rand_clear_seed;
+static OSSL_FUNC_rand_enable_locking_fn rand_enable_locking;
+static OSSL_FUNC_rand_lock_fn rand_lock;
+static OSSL_FUNC_rand_unlock_fn rand_unlock;
+static OSSL_FUNC_rand_gettable_ctx_params_fn rand_gettable_ctx_params;
+static OSSL_FUNC_rand_get_ctx_params_fn rand_get_ctx_params;
+static OSSL_FUNC_rand_verify_zeroization_fn rand_verify_zeroization;
+
+static const OSSL_DISPATCH rand_functions[] = {
+    { OSSL_FUNC_RAND_NEWCTX, (void (*)(void))rand_newctx },
+    { OSSL_FUNC_RAND_FREECTX, (void (*)(void))rand_freectx },
+    { OSSL_FUNC_RAND_INSTANTIATE, (void (*)(void))rand_instantiate },
+    { OSSL_FUNC_RAND_UNINSTANTIATE, (void (*)(void))rand_uninstantiate },
+    { OSSL_FUNC_RAND_GENERATE, (void (*)(void))rand_generate },
+    { OSSL_FUNC_RAND_RESEED, (void (*)(void))rand_reseed },
+    { OSSL_FUNC_RAND_GET_SEED, (void (*)(void))rand_get_seed },
+    { OSSL_FUNC_RAND_CLEAR_SEED, (void (*)(void))rand_clear_seed },
+    { OSSL_FUNC_RAND_ENABLE_LOCKING, (void (*)(void))rand_enable_locking },
+    { OSSL_FUNC_RAND_LOCK, (void (*)(void))rand_lock },
+    { OSSL_FUNC_RAND_UNLOCK, (void (*)(void))rand_unlock },
+    { OSSL_FUNC_RAND_GETTABLE_CTX_PARAMS, (void (*)(void))rand_gettable_ctx_params },
+    { OSSL_FUNC_RAND_GET_CTX_PARAMS, (void (*)(void))rand_get_ctx_params },
+    { OSSL_FUNC_RAND_VERIFY_ZEROIZATION, (void (*)(void))rand_verify_zeroization },
+    { 0, NULL }
+};
+
+static const OSSL_ALGORITHM rand_algorithms[] = {
+    { "QRNG", "provider=" PROVIDER_NAME, rand_functions, "Quantum random bytes from libqrng" },
+    { NULL, NULL, NULL, NULL }
+};
+
+static const OSSL_DISPATCH provider_functions[] = {
+    { OSSL_FUNC_PROVIDER_TEARDOWN, (void (*)(void))provider_teardown },
+    { OSSL_FUNC_PROVIDER_GETTABLE_PARAMS, (void (*)(void))provider_gettable_params },
+    { OSSL_FUNC_PROVIDER_GET_PARAMS, (void (*)(void))provider_get_params },
+    { OSSL_FUNC_PROVIDER_QUERY_OPERATION, (void (*)(void))provider_query },
+    { 0, NULL }
+};
+
+int OSSL_provider_init(const OSSL_CORE_HANDLE *handle, const OSSL_DISPATCH *in,
+                       const OSSL_DISPATCH **out, void **provctx)
+{
+    provider_t *provider = calloc(1, sizeof(*provider));
+    const char *source = NULL;
+
+    if (provider == NULL) {
+        return 0;
+    }
+    if (read_config(handle, in, provider, &source) != 0) {
+        free(provider);
+        return 0;
+    }
+    if (qrng_open(source) != 0) {
+        fprintf(stderr, "%s: cannot open entropy source %s\n", PROVIDER_NAME, source);
+        free(provider);
+        return 0;
+    }
+    /* qrngd keeps its own pool; a local one would only add a second copy. */
+    if (strncmp(source, DAEMON_SCHEME, strlen(DAEMON_SCHEME)) != 0 &&
+        qrng_pool_enable(provider->pool_bytes, provider->pool_bytes / 2) != 0) {
+        fprintf(stderr, "%s: cannot enable a %zu byte pool\n", PROVIDER_NAME, provider->pool_bytes);
+        qrng_close();
+        free(provider);
+        return 0;
+    }
+
+    *out = provider_functions;
+    *provctx = provider;
+    return 1;
+}
+
+
+int read_config(const OSSL_CORE_HANDLE *handle, const OSSL_DISPATCH *in,
+                provider_t *provider, const char **source)
+{
+    OSSL_FUNC_core_get_params_fn *core_get_params = NULL;
+    char *source_param = NULL;
+    char *pool_param = NULL;
+    char *timeout_param = NULL;
+    OSSL_PARAM params[4];
+    size_t timeout_ms = 0;
+
+    provider->handle = handle;
+    provider->pool_bytes = DEFAULT_POOL_BYTES;
+    provider->timeout_ms = DEFAULT_TIMEOUT_MS;
+
+    for (; in != NULL && in->function_id != 0; in++) {
+        if (in->function_id == OSSL_FUNC_CORE_GET_PARAMS) {
+            core_get_params = OSSL_FUNC_core_get_params(in);
+        }
+    }
+    /* Config values reach the provider as strings; missing keys leave the pointers NULL. */
+    params[0] = OSSL_PARAM_construct_utf8_ptr("source", &source_param, 0);
+    params[1] = OSSL_PARAM_construct_utf8_ptr("pool_bytes", &pool_param, 0);
+    params[2] = OSSL_PARAM_construct_utf8_ptr("timeout_ms", &timeout_param, 0);
+    params[3] = OSSL_PARAM_construct_end();
+    if (core_get_params != NULL && !core_get_params(handle, params)) {
+        return -1;
+    }
+
+    *source = source_param != NULL ? source_param : getenv(SOURCE_ENV);
+    if (*source == NULL || **source == '\0') {
+        fprintf(stderr, "%s: no entropy source, set \"source\" in the config or %s\n",
+                PROVIDER_NAME, SOURCE_ENV);
+        return -1;
+    }
+    if (pool_param != NULL &&
+        parse_size(pool_param, MIN_POOL_BYTES, SIZE_MAX / 2, &provider->pool_bytes) != 0) {
+        fprintf(stderr, "%s: invalid pool_bytes %s\n", PROVIDER_NAME, pool_param);
+        return -1;
+    }
+    if (timeout_param != NULL) {
+        if (parse_size(timeout_param, 1, 3600000u, &timeout_ms) != 0) {
+            fprintf(stderr, "%s: invalid timeout_ms %s\n", PROVIDER_NAME, timeout_param);
+            return -1;
+        }
+        provider->timeout_ms = (long)timeout_ms;
+    }
+    return 0;
+}
+
+
+int parse_size(const char *text, size_t min, size_t max, size_t *value)
+{
+    char *end = NULL;
+    unsigned long long parsed = 0;
+
+    errno = 0;
+    parsed = strtoull(text, &end, 10);
+    if (errno != 0 || end == text || *end != '\0' || parsed < min || parsed > max) {
+        return -1;
+    }
+    *value = (size_t)parsed;
+    return 0;
+}
+
+
+int fill(const provider_t *provider, unsigned char *out, size_t outlen)
+{
+    struct timespec deadline;
+    size_t filled = 0;
+
+    /* A bounded wait: TLS code should fail a handshake rather than hang on a dead appliance. */
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += provider->timeout_ms / 1000;
+    deadline.tv_nsec += (provider->timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    if (qrng_random_bytes_deadline(outlen, out, &deadline, &filled) != 0 || filled != outlen) {
+        OPENSSL_cleanse(out, outlen);
+        fprintf(stderr, "%s: %zu of %zu random bytes before the deadline\n",
+                PROVIDER_NAME, filled, outlen);
+        return -1;
+    }
+    return 0;
+}
+
+
+void provider_teardown(void *provctx)
+{
+    qrng_close();
+    free(provctx);
+}
+
+
+const OSSL_PARAM *provider_gettable_params(void *provctx)
+{
+    static const OSSL_PARAM gettable[] = {
+        OSSL_PARAM_DEFN(OSSL_PROV_PARAM_NAME, OSSL_PARAM_UTF8_PTR, NULL, 0),
+        OSSL_PARAM_DEFN(OSSL_PROV_PARAM_VERSION, OSSL_PARAM_UTF8_PTR, NULL, 0),
+        OSSL_PARAM_DEFN(OSSL_PROV_PARAM_BUILDINFO, OSSL_PARAM_UTF8_PTR, NULL, 0),
+        OSSL_PARAM_DEFN(OSSL_PROV_PARAM_STATUS, OSSL_PARAM_INTEGER, NULL, 0),
+        OSSL_PARAM_END
+    };
+
+    (void)provctx;
+    return gettable;
+}
+
+
+int provider_get_params(void *provctx, OSSL_PARAM params[])
+{
+    OSSL_PARAM *p = NULL;
+
+    (void)provctx;
+    p = OSSL_PARAM_locate(params, OSSL_PROV_PARAM_NAME);
+    if (p != NULL && !OSSL_PARAM_set_utf8_ptr(p, PROVIDER_NAME)) {
+        return 0;
+    }
+    p = OSSL_PARAM_locate(params, OSSL_PROV_PARAM_VERSION);
+    if (p != NULL && !OSSL_PARAM_set_utf8_ptr(p, VERSION)) {
+        return 0;
+    }
+    p = OSSL_PARAM_locate(params, OSSL_PROV_PARAM_BUILDINFO);
+    if (p != NULL && !OSSL_PARAM_set_utf8_ptr(p, "libqrng")) {
+        return 0;
+    }
+    p = OSSL_PARAM_locate(params, OSSL_PROV_PARAM_STATUS);
+    if (p != NULL && !OSSL_PARAM_set_int(p, 1)) {
+        return 0;
+    }
+    return 1;
+}
+
+
+const OSSL_ALGORITHM *provider_query(void *provctx, int operation_id, int *no_cache)
+{
+    (void)provctx;
+    *no_cache = 0;
+    return operation_id == OSSL_OP_RAND ? rand_algorithms : NULL;
+}
+
+
+void *rand_newctx(void *provctx, void *parent, const OSSL_DISPATCH *parent_dispatch)
+{
+    rand_ctx_t *ctx = NULL;
+
+    /* OpenSSL chains every DRBG to a parent; QRNG is its own entropy source and never calls it. */
+    (void)parent;
+    (void)parent_dispatch;
+    ctx = calloc(1, sizeof(*ctx));
+    if (ctx != NULL) {
+        ctx->provider = provctx;
+        ctx->state = EVP_RAND_STATE_UNINITIALISED;
+    }
+    return ctx;
+}
+
+
+void rand_freectx(void *vctx)
+{
+    rand_ctx_t *ctx = vctx;
+
+    if (ctx == NULL) {
+        return;
+    }
+    if (ctx->lock != NULL) {
+        pthread_mutex_destroy(ctx->lock);
+        free(ctx->lock);
+    }
+    free(ctx);
+}
+
+
+int rand_instantiate(void *vctx, unsigned int strength, int prediction_resistance,
+                     const unsigned char *pstr, size_t pstr_len, const OSSL_PARAM params[])
+{
+    rand_ctx_t *ctx = vctx;
+
+    (void)prediction_resistance;
+    (void)pstr;
+    (void)pstr_len;
+    (void)params;
+    if (strength > STRENGTH_BITS) {
+        return 0;
+    }
+    ctx->state = EVP_RAND_STATE_READY;
+    return 1;
+}
+
+
+int rand_uninstantiate(void *vctx)
+{
+    rand_ctx_t *ctx = vctx;
+
+    ctx->state = EVP_RAND_STATE_UNINITIALISED;
+    return 1;
+}
+
+
+int rand_generate(void *vctx, unsigned char *out, size_t outlen, unsigned int strength,
+                  int prediction_resistance, const unsigned char *adin, size_t adin_len)
+{
+    rand_ctx_t *ctx = vctx;
+
+    (void)prediction_resistance;
+    (void)adin;
+    (void)adin_len;
+    if (ctx->state != EVP_RAND_STATE_READY || strength > STRENGTH_BITS) {
+        return 0;
+    }
+    return fill(ctx->provider, out, outlen) == 0;
+}
+
+
+int rand_reseed(void *vctx, int prediction_resistance, const unsigned char *ent, size_t ent_len,
+                const unsigned char *adin, size_t adin_len)
+{
+    rand_ctx_t *ctx = vctx;
+
+    /* Every output comes straight from the appliance; there is no internal state to reseed. */
+    (void)prediction_resistance;
+    (void)ent;
+    (void)ent_len;
+    (void)adin;
+    (void)adin_len;
+    return ctx->state == EVP_RAND_STATE_READY;
+}
+
+
+size_t rand_get_seed(void *vctx, unsigned char **pout, int entropy, size_t min_len,
+                     size_t max_len, int prediction_resistance, const unsigned char *adin,
+                     size_t adin_len)
+{
+    rand_ctx_t *ctx = vctx;
+    size_t len = entropy > 0 ? ((size_t)entropy + 7u) / 8u : 0;
+    unsigned char *seed = NULL;
+
+    (void)prediction_resistance;
+    (void)adin;
+    (void)adin_len;
+    /* Full entropy per byte, so the seed is as short as the DRBG allows. */
+    if (len < min_len) {
+        len = min_len;
+    }
+    if (ctx->state != EVP_RAND_STATE_READY || len == 0 || len > max_len) {
+        return 0;
+    }
+    seed = OPENSSL_secure_malloc(len);
+    if (seed == NULL) {
+        return 0;
+    }
+    if (fill(ctx->provider, seed, len) != 0) {
+        OPENSSL_secure_clear_free(seed, len);
+        return 0;
+    }
+    *pout = seed;
+    return len;
+}
+
+
+void rand_clear_seed(void *vctx, unsigned char *out, size_t outlen)
+{
+    (void)vctx;
+    OPENSSL_secure_clear_free(out, outlen);
+}
+
+
+int rand_enable_locking(void *vctx)
+{
+    rand_ctx_t *ctx = vctx;
+
+    if (ctx->lock != NULL) {
+        return 1;
+    }
+    ctx->lock = malloc(sizeof(*ctx->lock));
+    if (ctx->lock == NULL || pthread_mutex_init(ctx->lock, NULL) != 0) {
+        free(ctx->lock);
+        ctx->lock = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+
+int rand_lock(void *vctx)
+{
+    rand_ctx_t *ctx = vctx;
+
+    return ctx->lock == NULL || pthread_mutex_lock(ctx->lock) == 0;
+}
+
+
+void rand_unlock(void *vctx)
+{
+    rand_ctx_t *ctx = vctx;
+
+    if (ctx->lock != NULL) {
+        pthread_mutex_unlock(ctx->lock);
+    }
+}
+
+
+const OSSL_PARAM *rand_gettable_ctx_params(void *vctx, void *provctx)
+{
+    static const OSSL_PARAM gettable[] = {
+        OSSL_PARAM_int(OSSL_RAND_PARAM_STATE, NULL),
+        OSSL_PARAM_uint(OSSL_RAND_PARAM_STRENGTH, NULL),
+        OSSL_PARAM_size_t(OSSL_RAND_PARAM_MAX_REQUEST, NULL),
+        OSSL_PARAM_END
+    };
+
+    (void)vctx;
+    (void)provctx;
+    return gettable;
+}
+
+
+int rand_get_ctx_params(void *vctx, OSSL_PARAM params[])
+{
+    rand_ctx_t *ctx = vctx;
+    OSSL_PARAM *p = NULL;
+
+    p = OSSL_PARAM_locate(params, OSSL_RAND_PARAM_STATE);
+    if (p != NULL && !OSSL_PARAM_set_int(p, ctx->state)) {
+        return 0;
+    }
+    p = OSSL_PARAM_locate(params, OSSL_RAND_PARAM_STRENGTH);
+    if (p != NULL && !OSSL_PARAM_set_uint(p, STRENGTH_BITS)) {
+        return 0;
+    }
+    p = OSSL_PARAM_locate(params, OSSL_RAND_PARAM_MAX_REQUEST);
+    if (p != NULL && !OSSL_PARAM_set_size_t(p, MAX_REQUEST)) {
+        return 0;
+    }
+    return 1;
+}
+
+
+int rand_verify_zeroization(void *vctx)
+{
+    /* Output is never kept: generated bytes leave the pool once and seeds are freed cleared. */
+    (void)vctx;
+    return 1;
+}
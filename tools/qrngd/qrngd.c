@@ -0,0 +1,663 @@
+/****************************************************************************
+ * qrngd - local entropy daemon for IDQ's Quantis Appliance                 *
+ *                                                                          *
+ * Copyright (C) 2023  Sebastian Mihai Ardelean                             *
+ *                                                                          *
+ * This program is free software: you can redistribute it and/or modify     *
+ * it under the terms of the GNU General Public License as published by     *
+ * the Free Software Foundation, either version 3 of the License, or        *
+ * (at your option) any later version.                                      *
+ *                                                                          *
+ * This program is distributed in the hope that it will be useful,          *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ * GNU General Public License for more details.                             *
+ *                                                                          *
+ * You should have received a copy of the GNU General Public License        *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.   *
+ ****************************************************************************/
+
+/**
+ * @file qrngd.c
+ * @author Sebastian Mihai Ardelean <sebastian.ardelean@cs.upt.ro>
+ * @date 24 May 2023
+ * @brief Daemon owning the appliance connections and one large pool for every process on the host.
+ *
+ * Processes open libqrng with a "unix:" address and their calls arrive here as
+ * @qrngd_request_t@ messages (see qrngd_protocol.h). Each client connection gets a thread that
+ * makes the same libqrng call the client made and sends the result back, so the per-host
+ * appliance load is one set of TLS connections, the pool is shared, and concurrent small JSON
+ * requests from different processes are coalesced.
+ *
+ *   qrngd -a random.cs.upt.ro -s /tmp/qrngd.sock
+ *   qrand -a unix:/tmp/qrngd.sock -t 0 -s 10
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <qrng.h>
+#include <qrngd_protocol.h>
+
+/**
+ * @def PROGRAM_NAME
+ * @brief A macro for the program name.
+ *
+ */
+#define PROGRAM_NAME "qrngd"
+
+/**
+ * @def VERSION
+ * @brief A macro for the program version.
+ *
+ */
+#define VERSION "1.0.0"
+
+/**
+ * @def DOMAIN_ADDR_LENGTH
+ * @brief Length of the appliance address.
+ *
+ */
+#define DOMAIN_ADDR_LENGTH 256u
+
+/**
+ * @def MAX_CLIENTS
+ * @brief Upper bound of concurrently connected clients.
+ *
+ */
+#define MAX_CLIENTS 1024u
+
+#define DEFAULT_POOL_BYTES (16u * 1024u * 1024u)
+#define DEFAULT_CONNECTIONS 4u
+#define DEFAULT_COALESCE_US 200u
+#define DEFAULT_RING_BYTES (8u * 1024u * 1024u)
+#define DEFAULT_RESERVE_BYTES (256u * 1024u * 1024u)
+#define COALESCE_MAX_SAMPLES 65536u
+#define SHUTDOWN_WAIT_MS 2000u
+#define WARMUP_TIMEOUT_MS 5000L
+#define USER_BURST_SECONDS 1u
+
+static atomic_bool stopping = false;
+static atomic_uint_fast64_t served_requests = 0;
+static atomic_uint_fast64_t served_bytes = 0;
+static int client_fds[MAX_CLIENTS];
+static unsigned client_count = 0;
+static pthread_mutex_t clients_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool verbose = false;
+static uid_t tenant_uids[QRNG_MAX_TENANTS];
+static int tenant_ids[QRNG_MAX_TENANTS];
+static unsigned tenant_count = 0;
+static uint64_t user_rate = 0;
+static pthread_mutex_t tenants_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void print_help(void);
+static void on_signal(int signo);
+static int listen_on(const char *path, mode_t mode);
+static bool register_client(int fd);
+static void unregister_client(int fd);
+static void *client_thread(void *arg);
+static int tenant_of(int fd);
+static void print_tenants(void);
+static int serve(const qrngd_request_t *request, qrngd_response_t *response,
+                 uint8_t **payload, size_t *capacity);
+static int reserve(uint8_t **payload, size_t *capacity, size_t size);
+static int capture_info(const qrngd_request_t *request, qrngd_response_t *response,
+                        uint8_t **payload, size_t *capacity);
+static size_t value_size(unsigned op);
+static int write_all(int fd, const void *data, size_t len);
+static int read_all(int fd, void *data, size_t len);
+
+int main(int argc, char **argv)
+{
+    int opt = -1;
+    char domain_addr[DOMAIN_ADDR_LENGTH] = {0};
+    const char *socket_path = QRNGD_DEFAULT_SOCKET;
+    size_t pool_bytes = DEFAULT_POOL_BYTES;
+    long connections = DEFAULT_CONNECTIONS;
+    unsigned long coalesce_us = DEFAULT_COALESCE_US;
+    mode_t mode = 0660;
+    const char *ring_name = NULL;
+    size_t ring_bytes = DEFAULT_RING_BYTES;
+    const char *reserve_path = NULL;
+    size_t reserve_bytes = DEFAULT_RESERVE_BYTES;
+    uint64_t bandwidth = 0;
+    struct qrng_warmup_stats warmup;
+    struct sigaction sa;
+    pthread_t tid;
+    int listener = -1;
+    int fd = -1;
+    unsigned waited_ms = 0;
+    unsigned i = 0;
+
+    if (argc == 1) {
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+    while ((opt = getopt(argc, argv, "ha:s:p:l:c:m:r:R:f:F:B:u:v")) != -1) {
+        switch (opt) {
+            case 'h':
+                print_help();
+                exit(EXIT_SUCCESS);
+                break;
+            case 'a':
+                strncpy(domain_addr, optarg, DOMAIN_ADDR_LENGTH - 1u);
+                break;
+            case 's':
+                socket_path = optarg;
+                break;
+            case 'p':
+                pool_bytes = strtoul(optarg, NULL, 10);
+                break;
+            case 'l':
+                connections = atol(optarg);
+                break;
+            case 'c':
+                coalesce_us = strtoul(optarg, NULL, 10);
+                break;
+            case 'm':
+                mode = (mode_t)strtoul(optarg, NULL, 8);
+                break;
+            case 'r':
+                ring_name = optarg;
+                break;
+            case 'R':
+                ring_bytes = strtoul(optarg, NULL, 10);
+                break;
+            case 'f':
+                reserve_path = optarg;
+                break;
+            case 'F':
+                reserve_bytes = strtoul(optarg, NULL, 10);
+                break;
+            case 'B':
+                bandwidth = strtoull(optarg, NULL, 10);
+                break;
+            case 'u':
+                user_rate = strtoull(optarg, NULL, 10);
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            default:
+                print_help();
+                exit(EXIT_FAILURE);
+        }
+    }
+    /* The daemon talks to the appliance itself; pointing it at a socket would loop. */
+    if (domain_addr[0] == '\0' || strncmp(domain_addr, "unix:", 5) == 0 || connections < 1) {
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+
+    if (qrng_open(domain_addr) != 0) {
+        exit(EXIT_FAILURE);
+    }
+    /* Before the pool and the reserve start, so their refills count against the ceiling. */
+    qrng_set_bandwidth_limit(bandwidth, bandwidth * USER_BURST_SECONDS);
+    if (qrng_set_lanes((size_t)connections, (size_t)connections) != 0 ||
+        (pool_bytes > 0 && qrng_pool_enable_predictive(pool_bytes / 16u + 1u, pool_bytes) != 0)) {
+        qrng_close();
+        exit(EXIT_FAILURE);
+    }
+    /* Connect now rather than inside the first client request; a failure is not fatal. */
+    if (qrng_warmup(0, WARMUP_TIMEOUT_MS, &warmup) == 0 && verbose) {
+        fprintf(stderr, "%s: %llu appliance connections ready in %llu ms\n", PROGRAM_NAME,
+                (unsigned long long)warmup.connections, (unsigned long long)(warmup.duration_ns / 1000000u));
+    }
+    qrng_set_coalescing(coalesce_us, COALESCE_MAX_SAMPLES);
+    if (reserve_path != NULL && qrng_reserve_open(reserve_path, reserve_bytes) != 0) {
+        qrng_close();
+        exit(EXIT_FAILURE);
+    }
+    if (ring_name != NULL && qrng_ring_create(ring_name, ring_bytes) != 0) {
+        qrng_close();
+        exit(EXIT_FAILURE);
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = &on_signal;
+    /* No SA_RESTART: accept() must return on SIGINT/SIGTERM. */
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    listener = listen_on(socket_path, mode);
+    if (listener < 0) {
+        qrng_close();
+        exit(EXIT_FAILURE);
+    }
+    if (verbose) {
+        fprintf(stderr, "%s: serving %s on %s\n", PROGRAM_NAME, domain_addr, socket_path);
+        if (ring_name != NULL) {
+            fprintf(stderr, "%s: filling the shared memory ring %s\n", PROGRAM_NAME, ring_name);
+        }
+    }
+
+    while (!atomic_load(&stopping)) {
+        fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EINTR && errno != ECONNABORTED) {
+                perror("accept");
+            }
+            continue;
+        }
+        if (!register_client(fd)) {
+            close(fd);
+            continue;
+        }
+        if (pthread_create(&tid, NULL, &client_thread, (void *)(intptr_t)fd) != 0) {
+            unregister_client(fd);
+            close(fd);
+            continue;
+        }
+        pthread_detach(tid);
+    }
+
+    close(listener);
+    unlink(socket_path);
+    /* Wake the client threads and let them finish the call they are in. */
+    pthread_mutex_lock(&clients_lock);
+    for (i = 0; i < client_count; i++) {
+        shutdown(client_fds[i], SHUT_RDWR);
+    }
+    pthread_mutex_unlock(&clients_lock);
+    while (waited_ms < SHUTDOWN_WAIT_MS) {
+        pthread_mutex_lock(&clients_lock);
+        fd = (int)client_count;
+        pthread_mutex_unlock(&clients_lock);
+        if (fd == 0) {
+            break;
+        }
+        usleep(10000);
+        waited_ms += 10u;
+    }
+    if (verbose) {
+        fprintf(stderr, "%s: served %llu requests, %llu bytes\n", PROGRAM_NAME,
+                (unsigned long long)atomic_load(&served_requests),
+                (unsigned long long)atomic_load(&served_bytes));
+        print_tenants();
+    }
+    qrng_close();
+    exit(EXIT_SUCCESS);
+}
+
+
+void on_signal(int signo)
+{
+    (void)signo;
+    atomic_store(&stopping, true);
+}
+
+
+int listen_on(const char *path, mode_t mode)
+{
+    struct sockaddr_un addr;
+    int fd = -1;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return -1;
+    }
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    /* A socket left behind by a crashed daemon would make bind fail. */
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || chmod(path, mode) != 0 ||
+        listen(fd, SOMAXCONN) != 0) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+bool register_client(int fd)
+{
+    bool ok = false;
+
+    pthread_mutex_lock(&clients_lock);
+    if (client_count < MAX_CLIENTS) {
+        client_fds[client_count++] = fd;
+        ok = true;
+    }
+    pthread_mutex_unlock(&clients_lock);
+    return ok;
+}
+
+
+void unregister_client(int fd)
+{
+    unsigned i = 0;
+
+    pthread_mutex_lock(&clients_lock);
+    for (i = 0; i < client_count; i++) {
+        if (client_fds[i] == fd) {
+            client_fds[i] = client_fds[--client_count];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&clients_lock);
+}
+
+
+void *client_thread(void *arg)
+{
+    int fd = (int)(intptr_t)arg;
+    qrngd_request_t request;
+    qrngd_response_t response;
+    uint8_t *payload = NULL;
+    size_t capacity = 0;
+
+    /* Appliance transfers made for this client are shared fairly with the other users. */
+    qrng_set_tenant(tenant_of(fd));
+    while (read_all(fd, &request, sizeof(request)) == 0) {
+        if (request.magic != QRNGD_MAGIC || request.version != QRNGD_VERSION) {
+            if (verbose) {
+                fprintf(stderr, "%s: dropping a client speaking another protocol\n", PROGRAM_NAME);
+            }
+            break;
+        }
+        memset(&response, 0, sizeof(response));
+        if (serve(&request, &response, &payload, &capacity) != 0) {
+            break;
+        }
+        if (write_all(fd, &response, sizeof(response)) != 0 ||
+            (response.length > 0 && write_all(fd, payload, response.length) != 0)) {
+            break;
+        }
+        atomic_fetch_add_explicit(&served_requests, 1u, memory_order_relaxed);
+        atomic_fetch_add_explicit(&served_bytes, response.length, memory_order_relaxed);
+        memset(payload, 0, response.length);
+    }
+    free(payload);
+    unregister_client(fd);
+    close(fd);
+    return NULL;
+}
+
+
+int tenant_of(int fd)
+{
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    int tenant = 0;
+    unsigned i = 0;
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0) {
+        return 0;
+    }
+    pthread_mutex_lock(&tenants_lock);
+    for (i = 0; i < tenant_count; i++) {
+        if (tenant_uids[i] == cred.uid) {
+            tenant = tenant_ids[i];
+            break;
+        }
+    }
+    if (i == tenant_count) {
+        tenant = qrng_tenant_create(1u, user_rate, user_rate * USER_BURST_SECONDS);
+        if (tenant > 0) {
+            tenant_uids[tenant_count] = cred.uid;
+            tenant_ids[tenant_count] = tenant;
+            tenant_count++;
+            if (verbose) {
+                fprintf(stderr, "%s: uid %u is tenant %d\n", PROGRAM_NAME, (unsigned)cred.uid, tenant);
+            }
+        } else {
+            /* Out of tenants: the newcomers share the default one. */
+            tenant = 0;
+        }
+    }
+    pthread_mutex_unlock(&tenants_lock);
+    return tenant;
+}
+
+
+void print_tenants(void)
+{
+    struct qrng_tenant_stats stats;
+    unsigned i = 0;
+
+    pthread_mutex_lock(&tenants_lock);
+    for (i = 0; i < tenant_count; i++) {
+        if (qrng_get_tenant_stats(tenant_ids[i], &stats) == 0) {
+            fprintf(stderr, "%s: uid %u fetched %llu bytes in %llu transfers, queued %llu us on average\n",
+                    PROGRAM_NAME, (unsigned)tenant_uids[i], (unsigned long long)stats.bytes,
+                    (unsigned long long)stats.requests,
+                    (unsigned long long)(stats.queue_delay_avg_ns / 1000u));
+        }
+    }
+    pthread_mutex_unlock(&tenants_lock);
+}
+
+
+int serve(const qrngd_request_t *request, qrngd_response_t *response,
+          uint8_t **payload, size_t *capacity)
+{
+    struct timespec deadline;
+    const struct timespec *limit = NULL;
+    size_t size = value_size(request->op);
+    size_t filled = 0;
+    FILE *stream = NULL;
+
+    if (request->op == QRNGD_OP_FIRMWARE_INFO || request->op == QRNGD_OP_SYSTEM_INFO) {
+        return capture_info(request, response, payload, capacity);
+    }
+    if (size == 0) {
+        response->status = -1;
+        return 0;
+    }
+    if (request->samples > QRNGD_MAX_PAYLOAD / size) {
+        /* The client splits streams; anything bigger is a request we refuse, not an error. */
+        response->status = -1;
+        return 0;
+    }
+    if (reserve(payload, capacity, request->samples * size) != 0) {
+        return -1;
+    }
+    if (request->deadline_ns) {
+        deadline.tv_sec = (time_t)(request->deadline_ns / 1000000000u);
+        deadline.tv_nsec = (long)(request->deadline_ns % 1000000000u);
+        limit = &deadline;
+    }
+
+    filled = request->samples;
+    switch (request->op) {
+        case QRNGD_OP_BYTES:
+            response->status = qrng_random_bytes(request->samples, *payload);
+            break;
+        case QRNGD_OP_INT16:
+            response->status = qrng_random_int16((int16_t)request->min_i, (int16_t)request->max_i,
+                                                 request->samples, (int16_t *)*payload);
+            break;
+        case QRNGD_OP_INT32:
+            response->status = qrng_random_int32(request->min_i, request->max_i,
+                                                 request->samples, (int32_t *)*payload);
+            break;
+        case QRNGD_OP_DOUBLE:
+            response->status = qrng_random_double(request->min_f, request->max_f,
+                                                  request->samples, (double *)*payload);
+            break;
+        case QRNGD_OP_FLOAT:
+            response->status = qrng_random_float((float)request->min_f, (float)request->max_f,
+                                                 request->samples, (float *)*payload);
+            break;
+        case QRNGD_OP_STREAM:
+            stream = fmemopen(*payload, request->samples + 1u, "w");
+            if (stream == NULL) {
+                response->status = -1;
+                filled = 0;
+                break;
+            }
+            setvbuf(stream, NULL, _IONBF, 0);
+            response->status = qrng_random_stream(stream, request->samples);
+            filled = (size_t)ftell(stream);
+            fclose(stream);
+            break;
+        case QRNGD_OP_BYTES_DEADLINE:
+            response->status = qrng_random_bytes_deadline(request->samples, *payload, limit, &filled);
+            break;
+        case QRNGD_OP_INT32_DEADLINE:
+            response->status = qrng_random_int32_deadline(request->min_i, request->max_i, request->samples,
+                                                          (int32_t *)*payload, limit, &filled);
+            break;
+        default:
+            response->status = qrng_random_double_deadline(request->min_f, request->max_f, request->samples,
+                                                           (double *)*payload, limit, &filled);
+            break;
+    }
+    /* Failed calls return nothing, except the deadline ones which report a valid prefix. */
+    if (response->status != 0 && request->op < QRNGD_OP_BYTES_DEADLINE && request->op != QRNGD_OP_STREAM) {
+        filled = 0;
+    }
+    response->length = (uint64_t)filled * size;
+    return 0;
+}
+
+
+int reserve(uint8_t **payload, size_t *capacity, size_t size)
+{
+    uint8_t *grown = NULL;
+
+    /* One extra byte: fmemopen keeps room for a terminating NUL. */
+    if (size + 1u <= *capacity) {
+        return 0;
+    }
+    grown = realloc(*payload, size + 1u);
+    if (grown == NULL) {
+        fprintf(stderr, "%s: not enough memory for a %zu byte response\n", PROGRAM_NAME, size);
+        return -1;
+    }
+    *payload = grown;
+    *capacity = size + 1u;
+    return 0;
+}
+
+
+int capture_info(const qrngd_request_t *request, qrngd_response_t *response,
+                 uint8_t **payload, size_t *capacity)
+{
+    /* The library caches the info, so many clients polling it cost one appliance request per TTL. */
+    struct qrng_info *info = malloc(sizeof(*info));
+    size_t len = 0;
+
+    if (info == NULL) {
+        response->status = -1;
+        return 0;
+    }
+    response->status = request->op == QRNGD_OP_FIRMWARE_INFO ?
+        qrng_get_firmware_info(info) : qrng_get_system_info(info);
+    len = response->status == 0 ? strlen(info->raw) : 0;
+    if (len > QRNGD_MAX_PAYLOAD || reserve(payload, capacity, len) != 0) {
+        free(info);
+        response->status = -1;
+        return 0;
+    }
+    memcpy(*payload, info->raw, len);
+    response->length = len;
+    free(info);
+    return 0;
+}
+
+
+size_t value_size(unsigned op)
+{
+    switch (op) {
+        case QRNGD_OP_BYTES:
+        case QRNGD_OP_STREAM:
+        case QRNGD_OP_BYTES_DEADLINE:
+            return sizeof(uint8_t);
+        case QRNGD_OP_INT16:
+            return sizeof(int16_t);
+        case QRNGD_OP_INT32:
+        case QRNGD_OP_INT32_DEADLINE:
+            return sizeof(int32_t);
+        case QRNGD_OP_FLOAT:
+            return sizeof(float);
+        case QRNGD_OP_DOUBLE:
+        case QRNGD_OP_DOUBLE_DEADLINE:
+            return sizeof(double);
+        default:
+            return 0;
+    }
+}
+
+
+int write_all(int fd, const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    ssize_t n = 0;
+
+    while (len > 0) {
+        n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+
+int read_all(int fd, void *data, size_t len)
+{
+    uint8_t *p = (uint8_t *)data;
+    ssize_t n = 0;
+
+    while (len > 0) {
+        n = recv(fd, p, len, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+
+void print_help(void)
+{
+    fprintf(stderr, "%s version %s\n", PROGRAM_NAME, VERSION);
+    fprintf(stderr, "%s -a domain [-h] [-s socket] [-p bytes] [-l connections] [-c microseconds] [-m mode] [-r ring] [-R bytes] [-f file] [-F bytes] [-B bytes] [-u bytes] [-v]\n", PROGRAM_NAME);
+    fprintf(stderr, "-a \t IDQ's Quantis Appliance address, or entropy sources such as \"host|hwrng:\" or \"mock:\".\n");
+    fprintf(stderr, "-s \t Unix socket to listen on. [Default %s]\n", QRNGD_DEFAULT_SOCKET);
+    fprintf(stderr, "-p \t largest size of the shared entropy pool in bytes, 0 to disable. [Default %u]\n", DEFAULT_POOL_BYTES);
+    fprintf(stderr, "-l \t appliance connections per lane, 1 to 8. [Default %u]\n", DEFAULT_CONNECTIONS);
+    fprintf(stderr, "-c \t window in microseconds for merging concurrent small requests, 0 to disable. [Default %u]\n", DEFAULT_COALESCE_US);
+    fprintf(stderr, "-m \t permissions of the socket, octal. [Default 0660]\n");
+    fprintf(stderr, "-r \t also fill a shared memory ring with this name, e.g. /qrngd.\n");
+    fprintf(stderr, "-R \t size of the shared memory ring in bytes. [Default %u]\n", DEFAULT_RING_BYTES);
+    fprintf(stderr, "-f \t keep an on-disk entropy reserve in this file, served when the appliance is down.\n");
+    fprintf(stderr, "-F \t size of the on-disk reserve in bytes. [Default %u]\n", DEFAULT_RESERVE_BYTES);
+    fprintf(stderr, "-B \t cap the traffic to the appliance, in bytes per second, 0 for no cap. [Default 0]\n");
+    fprintf(stderr, "-u \t cap the bytes served to each client uid, buffered or fetched, in bytes per second. [Default 0]\n");
+    fprintf(stderr, "-v \t log to stderr.\n");
+    fprintf(stderr, "-h \t print this help.\n");
+    fprintf(stderr, "Clients open libqrng with the address unix:<socket>; processes that only need bytes\n");
+    fprintf(stderr, "may also call qrng_ring_attach(ring) to read them from shared memory.\n");
+}